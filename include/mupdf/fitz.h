@@ -56,6 +56,7 @@ extern "C" {
 #include "mupdf/fitz/annotation.h"
 
 #include "mupdf/fitz/util.h"
+#include "mupdf/fitz/text-index.h"
 
 /* Output formats */
 #include "mupdf/fitz/writer.h"
@@ -10,6 +10,7 @@ typedef struct fz_archive_s fz_archive;
 
 struct fz_archive_s
 {
+	int refs;
 	fz_stream *file;
 	const char *format;
 
@@ -61,10 +62,16 @@ fz_archive *fz_open_archive_with_stream(fz_context *ctx, fz_stream *file);
 */
 fz_archive *fz_open_directory(fz_context *ctx, const char *path);
 
+/*
+	fz_keep_archive: Take a new reference to an archive.
+*/
+fz_archive *fz_keep_archive(fz_context *ctx, fz_archive *arch);
+
 /*
 	fz_drop_archive: Release an open archive.
 
-	Any allocations for the archive are freed.
+	Any allocations for the archive are freed when the last
+	reference is dropped.
 */
 void fz_drop_archive(fz_context *ctx, fz_archive *arch);
 
@@ -103,6 +110,10 @@ int fz_has_archive_entry(fz_context *ctx, fz_archive *arch, const char *name);
 /*
 	fz_open_archive_entry: Opens an archive entry as a stream.
 
+	Entry streams read the archive file under the FZ_LOCK_ARCHIVE
+	lock, so they may be read on other threads than the one using
+	the archive, for example to decode images on worker threads.
+
 	name: Entry name to look for, this must be an exact match to
 	the entry name in the archive.
 */
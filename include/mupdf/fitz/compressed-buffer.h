@@ -75,6 +75,10 @@ struct fz_compression_params_s
 			int bpc;
 			int early_change;
 		} lzw;
+		struct
+		{
+			int subimage;
+		} tiff;
 	} u;
 };
 
@@ -280,6 +280,132 @@ void fz_tune_image_decode(fz_context *ctx, fz_tune_image_decode_fn *image_decode
 */
 void fz_tune_image_scale(fz_context *ctx, fz_tune_image_scale_fn *image_scale, void *arg);
 
+/*
+	fz_parallel_job_fn: A job handed to a parallel hook.
+
+	ctx: The context to run the job with. This must be a context
+	that no other thread is using at the same time (typically one
+	cloned for a worker thread, or the context passed to the hook
+	if the job is run by the calling thread).
+
+	arg: The opaque argument passed to the hook along with the job.
+
+	i: The index of the job, 0 <= i < n.
+
+	Jobs do not throw exceptions.
+*/
+typedef void (fz_parallel_job_fn)(fz_context *ctx, void *arg, int i);
+
+/*
+	fz_parallel_fn: Run n jobs, potentially concurrently, and only
+	return once all of them have completed.
+
+	arg: The caller supplied opaque argument.
+
+	ctx: The context of the calling thread.
+
+	n: The number of jobs to run.
+
+	job, job_arg: The function to call for each job, and its
+	argument.
+
+	A hook that is unable to run the jobs concurrently (for
+	instance because it is already busy) should simply run them
+	all in the calling thread using ctx.
+*/
+typedef void (fz_parallel_fn)(void *arg, fz_context *ctx, int n, fz_parallel_job_fn *job, void *job_arg);
+
+/*
+	fz_tune_parallel: Set the hook to use for splitting work
+	(pixmap conversion, scaling and halftoning) across threads.
+
+	parallel: Function to use, or NULL to do all work in the
+	calling thread.
+
+	arg: Opaque argument to be passed to the hook.
+
+	min_rows: The minimum number of rows of a pixmap to hand to a
+	single job. Smaller values split the work more finely at the
+	cost of more overhead; 0 selects the default.
+*/
+void fz_tune_parallel(fz_context *ctx, fz_parallel_fn *parallel, void *arg, int min_rows);
+
+/*
+	fz_parallel_rows_fn: Process rows y0 <= y < y1 of some
+	operation. May throw exceptions.
+*/
+typedef void (fz_parallel_rows_fn)(fz_context *ctx, void *arg, int y0, int y1);
+
+/*
+	fz_parallel_rows: Process h rows by calling fn on chunks of
+	rows, using the parallel hook if one has been set and there
+	are enough rows to make it worthwhile. Each chunk is processed
+	by exactly one call; chunks may be processed concurrently and in
+	any order.
+
+	If any call throws, the exception of the first chunk that
+	failed (its error code and message) is rethrown once all calls
+	have completed.
+*/
+void fz_parallel_rows(fz_context *ctx, int h, fz_parallel_rows_fn *fn, void *arg);
+
+/*
+	fz_background_fn: Start a job on another thread, and return
+	without waiting for it.
+
+	arg: The caller supplied opaque argument.
+
+	ctx: The context of the calling thread.
+
+	job, job_arg: The function to call, with i = 0, and its
+	argument. As for fz_parallel_fn, the job must be called with a
+	context that no other thread is using at the same time.
+
+	Returns 0 if the job has been started, or non-zero if it
+	cannot be, in which case it is not called at all. Every job
+	that has been started must be run, even if the hook is being
+	shut down, as jobs free their own resources.
+*/
+typedef int (fz_background_fn)(void *arg, fz_context *ctx, fz_parallel_job_fn *job, void *job_arg);
+
+/*
+	fz_tune_background: Set the hook to use for work that is done
+	ahead of time, without the caller waiting for it (decoding the
+	images of the pages ahead in image documents).
+
+	background: Function to use, or NULL to do no work ahead.
+
+	arg: Opaque argument to be passed to the hook.
+*/
+void fz_tune_background(fz_context *ctx, fz_background_fn *background, void *arg);
+
+/*
+	fz_tune_prefetch: Set how far the image based document
+	handlers (CBZ and TIFF) look ahead when pages are loaded in
+	order.
+
+	While pages are loaded in order, the images of the pages after
+	the one being loaded are read, and decoded into the store in
+	the background with the hook set with fz_tune_background.
+	Loading a page does not wait for any of this. Loading a page
+	outside the pages looked ahead cancels the decoding that has
+	not started yet, and drops the images read ahead. Without a
+	background hook, nothing is read ahead.
+
+	pages: The number of pages to look ahead, or 0 (the default)
+	to disable look-ahead.
+
+	budget: The most memory, in bytes, that the decoded images of
+	the pages ahead may take; 0 selects the default of 64MB.
+*/
+void fz_tune_prefetch(fz_context *ctx, int pages, size_t budget);
+
+/*
+	fz_prefetch_pages: The number of pages to look ahead, as set
+	by fz_tune_prefetch, or 0 if there is no background hook.
+*/
+int fz_prefetch_pages(fz_context *ctx);
+
 /*
 	fz_aa_level: Get the number of bits of antialiasing we are
 	using (for graphics). Between 0 and 8.
@@ -393,6 +519,7 @@ enum {
 	FZ_LOCK_ALLOC = 0,
 	FZ_LOCK_FREETYPE,
 	FZ_LOCK_GLYPHCACHE,
+	FZ_LOCK_ARCHIVE,
 	FZ_LOCK_MAX
 };
 
@@ -10,6 +10,7 @@
 #include "mupdf/fitz/buffer.h"
 #include "mupdf/fitz/stream.h"
 #include "mupdf/fitz/compressed-buffer.h"
+#include "mupdf/fitz/archive.h"
 
 /*
 	Images are storable objects from which we can obtain fz_pixmaps.
@@ -46,6 +47,55 @@ typedef struct fz_pixmap_image_s fz_pixmap_image;
 */
 fz_pixmap *fz_get_pixmap_from_image(fz_context *ctx, fz_image *image, const fz_irect *subarea, fz_matrix *trans, int *w, int *h);
 
+/*
+	fz_image_prefetch: A set of images being decoded at full
+	resolution into the store in the background, with the hook set
+	with fz_tune_background, so that drawing them later finds them
+	already decoded. The decoded images in the set never take more
+	memory than the budget set with fz_tune_prefetch.
+
+	The set is only used by the thread that made it; the decoding
+	happens on the threads of the hook.
+*/
+typedef struct fz_image_prefetch_s fz_image_prefetch;
+
+/*
+	fz_new_image_prefetch: Create an empty set of images to decode
+	ahead.
+*/
+fz_image_prefetch *fz_new_image_prefetch(fz_context *ctx);
+
+/*
+	fz_drop_image_prefetch: Cancel all the images in the set, as
+	fz_cancel_image_prefetch, and free it.
+*/
+void fz_drop_image_prefetch(fz_context *ctx, fz_image_prefetch *prefetch);
+
+/*
+	fz_prefetch_image: Start decoding an image in the background
+	and add it to the set.
+
+	Returns 1 if decoding has started, or 0 if there is no
+	background hook, the hook cannot start the job, or the image
+	would take the set over its budget.
+*/
+int fz_prefetch_image(fz_context *ctx, fz_image_prefetch *prefetch, fz_image *image);
+
+/*
+	fz_release_prefetched_image: Take an image out of the set, as
+	it is about to be used, or is no longer wanted. If its
+	decoding has not started, it never will. Does nothing if the
+	image is not in the set.
+*/
+void fz_release_prefetched_image(fz_context *ctx, fz_image_prefetch *prefetch, fz_image *image);
+
+/*
+	fz_cancel_image_prefetch: Take all the images out of the set.
+	Decoding that has not started never will; decoding that has
+	started runs to the end in the background.
+*/
+void fz_cancel_image_prefetch(fz_context *ctx, fz_image_prefetch *prefetch);
+
 /*
 	fz_drop_image: Drop a reference to an image.
 
@@ -231,6 +281,17 @@ fz_image *fz_new_image_from_buffer(fz_context *ctx, fz_buffer *buffer);
 */
 fz_image *fz_new_image_from_file(fz_context *ctx, const char *path);
 
+/*
+	fz_new_image_from_archive_entry: Create a new image from an
+	archive entry, inferring its type from the format of the data.
+
+	JPEG images keep a reference to the archive and read the
+	entry again whenever they are decoded, rather than holding
+	the compressed data in memory. Other images are read into a
+	buffer, as with fz_new_image_from_buffer.
+*/
+fz_image *fz_new_image_from_archive_entry(fz_context *ctx, fz_archive *arch, const char *name);
+
 void fz_drop_image_imp(fz_context *ctx, fz_storable *image);
 void fz_drop_image_base(fz_context *ctx, fz_image *image);
 fz_pixmap *fz_decomp_image_from_stream(fz_context *ctx, fz_stream *stm, fz_compressed_image *image, fz_irect *subarea, int indexed, int l2factor);
@@ -285,6 +346,22 @@ void fz_load_pnm_info(fz_context *ctx, unsigned char *data, size_t size, int *w,
 
 int fz_load_tiff_subimage_count(fz_context *ctx, unsigned char *buf, size_t len);
 fz_pixmap *fz_load_tiff_subimage(fz_context *ctx, unsigned char *buf, size_t len, int subimage);
+void fz_load_tiff_info_subimage(fz_context *ctx, unsigned char *buf, size_t len, int *w, int *h, int *xres, int *yres, fz_colorspace **cspace, int subimage);
+
+/*
+	fz_load_tiff_subimage_area: Decode only part of a TIFF subimage.
+
+	Only the tiles or strips that intersect subarea are decoded, and a
+	reduced resolution version of the image is used if the file has one
+	that suits l2factor.
+
+	subarea: NULL, or the area required in full resolution image
+	coordinates. Updated on exit to the area actually decoded.
+
+	l2factor: NULL, or on entry the log 2 subsample factor required.
+	Updated on exit to the subsampling that remains to be done.
+*/
+fz_pixmap *fz_load_tiff_subimage_area(fz_context *ctx, unsigned char *buf, size_t len, int subimage, fz_irect *subarea, int *l2factor);
 
 /*
 	fz_image_resolution: Request the natural resolution
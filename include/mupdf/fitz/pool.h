@@ -7,7 +7,13 @@
 typedef struct fz_pool_s fz_pool;
 
 fz_pool *fz_new_pool(fz_context *ctx);
+
+/* Allocations are zeroed, and live until the pool is dropped. */
 void *fz_pool_alloc(fz_context *ctx, fz_pool *pool, size_t size);
+
+/* Resize an allocation; in place if it was the last one made. Any
+ * added space is zeroed. */
+void *fz_pool_grow(fz_context *ctx, fz_pool *pool, void *old, size_t old_size, size_t new_size);
 char *fz_pool_strdup(fz_context *ctx, fz_pool *pool, const char *s);
 void fz_drop_pool(fz_context *ctx, fz_pool *pool);
 
@@ -60,6 +60,8 @@ typedef struct fz_shade_s
 			float y0, y1;
 			float c0[FZ_MAX_COLORS];
 			float c1[FZ_MAX_COLORS];
+			int has_patch_bbox;
+			fz_rect patch_bbox; /* of the patch poles, once known */
 		} m;
 		struct
 		{
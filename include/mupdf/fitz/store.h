@@ -131,6 +131,12 @@ typedef struct fz_store_hash_s
 			fz_irect r;
 		} pir; /* 24 or 28 bytes */
 		struct
+		{
+			const void *ptr;
+			int i;
+			unsigned char md5[16];
+		} pim; /* 24 or 32 bytes */
+		struct
 		{
 			int id;
 			float m[4];
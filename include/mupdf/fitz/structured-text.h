@@ -9,6 +9,7 @@
 #include "mupdf/fitz/image.h"
 #include "mupdf/fitz/output.h"
 #include "mupdf/fitz/device.h"
+#include "mupdf/fitz/pool.h"
 
 /*
 	Text extraction device: Used for searching, format conversion etc.
@@ -26,6 +27,7 @@ typedef struct fz_page_block_s fz_page_block;
 
 typedef struct fz_stext_sheet_s fz_stext_sheet;
 typedef struct fz_stext_page_s fz_stext_page;
+typedef struct fz_stext_index_s fz_stext_index;
 
 /*
 	FZ_STEXT_PRESERVE_LIGATURES: If this option is activated ligatures
@@ -84,13 +86,26 @@ struct fz_stext_style_s
 /*
 	fz_stext_page: A text page is a list of page blocks, together with
 	an overall bounding box.
+
+	The blocks, lines, spans and characters of a page are allocated
+	from its pool, and are all freed together when the page is
+	dropped.
+
+	The index is a flattened copy of the characters on the page and
+	their bboxes, built on demand for searching and selection. It is
+	discarded whenever the page contents are changed by the text
+	device or by fz_analyze_text.
 */
 struct fz_stext_page_s
 {
+	fz_pool *pool;
 	fz_rect mediabox;
 	int len, cap;
 	fz_page_block *blocks;
 	fz_stext_page *next;
+
+	/* Cached information */
+	fz_stext_index *index;
 };
 
 /*
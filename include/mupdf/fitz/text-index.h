@@ -0,0 +1,106 @@
+#ifndef MUPDF_FITZ_TEXT_INDEX_H
+#define MUPDF_FITZ_TEXT_INDEX_H
+
+#include "mupdf/fitz/system.h"
+#include "mupdf/fitz/context.h"
+#include "mupdf/fitz/geometry.h"
+#include "mupdf/fitz/stream.h"
+#include "mupdf/fitz/output.h"
+#include "mupdf/fitz/document.h"
+#include "mupdf/fitz/structured-text.h"
+
+/*
+	Full text index: An inverted index of the words of a document,
+	built from structured text. Each word is recorded with the page
+	it is on, its character offset in the structured text of that
+	page and its bbox, so that the index can be searched without
+	interpreting the pages again. Indexes can be written to and read
+	from files.
+
+	Words are maximal runs of characters within a line that are
+	neither whitespace nor punctuation; they are matched without
+	regard to case, folded the same way as for fz_search_stext_page.
+
+	(In development - Subject to change in future versions)
+*/
+
+typedef struct fz_text_index_s fz_text_index;
+typedef struct fz_text_index_hit_s fz_text_index_hit;
+
+/*
+	fz_text_index_hit: A search hit.
+
+	page: The page number (counting from 0).
+
+	offset: The character offset of the start of the hit in the
+	structured text of the page, as for fz_stext_char_at.
+
+	bbox: The area to highlight. A hit that is split across lines
+	is returned as one fz_text_index_hit per line, all with the same
+	page and offset.
+*/
+struct fz_text_index_hit_s
+{
+	int page;
+	int offset;
+	fz_rect bbox;
+};
+
+/*
+	fz_new_text_index: Create an empty text index.
+*/
+fz_text_index *fz_new_text_index(fz_context *ctx);
+
+/*
+	fz_drop_text_index: Free a text index.
+*/
+void fz_drop_text_index(fz_context *ctx, fz_text_index *index);
+
+/*
+	fz_add_stext_page_to_text_index: Add the words on a structured
+	text page to an index.
+
+	number: The number of the page (counting from 0). Pages may be
+	added in any order, but each page should only be added once.
+*/
+void fz_add_stext_page_to_text_index(fz_context *ctx, fz_text_index *index, int number, fz_stext_page *page);
+
+/*
+	fz_new_text_index_from_document: Extract the structured text of
+	every page of a document, and build an index of it.
+
+	Pages are loaded in the calling thread, but the text extraction
+	is split across threads by page ranges if a parallel hook has
+	been set with fz_tune_parallel.
+
+	options: Options for the structured text device, or NULL.
+*/
+fz_text_index *fz_new_text_index_from_document(fz_context *ctx, fz_document *doc, const fz_stext_options *options);
+
+/*
+	fz_search_text_index: Search an index for a word or phrase.
+
+	needle: The text to look for. Its words must occur consecutively,
+	and in order, on a page for it to match.
+
+	hits, hit_max: Where to record the hits, and how many to record
+	at most. Hits are ordered by page and offset.
+
+	Returns the number of hits recorded.
+*/
+int fz_search_text_index(fz_context *ctx, fz_text_index *index, const char *needle, fz_text_index_hit *hits, int hit_max);
+
+/*
+	fz_write_text_index: Serialise an index to an output stream.
+*/
+void fz_write_text_index(fz_context *ctx, fz_text_index *index, fz_output *out);
+
+/*
+	fz_read_text_index: Read an index previously written by
+	fz_write_text_index.
+
+	Throws exceptions if the stream does not contain a valid index.
+*/
+fz_text_index *fz_read_text_index(fz_context *ctx, fz_stream *stm);
+
+#endif
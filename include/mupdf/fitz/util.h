@@ -17,6 +17,32 @@ fz_display_list *fz_new_display_list_from_page_number(fz_context *ctx, fz_docume
 fz_display_list *fz_new_display_list_from_page_contents(fz_context *ctx, fz_page *page);
 fz_display_list *fz_new_display_list_from_annot(fz_context *ctx, fz_annot *annot);
 
+/*
+	fz_run_page_contents_cached: Run the contents of a page through
+	a display list kept in the store, for document handlers whose
+	pages are expensive to interpret.
+
+	The first time a page is run, run is called to record its
+	contents (untransformed) into a display list, which is put in
+	the store keyed by doc and number and then replayed to dev.
+	Later runs of the same page replay the stored list for as long
+	as the store keeps it. Lists that are only partially recorded
+	because of errors or an aborted cookie are not stored. When dev
+	is itself a list device and the page is not stored yet, the
+	page is run straight to it instead of being recorded twice.
+
+	The cached lists do not hold a reference to doc, so handlers
+	that use this must call fz_drop_cached_page_lists from their
+	drop_document function.
+*/
+void fz_run_page_contents_cached(fz_context *ctx, fz_document *doc, int number, fz_page *page, fz_page_run_page_contents_fn *run, fz_device *dev, const fz_matrix *transform, fz_cookie *cookie);
+
+/*
+	fz_drop_cached_page_lists: Remove all the display lists stored
+	by fz_run_page_contents_cached for a document.
+*/
+void fz_drop_cached_page_lists(fz_context *ctx, fz_document *doc);
+
 /*
 	fz_new_pixmap_from_page: Render the page to a pixmap using the transform and colorspace.
 */
@@ -3,6 +3,8 @@
 
 #include "mupdf/fitz/system.h"
 #include "mupdf/fitz/context.h"
+#include "mupdf/fitz/buffer.h"
+#include "mupdf/fitz/stream.h"
 
 /*
 	XML document model
@@ -17,6 +19,72 @@ typedef struct fz_xml_s fz_xml;
 */
 fz_xml *fz_parse_xml(fz_context *ctx, fz_buffer *buf, int preserve_white);
 
+/*
+	fz_xml_sax: Callbacks for parsing XML without building a tree.
+	Any of them may be NULL.
+
+	open_tag: Called at the end of each start tag, with the tag name
+	(without namespace prefix) and a NULL terminated array of
+	alternating attribute names and values. Empty element tags get an
+	open_tag call followed by a close_tag call.
+
+	close_tag: Called at each end tag, with the name of the element
+	being closed.
+
+	text: Called with the text (with entities decoded) and the CDATA
+	sections between tags.
+
+	The strings passed to the callbacks are only valid for the
+	duration of the call, except for the tag and attribute names,
+	which are valid until the parse has finished.
+*/
+typedef struct fz_xml_sax_s fz_xml_sax;
+
+struct fz_xml_sax_s
+{
+	void (*open_tag)(fz_context *ctx, void *arg, char *tag, char **atts);
+	void (*close_tag)(fz_context *ctx, void *arg, char *tag);
+	void (*text)(fz_context *ctx, void *arg, char *text);
+};
+
+/*
+	fz_parse_xml_sax: Parse the contents of a stream, calling back for
+	each start tag, end tag and piece of text, instead of building a
+	tree. Use this for documents that only need to be scanned once;
+	the stream is read a chunk at a time, and memory use does not grow
+	with the size of the document.
+
+	preserve_white: whether to report or skip all-whitespace text.
+
+	Exceptions thrown by the callbacks abort the parse and are passed
+	on to the caller.
+*/
+void fz_parse_xml_sax(fz_context *ctx, fz_stream *stm, int preserve_white, const fz_xml_sax *sax, void *arg);
+
+/*
+	fz_xml_child_fn: Called by fz_parse_xml_children, first with the
+	root element alone once its start tag has been read, with child
+	NULL, and then with each child of the root as soon as it has been
+	read, in a tree of its own. The root has no children.
+
+	The callback owns the child, even if it throws, and drops it with
+	fz_drop_xml when done with it. The root is only valid for the
+	duration of the parse.
+
+	Return non-zero to stop the parse.
+*/
+typedef int (fz_xml_child_fn)(fz_context *ctx, void *arg, fz_xml *root, fz_xml *child);
+
+/*
+	fz_parse_xml_children: Parse the contents of a stream a child of
+	the root element at a time, so that each can be used while the
+	rest is still to be read. Only the child being read, and those
+	kept by the callback, take up memory.
+
+	preserve_white: whether to keep or delete all-whitespace nodes.
+*/
+void fz_parse_xml_children(fz_context *ctx, fz_stream *stm, int preserve_white, fz_xml_child_fn *fn, void *arg);
+
 /*
 	fz_xml_prev: Return previous sibling of XML node.
 */
@@ -0,0 +1,71 @@
+#ifndef MUPDF_HELPERS_MU_THREAD_POOL_H
+#define MUPDF_HELPERS_MU_THREAD_POOL_H
+
+/*
+	Simple thread pool, built on the threading helper
+	library, suitable for use as a parallel hook for
+	fz_tune_parallel, and as a background hook for
+	fz_tune_background.
+
+	Each worker thread runs with its own context, cloned
+	from the one the pool was created with. That context
+	must therefore have locking functions.
+*/
+
+#include "mupdf/fitz.h"
+#include "mupdf/helpers/mu-threads.h"
+
+typedef struct mu_thread_pool_s mu_thread_pool;
+
+/*
+	mu_new_thread_pool: Create a pool of worker threads.
+
+	workers: The number of worker threads to create. The
+	thread calling mu_run_thread_pool takes part in the work
+	too. One more thread is created to run the jobs started
+	with mu_start_thread_pool_job.
+
+	Throws exceptions on failure (including on platforms
+	without threads).
+*/
+mu_thread_pool *mu_new_thread_pool(fz_context *ctx, int workers);
+
+/*
+	mu_drop_thread_pool: Stop the worker threads and free
+	the pool. Must not be called while the pool is running
+	jobs. Background jobs that have been started and not run
+	yet are run before the background thread stops.
+*/
+void mu_drop_thread_pool(fz_context *ctx, mu_thread_pool *pool);
+
+/*
+	mu_run_thread_pool: Run n jobs on the pool, returning
+	once all of them have completed. The signature matches
+	fz_parallel_fn, so this can be passed to
+	fz_tune_parallel along with the pool:
+
+		fz_tune_parallel(ctx, mu_run_thread_pool, pool, 0);
+
+	If the pool is already busy (for instance because a
+	job itself wants to run jobs, or because another thread
+	is using the pool) the jobs are run in the calling
+	thread instead.
+*/
+void mu_run_thread_pool(void *pool, fz_context *ctx, int n, fz_parallel_job_fn *job, void *job_arg);
+
+/*
+	mu_start_thread_pool_job: Queue a job to be run on the
+	background thread of the pool, and return at once. Jobs
+	are run one at a time, in the order they were started,
+	with i = 0. The signature matches fz_background_fn, so
+	this can be passed to fz_tune_background along with the
+	pool:
+
+		fz_tune_background(ctx, mu_start_thread_pool_job, pool);
+
+	Returns 0 if the job has been queued, or non-zero if it
+	cannot be (it is then never run).
+*/
+int mu_start_thread_pool_job(void *pool, fz_context *ctx, fz_parallel_job_fn *job, void *job_arg);
+
+#endif /* MUPDF_HELPERS_MU_THREAD_POOL_H */
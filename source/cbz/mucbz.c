@@ -5,6 +5,9 @@
 
 #define DPI 72.0f
 
+/* Number of recently loaded page images kept by the document. */
+#define CBZ_IMAGE_CACHE_SIZE 8
+
 typedef struct cbz_document_s cbz_document;
 typedef struct cbz_page_s cbz_page;
 
@@ -42,6 +45,14 @@ struct cbz_document_s
 	fz_archive *arch;
 	int page_count;
 	const char **page;
+	int cache_next;
+	struct {
+		int number;
+		int ahead; /* being decoded ahead, and not loaded since */
+		fz_image *image;
+	} cache[CBZ_IMAGE_CACHE_SIZE];
+	int last_number;
+	fz_image_prefetch *prefetch;
 };
 
 static inline int cbz_isdigit(int c)
@@ -124,6 +135,10 @@ static void
 cbz_drop_document(fz_context *ctx, fz_document *doc_)
 {
 	cbz_document *doc = (cbz_document*)doc_;
+	int i;
+	fz_drop_image_prefetch(ctx, doc->prefetch);
+	for (i = 0; i < CBZ_IMAGE_CACHE_SIZE; i++)
+		fz_drop_image(ctx, doc->cache[i].image);
 	fz_drop_archive(ctx, doc->arch);
 	fz_free(ctx, (char **)doc->page);
 }
@@ -172,38 +187,159 @@ cbz_drop_page(fz_context *ctx, fz_page *page_)
 	fz_drop_image(ctx, page->image);
 }
 
+/*
+	Page images are kept in a small ring so that reloading a page, or
+	loading one that another thread has already loaded and rendered
+	ahead of time, reuses the same image and thus the decoded pixmaps
+	that the store holds for it.
+*/
+static int
+cbz_find_image(cbz_document *doc, int number)
+{
+	int i;
+	for (i = 0; i < CBZ_IMAGE_CACHE_SIZE; i++)
+		if (doc->cache[i].image && doc->cache[i].number == number)
+			return i;
+	return -1;
+}
+
+static fz_image *
+cbz_load_image(fz_context *ctx, cbz_document *doc, int number)
+{
+	fz_image *image;
+	int i;
+
+	i = cbz_find_image(doc, number);
+	if (i >= 0)
+	{
+		if (doc->cache[i].ahead)
+		{
+			fz_release_prefetched_image(ctx, doc->prefetch, doc->cache[i].image);
+			doc->cache[i].ahead = 0;
+		}
+		return fz_keep_image(ctx, doc->cache[i].image);
+	}
+
+	if (!doc->arch)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot load cbz page");
+	image = fz_new_image_from_archive_entry(ctx, doc->arch, doc->page[number]);
+
+	i = doc->cache_next;
+	if (doc->cache[i].ahead)
+		fz_release_prefetched_image(ctx, doc->prefetch, doc->cache[i].image);
+	fz_drop_image(ctx, doc->cache[i].image);
+	doc->cache[i].number = number;
+	doc->cache[i].ahead = 0;
+	doc->cache[i].image = fz_keep_image(ctx, image);
+	doc->cache_next = (i + 1) % CBZ_IMAGE_CACHE_SIZE;
+
+	return image;
+}
+
+/*
+	While pages are loaded in order, the images of the next few pages
+	are decoded in the background, with the hook set with
+	fz_tune_background, so that they are in the store by the time
+	their pages are drawn. Loading a page never waits for this: the
+	images are only read here, and only the pages ahead that are not
+	already being decoded are started, as far as the budget allows.
+
+	Loading a page that is not among the ones looked ahead from the
+	last page loaded cancels the decoding that has not started yet,
+	and drops the images read ahead, so that the store can evict the
+	pixmaps decoded for them. Looking ahead starts again from the next
+	page loaded in order, so that jumping about the document does not
+	start decoding pages that will not be read.
+*/
+static void
+cbz_look_ahead(fz_context *ctx, cbz_document *doc, int number)
+{
+	int pages = fz_mini(fz_prefetch_pages(ctx), CBZ_IMAGE_CACHE_SIZE - 1);
+	int last = doc->last_number;
+	fz_image *image = NULL;
+	int i, p, started;
+
+	fz_var(image);
+
+	doc->last_number = number;
+
+	if (last < 0 || number < last || number > last + fz_maxi(pages, 1))
+	{
+		fz_cancel_image_prefetch(ctx, doc->prefetch);
+		for (i = 0; i < CBZ_IMAGE_CACHE_SIZE; i++)
+		{
+			if (doc->cache[i].ahead)
+			{
+				fz_drop_image(ctx, doc->cache[i].image);
+				doc->cache[i].image = NULL;
+				doc->cache[i].ahead = 0;
+			}
+		}
+		return;
+	}
+
+	/* Pages skipped over will not be loaded now. */
+	for (i = 0; i < CBZ_IMAGE_CACHE_SIZE; i++)
+	{
+		if (doc->cache[i].ahead && doc->cache[i].number < number)
+		{
+			fz_release_prefetched_image(ctx, doc->prefetch, doc->cache[i].image);
+			doc->cache[i].ahead = 0;
+		}
+	}
+
+	fz_try(ctx)
+	{
+		for (p = number + 1; p <= number + pages && p < doc->page_count; p++)
+		{
+			i = cbz_find_image(doc, p);
+			if (i >= 0 && doc->cache[i].ahead)
+				continue;
+			image = cbz_load_image(ctx, doc, p);
+			started = fz_prefetch_image(ctx, doc->prefetch, image);
+			if (started)
+				doc->cache[cbz_find_image(doc, p)].ahead = 1;
+			fz_drop_image(ctx, image);
+			image = NULL;
+			if (!started)
+				break;
+		}
+	}
+	fz_catch(ctx)
+	{
+		/* The page itself has loaded; only the look-ahead stops. */
+		fz_drop_image(ctx, image);
+		if (fz_caught(ctx) != FZ_ERROR_TRYLATER)
+			fz_warn(ctx, "cannot read ahead: %s", fz_caught_message(ctx));
+	}
+}
+
 static fz_page *
 cbz_load_page(fz_context *ctx, fz_document *doc_, int number)
 {
 	cbz_document *doc = (cbz_document*)doc_;
 	cbz_page *page = NULL;
-	fz_buffer *buf = NULL;
+	fz_image *image;
 
 	if (number < 0 || number >= doc->page_count)
 		return NULL;
 
 	fz_var(page);
 
-	if (doc->arch)
-		buf = fz_read_archive_entry(ctx, doc->arch, doc->page[number]);
-	if (!buf)
-		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot load cbz page");
+	image = cbz_load_image(ctx, doc, number);
 
 	fz_try(ctx)
 	{
+		cbz_look_ahead(ctx, doc, number);
 		page = fz_new_derived_page(ctx, cbz_page);
 		page->super.bound_page = cbz_bound_page;
 		page->super.run_page_contents = cbz_run_page;
 		page->super.drop_page = cbz_drop_page;
-		page->image = fz_new_image_from_buffer(ctx, buf);
-	}
-	fz_always(ctx)
-	{
-		fz_drop_buffer(ctx, buf);
+		page->image = image;
 	}
 	fz_catch(ctx)
 	{
-		fz_drop_page(ctx, (fz_page*)page);
+		fz_drop_image(ctx, image);
 		fz_rethrow(ctx);
 	}
 
@@ -230,9 +366,11 @@ cbz_open_document_with_stream(fz_context *ctx, fz_stream *file)
 	doc->super.count_pages = cbz_count_pages;
 	doc->super.load_page = cbz_load_page;
 	doc->super.lookup_metadata = cbz_lookup_metadata;
+	doc->last_number = -1;
 
 	fz_try(ctx)
 	{
+		doc->prefetch = fz_new_image_prefetch(ctx);
 		doc->arch = fz_open_archive_with_stream(ctx, file);
 		cbz_create_page_list(ctx, doc);
 	}
@@ -7,6 +7,9 @@ typedef struct tiff_page_s tiff_page;
 
 #define DPI 72.0f
 
+/* Number of recently loaded page images kept by the document. */
+#define TIFF_IMAGE_CACHE_SIZE 8
+
 struct tiff_page_s
 {
 	fz_page super;
@@ -18,6 +21,14 @@ struct tiff_document_s
 	fz_document super;
 	fz_buffer *buffer;
 	int page_count;
+	int cache_next;
+	struct {
+		int number;
+		int ahead; /* being decoded ahead, and not loaded since */
+		fz_image *image;
+	} cache[TIFF_IMAGE_CACHE_SIZE];
+	int last_number;
+	fz_image_prefetch *prefetch;
 };
 
 static fz_rect *
@@ -57,43 +68,170 @@ tiff_drop_page(fz_context *ctx, fz_page *page_)
 	fz_drop_image(ctx, page->image);
 }
 
+/*
+	Page images are kept in a small ring so that reloading a page, or
+	loading one that another thread has already loaded and rendered
+	ahead of time, reuses the same image and thus the decoded pixmaps
+	that the store holds for it.
+*/
+static int
+tiff_find_image(tiff_document *doc, int number)
+{
+	int i;
+	for (i = 0; i < TIFF_IMAGE_CACHE_SIZE; i++)
+		if (doc->cache[i].image && doc->cache[i].number == number)
+			return i;
+	return -1;
+}
+
+static fz_image *
+tiff_load_image(fz_context *ctx, tiff_document *doc, int number)
+{
+	fz_compressed_buffer *bc;
+	fz_image *image;
+	size_t len;
+	unsigned char *data;
+	int w, h, xres, yres, i;
+	fz_colorspace *cspace;
+
+	i = tiff_find_image(doc, number);
+	if (i >= 0)
+	{
+		if (doc->cache[i].ahead)
+		{
+			fz_release_prefetched_image(ctx, doc->prefetch, doc->cache[i].image);
+			doc->cache[i].ahead = 0;
+		}
+		return fz_keep_image(ctx, doc->cache[i].image);
+	}
+
+	/* Only read the image header here; the image data is decoded
+	 * on demand, a subarea and resolution at a time. */
+	len = fz_buffer_storage(ctx, doc->buffer, &data);
+	fz_load_tiff_info_subimage(ctx, data, len, &w, &h, &xres, &yres, &cspace, number);
+
+	bc = fz_malloc_struct(ctx, fz_compressed_buffer);
+	bc->buffer = fz_keep_buffer(ctx, doc->buffer);
+	bc->params.type = FZ_IMAGE_TIFF;
+	bc->params.u.tiff.subimage = number;
+
+	/* The image owns the compressed buffer, even on failure. */
+	image = fz_new_image_from_compressed_buffer(ctx, w, h, 8, cspace, xres, yres, 0, 0, NULL, NULL, bc, NULL);
+
+	i = doc->cache_next;
+	if (doc->cache[i].ahead)
+		fz_release_prefetched_image(ctx, doc->prefetch, doc->cache[i].image);
+	fz_drop_image(ctx, doc->cache[i].image);
+	doc->cache[i].number = number;
+	doc->cache[i].ahead = 0;
+	doc->cache[i].image = fz_keep_image(ctx, image);
+	doc->cache_next = (i + 1) % TIFF_IMAGE_CACHE_SIZE;
+
+	return image;
+}
+
+/*
+	While pages are loaded in order, the images of the next few pages
+	are decoded in the background, with the hook set with
+	fz_tune_background, so that they are in the store by the time
+	their pages are drawn. Loading a page never waits for this: the
+	images are only read here, and only the pages ahead that are not
+	already being decoded are started, as far as the budget allows.
+
+	Loading a page that is not among the ones looked ahead from the
+	last page loaded cancels the decoding that has not started yet,
+	and drops the images read ahead, so that the store can evict the
+	pixmaps decoded for them. Looking ahead starts again from the next
+	page loaded in order, so that jumping about the document does not
+	start decoding pages that will not be read.
+*/
+static void
+tiff_look_ahead(fz_context *ctx, tiff_document *doc, int number)
+{
+	int pages = fz_mini(fz_prefetch_pages(ctx), TIFF_IMAGE_CACHE_SIZE - 1);
+	int last = doc->last_number;
+	fz_image *image = NULL;
+	int i, p, started;
+
+	fz_var(image);
+
+	doc->last_number = number;
+
+	if (last < 0 || number < last || number > last + fz_maxi(pages, 1))
+	{
+		fz_cancel_image_prefetch(ctx, doc->prefetch);
+		for (i = 0; i < TIFF_IMAGE_CACHE_SIZE; i++)
+		{
+			if (doc->cache[i].ahead)
+			{
+				fz_drop_image(ctx, doc->cache[i].image);
+				doc->cache[i].image = NULL;
+				doc->cache[i].ahead = 0;
+			}
+		}
+		return;
+	}
+
+	/* Pages skipped over will not be loaded now. */
+	for (i = 0; i < TIFF_IMAGE_CACHE_SIZE; i++)
+	{
+		if (doc->cache[i].ahead && doc->cache[i].number < number)
+		{
+			fz_release_prefetched_image(ctx, doc->prefetch, doc->cache[i].image);
+			doc->cache[i].ahead = 0;
+		}
+	}
+
+	fz_try(ctx)
+	{
+		for (p = number + 1; p <= number + pages && p < doc->page_count; p++)
+		{
+			i = tiff_find_image(doc, p);
+			if (i >= 0 && doc->cache[i].ahead)
+				continue;
+			image = tiff_load_image(ctx, doc, p);
+			started = fz_prefetch_image(ctx, doc->prefetch, image);
+			if (started)
+				doc->cache[tiff_find_image(doc, p)].ahead = 1;
+			fz_drop_image(ctx, image);
+			image = NULL;
+			if (!started)
+				break;
+		}
+	}
+	fz_catch(ctx)
+	{
+		/* The page itself has loaded; only the look-ahead stops. */
+		fz_drop_image(ctx, image);
+		if (fz_caught(ctx) != FZ_ERROR_TRYLATER)
+			fz_warn(ctx, "cannot read ahead: %s", fz_caught_message(ctx));
+	}
+}
+
 static fz_page *
 tiff_load_page(fz_context *ctx, fz_document *doc_, int number)
 {
 	tiff_document *doc = (tiff_document*)doc_;
-	fz_pixmap *pixmap = NULL;
-	fz_image *image = NULL;
 	tiff_page *page = NULL;
+	fz_image *image;
 
 	if (number < 0 || number >= doc->page_count)
 		return NULL;
 
-	fz_var(pixmap);
-	fz_var(image);
-	fz_var(page);
+	image = tiff_load_image(ctx, doc, number);
 
 	fz_try(ctx)
 	{
-		size_t len;
-		unsigned char *data;
-		len = fz_buffer_storage(ctx, doc->buffer, &data);
-		pixmap = fz_load_tiff_subimage(ctx, data, len, number);
-		image = fz_new_image_from_pixmap(ctx, pixmap, NULL);
-
+		tiff_look_ahead(ctx, doc, number);
 		page = fz_new_derived_page(ctx, tiff_page);
 		page->super.bound_page = tiff_bound_page;
 		page->super.run_page_contents = tiff_run_page;
 		page->super.drop_page = tiff_drop_page;
-		page->image = fz_keep_image(ctx, image);
-	}
-	fz_always(ctx)
-	{
-		fz_drop_image(ctx, image);
-		fz_drop_pixmap(ctx, pixmap);
+		page->image = image;
 	}
 	fz_catch(ctx)
 	{
-		fz_free(ctx, page);
+		fz_drop_image(ctx, image);
 		fz_rethrow(ctx);
 	}
 
@@ -119,6 +257,10 @@ static void
 tiff_drop_document(fz_context *ctx, fz_document *doc_)
 {
 	tiff_document *doc = (tiff_document*)doc_;
+	int i;
+	fz_drop_image_prefetch(ctx, doc->prefetch);
+	for (i = 0; i < TIFF_IMAGE_CACHE_SIZE; i++)
+		fz_drop_image(ctx, doc->cache[i].image);
 	fz_drop_buffer(ctx, doc->buffer);
 }
 
@@ -133,11 +275,13 @@ tiff_open_document_with_stream(fz_context *ctx, fz_stream *file)
 	doc->super.count_pages = tiff_count_pages;
 	doc->super.load_page = tiff_load_page;
 	doc->super.lookup_metadata = tiff_lookup_metadata;
+	doc->last_number = -1;
 
 	fz_try(ctx)
 	{
 		size_t len;
 		unsigned char *data;
+		doc->prefetch = fz_new_image_prefetch(ctx);
 		doc->buffer = fz_read_all(ctx, file, 1024);
 		len = fz_buffer_storage(ctx, doc->buffer, &data);
 		doc->page_count = fz_load_tiff_subimage_count(ctx, data, len);
@@ -1,19 +1,116 @@
 #include "mupdf/fitz.h"
+#include "fitz-imp.h"
+
+/* Archive files are shared by all the entry streams opened on them,
+ * which may be read on other threads, so every seek and read of them
+ * happens under FZ_LOCK_ARCHIVE. */
 
 fz_stream *
 fz_open_archive_entry(fz_context *ctx, fz_archive *arch, const char *name)
 {
+	fz_stream *stm = NULL;
+
 	if (!arch->open_entry)
 		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot open archive entry");
-	return arch->open_entry(ctx, arch, name);
+
+	fz_lock(ctx, FZ_LOCK_ARCHIVE);
+	fz_try(ctx)
+		stm = arch->open_entry(ctx, arch, name);
+	fz_always(ctx)
+		fz_unlock(ctx, FZ_LOCK_ARCHIVE);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return stm;
 }
 
 fz_buffer *
 fz_read_archive_entry(fz_context *ctx, fz_archive *arch, const char *name)
 {
+	fz_buffer *buf = NULL;
+
 	if (!arch->read_entry)
 		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot read archive entry");
-	return arch->read_entry(ctx, arch, name);
+
+	fz_lock(ctx, FZ_LOCK_ARCHIVE);
+	fz_try(ctx)
+		buf = arch->read_entry(ctx, arch, name);
+	fz_always(ctx)
+		fz_unlock(ctx, FZ_LOCK_ARCHIVE);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return buf;
+}
+
+struct archive_range
+{
+	fz_stream *file;
+	size_t remain;
+	fz_off_t offset;
+	unsigned char buffer[4096];
+};
+
+static int
+next_archive_range(fz_context *ctx, fz_stream *stm, size_t max)
+{
+	struct archive_range *state = stm->state;
+	size_t n = 0;
+
+	if (state->remain == 0)
+		return EOF;
+
+	fz_lock(ctx, FZ_LOCK_ARCHIVE);
+	fz_try(ctx)
+	{
+		fz_seek(ctx, state->file, state->offset, 0);
+		n = fz_read(ctx, state->file, state->buffer, fz_minz(state->remain, sizeof state->buffer));
+	}
+	fz_always(ctx)
+		fz_unlock(ctx, FZ_LOCK_ARCHIVE);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	stm->rp = state->buffer;
+	stm->wp = stm->rp + n;
+	if (n == 0)
+		return EOF;
+	state->remain -= n;
+	state->offset += (fz_off_t)n;
+	stm->pos += (fz_off_t)n;
+	return *stm->rp++;
+}
+
+static void
+close_archive_range(fz_context *ctx, void *state_)
+{
+	struct archive_range *state = (struct archive_range *)state_;
+	fz_stream *file = state->file;
+	fz_free(ctx, state);
+	fz_drop_stream(ctx, file);
+}
+
+fz_stream *
+fz_open_archive_range(fz_context *ctx, fz_stream *file, int len, fz_off_t offset)
+{
+	struct archive_range *state;
+
+	if (len < 0)
+		len = 0;
+	fz_try(ctx)
+	{
+		state = fz_malloc_struct(ctx, struct archive_range);
+		state->file = file;
+		state->remain = len;
+		state->offset = offset;
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_stream(ctx, file);
+		fz_rethrow(ctx);
+	}
+
+	return fz_new_stream(ctx, state, next_archive_range, close_archive_range);
 }
 
 int
@@ -45,11 +142,121 @@ fz_archive_format(fz_context *ctx, fz_archive *arch)
 	return arch->format;
 }
 
+typedef struct fz_archive_lookup_slot_s fz_archive_lookup_slot;
+
+struct fz_archive_lookup_slot_s
+{
+	unsigned int hash;
+	int idx;
+	const char *name;
+};
+
+struct fz_archive_lookup_s
+{
+	int cap;
+	fz_archive_lookup_slot *slots;
+};
+
+static unsigned int
+hash_entry_name(const char *s)
+{
+	unsigned int h = 2166136261U;
+	while (*s)
+	{
+		int c = (unsigned char)*s++;
+		if (c >= 'A' && c <= 'Z')
+			c += 32;
+		h = (h ^ c) * 16777619U;
+	}
+	return h;
+}
+
+fz_archive_lookup *
+fz_new_archive_lookup(fz_context *ctx, fz_archive *arch)
+{
+	fz_archive_lookup *lookup;
+	int i, n, k;
+
+	n = fz_count_archive_entries(ctx, arch);
+
+	lookup = fz_malloc_struct(ctx, fz_archive_lookup);
+	lookup->cap = 16;
+	while (lookup->cap < n * 2)
+		lookup->cap <<= 1;
+
+	fz_try(ctx)
+	{
+		lookup->slots = fz_malloc_array(ctx, lookup->cap, sizeof *lookup->slots);
+		for (k = 0; k < lookup->cap; k++)
+			lookup->slots[k].idx = -1;
+
+		for (i = 0; i < n; i++)
+		{
+			const char *name = fz_list_archive_entry(ctx, arch, i);
+			unsigned int hash;
+			if (!name)
+				continue;
+			hash = hash_entry_name(name);
+			k = hash & (lookup->cap - 1);
+			while (lookup->slots[k].idx >= 0)
+			{
+				if (lookup->slots[k].hash == hash && !fz_strcasecmp(lookup->slots[k].name, name))
+					break;
+				k = (k + 1) & (lookup->cap - 1);
+			}
+			/* Keep the first of several entries with the same name. */
+			if (lookup->slots[k].idx < 0)
+			{
+				lookup->slots[k].hash = hash;
+				lookup->slots[k].idx = i;
+				lookup->slots[k].name = name;
+			}
+		}
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_archive_lookup(ctx, lookup);
+		fz_rethrow(ctx);
+	}
+
+	return lookup;
+}
+
+int
+fz_lookup_archive_entry(fz_context *ctx, fz_archive_lookup *lookup, const char *name)
+{
+	unsigned int hash;
+	int k;
+
+	if (!lookup)
+		return -1;
+
+	hash = hash_entry_name(name);
+	k = hash & (lookup->cap - 1);
+	while (lookup->slots[k].idx >= 0)
+	{
+		if (lookup->slots[k].hash == hash && !fz_strcasecmp(lookup->slots[k].name, name))
+			return lookup->slots[k].idx;
+		k = (k + 1) & (lookup->cap - 1);
+	}
+	return -1;
+}
+
+void
+fz_drop_archive_lookup(fz_context *ctx, fz_archive_lookup *lookup)
+{
+	if (!lookup)
+		return;
+	fz_free(ctx, lookup->slots);
+	fz_free(ctx, lookup);
+}
+
 fz_archive *
 fz_new_archive_of_size(fz_context *ctx, fz_stream *file, int size)
 {
 	fz_archive *arch;
 	arch = Memento_label(fz_calloc(ctx, 1, size), "fz_archive");
+	arch->refs = 1;
 	arch->file = fz_keep_stream(ctx, file);
 	return arch;
 }
@@ -92,10 +299,16 @@ fz_open_archive(fz_context *ctx, const char *filename)
 	return arch;
 }
 
+fz_archive *
+fz_keep_archive(fz_context *ctx, fz_archive *arch)
+{
+	return fz_keep_imp(ctx, arch, &arch->refs);
+}
+
 void
 fz_drop_archive(fz_context *ctx, fz_archive *arch)
 {
-	if (!arch)
+	if (!fz_drop_imp(ctx, arch, &arch->refs))
 		return;
 
 	if (arch->drop_archive)
@@ -2445,6 +2445,295 @@ convert_to_icc_base(fz_context *ctx, fz_colorspace *srcs, float *src_f, float *d
 	}
 }
 
+/*
+	Conversions without a fast path go through a lookup table sampled
+	on a regular grid over the source components. The table is built
+	once per pair of colorspaces and kept in the store. Each pixel is
+	interpolated from the corners of the simplex of the grid cell that
+	holds it; for three components that is tetrahedral interpolation.
+*/
+
+#define LUT_MAX_N 4
+
+typedef struct fz_color_lut_s
+{
+	fz_storable storable;
+	int srcn, dstn;
+	int grid;
+	int stride[LUT_MAX_N];
+	unsigned char *table;
+} fz_color_lut;
+
+typedef struct fz_color_lut_key_s
+{
+	int refs;
+	fz_colorspace *ss;
+	fz_colorspace *ds;
+	fz_color_params params;
+	int to_base;
+} fz_color_lut_key;
+
+static int
+fz_make_hash_color_lut_key(fz_context *ctx, fz_store_hash *hash, void *key_)
+{
+	fz_color_lut_key *key = (fz_color_lut_key *)key_;
+	fz_md5 md5;
+
+	hash->u.pim.ptr = key->ss;
+	hash->u.pim.i = key->to_base;
+	fz_md5_init(&md5);
+	fz_md5_update(&md5, (unsigned char *)&key->ds, sizeof key->ds);
+	fz_md5_update(&md5, (unsigned char *)&key->params, sizeof key->params);
+	fz_md5_final(&md5, hash->u.pim.md5);
+	return 1;
+}
+
+static void *
+fz_keep_color_lut_key(fz_context *ctx, void *key_)
+{
+	fz_color_lut_key *key = (fz_color_lut_key *)key_;
+	return fz_keep_imp(ctx, key, &key->refs);
+}
+
+static void
+fz_drop_color_lut_key(fz_context *ctx, void *key_)
+{
+	fz_color_lut_key *key = (fz_color_lut_key *)key_;
+	if (fz_drop_imp(ctx, key, &key->refs))
+	{
+		fz_drop_colorspace(ctx, key->ss);
+		fz_drop_colorspace(ctx, key->ds);
+		fz_free(ctx, key);
+	}
+}
+
+static int
+fz_cmp_color_lut_key(fz_context *ctx, void *k0_, void *k1_)
+{
+	fz_color_lut_key *k0 = (fz_color_lut_key *)k0_;
+	fz_color_lut_key *k1 = (fz_color_lut_key *)k1_;
+	return k0->ss != k1->ss ||
+		k0->ds != k1->ds ||
+		k0->to_base != k1->to_base ||
+		memcmp(&k0->params, &k1->params, sizeof k0->params);
+}
+
+static void
+fz_format_color_lut_key(fz_context *ctx, char *s, int n, void *key_)
+{
+	fz_color_lut_key *key = (fz_color_lut_key *)key_;
+	fz_snprintf(s, n, "(color lut %s to %s)", key->ss->name, key->ds->name);
+}
+
+static fz_store_type fz_color_lut_store_type =
+{
+	fz_make_hash_color_lut_key,
+	fz_keep_color_lut_key,
+	fz_drop_color_lut_key,
+	fz_cmp_color_lut_key,
+	fz_format_color_lut_key,
+	NULL
+};
+
+static void
+fz_drop_color_lut_imp(fz_context *ctx, fz_storable *storable)
+{
+	fz_color_lut *lut = (fz_color_lut *)storable;
+	fz_free(ctx, lut->table);
+	fz_free(ctx, lut);
+}
+
+static void
+fz_drop_color_lut(fz_context *ctx, fz_color_lut *lut)
+{
+	fz_drop_storable(ctx, &lut->storable);
+}
+
+/* Grid sizes that keep the tables at a few tens of kilobytes. */
+static int
+fz_color_lut_grid(int n)
+{
+	switch (n)
+	{
+	case 2: return 33;
+	case 3: return 17;
+	case 4: return 9;
+	}
+	return 0;
+}
+
+static fz_color_lut *
+fz_new_color_lut(fz_context *ctx, fz_colorspace *ss, fz_colorspace *ds, const fz_color_params *params, int to_base)
+{
+	fz_color_lut *lut;
+	fz_color_converter cc;
+	float srcv[FZ_MAX_COLORS];
+	float dstv[FZ_MAX_COLORS];
+	int is_lab = fz_colorspace_is_lab(ctx, ss) || fz_colorspace_is_lab_icc(ctx, ss);
+	int size, i, k;
+
+	lut = fz_malloc_struct(ctx, fz_color_lut);
+	FZ_INIT_STORABLE(lut, 1, fz_drop_color_lut_imp);
+	lut->srcn = ss->n;
+	lut->dstn = ds->n;
+	lut->grid = fz_color_lut_grid(ss->n);
+	size = 1;
+	for (k = lut->srcn - 1; k >= 0; k--)
+	{
+		lut->stride[k] = size * lut->dstn;
+		size *= lut->grid;
+	}
+
+	fz_try(ctx)
+		lut->table = fz_malloc(ctx, (size_t)size * lut->dstn);
+	fz_catch(ctx)
+	{
+		fz_free(ctx, lut);
+		fz_rethrow(ctx);
+	}
+
+	if (!to_base)
+		fz_find_color_converter(ctx, &cc, NULL, ds, ss, params);
+
+	fz_try(ctx)
+	{
+		for (i = 0; i < size; i++)
+		{
+			int rem = i;
+			for (k = lut->srcn - 1; k >= 0; k--)
+			{
+				float v = (float)(rem % lut->grid) / (lut->grid - 1);
+				rem /= lut->grid;
+				/* Use the same scaling as std_conv_pixmap. */
+				if (is_lab)
+					srcv[k] = (k == 0 ? v * 100 : v * 255 - 128);
+				else
+					srcv[k] = v;
+			}
+			if (to_base)
+			{
+				convert_to_icc_base(ctx, ss, srcv, dstv);
+				ds->clamp(ds, dstv, dstv);
+			}
+			else
+				cc.convert(ctx, &cc, dstv, srcv);
+			for (k = 0; k < lut->dstn; k++)
+				lut->table[i * lut->dstn + k] = fz_clamp(dstv[k] * 255 + 0.5f, 0, 255);
+		}
+	}
+	fz_always(ctx)
+	{
+		if (!to_base)
+			fz_drop_color_converter(ctx, &cc);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_color_lut(ctx, lut);
+		fz_rethrow(ctx);
+	}
+
+	return lut;
+}
+
+static fz_color_lut *
+fz_find_color_lut(fz_context *ctx, fz_colorspace *ss, fz_colorspace *ds, const fz_color_params *params, int to_base)
+{
+	fz_color_lut_key key, *keyp = NULL;
+	fz_color_lut *lut, *existing;
+
+	if (params == NULL)
+		params = fz_default_color_params(ctx);
+
+	memset(&key, 0, sizeof key);
+	key.refs = 1;
+	key.ss = ss;
+	key.ds = ds;
+	key.params = *params;
+	key.to_base = to_base;
+
+	lut = fz_find_item(ctx, fz_drop_color_lut_imp, &key, &fz_color_lut_store_type);
+	if (lut)
+		return lut;
+
+	lut = fz_new_color_lut(ctx, ss, ds, params, to_base);
+
+	fz_var(keyp);
+
+	/* Any failure here will just result in us not caching. */
+	fz_try(ctx)
+	{
+		keyp = fz_malloc_struct(ctx, fz_color_lut_key);
+		*keyp = key;
+		keyp->ss = fz_keep_colorspace(ctx, ss);
+		keyp->ds = fz_keep_colorspace(ctx, ds);
+		existing = fz_store_item(ctx, keyp, lut, sizeof(fz_color_lut) + (size_t)lut->stride[0] * lut->grid, &fz_color_lut_store_type);
+		if (existing)
+		{
+			/* Found one while adding! Perhaps from another thread? */
+			fz_drop_color_lut(ctx, lut);
+			lut = existing;
+		}
+	}
+	fz_always(ctx)
+	{
+		if (keyp)
+			fz_drop_color_lut_key(ctx, keyp);
+	}
+	fz_catch(ctx)
+	{
+		/* Do nothing */
+	}
+
+	return lut;
+}
+
+static inline void
+fz_eval_color_lut(const fz_color_lut *lut, const unsigned char *s, unsigned char *d)
+{
+	const int g1 = lut->grid - 1;
+	const int srcn = lut->srcn;
+	const int dstn = lut->dstn;
+	const unsigned char *v;
+	int frac[LUT_MAX_N] = { 0 }, order[LUT_MAX_N] = { 0 };
+	int acc[FZ_MAX_COLORS];
+	int i, j, k, w, offset = 0;
+
+	for (k = 0; k < srcn; k++)
+	{
+		int p = s[k] * g1;
+		i = p / 255;
+		frac[k] = p - i * 255;
+		if (i == g1)
+		{
+			i--;
+			frac[k] = 255;
+		}
+		offset += i * lut->stride[k];
+
+		/* Insertion sort, largest fraction first. */
+		for (j = k; j > 0 && frac[order[j - 1]] < frac[k]; j--)
+			order[j] = order[j - 1];
+		order[j] = k;
+	}
+
+	/* Walk from the low corner of the cell to the high one, one
+	 * component at a time, in the order of the fractions. The weights
+	 * are the differences between successive fractions. */
+	v = lut->table + offset;
+	w = 255 - frac[order[0]];
+	for (k = 0; k < dstn; k++)
+		acc[k] = w * v[k];
+	for (j = 0; j < srcn; j++)
+	{
+		v += lut->stride[order[j]];
+		w = frac[order[j]] - (j + 1 < srcn ? frac[order[j + 1]] : 0);
+		for (k = 0; k < dstn; k++)
+			acc[k] += w * v[k];
+	}
+	for (k = 0; k < dstn; k++)
+		d[k] = (acc[k] + 127) / 255;
+}
+
 /* For DeviceN and Separation CS, where we require an alternate tint tranform
  * prior to the application of an icc profile. Also, indexed images have to
  * be handled.  Realize those can map from index->devn->pdf-cal->icc for
@@ -2465,6 +2754,8 @@ icc_base_conv_pixmap(fz_context *ctx, fz_pixmap *dst, fz_pixmap *src, fz_colorsp
 	int stride_src = src->stride - src->w * sn;
 	int stride_base;
 	int bn, bc;
+	fz_color_lut *lut = NULL;
+	unsigned char lookup[FZ_MAX_COLORS * 256];
 
 	base = fz_new_pixmap_with_bbox(ctx, base_cs, fz_pixmap_bbox(ctx, src, &bbox), src->seps, src->alpha);
 	bn = base->n;
@@ -2474,6 +2765,34 @@ icc_base_conv_pixmap(fz_context *ctx, fz_pixmap *dst, fz_pixmap *src, fz_colorsp
 	inputpos = src->samples;
 	outputpos = base->samples;
 
+	/* The tint transforms are expensive; for all but small images use
+	 * a lookup table, which for separation and indexed colorspaces is
+	 * exact. */
+	if (src->w * src->h >= 256)
+	{
+		if (sc == 1)
+		{
+			for (i = 0; i < 256; i++)
+			{
+				src_f[0] = i / 255.0f;
+				convert_to_icc_base(ctx, srcs, src_f, des_f);
+				base_cs->clamp(base_cs, des_f, des_f);
+				for (j = 0; j < bc; j++)
+					lookup[i * bc + j] = des_f[j] * 255.0;
+			}
+		}
+		else if (sc == srcs->n && fz_color_lut_grid(sc) && bc == base_cs->n)
+		{
+			fz_try(ctx)
+				lut = fz_find_color_lut(ctx, srcs, base_cs, color_params, 1);
+			fz_catch(ctx)
+			{
+				fz_drop_pixmap(ctx, base);
+				fz_rethrow(ctx);
+			}
+		}
+	}
+
 	h = src->h;
 	while (h--)
 	{
@@ -2481,14 +2800,26 @@ icc_base_conv_pixmap(fz_context *ctx, fz_pixmap *dst, fz_pixmap *src, fz_colorsp
 		while (len--)
 		{
 			/* Convert the actual colors */
-			for (i = 0; i < sc; i++)
-				src_f[i] = (float) inputpos[i] / 255.0;
+			if (lut)
+				fz_eval_color_lut(lut, inputpos, outputpos);
+			else if (sc == 1 && src->w * src->h >= 256)
+			{
+				for (j = 0; j < bc; j++)
+					outputpos[j] = lookup[inputpos[0] * bc + j];
+			}
+			else
+			{
+				for (i = 0; i < sc; i++)
+					src_f[i] = (float) inputpos[i] / 255.0;
 
-			convert_to_icc_base(ctx, srcs, src_f, des_f);
-			base_cs->clamp(base_cs, des_f, des_f);
+				convert_to_icc_base(ctx, srcs, src_f, des_f);
+				base_cs->clamp(base_cs, des_f, des_f);
 
-			for (j = 0; j < bc; j++)
-				outputpos[j] = des_f[j] * 255.0;
+				for (j = 0; j < bc; j++)
+					outputpos[j] = des_f[j] * 255.0;
+			}
+			i = sc;
+			j = bc;
 			/* Copy spots and alphas unchanged */
 			for (; i < sn; i++, j++)
 				outputpos[j] = inputpos[i];
@@ -2500,6 +2831,9 @@ icc_base_conv_pixmap(fz_context *ctx, fz_pixmap *dst, fz_pixmap *src, fz_colorsp
 		inputpos += stride_src;
 	}
 
+	if (lut)
+		fz_drop_color_lut(ctx, lut);
+
 	fz_try(ctx)
 		icc_conv_pixmap(ctx, dst, base, prf, default_cs, color_params);
 	fz_always(ctx)
@@ -2547,8 +2881,31 @@ std_conv_pixmap(fz_context *ctx, fz_pixmap *dst, fz_pixmap *src, fz_colorspace *
 		h = 1;
 	}
 
+	/* Multi-dimensional lookup table for anything but small images */
+	if (w*h >= 256 && fz_color_lut_grid(srcn))
+	{
+		fz_color_lut *lut = fz_find_color_lut(ctx, ss, ds, color_params, 0);
+
+		while (h--)
+		{
+			size_t ww = w;
+			while (ww--)
+			{
+				fz_eval_color_lut(lut, s, d);
+				s += srcn;
+				d += dstn;
+				if (da)
+					*d++ = (sa ? *s : 255);
+				s += sa;
+			}
+			d += d_line_inc;
+			s += s_line_inc;
+		}
+		fz_drop_color_lut(ctx, lut);
+	}
+
 	/* Special case for Lab colorspace (scaling of components to float) */
-	if ((fz_colorspace_is_lab(ctx, ss) || fz_colorspace_is_lab_icc(ctx, ss)) && srcn == 3)
+	else if ((fz_colorspace_is_lab(ctx, ss) || fz_colorspace_is_lab_icc(ctx, ss)) && srcn == 3)
 	{
 		fz_color_converter cc;
 
@@ -100,6 +100,8 @@ static void fz_new_tuning_context(fz_context *ctx)
 		ctx->tuning->refs = 1;
 		ctx->tuning->image_decode = fz_default_image_decode;
 		ctx->tuning->image_scale = fz_default_image_scale;
+		ctx->tuning->parallel_min_rows = FZ_DEFAULT_PARALLEL_ROWS;
+		ctx->tuning->prefetch_budget = FZ_DEFAULT_PREFETCH_BUDGET;
 	}
 }
 
@@ -132,6 +134,93 @@ void fz_tune_image_scale(fz_context *ctx, fz_tune_image_scale_fn *image_scale, v
 	ctx->tuning->image_scale_arg = arg;
 }
 
+void fz_tune_parallel(fz_context *ctx, fz_parallel_fn *parallel, void *arg, int min_rows)
+{
+	ctx->tuning->parallel = parallel;
+	ctx->tuning->parallel_arg = arg;
+	ctx->tuning->parallel_min_rows = min_rows > 0 ? min_rows : FZ_DEFAULT_PARALLEL_ROWS;
+}
+
+void fz_tune_background(fz_context *ctx, fz_background_fn *background, void *arg)
+{
+	ctx->tuning->background = background;
+	ctx->tuning->background_arg = arg;
+}
+
+void fz_tune_prefetch(fz_context *ctx, int pages, size_t budget)
+{
+	ctx->tuning->prefetch_pages = pages > 0 ? pages : 0;
+	ctx->tuning->prefetch_budget = budget > 0 ? budget : FZ_DEFAULT_PREFETCH_BUDGET;
+}
+
+int fz_prefetch_pages(fz_context *ctx)
+{
+	return ctx->tuning->background ? ctx->tuning->prefetch_pages : 0;
+}
+
+typedef struct
+{
+	fz_parallel_rows_fn *fn;
+	void *arg;
+	int h;
+	int n;
+	fz_parallel_error error[FZ_MAX_PARALLEL_JOBS];
+} fz_parallel_rows_job;
+
+void fz_catch_parallel_error(fz_context *ctx, fz_parallel_error *err)
+{
+	err->code = fz_caught(ctx);
+	fz_strlcpy(err->message, fz_caught_message(ctx), sizeof err->message);
+}
+
+void fz_rethrow_parallel_errors(fz_context *ctx, fz_parallel_error *errs, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		if (errs[i].code)
+			fz_throw(ctx, errs[i].code, "%s", errs[i].message);
+}
+
+static void
+fz_run_parallel_rows(fz_context *ctx, void *arg, int i)
+{
+	fz_parallel_rows_job *job = arg;
+	int y0 = (int)((int64_t)job->h * i / job->n);
+	int y1 = (int)((int64_t)job->h * (i + 1) / job->n);
+
+	fz_try(ctx)
+		job->fn(ctx, job->arg, y0, y1);
+	fz_catch(ctx)
+		fz_catch_parallel_error(ctx, &job->error[i]);
+}
+
+void fz_parallel_rows(fz_context *ctx, int h, fz_parallel_rows_fn *fn, void *arg)
+{
+	fz_tuning_context *tuning = ctx->tuning;
+	fz_parallel_rows_job job;
+	int i;
+
+	job.n = h / tuning->parallel_min_rows;
+	if (!tuning->parallel || job.n < 2)
+	{
+		fn(ctx, arg, 0, h);
+		return;
+	}
+	if (job.n > FZ_MAX_PARALLEL_JOBS)
+		job.n = FZ_MAX_PARALLEL_JOBS;
+
+	job.fn = fn;
+	job.arg = arg;
+	job.h = h;
+	for (i = 0; i < job.n; i++)
+		job.error[i].code = 0;
+
+	tuning->parallel(tuning->parallel_arg, ctx, job.n, fz_run_parallel_rows, &job);
+
+	fz_rethrow_parallel_errors(ctx, job.error, job.n);
+}
+
 void
 fz_drop_context(fz_context *ctx)
 {
@@ -0,0 +1,411 @@
+#include "mupdf/fitz.h"
+#include "draw-imp.h"
+
+#include <string.h>
+#include <math.h>
+
+/*
+ * Exact area coverage rasterizer.
+ *
+ * Rather than sampling coverage on a grid of subpixels, each edge adds
+ * the signed area it covers to an accumulation buffer, and a running
+ * sum along each row turns that into the exact coverage of each pixel.
+ * This needs no sorting of edges and no active edge list; each edge is
+ * simply visited once per band of rows that it crosses.
+ *
+ * See Raph Levien, "Inside the fastest font renderer in the world".
+ */
+
+#define AREA_BAND 16
+
+typedef struct fz_area_edge_s
+{
+	float x0, y0, x1, y1;
+	float dir;
+} fz_area_edge;
+
+typedef struct fz_area_rasterizer_s
+{
+	fz_rasterizer super;
+	int len, cap;
+	fz_area_edge *edges;
+	int acc_cap;
+	float *acc;
+	unsigned char *alphas;
+} fz_area_rasterizer;
+
+static int
+fz_reset_area(fz_context *ctx, fz_rasterizer *ras)
+{
+	fz_area_rasterizer *ar = (fz_area_rasterizer *)ras;
+
+	ar->len = 0;
+
+	return 0;
+}
+
+static void
+fz_drop_area(fz_context *ctx, fz_rasterizer *ras)
+{
+	fz_area_rasterizer *ar = (fz_area_rasterizer *)ras;
+	if (ar == NULL)
+		return;
+	fz_free(ctx, ar->edges);
+	fz_free(ctx, ar->acc);
+	fz_free(ctx, ar->alphas);
+	fz_free(ctx, ar);
+}
+
+static void
+fz_insert_area_raw(fz_context *ctx, fz_area_rasterizer *ar, float x0, float y0, float x1, float y1)
+{
+	const int hscale = fz_rasterizer_aa_hscale(&ar->super);
+	const int vscale = fz_rasterizer_aa_vscale(&ar->super);
+	fz_area_edge *edge;
+	int v;
+
+	if (y0 == y1)
+		return;
+
+	if (ar->len == ar->cap)
+	{
+		int new_cap = ar->cap * 2;
+		ar->edges = fz_resize_array(ctx, ar->edges, new_cap, sizeof(fz_area_edge));
+		ar->cap = new_cap;
+	}
+
+	edge = &ar->edges[ar->len++];
+	if (y0 < y1)
+	{
+		edge->x0 = x0; edge->y0 = y0;
+		edge->x1 = x1; edge->y1 = y1;
+		edge->dir = 1;
+	}
+	else
+	{
+		edge->x0 = x1; edge->y0 = y1;
+		edge->x1 = x0; edge->y1 = y0;
+		edge->dir = -1;
+	}
+
+	/* The bbox is kept in subpixel units, like the other rasterizers. */
+	v = (int)floorf(fz_min(x0, x1)) * hscale;
+	if (v < ar->super.bbox.x0) ar->super.bbox.x0 = v;
+	v = (int)ceilf(fz_max(x0, x1)) * hscale;
+	if (v > ar->super.bbox.x1) ar->super.bbox.x1 = v;
+	v = (int)floorf(edge->y0) * vscale;
+	if (v < ar->super.bbox.y0) ar->super.bbox.y0 = v;
+	v = (int)ceilf(edge->y1) * vscale;
+	if (v > ar->super.bbox.y1) ar->super.bbox.y1 = v;
+}
+
+static void
+fz_insert_area(fz_context *ctx, fz_rasterizer *ras, float x0, float y0, float x1, float y1, int rev)
+{
+	fz_area_rasterizer *ar = (fz_area_rasterizer *)ras;
+	const int hscale = fz_rasterizer_aa_hscale(ras);
+	const int vscale = fz_rasterizer_aa_vscale(ras);
+	float cx0 = (float)ras->clip.x0 / hscale;
+	float cx1 = (float)ras->clip.x1 / hscale;
+	float cy0 = (float)ras->clip.y0 / vscale;
+	float cy1 = (float)ras->clip.y1 / vscale;
+	float t[4], px, py;
+	int i, n;
+
+	/* Keep well away from float precision trouble. */
+	x0 = fz_clamp(x0, BBOX_MIN, BBOX_MAX);
+	y0 = fz_clamp(y0, BBOX_MIN, BBOX_MAX);
+	x1 = fz_clamp(x1, BBOX_MIN, BBOX_MAX);
+	y1 = fz_clamp(y1, BBOX_MIN, BBOX_MAX);
+
+	/* Drop the parts above and below the clip. */
+	if (y0 == y1 || (y0 <= cy0 && y1 <= cy0) || (y0 >= cy1 && y1 >= cy1))
+		return;
+	if (y0 < cy0 || y1 < cy0)
+	{
+		float x = x0 + (x1 - x0) * (cy0 - y0) / (y1 - y0);
+		if (y0 < cy0) { x0 = x; y0 = cy0; }
+		else { x1 = x; y1 = cy0; }
+	}
+	if (y0 > cy1 || y1 > cy1)
+	{
+		float x = x0 + (x1 - x0) * (cy1 - y0) / (y1 - y0);
+		if (y0 > cy1) { x0 = x; y0 = cy1; }
+		else { x1 = x; y1 = cy1; }
+	}
+
+	/* Parts to the left or right of the clip still affect the coverage
+	 * inside it; project them onto the clip edges. Split the edge where
+	 * it crosses the clip edges so that each piece can be clamped. */
+	n = 0;
+	t[n++] = 0;
+	if ((x0 < cx0) != (x1 < cx0))
+		t[n++] = (cx0 - x0) / (x1 - x0);
+	if ((x0 > cx1) != (x1 > cx1))
+		t[n++] = (cx1 - x0) / (x1 - x0);
+	if (n == 3 && t[2] < t[1])
+	{
+		float tmp = t[1]; t[1] = t[2]; t[2] = tmp;
+	}
+	t[n++] = 1;
+
+	px = fz_clamp(x0, cx0, cx1);
+	py = y0;
+	for (i = 1; i < n; i++)
+	{
+		float qx, qy;
+		if (i == n - 1)
+		{
+			qx = x1;
+			qy = y1;
+		}
+		else
+		{
+			qx = x0 + (x1 - x0) * t[i];
+			qy = y0 + (y1 - y0) * t[i];
+		}
+		qx = fz_clamp(qx, cx0, cx1);
+		fz_insert_area_raw(ctx, ar, px, py, qx, qy);
+		px = qx;
+		py = qy;
+	}
+}
+
+static int
+fz_is_rect_area(fz_context *ctx, fz_rasterizer *ras)
+{
+	fz_area_rasterizer *ar = (fz_area_rasterizer *)ras;
+
+	/* Only pixel aligned rectangles can be treated as plain clips. */
+	if (ar->len == 2)
+	{
+		fz_area_edge *a = &ar->edges[0];
+		fz_area_edge *b = &ar->edges[1];
+		return a->x0 == a->x1 && b->x0 == b->x1 &&
+			a->y0 == b->y0 && a->y1 == b->y1 &&
+			a->x0 == floorf(a->x0) && b->x0 == floorf(b->x0) &&
+			a->y0 == floorf(a->y0) && a->y1 == floorf(a->y1);
+	}
+	return 0;
+}
+
+/* Add the area covered by one edge within a band of rows to the
+ * accumulation buffer. x and y are relative to the band origin, and
+ * the band is w pixels wide with a stride of w+2. */
+static void
+fz_accumulate_edge(float *acc, int w, int rows, const fz_area_edge *e, float ox, float oy, int *rowmin, int *rowmax)
+{
+	const int stride = w + 2;
+	float y0 = e->y0 - oy;
+	float y1 = e->y1 - oy;
+	float dxdy, x;
+	int y, yend;
+
+	if (y1 <= 0 || y0 >= rows)
+		return;
+
+	dxdy = (e->x1 - e->x0) / (e->y1 - e->y0);
+	x = e->x0 - ox;
+	if (y0 < 0)
+	{
+		x -= y0 * dxdy;
+		y0 = 0;
+	}
+	if (y1 > rows)
+		y1 = rows;
+
+	yend = (int)ceilf(y1);
+	for (y = (int)y0; y < yend; y++)
+	{
+		float *a = acc + y * stride;
+		float dy = fz_min(y + 1, y1) - fz_max(y, y0);
+		float xnext = x + dxdy * dy;
+		float d = dy * e->dir;
+		float xa = fz_clamp(x, 0, w);
+		float xb = fz_clamp(xnext, 0, w);
+		float lo = fz_min(xa, xb);
+		float hi = fz_max(xa, xb);
+		float lofloor = floorf(lo);
+		float hiceil = ceilf(hi);
+		int loi = (int)lofloor;
+		int hii = (int)hiceil;
+
+		if (hii <= loi + 1)
+		{
+			/* Within a single pixel. */
+			float xmf = 0.5f * (xa + xb) - lofloor;
+			a[loi] += d - d * xmf;
+			a[loi + 1] += d * xmf;
+			hii = loi + 1;
+		}
+		else
+		{
+			float s = 1 / (hi - lo);
+			float lof = lo - lofloor;
+			float a0 = 0.5f * s * (1 - lof) * (1 - lof);
+			float hif = hi - hiceil + 1;
+			float am = 0.5f * s * hif * hif;
+			a[loi] += d * a0;
+			if (hii == loi + 2)
+				a[loi + 1] += d * (1 - a0 - am);
+			else
+			{
+				float a1 = s * (1.5f - lof);
+				float a2 = a1 + (hii - loi - 3) * s;
+				int xi;
+				a[loi + 1] += d * (a1 - a0);
+				for (xi = loi + 2; xi < hii - 1; xi++)
+					a[xi] += d * s;
+				a[hii - 1] += d * (1 - a2 - am);
+			}
+			a[hii] += d * am;
+		}
+
+		if (loi < rowmin[y])
+			rowmin[y] = loi;
+		if (hii > rowmax[y])
+			rowmax[y] = hii;
+
+		x = xnext;
+	}
+}
+
+static inline unsigned char
+fz_area_coverage(float s, int eofill)
+{
+	s = fabsf(s);
+	if (eofill)
+	{
+		s -= 2 * floorf(s * 0.5f);
+		if (s > 1)
+			s = 2 - s;
+	}
+	else if (s > 1)
+		s = 1;
+	return (unsigned char)(s * 255 + 0.5f);
+}
+
+static inline void
+blit_area(fz_pixmap *dst, int x, int y, unsigned char *mp, int w, unsigned char *color, void *fn)
+{
+	unsigned char *dp;
+	dp = dst->samples + (unsigned int)((y - dst->y) * dst->stride + (x - dst->x) * dst->n);
+	if (color)
+		(*(fz_span_color_painter_t *)fn)(dp, mp, dst->n, w, color, dst->alpha);
+	else
+		(*(fz_span_painter_t *)fn)(dp, dst->alpha, mp, 1, 0, w, 255);
+}
+
+static void
+fz_convert_area(fz_context *ctx, fz_rasterizer *ras, int eofill, const fz_irect *clip, fz_pixmap *dst, unsigned char *color)
+{
+	fz_area_rasterizer *ar = (fz_area_rasterizer *)ras;
+	int rowmin[AREA_BAND], rowmax[AREA_BAND];
+	int w = clip->x1 - clip->x0;
+	int stride = w + 2;
+	int y, r, i;
+	void *fn;
+
+	if (ar->len == 0)
+		return;
+
+	if (color)
+		fn = (void *)fz_get_span_color_painter(dst->n, dst->alpha, color);
+	else
+		fn = (void *)fz_get_span_painter(dst->alpha, 1, 0, 255);
+	if (fn == NULL)
+		return;
+
+	if (ar->acc_cap < stride * AREA_BAND)
+	{
+		fz_free(ctx, ar->acc);
+		ar->acc = NULL;
+		fz_free(ctx, ar->alphas);
+		ar->alphas = NULL;
+		ar->acc_cap = 0;
+		ar->acc = fz_malloc_array(ctx, stride * AREA_BAND, sizeof(float));
+		ar->alphas = fz_malloc(ctx, stride);
+		ar->acc_cap = stride * AREA_BAND;
+		/* Rows are cleared again as they are painted. */
+		memset(ar->acc, 0, stride * AREA_BAND * sizeof(float));
+	}
+
+	for (r = 0; r < AREA_BAND; r++)
+	{
+		rowmin[r] = stride;
+		rowmax[r] = -1;
+	}
+
+	for (y = clip->y0; y < clip->y1; y += AREA_BAND)
+	{
+		int rows = fz_mini(AREA_BAND, clip->y1 - y);
+
+		for (i = 0; i < ar->len; i++)
+			fz_accumulate_edge(ar->acc, w, rows, &ar->edges[i], clip->x0, y, rowmin, rowmax);
+
+		for (r = 0; r < rows; r++)
+		{
+			float *a = ar->acc + r * stride;
+			int x0 = rowmin[r];
+			int x1 = rowmax[r];
+			unsigned char v = 0;
+			float s = 0;
+			int x;
+
+			if (x1 < x0)
+				continue;
+
+			/* Past the last touched entry the sum no longer changes,
+			 * so stop as soon as it gives no coverage. */
+			for (x = x0; x < w; x++)
+			{
+				if (x > x1 && v == 0)
+					break;
+				s += a[x];
+				a[x] = 0;
+				ar->alphas[x] = v = fz_area_coverage(s, eofill);
+			}
+			if (x > x0)
+				blit_area(dst, clip->x0 + x0, y + r, ar->alphas + x0, x - x0, color, fn);
+			for (; x <= x1; x++)
+				a[x] = 0;
+
+			rowmin[r] = stride;
+			rowmax[r] = -1;
+		}
+	}
+}
+
+static const fz_rasterizer_fns area_rasterizer =
+{
+	fz_drop_area,
+	fz_reset_area,
+	NULL, /* postindex */
+	fz_insert_area,
+	NULL, /* rect; coverage is exact, so no antidropout is needed */
+	NULL, /* gap */
+	fz_convert_area,
+	fz_is_rect_area,
+	1 /* Reusable */
+};
+
+fz_rasterizer *
+fz_new_area_rasterizer(fz_context *ctx)
+{
+	fz_area_rasterizer *ar;
+
+	ar = fz_new_derived_rasterizer(ctx, fz_area_rasterizer, &area_rasterizer);
+	fz_try(ctx)
+	{
+		ar->cap = 512;
+		ar->len = 0;
+		ar->edges = fz_malloc_array(ctx, ar->cap, sizeof(fz_area_edge));
+	}
+	fz_catch(ctx)
+	{
+		fz_free(ctx, ar);
+		fz_rethrow(ctx);
+	}
+
+	return &ar->super;
+}
@@ -8,6 +8,9 @@
 
 #define STACK_SIZE 96
 
+/* Number of released clip/mask/group sample buffers kept for reuse. */
+#define SCRATCH_POOL_SIZE 8
+
 /* Enable the following to attempt to support knockout and/or isolated
  * blending groups. */
 #define ATTEMPT_KNOCKOUT_AND_ISOLATED
@@ -49,6 +52,11 @@ struct fz_draw_device_s
 	int top;
 	fz_scale_cache *cache_x;
 	fz_scale_cache *cache_y;
+	int scratch_len;
+	struct {
+		unsigned char *samples;
+		size_t size;
+	} scratch[SCRATCH_POOL_SIZE];
 	fz_draw_state *stack;
 	int stack_cap;
 	fz_draw_state init_stack[STACK_SIZE];
@@ -174,6 +182,92 @@ static void fz_grow_stack(fz_context *ctx, fz_draw_device *dev)
 	dev->stack_cap = max;
 }
 
+/*
+	Clip, mask, group and knockout buffers come and go in strict stack
+	order, often many times per page and with similar sizes. Rather than
+	returning their samples to the allocator each time, keep a few of
+	the released sample buffers and hand them out again for buffers of
+	a similar size.
+
+	Pixmaps handed out here own their samples as usual, so one that
+	outlives the device (for instance because it was stored as a tile)
+	cleans up after itself.
+*/
+static fz_pixmap *
+fz_new_scratch_pixmap(fz_context *ctx, fz_draw_device *dev, fz_colorspace *cs, const fz_irect *bbox, fz_separations *seps, int alpha)
+{
+	fz_pixmap *pix;
+	unsigned char *samples;
+	size_t size;
+	int s = fz_count_active_separations(ctx, seps);
+	int i, best = -1;
+
+	if (!cs && s == 0)
+		alpha = 1;
+	size = (size_t)(bbox->x1 - bbox->x0) * (bbox->y1 - bbox->y0) * (fz_colorspace_n(ctx, cs) + s + alpha);
+
+	/* Don't waste more than half of a recycled buffer. */
+	for (i = 0; i < dev->scratch_len; i++)
+		if (dev->scratch[i].size >= size && dev->scratch[i].size / 2 <= size)
+			if (best < 0 || dev->scratch[i].size < dev->scratch[best].size)
+				best = i;
+
+	if (size == 0 || best < 0)
+		return fz_new_pixmap_with_bbox(ctx, cs, bbox, seps, alpha);
+
+	samples = dev->scratch[best].samples;
+	dev->scratch[best] = dev->scratch[--dev->scratch_len];
+
+	fz_try(ctx)
+		pix = fz_new_pixmap_with_bbox_and_data(ctx, cs, bbox, seps, alpha, samples);
+	fz_catch(ctx)
+	{
+		fz_free(ctx, samples);
+		fz_rethrow(ctx);
+	}
+	pix->flags |= FZ_PIXMAP_FLAG_FREE_SAMPLES;
+
+	return pix;
+}
+
+static void
+fz_drop_scratch_pixmap(fz_context *ctx, fz_draw_device *dev, fz_pixmap *pix)
+{
+	/* Only take the samples back if nobody else holds the pixmap. */
+	if (pix && pix->storable.refs == 1 && (pix->flags & FZ_PIXMAP_FLAG_FREE_SAMPLES) && pix->stride > 0)
+	{
+		size_t size = (size_t)pix->stride * pix->h;
+		int i = dev->scratch_len;
+
+		/* When the pool is full, give up the smallest buffer if it is
+		 * smaller than this one. */
+		if (i == SCRATCH_POOL_SIZE)
+		{
+			int k;
+			for (i = 0, k = 1; k < SCRATCH_POOL_SIZE; k++)
+				if (dev->scratch[k].size < dev->scratch[i].size)
+					i = k;
+			if (dev->scratch[i].size < size)
+				fz_free(ctx, dev->scratch[i].samples);
+			else
+				i = -1;
+		}
+		else if (size > 0)
+			dev->scratch_len++;
+		else
+			i = -1;
+
+		if (i >= 0)
+		{
+			dev->scratch[i].samples = pix->samples;
+			dev->scratch[i].size = size;
+			pix->samples = NULL;
+			pix->flags &= ~FZ_PIXMAP_FLAG_FREE_SAMPLES;
+		}
+	}
+	fz_drop_pixmap(ctx, pix);
+}
+
 /* 'Push' the stack. Returns a pointer to the current state, with state[1]
  * already having been initialised to contain the same thing. Simply
  * change any contents of state[1] that you want to and continue. */
@@ -193,11 +287,11 @@ push_stack(fz_context *ctx, fz_draw_device *dev)
 static void emergency_pop_stack(fz_context *ctx, fz_draw_device *dev, fz_draw_state *state)
 {
 	if (state[1].mask != state[0].mask)
-		fz_drop_pixmap(ctx, state[1].mask);
+		fz_drop_scratch_pixmap(ctx, dev, state[1].mask);
 	if (state[1].dest != state[0].dest)
-		fz_drop_pixmap(ctx, state[1].dest);
+		fz_drop_scratch_pixmap(ctx, dev, state[1].dest);
 	if (state[1].shape != state[0].shape)
-		fz_drop_pixmap(ctx, state[1].shape);
+		fz_drop_scratch_pixmap(ctx, dev, state[1].shape);
 	dev->top--;
 	STACK_POPPED("emergency");
 	fz_rethrow(ctx);
@@ -219,7 +313,7 @@ fz_knockout_begin(fz_context *ctx, fz_draw_device *dev)
 
 	fz_pixmap_bbox(ctx, state->dest, &bbox);
 	fz_intersect_irect(&bbox, &state->scissor);
-	dest = fz_new_pixmap_with_bbox(ctx, state->dest->colorspace, &bbox, state->dest->seps, state->dest->alpha || isolated);
+	dest = fz_new_scratch_pixmap(ctx, dev, state->dest->colorspace, &bbox, state->dest->seps, state->dest->alpha || isolated);
 
 	if (isolated)
 	{
@@ -250,7 +344,7 @@ fz_knockout_begin(fz_context *ctx, fz_draw_device *dev)
 	}
 	else
 	{
-		shape = fz_new_pixmap_with_bbox(ctx, NULL, &bbox, NULL, 1);
+		shape = fz_new_scratch_pixmap(ctx, dev, NULL, &bbox, NULL, 1);
 		fz_clear_pixmap(ctx, shape);
 	}
 #ifdef DUMP_GROUP_BLENDS
@@ -306,12 +400,12 @@ static void fz_knockout_end(fz_context *ctx, fz_draw_device *dev)
 	 * errors can cause the stack to get out of sync, and this saves our
 	 * bacon. */
 	if (state[0].dest != state[1].dest)
-		fz_drop_pixmap(ctx, state[1].dest);
+		fz_drop_scratch_pixmap(ctx, dev, state[1].dest);
 	if (state[0].shape != state[1].shape)
 	{
 		if (state[0].shape)
 			fz_paint_pixmap(state[0].shape, state[1].shape, 255);
-		fz_drop_pixmap(ctx, state[1].shape);
+		fz_drop_scratch_pixmap(ctx, dev, state[1].shape);
 	}
 #ifdef DUMP_GROUP_BLENDS
 	fz_dump_blend(ctx, " to get ", state[0].dest);
@@ -510,13 +604,13 @@ fz_draw_clip_path(fz_context *ctx, fz_device *devp, const fz_path *path, int eve
 
 	fz_try(ctx)
 	{
-		state[1].mask = fz_new_pixmap_with_bbox(ctx, NULL, &bbox, NULL, 1);
+		state[1].mask = fz_new_scratch_pixmap(ctx, dev, NULL, &bbox, NULL, 1);
 		fz_clear_pixmap(ctx, state[1].mask);
-		state[1].dest = fz_new_pixmap_with_bbox(ctx, model, &bbox, state[0].dest->seps, state[0].dest->alpha);
+		state[1].dest = fz_new_scratch_pixmap(ctx, dev, model, &bbox, state[0].dest->seps, state[0].dest->alpha);
 		fz_copy_pixmap_rect(ctx, state[1].dest, state[0].dest, &bbox, dev->default_cs);
 		if (state[1].shape)
 		{
-			state[1].shape = fz_new_pixmap_with_bbox(ctx, NULL, &bbox, NULL, 1);
+			state[1].shape = fz_new_scratch_pixmap(ctx, dev, NULL, &bbox, NULL, 1);
 			fz_clear_pixmap(ctx, state[1].shape);
 		}
 
@@ -582,20 +676,20 @@ fz_draw_clip_stroke_path(fz_context *ctx, fz_device *devp, const fz_path *path,
 
 	fz_try(ctx)
 	{
-		state[1].mask = fz_new_pixmap_with_bbox(ctx, NULL, &bbox, NULL, 1);
+		state[1].mask = fz_new_scratch_pixmap(ctx, dev, NULL, &bbox, NULL, 1);
 		fz_clear_pixmap(ctx, state[1].mask);
 		/* When there is no alpha in the current destination (state[0].dest->alpha == 0)
 		 * we have a choice. We can either create the new destination WITH alpha, or
 		 * we can copy the old pixmap contents in. We opt for the latter here, but
 		 * may want to revisit this decision in the future. */
-		state[1].dest = fz_new_pixmap_with_bbox(ctx, model, &bbox, state[0].dest->seps, state[0].dest->alpha);
+		state[1].dest = fz_new_scratch_pixmap(ctx, dev, model, &bbox, state[0].dest->seps, state[0].dest->alpha);
 		if (state[0].dest->alpha)
 			fz_clear_pixmap(ctx, state[1].dest);
 		else
 			fz_copy_pixmap_rect(ctx, state[1].dest, state[0].dest, &bbox, dev->default_cs);
 		if (state->shape)
 		{
-			state[1].shape = fz_new_pixmap_with_bbox(ctx, NULL, &bbox, NULL, 1);
+			state[1].shape = fz_new_scratch_pixmap(ctx, dev, NULL, &bbox, NULL, 1);
 			fz_clear_pixmap(ctx, state[1].shape);
 		}
 
@@ -902,20 +996,20 @@ fz_draw_clip_text(fz_context *ctx, fz_device *devp, const fz_text *text, const f
 
 	fz_try(ctx)
 	{
-		mask = fz_new_pixmap_with_bbox(ctx, NULL, &bbox, NULL, 1);
+		mask = fz_new_scratch_pixmap(ctx, dev, NULL, &bbox, NULL, 1);
 		fz_clear_pixmap(ctx, mask);
 		/* When there is no alpha in the current destination (state[0].dest->alpha == 0)
 		 * we have a choice. We can either create the new destination WITH alpha, or
 		 * we can copy the old pixmap contents in. We opt for the latter here, but
 		 * may want to revisit this decision in the future. */
-		dest = fz_new_pixmap_with_bbox(ctx, model, &bbox, state[0].dest->seps, state[0].dest->alpha);
+		dest = fz_new_scratch_pixmap(ctx, dev, model, &bbox, state[0].dest->seps, state[0].dest->alpha);
 		if (state[0].dest->alpha)
 			fz_clear_pixmap(ctx, dest);
 		else
 			fz_copy_pixmap_rect(ctx, dest, state[0].dest, &bbox, dev->default_cs);
 		if (state->shape)
 		{
-			shape = fz_new_pixmap_with_bbox(ctx, NULL, &bbox, NULL, 1);
+			shape = fz_new_scratch_pixmap(ctx, dev, NULL, &bbox, NULL, 1);
 			fz_clear_pixmap(ctx, shape);
 		}
 		else
@@ -1028,20 +1122,20 @@ fz_draw_clip_stroke_text(fz_context *ctx, fz_device *devp, const fz_text *text,
 
 	fz_try(ctx)
 	{
-		state[1].mask = mask = fz_new_pixmap_with_bbox(ctx, NULL, &bbox, NULL, 1);
+		state[1].mask = mask = fz_new_scratch_pixmap(ctx, dev, NULL, &bbox, NULL, 1);
 		fz_clear_pixmap(ctx, mask);
 		/* When there is no alpha in the current destination (state[0].dest->alpha == 0)
 		 * we have a choice. We can either create the new destination WITH alpha, or
 		 * we can copy the old pixmap contents in. We opt for the latter here, but
 		 * may want to revisit this decision in the future. */
-		state[1].dest = dest = fz_new_pixmap_with_bbox(ctx, model, &bbox, state[0].dest->seps, state[0].dest->alpha);
+		state[1].dest = dest = fz_new_scratch_pixmap(ctx, dev, model, &bbox, state[0].dest->seps, state[0].dest->alpha);
 		if (state[0].dest->alpha)
 			fz_clear_pixmap(ctx, state[1].dest);
 		else
 			fz_copy_pixmap_rect(ctx, state[1].dest, state[0].dest, &bbox, dev->default_cs);
 		if (state->shape)
 		{
-			state[1].shape = shape = fz_new_pixmap_with_bbox(ctx, NULL, &bbox, NULL, 1);
+			state[1].shape = shape = fz_new_scratch_pixmap(ctx, dev, NULL, &bbox, NULL, 1);
 			fz_clear_pixmap(ctx, shape);
 		}
 		else
@@ -1158,14 +1252,14 @@ fz_draw_fill_shade(fz_context *ctx, fz_device *devp, fz_shade *shade, const fz_m
 
 	if (alpha < 1)
 	{
-		dest = fz_new_pixmap_with_bbox(ctx, state->dest->colorspace, &bbox, state->dest->seps, state->dest->alpha);
+		dest = fz_new_scratch_pixmap(ctx, dev, state->dest->colorspace, &bbox, state->dest->seps, state->dest->alpha);
 		if (state->dest->alpha)
 			fz_clear_pixmap(ctx, dest);
 		else
 			fz_copy_pixmap_rect(ctx, dest, state[0].dest, &bbox, dev->default_cs);
 		if (shape)
 		{
-			shape = fz_new_pixmap_with_bbox(ctx, NULL, &bbox, NULL, 1);
+			shape = fz_new_scratch_pixmap(ctx, dev, NULL, &bbox, NULL, 1);
 			fz_clear_pixmap(ctx, shape);
 		}
 	}
@@ -1223,11 +1317,11 @@ fz_draw_fill_shade(fz_context *ctx, fz_device *devp, fz_shade *shade, const fz_m
 	if (alpha < 1)
 	{
 		fz_paint_pixmap(state->dest, dest, alpha * 255);
-		fz_drop_pixmap(ctx, dest);
+		fz_drop_scratch_pixmap(ctx, dev, dest);
 		if (shape)
 		{
 			fz_paint_pixmap(state->shape, shape, alpha * 255);
-			fz_drop_pixmap(ctx, shape);
+			fz_drop_scratch_pixmap(ctx, dev, shape);
 		}
 	}
 
@@ -1299,6 +1393,196 @@ fz_default_image_scale(void *arg, int dst_w, int dst_h, int src_w, int src_h)
 	return dst_w < src_w && dst_h < src_h;
 }
 
+/*
+	Images are cached in the store in their final form: converted to
+	the destination colorspace and scaled for the destination. The key
+	covers everything that the result depends on. Translations are
+	factored out into the integer offset of the transform so that the
+	same image drawn at the same size in another place (a repeated logo,
+	or a page redrawn after scrolling) is found too.
+*/
+typedef struct
+{
+	int refs;
+	fz_image *image;
+	fz_colorspace *model;
+	fz_colorspace *prf;
+	fz_default_colorspaces *default_cs;
+	unsigned char digest[16];
+} image_key;
+
+typedef struct
+{
+	fz_storable storable;
+	fz_pixmap *pixmap;
+	fz_matrix ctm;
+} image_record;
+
+static int
+fz_make_hash_image_record_key(fz_context *ctx, fz_store_hash *hash, void *key_)
+{
+	image_key *key = key_;
+	hash->u.pim.ptr = key->image;
+	hash->u.pim.i = 0;
+	memcpy(hash->u.pim.md5, key->digest, 16);
+	return 1;
+}
+
+static void *
+fz_keep_image_record_key(fz_context *ctx, void *key_)
+{
+	image_key *key = key_;
+	return fz_keep_imp(ctx, key, &key->refs);
+}
+
+static void
+fz_drop_image_record_key(fz_context *ctx, void *key_)
+{
+	image_key *key = key_;
+	if (fz_drop_imp(ctx, key, &key->refs))
+	{
+		fz_drop_image_store_key(ctx, key->image);
+		fz_drop_colorspace(ctx, key->model);
+		fz_drop_colorspace(ctx, key->prf);
+		fz_drop_default_colorspaces(ctx, key->default_cs);
+		fz_free(ctx, key);
+	}
+}
+
+static int
+fz_cmp_image_record_key(fz_context *ctx, void *k0_, void *k1_)
+{
+	image_key *k0 = k0_;
+	image_key *k1 = k1_;
+	return k0->image != k1->image || memcmp(k0->digest, k1->digest, 16);
+}
+
+static void
+fz_format_image_record_key(fz_context *ctx, char *s, int n, void *key_)
+{
+	image_key *key = (image_key *)key_;
+	fz_snprintf(s, n, "(drawn image %d x %d)", key->image->w, key->image->h);
+}
+
+static int
+fz_needs_reap_image_record_key(fz_context *ctx, void *key_)
+{
+	image_key *key = (image_key *)key_;
+	return fz_key_storable_needs_reaping(ctx, &key->image->key_storable);
+}
+
+static const fz_store_type fz_image_record_store_type =
+{
+	fz_make_hash_image_record_key,
+	fz_keep_image_record_key,
+	fz_drop_image_record_key,
+	fz_cmp_image_record_key,
+	fz_format_image_record_key,
+	fz_needs_reap_image_record_key
+};
+
+static void
+fz_drop_image_record_imp(fz_context *ctx, fz_storable *storable)
+{
+	image_record *ir = (image_record *)storable;
+	fz_drop_pixmap(ctx, ir->pixmap);
+	fz_free(ctx, ir);
+}
+
+static void
+fz_drop_image_record(fz_context *ctx, image_record *ir)
+{
+	fz_drop_storable(ctx, &ir->storable);
+}
+
+static void
+fz_make_image_key(fz_context *ctx, image_key *key, fz_image *image, fz_colorspace *model, fz_colorspace *prf,
+	fz_default_colorspaces *default_cs, const fz_color_params *color_params, const fz_matrix *ctm,
+	const fz_irect *clip, int ix, int iy, int flags)
+{
+	struct
+	{
+		float ctm[6];
+		fz_irect clip;
+		fz_color_params color_params;
+		int flags;
+		void *model, *prf, *default_cs;
+	} params;
+	fz_md5 md5;
+
+	memset(&params, 0, sizeof params);
+	params.ctm[0] = ctm->a;
+	params.ctm[1] = ctm->b;
+	params.ctm[2] = ctm->c;
+	params.ctm[3] = ctm->d;
+	params.ctm[4] = ctm->e - ix;
+	params.ctm[5] = ctm->f - iy;
+	params.clip.x0 = clip->x0 - ix;
+	params.clip.y0 = clip->y0 - iy;
+	params.clip.x1 = clip->x1 - ix;
+	params.clip.y1 = clip->y1 - iy;
+	params.color_params = *(color_params ? color_params : fz_default_color_params(ctx));
+	params.flags = flags;
+	params.model = model;
+	params.prf = prf;
+	params.default_cs = default_cs;
+
+	fz_md5_init(&md5);
+	fz_md5_update(&md5, (unsigned char *)&params, sizeof params);
+	fz_md5_final(&md5, key->digest);
+
+	key->refs = 1;
+	key->image = image;
+	key->model = model;
+	key->prf = prf;
+	key->default_cs = default_cs;
+}
+
+static void
+fz_store_image_record(fz_context *ctx, image_key *key, fz_pixmap *pixmap, const fz_matrix *ctm, int ix, int iy)
+{
+	image_key *keyp = NULL;
+	image_record *ir = NULL;
+
+	fz_var(keyp);
+	fz_var(ir);
+
+	/* Any failure here will just result in us not caching. */
+	fz_try(ctx)
+	{
+		image_record *existing;
+
+		ir = fz_malloc_struct(ctx, image_record);
+		FZ_INIT_STORABLE(ir, 1, fz_drop_image_record_imp);
+		ir->pixmap = fz_keep_pixmap(ctx, pixmap);
+		ir->ctm = *ctm;
+		ir->ctm.e -= ix;
+		ir->ctm.f -= iy;
+
+		keyp = fz_malloc_struct(ctx, image_key);
+		*keyp = *key;
+		keyp->image = fz_keep_image_store_key(ctx, key->image);
+		keyp->model = fz_keep_colorspace(ctx, key->model);
+		keyp->prf = fz_keep_colorspace(ctx, key->prf);
+		keyp->default_cs = fz_keep_default_colorspaces(ctx, key->default_cs);
+
+		existing = fz_store_item(ctx, keyp, ir, fz_pixmap_size(ctx, pixmap), &fz_image_record_store_type);
+		if (existing)
+			fz_drop_image_record(ctx, existing);
+	}
+	fz_always(ctx)
+	{
+		if (keyp)
+			fz_drop_image_record_key(ctx, keyp);
+		if (ir)
+			fz_drop_image_record(ctx, ir);
+	}
+	fz_catch(ctx)
+	{
+		/* Do nothing */
+	}
+}
+
 static void
 fz_draw_fill_image(fz_context *ctx, fz_device *devp, fz_image *image, const fz_matrix *in_ctm, float alpha, const fz_color_params *color_params)
 {
@@ -1314,12 +1598,30 @@ fz_draw_fill_image(fz_context *ctx, fz_device *devp, fz_image *image, const fz_m
 	fz_irect src_area;
 	fz_colorspace *src_cs;
 	fz_colorspace *prf = fz_proof_cs(ctx, devp);
+	image_key key;
+	image_record *ir = NULL;
+	fz_pixmap *decoded;
+	int cacheable, ix, iy;
 
 	fz_intersect_irect(fz_pixmap_bbox(ctx, state->dest, &clip), &state->scissor);
 
 	if (image->w == 0 || image->h == 0)
 		return;
 
+	/* Nothing outside the area that the image covers matters; trimming
+	 * the clip to it also keeps the image record key independent of
+	 * where the rest of the page is. */
+	{
+		fz_rect rect = fz_unit_rect;
+		fz_irect area;
+		fz_irect_from_rect(&area, fz_transform_rect(&rect, &local_ctm));
+		area.x0--;
+		area.y0--;
+		area.x1++;
+		area.y1++;
+		fz_intersect_irect(&clip, &area);
+	}
+
 	/* ctm maps the image (expressed as the unit square) onto the
 	 * destination device. Reverse that to get a mapping from
 	 * the destination device to the source pixels. */
@@ -1355,7 +1657,49 @@ fz_draw_fill_image(fz_context *ctx, fz_device *devp, fz_image *image, const fz_m
 			return;
 	}
 
+	/* Scalable images are rendered afresh at each size, and are not
+	 * worth caching. */
+	cacheable = !image->scalable;
+	ix = floorf(local_ctm.e);
+	iy = floorf(local_ctm.f);
+	if (cacheable)
+	{
+		int flags = (devp->hints & FZ_DONT_INTERPOLATE_IMAGES) ? 1 : 0;
+		if (alpha == 1.0f && !(dev->flags & FZ_DRAWDEV_FLAGS_TYPE3))
+			flags |= 2;
+		if (devp->flags & FZ_DEVFLAG_GRIDFIT_AS_TILED)
+			flags |= 4;
+		fz_make_image_key(ctx, &key, image, model, prf, dev->default_cs, color_params, &local_ctm, &clip, ix, iy, flags);
+		ir = fz_find_item(ctx, fz_drop_image_record_imp, &key, &fz_image_record_store_type);
+	}
+
+	if (ir)
+	{
+		pixmap = fz_keep_pixmap(ctx, ir->pixmap);
+		local_ctm = ir->ctm;
+		local_ctm.e += ix;
+		local_ctm.f += iy;
+		fz_drop_image_record(ctx, ir);
+
+		fz_try(ctx)
+		{
+			if (state->blendmode & FZ_BLEND_KNOCKOUT)
+				state = fz_knockout_begin(ctx, dev);
+
+			fz_paint_image(state->dest, &state->scissor, state->shape, pixmap, &local_ctm, alpha * 255, !(devp->hints & FZ_DONT_INTERPOLATE_IMAGES), devp->flags & FZ_DEVFLAG_GRIDFIT_AS_TILED);
+
+			if (state->blendmode & FZ_BLEND_KNOCKOUT)
+				fz_knockout_end(ctx, dev);
+		}
+		fz_always(ctx)
+			fz_drop_pixmap(ctx, pixmap);
+		fz_catch(ctx)
+			fz_rethrow(ctx);
+		return;
+	}
+
 	pixmap = fz_get_pixmap_from_image(ctx, image, &src_area, &local_ctm, &dx, &dy);
+	decoded = pixmap;
 	src_cs = fz_default_colorspace(ctx, dev->default_cs, pixmap->colorspace);
 
 	/* convert images with more components (cmyk->rgb) before scaling */
@@ -1416,6 +1760,10 @@ fz_draw_fill_image(fz_context *ctx, fz_device *devp, fz_image *image, const fz_m
 			}
 		}
 
+		/* Only keep the result if there was work in making it. */
+		if (cacheable && pixmap != decoded)
+			fz_store_image_record(ctx, &key, pixmap, &local_ctm, ix, iy);
+
 		fz_paint_image(state->dest, &state->scissor, state->shape, pixmap, &local_ctm, alpha * 255, !(devp->hints & FZ_DONT_INTERPOLATE_IMAGES), devp->flags & FZ_DEVFLAG_GRIDFIT_AS_TILED);
 
 		if (state->blendmode & FZ_BLEND_KNOCKOUT)
@@ -1594,21 +1942,21 @@ fz_draw_clip_image_mask(fz_context *ctx, fz_device *devp, fz_image *image, const
 
 	fz_try(ctx)
 	{
-		state[1].mask = fz_new_pixmap_with_bbox(ctx, NULL, &bbox, NULL, 1);
+		state[1].mask = fz_new_scratch_pixmap(ctx, dev, NULL, &bbox, NULL, 1);
 		fz_clear_pixmap(ctx, state[1].mask);
 
 		/* When there is no alpha in the current destination (state[0].dest->alpha == 0)
 		 * we have a choice. We can either create the new destination WITH alpha, or
 		 * we can copy the old pixmap contents in. We opt for the latter here, but
 		 * may want to revisit this decision in the future. */
-		state[1].dest = fz_new_pixmap_with_bbox(ctx, model, &bbox, state[0].dest->seps, state[0].dest->alpha);
+		state[1].dest = fz_new_scratch_pixmap(ctx, dev, model, &bbox, state[0].dest->seps, state[0].dest->alpha);
 		if (state[0].dest->alpha)
 			fz_clear_pixmap(ctx, state[1].dest);
 		else
 			fz_copy_pixmap_rect(ctx, state[1].dest, state[0].dest, &bbox, dev->default_cs);
 		if (state[0].shape)
 		{
-			state[1].shape = fz_new_pixmap_with_bbox(ctx, NULL, &bbox, NULL, 1);
+			state[1].shape = fz_new_scratch_pixmap(ctx, dev, NULL, &bbox, NULL, 1);
 			fz_clear_pixmap(ctx, state[1].shape);
 		}
 
@@ -1687,15 +2035,15 @@ fz_draw_pop_clip(fz_context *ctx, fz_device *devp)
 		if (state[0].shape != state[1].shape)
 		{
 			fz_paint_pixmap_with_mask(state[0].shape, state[1].shape, state[1].mask);
-			fz_drop_pixmap(ctx, state[1].shape);
+			fz_drop_scratch_pixmap(ctx, dev, state[1].shape);
 		}
 		/* The following tests should not be required, but just occasionally
 		 * errors can cause the stack to get out of sync, and this might save
 		 * our bacon. */
 		if (state[0].mask != state[1].mask)
-			fz_drop_pixmap(ctx, state[1].mask);
+			fz_drop_scratch_pixmap(ctx, dev, state[1].mask);
 		if (state[0].dest != state[1].dest)
-			fz_drop_pixmap(ctx, state[1].dest);
+			fz_drop_scratch_pixmap(ctx, dev, state[1].dest);
 #ifdef DUMP_GROUP_BLENDS
 		fz_dump_blend(ctx, " to get ", state[0].dest);
 		if (state[0].shape)
@@ -1742,9 +2090,9 @@ fz_draw_begin_mask(fz_context *ctx, fz_device *devp, const fz_rect *rect, int lu
 		 * If !luminosity, then we generate a mask from the alpha value of the shapes.
 		 */
 		if (luminosity)
-			state[1].dest = dest = fz_new_pixmap_with_bbox(ctx, fz_device_gray(ctx), &bbox, NULL, 0);
+			state[1].dest = dest = fz_new_scratch_pixmap(ctx, dev, fz_device_gray(ctx), &bbox, NULL, 0);
 		else
-			state[1].dest = dest = fz_new_pixmap_with_bbox(ctx, NULL, &bbox, NULL, 1);
+			state[1].dest = dest = fz_new_scratch_pixmap(ctx, dev, NULL, &bbox, NULL, 1);
 		if (state->shape)
 		{
 			/* FIXME: If we ever want to support AIS true, then
@@ -1811,13 +2159,13 @@ fz_draw_end_mask(fz_context *ctx, fz_device *devp)
 		/* convert to alpha mask */
 		temp = fz_alpha_from_gray(ctx, state[1].dest);
 		if (state[1].mask != state[0].mask)
-			fz_drop_pixmap(ctx, state[1].mask);
+			fz_drop_scratch_pixmap(ctx, dev, state[1].mask);
 		state[1].mask = temp;
 		if (state[1].dest != state[0].dest)
-			fz_drop_pixmap(ctx, state[1].dest);
+			fz_drop_scratch_pixmap(ctx, dev, state[1].dest);
 		state[1].dest = NULL;
 		if (state[1].shape != state[0].shape)
-			fz_drop_pixmap(ctx, state[1].shape);
+			fz_drop_scratch_pixmap(ctx, dev, state[1].shape);
 		state[1].shape = NULL;
 
 #ifdef DUMP_GROUP_BLENDS
@@ -1827,7 +2175,7 @@ fz_draw_end_mask(fz_context *ctx, fz_device *devp)
 
 		/* create new dest scratch buffer */
 		fz_pixmap_bbox(ctx, temp, &bbox);
-		dest = fz_new_pixmap_with_bbox(ctx, state->dest->colorspace, &bbox, state->dest->seps, state->dest->alpha);
+		dest = fz_new_scratch_pixmap(ctx, dev, state->dest->colorspace, &bbox, state->dest->seps, state->dest->alpha);
 		fz_copy_pixmap_rect(ctx, dest, state->dest, &bbox, dev->default_cs);
 
 		/* push soft mask as clip mask */
@@ -1837,7 +2185,7 @@ fz_draw_end_mask(fz_context *ctx, fz_device *devp)
 		 * clip mask when we pop. So create a new shape now. */
 		if (state[0].shape)
 		{
-			state[1].shape = fz_new_pixmap_with_bbox(ctx, NULL, &bbox, NULL, 1);
+			state[1].shape = fz_new_scratch_pixmap(ctx, dev, NULL, &bbox, NULL, 1);
 			fz_clear_pixmap(ctx, state[1].shape);
 		}
 		state[1].scissor = bbox;
@@ -1876,7 +2224,7 @@ fz_draw_begin_group(fz_context *ctx, fz_device *devp, const fz_rect *rect, fz_co
 		isolated = 1;
 #endif
 
-		state[1].dest = dest = fz_new_pixmap_with_bbox(ctx, model, &bbox, state[0].dest->seps, state[0].dest->alpha || isolated);
+		state[1].dest = dest = fz_new_scratch_pixmap(ctx, dev, model, &bbox, state[0].dest->seps, state[0].dest->alpha || isolated);
 
 		if (isolated)
 		{
@@ -1895,7 +2243,7 @@ fz_draw_begin_group(fz_context *ctx, fz_device *devp, const fz_rect *rect, fz_co
 		}
 		else
 		{
-			state[1].shape = fz_new_pixmap_with_bbox(ctx, NULL, &bbox, NULL, 1);
+			state[1].shape = fz_new_scratch_pixmap(ctx, dev, NULL, &bbox, NULL, 1);
 			fz_clear_pixmap(ctx, state[1].shape);
 		}
 
@@ -1953,7 +2301,7 @@ fz_draw_end_group(fz_context *ctx, fz_device *devp)
 	if (state[0].dest->colorspace != state[1].dest->colorspace)
 	{
 		fz_pixmap *converted = fz_convert_pixmap(ctx, state[1].dest, state[0].dest->colorspace, NULL, dev->default_cs, fz_default_color_params(ctx), 1);
-		fz_drop_pixmap(ctx, state[1].dest);
+		fz_drop_scratch_pixmap(ctx, dev, state[1].dest);
 		state[1].dest = converted;
 	}
 
@@ -1966,12 +2314,12 @@ fz_draw_end_group(fz_context *ctx, fz_device *devp)
 	 * errors can cause the stack to get out of sync, and this might save
 	 * our bacon. */
 	if (state[0].dest != state[1].dest)
-		fz_drop_pixmap(ctx, state[1].dest);
+		fz_drop_scratch_pixmap(ctx, dev, state[1].dest);
 	if (state[0].shape != state[1].shape)
 	{
 		if (state[0].shape)
 			fz_paint_pixmap(state[0].shape, state[1].shape, alpha * 255);
-		fz_drop_pixmap(ctx, state[1].shape);
+		fz_drop_scratch_pixmap(ctx, dev, state[1].shape);
 	}
 #ifdef DUMP_GROUP_BLENDS
 	fz_dump_blend(ctx, " to get ", state[0].dest);
@@ -2154,12 +2502,12 @@ fz_draw_begin_tile(fz_context *ctx, fz_device *devp, const fz_rect *area, const
 	fz_try(ctx)
 	{
 		/* Patterns can be transparent, so we need to have an alpha here. */
-		state[1].dest = dest = fz_new_pixmap_with_bbox(ctx, model, &bbox, state[0].dest->seps, 1);
+		state[1].dest = dest = fz_new_scratch_pixmap(ctx, dev, model, &bbox, state[0].dest->seps, 1);
 		fz_clear_pixmap(ctx, dest);
 		shape = state[0].shape;
 		if (shape)
 		{
-			state[1].shape = shape = fz_new_pixmap_with_bbox(ctx, NULL, &bbox, NULL, 1);
+			state[1].shape = shape = fz_new_scratch_pixmap(ctx, dev, NULL, &bbox, NULL, 1);
 			fz_clear_pixmap(ctx, shape);
 		}
 		state[1].blendmode |= FZ_BLEND_ISOLATED;
@@ -2334,9 +2682,9 @@ fz_draw_end_tile(fz_context *ctx, fz_device *devp)
 	 * errors can cause the stack to get out of sync, and this might save
 	 * our bacon. */
 	if (state[0].dest != state[1].dest)
-		fz_drop_pixmap(ctx, state[1].dest);
+		fz_drop_scratch_pixmap(ctx, dev, state[1].dest);
 	if (state[0].shape != state[1].shape)
-		fz_drop_pixmap(ctx, state[1].shape);
+		fz_drop_scratch_pixmap(ctx, dev, state[1].shape);
 #ifdef DUMP_GROUP_BLENDS
 	fz_dump_blend(ctx, " to get ", state[0].dest);
 	if (state[0].shape)
@@ -2379,11 +2727,11 @@ fz_draw_drop_device(fz_context *ctx, fz_device *devp)
 	{
 		fz_draw_state *state = &dev->stack[dev->top];
 		if (state[1].mask != state[0].mask)
-			fz_drop_pixmap(ctx, state[1].mask);
+			fz_drop_scratch_pixmap(ctx, dev, state[1].mask);
 		if (state[1].dest != state[0].dest)
-			fz_drop_pixmap(ctx, state[1].dest);
+			fz_drop_scratch_pixmap(ctx, dev, state[1].dest);
 		if (state[1].shape != state[0].shape)
-			fz_drop_pixmap(ctx, state[1].shape);
+			fz_drop_scratch_pixmap(ctx, dev, state[1].shape);
 	}
 	/* We never free the dest/mask/shape at level 0, as:
 	 * 1) dest is passed in and ownership remains with the caller.
@@ -2391,6 +2739,8 @@ fz_draw_drop_device(fz_context *ctx, fz_device *devp)
 	 */
 	if (dev->stack != &dev->init_stack[0])
 		fz_free(ctx, dev->stack);
+	while (dev->scratch_len > 0)
+		fz_free(ctx, dev->scratch[--dev->scratch_len].samples);
 	fz_drop_scale_cache(ctx, dev->cache_x);
 	fz_drop_scale_cache(ctx, dev->cache_y);
 	fz_drop_rasterizer(ctx, rast);
@@ -2516,11 +2866,12 @@ const char *fz_draw_options_usage =
 	"\theight=N: render pages to fit N pixels tall (ignore resolution option)\n"
 	"\tcolorspace=(gray|rgb|cmyk): render using specified colorspace\n"
 	"\talpha: render pages with alpha channel and transparent background\n"
-	"\tgraphics=(aaN|cop|app): set the rasterizer to use\n"
+	"\tgraphics=(aaN|cop|app|area): set the rasterizer to use\n"
 	"\ttext=(aaN|cop|app): set the rasterizer to use for text\n"
 	"\t\taaN=antialias with N bits (0 to 8)\n"
 	"\t\tcop=center of pixel\n"
 	"\t\tapp=any part of pixel\n"
+	"\t\tarea=exact area coverage\n"
 	"\n";
 
 static int parse_aa_opts(const char *val)
@@ -2529,6 +2880,8 @@ static int parse_aa_opts(const char *val)
 		return 9;
 	if (fz_option_eq(val, "app"))
 		return 10;
+	if (fz_option_eq(val, "area"))
+		return 11;
 	if (val[0] == 'a' && val[1] == 'a' && val[2] >= '0' && val[2] <= '9')
 		return  fz_clampi(fz_atoi(&val[2]), 0, 8);
 	return 8;
@@ -2647,7 +3000,7 @@ fz_new_draw_device_with_options(fz_context *ctx, const fz_draw_options *opts, co
 		else
 			fz_clear_pixmap_with_value(ctx, *pixmap, 255);
 
-		dev = fz_new_draw_device(ctx, &transform, *pixmap);
+		dev = new_draw_device(ctx, &transform, *pixmap, &aa);
 	}
 	fz_catch(ctx)
 	{
@@ -3,9 +3,26 @@
 
 #include <assert.h>
 #include <math.h>
+#include <string.h>
 
 enum { MAXN = 2 + FZ_MAX_COLORS };
 
+/* Each pixel is computed from the start of the span rather than by
+ * stepping from the last one, so that the iterations are independent.
+ * Called with constant n and pa, the loops unroll and vectorise. */
+static inline void paint_scan_run(unsigned char *restrict p, const int *restrict c, const int *restrict dc, int w, const int n, const int pa)
+{
+	const int pn = n + pa;
+	int i, k;
+
+	for (i = 0; i < w; i++)
+		for (k = 0; k < n; k++)
+			p[i * pn + k] = (c[k] + i * dc[k]) >> 16;
+	if (pa)
+		for (i = 0; i < w; i++)
+			p[i * pn + n] = 255;
+}
+
 static void paint_scan(fz_pixmap *restrict pix, int y, int fx0, int fx1, int cx0, int cx1, const int *restrict v0, const int *restrict v1, int n)
 {
 	unsigned char *p;
@@ -46,17 +63,16 @@ static void paint_scan(fz_pixmap *restrict pix, int y, int fx0, int fx1, int cx0
 
 	p = pix->samples + ((x0 - pix->x) * pix->n) + ((y - pix->y) * pix->stride);
 	pa = pix->alpha;
-	do
+	switch (n * 2 + pa)
 	{
-		for (k = 0; k < n; k++)
-		{
-			*p++ = c[k]>>16;
-			c[k] += dc[k];
-		}
-		if (pa)
-			*p++ = 255;
+	case 2: paint_scan_run(p, c, dc, w, 1, 0); break;
+	case 3: paint_scan_run(p, c, dc, w, 1, 1); break;
+	case 6: paint_scan_run(p, c, dc, w, 3, 0); break;
+	case 7: paint_scan_run(p, c, dc, w, 3, 1); break;
+	case 8: paint_scan_run(p, c, dc, w, 4, 0); break;
+	case 9: paint_scan_run(p, c, dc, w, 4, 1); break;
+	default: paint_scan_run(p, c, dc, w, n, pa); break;
 	}
-	while (--w);
 }
 
 typedef struct edge_data_s edge_data;
@@ -204,19 +220,196 @@ do_paint_tri(fz_context *ctx, void *arg, fz_vertex *av, fz_vertex *bv, fz_vertex
 	fz_paint_triangle(dest, vertices, 2 + fz_colorspace_n(ctx, dest->colorspace), ptd->bbox);
 }
 
+/*
+	Rendered shadings are cached in the store before they are mapped
+	through the shading function or composited onto the destination.
+	The key covers everything that the rendering depends on. Integer
+	translations are factored out, so that a page that has only been
+	scrolled finds its shadings again.
+
+	Shadings up to MAX_CACHED_SHADE_AREA pixels are always cached. Larger
+	ones are painted directly the first time, and only an empty marker is
+	stored under their key; they are cached when they are painted the
+	same way again, as when a viewer redraws a page.
+*/
+#define MAX_CACHED_SHADE_AREA (512 * 512)
+
+typedef struct
+{
+	int refs;
+	fz_shade *shade;
+	fz_colorspace *model;
+	unsigned char digest[16];
+} fz_shade_key;
+
+static int
+fz_make_hash_shade_key(fz_context *ctx, fz_store_hash *hash, void *key_)
+{
+	fz_shade_key *key = key_;
+	hash->u.pim.ptr = key->shade;
+	hash->u.pim.i = 0;
+	memcpy(hash->u.pim.md5, key->digest, 16);
+	return 1;
+}
+
+static void *
+fz_keep_shade_key(fz_context *ctx, void *key_)
+{
+	fz_shade_key *key = key_;
+	return fz_keep_imp(ctx, key, &key->refs);
+}
+
+static void
+fz_drop_shade_key(fz_context *ctx, void *key_)
+{
+	fz_shade_key *key = key_;
+	if (fz_drop_imp(ctx, key, &key->refs))
+	{
+		fz_drop_shade(ctx, key->shade);
+		fz_drop_colorspace(ctx, key->model);
+		fz_free(ctx, key);
+	}
+}
+
+static int
+fz_cmp_shade_key(fz_context *ctx, void *k0_, void *k1_)
+{
+	fz_shade_key *k0 = k0_;
+	fz_shade_key *k1 = k1_;
+	return k0->shade != k1->shade || memcmp(k0->digest, k1->digest, 16);
+}
+
+static void
+fz_format_shade_key(fz_context *ctx, char *s, int n, void *key_)
+{
+	fz_shade_key *key = (fz_shade_key *)key_;
+	fz_snprintf(s, n, "(rendered shade type %d)", key->shade->type);
+}
+
+static const fz_store_type fz_shade_store_type =
+{
+	fz_make_hash_shade_key,
+	fz_keep_shade_key,
+	fz_drop_shade_key,
+	fz_cmp_shade_key,
+	fz_format_shade_key,
+	NULL
+};
+
+static void
+fz_make_shade_key(fz_context *ctx, fz_shade_key *key, fz_shade *shade, fz_colorspace *model,
+	const fz_color_params *color_params, const fz_matrix *ctm, const fz_irect *bbox, int ix, int iy)
+{
+	struct
+	{
+		float ctm[6];
+		fz_irect bbox;
+		fz_color_params color_params;
+		void *model;
+	} params;
+	fz_md5 md5;
+
+	memset(&params, 0, sizeof params);
+	params.ctm[0] = ctm->a;
+	params.ctm[1] = ctm->b;
+	params.ctm[2] = ctm->c;
+	params.ctm[3] = ctm->d;
+	params.ctm[4] = ctm->e - ix;
+	params.ctm[5] = ctm->f - iy;
+	params.bbox.x0 = bbox->x0 - ix;
+	params.bbox.y0 = bbox->y0 - iy;
+	params.bbox.x1 = bbox->x1 - ix;
+	params.bbox.y1 = bbox->y1 - iy;
+	/* Shadings with a function are rendered as indexes into it, which
+	 * do not depend on the destination colors. */
+	if (model)
+		params.color_params = *color_params;
+	params.model = model;
+
+	fz_md5_init(&md5);
+	fz_md5_update(&md5, (unsigned char *)&params, sizeof params);
+	fz_md5_final(&md5, key->digest);
+
+	key->refs = 1;
+	key->shade = shade;
+	key->model = model;
+}
+
+static fz_pixmap *
+fz_store_rendered_shade(fz_context *ctx, fz_shade_key *key, fz_pixmap *pix)
+{
+	fz_shade_key *keyp = NULL;
+
+	fz_var(keyp);
+
+	/* Any failure here will just result in us not caching. */
+	fz_try(ctx)
+	{
+		fz_pixmap *existing;
+
+		keyp = fz_malloc_struct(ctx, fz_shade_key);
+		*keyp = *key;
+		keyp->shade = fz_keep_shade(ctx, key->shade);
+		keyp->model = fz_keep_colorspace(ctx, key->model);
+
+		existing = fz_store_item(ctx, keyp, pix, fz_pixmap_size(ctx, pix), &fz_shade_store_type);
+		if (existing && existing->w == 0 && pix->w != 0)
+		{
+			/* A racing thread left a marker; keep ours uncached. */
+			fz_drop_pixmap(ctx, existing);
+		}
+		else if (existing)
+		{
+			/* A racing thread got there first; use theirs. */
+			fz_drop_pixmap(ctx, pix);
+			pix = existing;
+		}
+	}
+	fz_always(ctx)
+	{
+		if (keyp)
+			fz_drop_shade_key(ctx, keyp);
+	}
+	fz_catch(ctx)
+	{
+		/* Do nothing */
+	}
+
+	return pix;
+}
+
+static void
+fz_rasterize_shade(fz_context *ctx, fz_shade *shade, const fz_matrix *ctm, fz_pixmap *dest, const fz_color_params *color_params, const fz_irect *bbox)
+{
+	struct paint_tri_data ptd = { 0 };
+
+	ptd.dest = dest;
+	ptd.shade = shade;
+	ptd.bbox = bbox;
+
+	fz_init_cached_color_converter(ctx, &ptd.cc, NULL, dest->colorspace, shade->colorspace, color_params);
+	fz_try(ctx)
+		fz_process_shade(ctx, shade, ctm, prepare_mesh_vertex, &do_paint_tri, &ptd);
+	fz_always(ctx)
+		fz_fin_cached_color_converter(ctx, &ptd.cc);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
 void
 fz_paint_shade(fz_context *ctx, fz_shade *shade, const fz_matrix *ctm, fz_pixmap *dest, fz_colorspace *prf, const fz_color_params *color_params, const fz_irect *bbox)
 {
 	unsigned char clut[256][FZ_MAX_COLORS];
 	fz_pixmap *temp = NULL;
 	fz_pixmap *conv = NULL;
+	fz_pixmap *cached = NULL;
 	float color[FZ_MAX_COLORS];
-	struct paint_tri_data ptd = { 0 };
 	int i, k, n;
 	fz_matrix local_ctm;
 
 	fz_var(temp);
 	fz_var(conv);
+	fz_var(cached);
 
 	fz_try(ctx)
 	{
@@ -240,21 +433,93 @@ fz_paint_shade(fz_context *ctx, fz_shade *shade, const fz_matrix *ctm, fz_pixmap
 			/* We need to use alpha = 1 here, because the shade might not fill
 			 * the bbox. */
 			conv = fz_new_pixmap_with_bbox(ctx, dest->colorspace, bbox, NULL, 1);
-			temp = fz_new_pixmap_with_bbox(ctx, fz_device_gray(ctx), bbox, NULL, 1);
-			fz_clear_pixmap(ctx, temp);
+		}
+
+		/* Spot colorants are not interpolated, so only render into a
+		 * pixmap of our own when the destination has none. */
+		if (shade->use_function || dest->n - dest->alpha == fz_colorspace_n(ctx, dest->colorspace))
+		{
+			fz_colorspace *model = shade->use_function ? NULL : dest->colorspace;
+			fz_shade_key key;
+			int ix = floorf(local_ctm.e);
+			int iy = floorf(local_ctm.f);
+			fz_matrix rel_ctm = local_ctm;
+			fz_irect rel_bbox = *bbox;
+			int cache;
+
+			rel_ctm.e -= ix;
+			rel_ctm.f -= iy;
+			rel_bbox.x0 -= ix;
+			rel_bbox.y0 -= iy;
+			rel_bbox.x1 -= ix;
+			rel_bbox.y1 -= iy;
+
+			fz_make_shade_key(ctx, &key, shade, model, color_params, &local_ctm, bbox, ix, iy);
+			cached = fz_find_item(ctx, fz_drop_pixmap_imp, &key, &fz_shade_store_type);
+			if (cached && cached->w == 0)
+			{
+				/* A large shading that has been painted like this
+				 * before, so it is likely to be painted again. */
+				fz_drop_pixmap(ctx, cached);
+				cached = NULL;
+				fz_remove_item(ctx, fz_drop_pixmap_imp, &key, &fz_shade_store_type);
+				cache = 1;
+			}
+			else
+				cache = (int64_t)(bbox->x1 - bbox->x0) * (bbox->y1 - bbox->y0) <= MAX_CACHED_SHADE_AREA;
+
+			if (cached)
+			{
+				temp = fz_new_pixmap_with_bbox_and_data(ctx, cached->colorspace, bbox, NULL, 1, cached->samples);
+			}
+			else if (cache)
+			{
+				cached = fz_new_pixmap_with_bbox(ctx, model ? model : fz_device_gray(ctx), &rel_bbox, NULL, 1);
+				fz_clear_pixmap(ctx, cached);
+				fz_rasterize_shade(ctx, shade, &rel_ctm, cached, color_params, &rel_bbox);
+				cached = fz_store_rendered_shade(ctx, &key, cached);
+				temp = fz_new_pixmap_with_bbox_and_data(ctx, cached->colorspace, bbox, NULL, 1, cached->samples);
+			}
+			else
+			{
+				/* Only remember that we have seen it, so that large
+				 * shadings painted once do not flush the store. They
+				 * are rendered relative to the same integer offset as
+				 * cached ones, so that both come out the same. */
+				fz_pixmap *marker = fz_new_pixmap(ctx, fz_device_gray(ctx), 0, 0, NULL, 1);
+				fz_drop_pixmap(ctx, fz_store_rendered_shade(ctx, &key, marker));
+
+				if (shade->use_function)
+				{
+					temp = fz_new_pixmap_with_bbox(ctx, fz_device_gray(ctx), &rel_bbox, NULL, 1);
+					fz_clear_pixmap(ctx, temp);
+					fz_rasterize_shade(ctx, shade, &rel_ctm, temp, color_params, &rel_bbox);
+					temp->x += ix;
+					temp->y += iy;
+				}
+				else
+				{
+					temp = dest;
+					dest->x -= ix;
+					dest->y -= iy;
+					fz_try(ctx)
+						fz_rasterize_shade(ctx, shade, &rel_ctm, dest, color_params, &rel_bbox);
+					fz_always(ctx)
+					{
+						dest->x += ix;
+						dest->y += iy;
+					}
+					fz_catch(ctx)
+						fz_rethrow(ctx);
+				}
+			}
 		}
 		else
 		{
 			temp = dest;
+			fz_rasterize_shade(ctx, shade, &local_ctm, temp, color_params, bbox);
 		}
 
-		ptd.dest = temp;
-		ptd.shade = shade;
-		ptd.bbox = bbox;
-
-		fz_init_cached_color_converter(ctx, &ptd.cc, NULL, temp->colorspace, shade->colorspace, color_params);
-		fz_process_shade(ctx, shade, &local_ctm, prepare_mesh_vertex, &do_paint_tri, &ptd);
-
 		if (shade->use_function)
 		{
 			unsigned char *s = temp->samples;
@@ -280,21 +545,19 @@ fz_paint_shade(fz_context *ctx, fz_shade *shade, const fz_matrix *ctm, fz_pixmap
 				s += temp->stride - temp->w * temp->n;
 			}
 			fz_paint_pixmap(dest, conv, 255);
-			fz_drop_pixmap(ctx, conv);
-			fz_drop_pixmap(ctx, temp);
 		}
+		else if (temp != dest)
+			fz_paint_pixmap(dest, temp, 255);
 	}
 	fz_always(ctx)
 	{
-		fz_fin_cached_color_converter(ctx, &ptd.cc);
+		if (temp != dest)
+			fz_drop_pixmap(ctx, temp);
+		fz_drop_pixmap(ctx, conv);
+		fz_drop_pixmap(ctx, cached);
 	}
 	fz_catch(ctx)
 	{
-		if (shade->use_function)
-		{
-			fz_drop_pixmap(ctx, conv);
-			fz_drop_pixmap(ctx, temp);
-		}
 		fz_rethrow(ctx);
 	}
 }
@@ -1939,6 +1939,72 @@ fz_paint_pixmap(fz_pixmap * restrict dst, const fz_pixmap * restrict src, int al
 	}
 }
 
+/* Clip masks are mostly long runs of fully-out or fully-in pixels with
+ * short partial runs at their edges. Runs shorter than this are left to
+ * the span painter along with the partial pixels around them. */
+#define MIN_MASK_RUN 16
+
+/* Find the end of the run of bytes equal to v (0 or 255) that starts at
+ * mp[i], a word at a time once aligned. */
+static inline int
+mask_run_end(const byte * restrict mp, int i, int w, int v)
+{
+	const uint32_t word = v ? 0xffffffff : 0;
+
+	i++;
+	while (i < w && ((intptr_t)(mp + i) & 3))
+	{
+		if (mp[i] != v)
+			return i;
+		i++;
+	}
+	while (i + 4 <= w && *(const uint32_t *)(const void *)(mp + i) == word)
+		i += 4;
+	while (i < w && mp[i] == v)
+		i++;
+	return i;
+}
+
+/* Fully-out runs are skipped without touching the source or destination,
+ * and fully-in runs are copied outright when the source has no alpha.
+ * With alpha, the span painter leaves the destination alone where the
+ * source is transparent, so fully-in runs still go through it. */
+static void
+paint_mask_row(byte * restrict dp, const byte * restrict sp, const byte * restrict mp, int w, int n, int sa, fz_span_mask_painter_t *fn)
+{
+	int i = 0, j = 0, start, v = 0;
+
+	while (i < w)
+	{
+		start = i;
+		while (i < w)
+		{
+			v = mp[i];
+			if (v == 0 || v == 255)
+			{
+				j = mask_run_end(mp, i, w, v);
+				if (j - i >= MIN_MASK_RUN)
+					break;
+				i = j;
+			}
+			else
+				i++;
+		}
+		if (i > start)
+			(*fn)(dp + start * (n + sa), sp + start * (n + sa), mp + start, i - start, n, sa);
+		if (i == w)
+			break;
+		if (v == 255)
+		{
+			if (sa)
+				(*fn)(dp + i * (n + sa), sp + i * (n + sa), mp + i, j - i, n, sa);
+			else
+				memcpy(dp + i * n, sp + i * n, (size_t)(j - i) * n);
+		}
+		i = j;
+	}
+}
+
 void
 fz_paint_pixmap_with_mask(fz_pixmap * restrict dst, const fz_pixmap * restrict src, const fz_pixmap * restrict msk)
 {
@@ -1981,7 +2047,7 @@ fz_paint_pixmap_with_mask(fz_pixmap * restrict dst, const fz_pixmap * restrict s
 
 	while (h--)
 	{
-		(*fn)(dp, sp, mp, w, n, sa);
+		paint_mask_row(dp, sp, mp, w, n, sa, fn);
 		sp += src->stride;
 		dp += dst->stride;
 		mp += msk->stride;
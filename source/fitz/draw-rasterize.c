@@ -65,7 +65,9 @@ fz_set_rasterizer_text_aa_level(fz_context *ctx, fz_aa_context *aa, int level)
 #ifdef AA_BITS
 	if (level != fz_aa_bits)
 	{
-		if (fz_aa_bits == 10)
+		if (fz_aa_bits == 11)
+			fz_warn(ctx, "Only the exact area coverage rasterizer was compiled in");
+		else if (fz_aa_bits == 10)
 			fz_warn(ctx, "Only the Any-part-of-a-pixel rasterizer was compiled in");
 		else if (fz_aa_bits == 9)
 			fz_warn(ctx, "Only the Centre-of-a-pixel rasterizer was compiled in");
@@ -92,7 +94,9 @@ fz_set_rasterizer_graphics_aa_level(fz_context *ctx, fz_aa_context *aa, int leve
 #ifdef AA_BITS
 	if (level != fz_aa_bits)
 	{
-		if (fz_aa_bits == 10)
+		if (fz_aa_bits == 11)
+			fz_warn(ctx, "Only the exact area coverage rasterizer was compiled in");
+		else if (fz_aa_bits == 10)
 			fz_warn(ctx, "Only the Any-part-of-a-pixel rasterizer was compiled in");
 		else if (fz_aa_bits == 9)
 			fz_warn(ctx, "Only the Centre-of-a-pixel rasterizer was compiled in");
@@ -100,7 +104,7 @@ fz_set_rasterizer_graphics_aa_level(fz_context *ctx, fz_aa_context *aa, int leve
 			fz_warn(ctx, "Only the %d bit anti-aliasing rasterizer was compiled in", fz_aa_bits);
 	}
 #else
-	if (level == 9 || level == 10)
+	if (level == 9 || level == 10 || level == 11)
 	{
 		aa->hscale = 1;
 		aa->vscale = 1;
@@ -280,7 +284,9 @@ fz_rasterizer *fz_new_rasterizer(fz_context *ctx, const fz_aa_context *aa)
 		aa = ctx->aa;
 	bits = aa->bits;
 #endif
-	if (bits == 10)
+	if (bits == 11)
+		r = fz_new_area_rasterizer(ctx);
+	else if (bits == 10)
 		r = fz_new_edgebuffer(ctx, FZ_EDGEBUFFER_ANY_PART_OF_PIXEL);
 	else if (bits == 9)
 		r = fz_new_edgebuffer(ctx, FZ_EDGEBUFFER_CENTER_OF_PIXEL);
@@ -1531,6 +1531,59 @@ fz_scale_pixmap(fz_context *ctx, fz_pixmap *src, float x, float y, float w, floa
 	return fz_scale_pixmap_cached(ctx, src, x, y, w, h, clip, NULL, NULL);
 }
 
+typedef struct
+{
+	const fz_pixmap *src;
+	fz_pixmap *output;
+	const fz_weights *contrib_rows;
+	const fz_weights *contrib_cols;
+	int flip_y;
+	int temp_span;
+	int temp_rows;
+	void (*row_scale_in)(unsigned char * restrict dst, const unsigned char * restrict src, const fz_weights * restrict weights);
+	void (*row_scale_out)(unsigned char * restrict dst, const unsigned char * restrict src, const fz_weights * restrict weights, int w, int n, int row);
+} fz_scale_rows_job;
+
+/* Scale output rows row0 to row1, with a temporary buffer of our own. */
+static void
+scale_rows(fz_context *ctx, void *arg, int row0, int row1)
+{
+	fz_scale_rows_job *job = arg;
+	const fz_pixmap *src = job->src;
+	fz_pixmap *output = job->output;
+	const fz_weights *contrib_rows = job->contrib_rows;
+	const fz_weights *contrib_cols = job->contrib_cols;
+	int temp_span = job->temp_span;
+	int temp_rows = job->temp_rows;
+	int flip_y = job->flip_y;
+	unsigned char *temp;
+	int max_row, row;
+
+	temp = fz_calloc(ctx, temp_span*temp_rows, sizeof(unsigned char));
+	max_row = contrib_rows->index[contrib_rows->index[row0]];
+	for (row = row0; row < row1; row++)
+	{
+		/*
+		Which source rows do we need to have scaled into the
+		temporary buffer in order to be able to do the final
+		scale?
+		*/
+		int row_index = contrib_rows->index[row];
+		int row_min = contrib_rows->index[row_index++];
+		int row_len = contrib_rows->index[row_index];
+		while (max_row < row_min+row_len)
+		{
+			/* Scale another row */
+			assert(max_row < src->h);
+			(*job->row_scale_in)(&temp[temp_span*(max_row % temp_rows)], &src->samples[(flip_y ? (src->h-1-max_row): max_row)*src->stride], contrib_cols);
+			max_row++;
+		}
+
+		(*job->row_scale_out)(&output->samples[row*output->stride], temp, contrib_rows, contrib_cols->count, src->n, row);
+	}
+	fz_free(ctx, temp);
+}
+
 fz_pixmap *
 fz_scale_pixmap_cached(fz_context *ctx, const fz_pixmap *src, float x, float y, float w, float h, const fz_irect *clip, fz_scale_cache *cache_x, fz_scale_cache *cache_y)
 {
@@ -1538,8 +1591,6 @@ fz_scale_pixmap_cached(fz_context *ctx, const fz_pixmap *src, float x, float y,
 	fz_weights *contrib_rows = NULL;
 	fz_weights *contrib_cols = NULL;
 	fz_pixmap *output = NULL;
-	unsigned char *temp = NULL;
-	int max_row, temp_span, temp_rows, row;
 	int dst_w_int, dst_h_int, dst_x_int, dst_y_int;
 	int flip_x, flip_y, forcealpha;
 	fz_rect patch;
@@ -1751,67 +1802,49 @@ fz_scale_pixmap_cached(fz_context *ctx, const fz_pixmap *src, float x, float y,
 	else
 #endif /* SINGLE_PIXEL_SPECIALS */
 	{
-		void (*row_scale_in)(unsigned char * restrict dst, const unsigned char * restrict src, const fz_weights * restrict weights);
-		void (*row_scale_out)(unsigned char * restrict dst, const unsigned char * restrict src, const fz_weights * restrict weights, int w, int n, int row);
+		fz_scale_rows_job job;
 
-		temp_span = contrib_cols->count * src->n;
-		temp_rows = contrib_rows->max_len;
-		if (temp_span <= 0 || temp_rows > INT_MAX / temp_span)
+		job.temp_span = contrib_cols->count * src->n;
+		job.temp_rows = contrib_rows->max_len;
+		if (job.temp_span <= 0 || job.temp_rows > INT_MAX / job.temp_span)
 			goto cleanup;
-		fz_try(ctx)
-		{
-			temp = fz_calloc(ctx, temp_span*temp_rows, sizeof(unsigned char));
-		}
-		fz_catch(ctx)
-		{
-			fz_drop_pixmap(ctx, output);
-			if (!cache_x)
-				fz_free(ctx, contrib_cols);
-			if (!cache_y)
-				fz_free(ctx, contrib_rows);
-			fz_rethrow(ctx);
-		}
 		switch (src->n)
 		{
 		default:
-			row_scale_in = scale_row_to_temp;
+			job.row_scale_in = scale_row_to_temp;
 			break;
 		case 1: /* Image mask case or Greyscale case */
-			row_scale_in = scale_row_to_temp1;
+			job.row_scale_in = scale_row_to_temp1;
 			break;
 		case 2: /* Greyscale with alpha case */
-			row_scale_in = scale_row_to_temp2;
+			job.row_scale_in = scale_row_to_temp2;
 			break;
 		case 3: /* RGB case */
-			row_scale_in = scale_row_to_temp3;
+			job.row_scale_in = scale_row_to_temp3;
 			break;
 		case 4: /* RGBA or CMYK case */
-			row_scale_in = scale_row_to_temp4;
+			job.row_scale_in = scale_row_to_temp4;
 			break;
 		}
-		row_scale_out = forcealpha ? scale_row_from_temp_alpha : scale_row_from_temp;
-		max_row = contrib_rows->index[contrib_rows->index[0]];
-		for (row = 0; row < contrib_rows->count; row++)
+		job.row_scale_out = forcealpha ? scale_row_from_temp_alpha : scale_row_from_temp;
+		job.src = src;
+		job.output = output;
+		job.contrib_rows = contrib_rows;
+		job.contrib_cols = contrib_cols;
+		job.flip_y = flip_y;
+		fz_try(ctx)
 		{
-			/*
-			Which source rows do we need to have scaled into the
-			temporary buffer in order to be able to do the final
-			scale?
-			*/
-			int row_index = contrib_rows->index[row];
-			int row_min = contrib_rows->index[row_index++];
-			int row_len = contrib_rows->index[row_index];
-			while (max_row < row_min+row_len)
-			{
-				/* Scale another row */
-				assert(max_row < src->h);
-				(*row_scale_in)(&temp[temp_span*(max_row % temp_rows)], &src->samples[(flip_y ? (src->h-1-max_row): max_row)*src->stride], contrib_cols);
-				max_row++;
-			}
-
-			(*row_scale_out)(&output->samples[row*output->stride], temp, contrib_rows, contrib_cols->count, src->n, row);
+			fz_parallel_rows(ctx, contrib_rows->count, scale_rows, &job);
+		}
+		fz_catch(ctx)
+		{
+			fz_drop_pixmap(ctx, output);
+			if (!cache_x)
+				fz_free(ctx, contrib_cols);
+			if (!cache_y)
+				fz_free(ctx, contrib_rows);
+			fz_rethrow(ctx);
 		}
-		fz_free(ctx, temp);
 
 		if (forcealpha)
 			adjust_alpha_edges(output, contrib_rows, contrib_cols);
@@ -61,6 +61,28 @@ fz_font_context *fz_keep_font_context(fz_context *ctx);
 void fz_drop_font_context(fz_context *ctx);
 
 /* Tuning context implementation details */
+enum { FZ_DEFAULT_PARALLEL_ROWS = 32, FZ_MAX_PARALLEL_JOBS = 64 };
+enum { FZ_DEFAULT_PREFETCH_BUDGET = 64 << 20 };
+
+/*
+	fz_parallel_error: The exception caught in a parallel job, kept
+	so that the caller can rethrow it once all the jobs are done.
+	Each job has its own, so no locking is needed.
+
+	fz_catch_parallel_error records the caught exception; call it
+	from the fz_catch of a job. fz_rethrow_parallel_errors throws
+	the exception of the first of n jobs that failed, with its
+	original code and message, if any did.
+*/
+typedef struct
+{
+	int code;
+	char message[256];
+} fz_parallel_error;
+
+void fz_catch_parallel_error(fz_context *ctx, fz_parallel_error *err);
+void fz_rethrow_parallel_errors(fz_context *ctx, fz_parallel_error *errs, int n);
+
 struct fz_tuning_context_s
 {
 	int refs;
@@ -68,6 +90,13 @@ struct fz_tuning_context_s
 	void *image_decode_arg;
 	fz_tune_image_scale_fn *image_scale;
 	void *image_scale_arg;
+	fz_parallel_fn *parallel;
+	void *parallel_arg;
+	int parallel_min_rows;
+	fz_background_fn *background;
+	void *background_arg;
+	int prefetch_pages;
+	size_t prefetch_budget;
 };
 
 void fz_default_image_decode(void *arg, int w, int h, int l2factor, fz_irect *subarea);
@@ -91,4 +120,59 @@ void fz_new_output_context(fz_context *ctx);
 void fz_drop_output_context(fz_context *ctx);
 fz_output_context *fz_keep_output_context(fz_context *ctx);
 
+void fz_drop_stext_index(fz_context *ctx, fz_stext_page *page);
+
+/*
+	fz_tolower: The case folding used when searching text. Text
+	searches and text indexes must fold the same way, or an index
+	would not find what a search of the page finds.
+*/
+static inline int fz_tolower(int c)
+{
+	if (c >= 'A' && c <= 'Z')
+		return c - 'A' + 'a';
+	return c;
+}
+
+/*
+	fz_archive_lookup: A case insensitive hash table of the entry
+	names of an archive, for archive implementations to find entries
+	by name without scanning their whole directory.
+
+	fz_new_archive_lookup builds the table from the count_entries
+	and list_entry functions of the archive, which must return the
+	same names for as long as the table is in use. Where several
+	entries have the same name, the first one is found, as with a
+	linear scan.
+
+	fz_lookup_archive_entry returns the index of the entry, or -1
+	if there is none with that name.
+
+	For internal use only.
+*/
+typedef struct fz_archive_lookup_s fz_archive_lookup;
+fz_archive_lookup *fz_new_archive_lookup(fz_context *ctx, fz_archive *arch);
+int fz_lookup_archive_entry(fz_context *ctx, fz_archive_lookup *lookup, const char *name);
+void fz_drop_archive_lookup(fz_context *ctx, fz_archive_lookup *lookup);
+
+/*
+	fz_open_archive_range: Open a stream on len bytes of an archive
+	file, starting at offset. Like fz_open_null, but the file is
+	only seeked and read while holding the FZ_LOCK_ARCHIVE lock, so
+	that several threads can read entries of the same archive.
+
+	Takes ownership of file. For archive implementations only.
+*/
+fz_stream *fz_open_archive_range(fz_context *ctx, fz_stream *file, int len, fz_off_t offset);
+
+/*
+	fz_path_data_size: Return the number of bytes a path holds in
+	memory outside of the block returned by fz_packed_path_size,
+	that is the commands and coordinates of unpacked and open
+	packed paths.
+
+	For internal use only.
+*/
+size_t fz_path_data_size(const fz_path *path);
+
 #endif
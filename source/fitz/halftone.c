@@ -519,12 +519,52 @@ static int gcd(int u, int v)
 	while (1);
 }
 
+typedef struct
+{
+	fz_pixmap *pix;
+	fz_bitmap *out;
+	fz_halftone *ht;
+	threshold_fn *thresh;
+	int band_start;
+	int lcm;
+} fz_halftone_rows_job;
+
+static void
+halftone_rows(fz_context *ctx, void *arg, int y0, int y1)
+{
+	fz_halftone_rows_job *job = arg;
+	fz_pixmap *pix = job->pix;
+	fz_bitmap *out = job->out;
+	unsigned char *ht_line;
+	unsigned char *o, *p;
+	int w, h, x, y, ostride, pstride, lcm = job->lcm;
+
+	ht_line = fz_malloc(ctx, lcm * pix->n);
+	o = out->samples + (size_t)y0 * out->stride;
+	p = pix->samples + (size_t)y0 * pix->stride;
+
+	h = y1 - y0;
+	x = pix->x;
+	y = pix->y + job->band_start + y0;
+	w = pix->w;
+	ostride = out->stride;
+	pstride = pix->stride;
+	while (h--)
+	{
+		make_ht_line(ht_line, job->ht, x, y++, lcm);
+		job->thresh(ht_line, p, o, w, lcm);
+		o += ostride;
+		p += pstride;
+	}
+
+	fz_free(ctx, ht_line);
+}
+
 fz_bitmap *fz_new_bitmap_from_pixmap_band(fz_context *ctx, fz_pixmap *pix, fz_halftone *ht, int band_start)
 {
+	fz_halftone_rows_job job;
 	fz_bitmap *out = NULL;
-	unsigned char *ht_line = NULL;
-	unsigned char *o, *p;
-	int w, h, x, y, n, pstride, ostride, lcm, i;
+	int w, n, lcm, i;
 	fz_halftone *ht_ = NULL;
 	threshold_fn *thresh;
 
@@ -534,7 +574,6 @@ fz_bitmap *fz_new_bitmap_from_pixmap_band(fz_context *ctx, fz_pixmap *pix, fz_ha
 	if (pix->alpha != 0)
 		fz_throw(ctx, FZ_ERROR_GENERIC, "pixmap may not have alpha channel to convert to bitmap");
 
-	fz_var(ht_line);
 	fz_var(out);
 
 	n = pix->n;
@@ -571,32 +610,22 @@ fz_bitmap *fz_new_bitmap_from_pixmap_band(fz_context *ctx, fz_pixmap *pix, fz_ha
 
 	fz_try(ctx)
 	{
-		ht_line = fz_malloc(ctx, lcm * n);
 		out = fz_new_bitmap(ctx, pix->w, pix->h, n, pix->xres, pix->yres);
-		o = out->samples;
-		p = pix->samples;
-
-		h = pix->h;
-		x = pix->x;
-		y = pix->y + band_start;
-		w = pix->w;
-		ostride = out->stride;
-		pstride = pix->stride;
-		while (h--)
-		{
-			make_ht_line(ht_line, ht, x, y++, lcm);
-			thresh(ht_line, p, o, w, lcm);
-			o += ostride;
-			p += pstride;
-		}
+		job.pix = pix;
+		job.out = out;
+		job.ht = ht;
+		job.thresh = thresh;
+		job.band_start = band_start;
+		job.lcm = lcm;
+		fz_parallel_rows(ctx, pix->h, halftone_rows, &job);
 	}
 	fz_always(ctx)
-	{
 		fz_drop_halftone(ctx, ht_);
-		fz_free(ctx, ht_line);
-	}
 	fz_catch(ctx)
+	{
+		fz_drop_bitmap(ctx, out);
 		fz_rethrow(ctx);
+	}
 
 	return out;
 }
@@ -283,11 +283,9 @@ fz_decomp_image_from_stream(fz_context *ctx, fz_stream *stm, fz_compressed_image
 			int l_margin = subarea->x0 >> l2factor;
 			int t_margin = subarea->y0 >> l2factor;
 			int r_margin = (image->w + f - 1 - subarea->x1) >> l2factor;
-			int b_margin = (image->h + f - 1 - subarea->y1) >> l2factor;
 			int l_skip = (l_margin * image->n * image->bpc)/8;
 			int r_skip = (r_margin * image->n * image->bpc + 7)/8;
 			size_t t_skip = t_margin * stream_stride + l_skip;
-			size_t b_skip = b_margin * stream_stride + r_skip;
 			size_t l = fz_skip(ctx, stm, t_skip);
 			len = 0;
 			if (l == t_skip)
@@ -307,7 +305,9 @@ fz_decomp_image_from_stream(fz_context *ctx, fz_stream *stm, fz_compressed_image
 						break;
 				}
 				while (1);
-				(void)fz_skip(ctx, stm, r_skip + b_skip);
+				/* Stop once we have the last row of the subarea. The
+				 * stream is dropped unread, so the decoder never has
+				 * to produce the rows below it. */
 			}
 		}
 		else
@@ -430,7 +430,9 @@ compressed_image_get_pixmap(fz_context *ctx, fz_image *image_, fz_irect *subarea
 		tile = fz_load_bmp(ctx, image->buffer->buffer->data, image->buffer->buffer->len);
 		break;
 	case FZ_IMAGE_TIFF:
-		tile = fz_load_tiff(ctx, image->buffer->buffer->data, image->buffer->buffer->len);
+		tile = fz_load_tiff_subimage_area(ctx, image->buffer->buffer->data, image->buffer->buffer->len,
+			image->buffer->params.u.tiff.subimage, subarea, l2factor);
+		can_sub = 1;
 		break;
 	case FZ_IMAGE_PNM:
 		tile = fz_load_pnm(ctx, image->buffer->buffer->data, image->buffer->buffer->len);
@@ -721,6 +723,151 @@ fz_get_pixmap_from_image(fz_context *ctx, fz_image *image, const fz_irect *subar
 	return tile;
 }
 
+/* The set's own reference to a job is dropped when the image is taken
+ * out of the set; the hook's when the job has run. */
+enum { PREFETCH_QUEUED, PREFETCH_RUNNING, PREFETCH_DONE, PREFETCH_CANCELLED };
+
+typedef struct fz_image_prefetch_job_s fz_image_prefetch_job;
+
+struct fz_image_prefetch_job_s
+{
+	int refs;
+	int state; /* protected by FZ_LOCK_ALLOC */
+	fz_image *image;
+	size_t size;
+	fz_image_prefetch_job *next;
+};
+
+struct fz_image_prefetch_s
+{
+	fz_image_prefetch_job *jobs;
+	size_t size;
+};
+
+static void
+drop_prefetch_job(fz_context *ctx, fz_image_prefetch_job *job)
+{
+	if (fz_drop_imp(ctx, job, &job->refs))
+	{
+		fz_drop_image(ctx, job->image);
+		fz_free(ctx, job);
+	}
+}
+
+static void
+prefetch_image_job(fz_context *ctx, void *arg, int i)
+{
+	fz_image_prefetch_job *job = arg;
+	fz_pixmap *pix = NULL;
+	int run;
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	run = (job->state == PREFETCH_QUEUED);
+	if (run)
+		job->state = PREFETCH_RUNNING;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+
+	fz_var(pix);
+
+	if (run)
+	{
+		fz_try(ctx)
+			pix = fz_get_pixmap_from_image(ctx, job->image, NULL, NULL, NULL, NULL);
+		fz_always(ctx)
+			fz_drop_pixmap(ctx, pix);
+		fz_catch(ctx)
+			fz_warn(ctx, "cannot decode image ahead: %s", fz_caught_message(ctx));
+
+		fz_lock(ctx, FZ_LOCK_ALLOC);
+		job->state = PREFETCH_DONE;
+		fz_unlock(ctx, FZ_LOCK_ALLOC);
+	}
+
+	drop_prefetch_job(ctx, job);
+}
+
+fz_image_prefetch *
+fz_new_image_prefetch(fz_context *ctx)
+{
+	return fz_malloc_struct(ctx, fz_image_prefetch);
+}
+
+void
+fz_drop_image_prefetch(fz_context *ctx, fz_image_prefetch *prefetch)
+{
+	if (!prefetch)
+		return;
+	fz_cancel_image_prefetch(ctx, prefetch);
+	fz_free(ctx, prefetch);
+}
+
+int
+fz_prefetch_image(fz_context *ctx, fz_image_prefetch *prefetch, fz_image *image)
+{
+	fz_tuning_context *tuning = ctx->tuning;
+	fz_image_prefetch_job *job;
+	size_t size = (size_t)image->w * image->h * image->n;
+
+	if (!tuning->background || prefetch->size + size > tuning->prefetch_budget)
+		return 0;
+
+	job = fz_malloc_struct(ctx, fz_image_prefetch_job);
+	job->refs = 2;
+	job->state = PREFETCH_QUEUED;
+	job->image = fz_keep_image(ctx, image);
+	job->size = size;
+	if (tuning->background(tuning->background_arg, ctx, prefetch_image_job, job))
+	{
+		fz_drop_image(ctx, job->image);
+		fz_free(ctx, job);
+		return 0;
+	}
+
+	job->next = prefetch->jobs;
+	prefetch->jobs = job;
+	prefetch->size += size;
+	return 1;
+}
+
+static void
+cancel_prefetch_job(fz_context *ctx, fz_image_prefetch *prefetch, fz_image_prefetch_job *job)
+{
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	if (job->state == PREFETCH_QUEUED)
+		job->state = PREFETCH_CANCELLED;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+	prefetch->size -= job->size;
+	drop_prefetch_job(ctx, job);
+}
+
+void
+fz_release_prefetched_image(fz_context *ctx, fz_image_prefetch *prefetch, fz_image *image)
+{
+	fz_image_prefetch_job **jobp, *job;
+
+	for (jobp = &prefetch->jobs; (job = *jobp) != NULL; jobp = &job->next)
+	{
+		if (job->image == image)
+		{
+			*jobp = job->next;
+			cancel_prefetch_job(ctx, prefetch, job);
+			return;
+		}
+	}
+}
+
+void
+fz_cancel_image_prefetch(fz_context *ctx, fz_image_prefetch *prefetch)
+{
+	fz_image_prefetch_job *job;
+
+	while ((job = prefetch->jobs) != NULL)
+	{
+		prefetch->jobs = job->next;
+		cancel_prefetch_job(ctx, prefetch, job);
+	}
+}
+
 static size_t
 pixmap_image_get_size(fz_context *ctx, fz_image *image)
 {
@@ -994,6 +1141,155 @@ fz_new_image_from_file(fz_context *ctx, const char *path)
 	return image;
 }
 
+/*
+	Images of archive entries keep a reference to the archive instead
+	of the compressed data, and read the entry again each time they are
+	decoded, so the compressed data is never held in memory. Only JPEG
+	can be decoded from a stream; other formats are read into a buffer.
+*/
+
+#define ARCHIVE_IMAGE_HEADER_SIZE (64 << 10)
+
+typedef struct fz_archive_image_s fz_archive_image;
+
+struct fz_archive_image_s
+{
+	fz_compressed_image super;
+	fz_archive *arch;
+	char *name;
+	fz_compression_params params;
+};
+
+static void
+drop_archive_image(fz_context *ctx, fz_image *image_)
+{
+	fz_archive_image *image = (fz_archive_image *)image_;
+
+	fz_drop_pixmap(ctx, image->super.tile);
+	fz_drop_archive(ctx, image->arch);
+	fz_free(ctx, image->name);
+}
+
+static size_t
+archive_image_get_size(fz_context *ctx, fz_image *image_)
+{
+	fz_archive_image *image = (fz_archive_image *)image_;
+
+	if (image == NULL)
+		return 0;
+
+	return sizeof(fz_archive_image) + fz_pixmap_size(ctx, image->super.tile);
+}
+
+static fz_pixmap *
+archive_image_get_pixmap(fz_context *ctx, fz_image *image_, fz_irect *subarea, int w, int h, int *l2factor)
+{
+	fz_archive_image *image = (fz_archive_image *)image_;
+	int native_l2factor = l2factor ? *l2factor : 0;
+	fz_stream *stm;
+	fz_pixmap *tile;
+
+	stm = fz_open_archive_entry(ctx, image->arch, image->name);
+	stm = fz_open_image_decomp_stream(ctx, stm, &image->params, l2factor);
+	if (l2factor)
+		native_l2factor -= *l2factor;
+
+	tile = fz_decomp_image_from_stream(ctx, stm, &image->super, subarea, 0, native_l2factor);
+
+	/* CMYK JPEGs in XPS documents have to be inverted */
+	if (image_->invert_cmyk_jpeg &&
+		image_->colorspace == fz_device_cmyk(ctx) &&
+		image->params.u.jpeg.color_transform)
+	{
+		fz_invert_pixmap(ctx, tile);
+	}
+
+	return tile;
+}
+
+static int
+load_archive_jpeg_info(fz_context *ctx, fz_buffer *buf, int *w, int *h, int *xres, int *yres, fz_colorspace **cspace)
+{
+	int ok = 0;
+
+	/* The frame header may lie beyond the part we have read, after
+	 * large metadata segments, in which case the caller falls back
+	 * to reading the whole entry. */
+	fz_try(ctx)
+	{
+		fz_load_jpeg_info(ctx, buf->data, buf->len, w, h, xres, yres, cspace);
+		ok = (*w > 0 && *h > 0);
+	}
+	fz_catch(ctx)
+		ok = 0;
+
+	return ok;
+}
+
+fz_image *
+fz_new_image_from_archive_entry(fz_context *ctx, fz_archive *arch, const char *name)
+{
+	fz_archive_image *image = NULL;
+	fz_image *result = NULL;
+	fz_buffer *buf = NULL;
+	fz_stream *stm;
+	fz_colorspace *cspace;
+	int w, h, xres, yres;
+	size_t n;
+
+	stm = fz_open_archive_entry(ctx, arch, name);
+
+	fz_var(image);
+	fz_var(buf);
+
+	fz_try(ctx)
+	{
+		/* Entries that are no bigger than a JPEG header would be are
+		 * kept in memory like any other image. */
+		buf = fz_new_buffer(ctx, ARCHIVE_IMAGE_HEADER_SIZE);
+		buf->len = fz_read(ctx, stm, buf->data, ARCHIVE_IMAGE_HEADER_SIZE);
+		if (buf->len == ARCHIVE_IMAGE_HEADER_SIZE &&
+			buf->data[0] == 0xff && buf->data[1] == 0xd8 &&
+			load_archive_jpeg_info(ctx, buf, &w, &h, &xres, &yres, &cspace))
+		{
+			/* Note: cspace is only ever a borrowed reference here */
+			image = fz_new_derived_image(ctx, w, h, 8, cspace, xres, yres, 0, 0, NULL, NULL, NULL,
+					fz_archive_image,
+					archive_image_get_pixmap,
+					archive_image_get_size,
+					drop_archive_image);
+			image->arch = fz_keep_archive(ctx, arch);
+			image->name = fz_strdup(ctx, name);
+			image->params.type = FZ_IMAGE_JPEG;
+			image->params.u.jpeg.color_transform = -1;
+			result = &image->super.super;
+		}
+		else
+		{
+			while ((n = fz_available(ctx, stm, 4096)) > 0)
+			{
+				fz_append_data(ctx, buf, stm->rp, n);
+				stm->rp += n;
+			}
+			fz_trim_buffer(ctx, buf);
+			result = fz_new_image_from_buffer(ctx, buf);
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_drop_buffer(ctx, buf);
+		fz_drop_stream(ctx, stm);
+	}
+	fz_catch(ctx)
+	{
+		if (image)
+			fz_drop_image(ctx, &image->super.super);
+		fz_rethrow(ctx);
+	}
+
+	return result;
+}
+
 void
 fz_image_resolution(fz_image *image, int *xres, int *yres)
 {
@@ -1,4 +1,4 @@
-#include "mupdf/fitz.h"
+#include "fitz-imp.h"
 
 #include <assert.h>
 #include <string.h>
@@ -1794,3 +1794,253 @@ visible:
 	fz_drop_stroke_state(ctx, stroke);
 	fz_drop_path(ctx, path);
 }
+
+static size_t
+fz_text_size(fz_context *ctx, const fz_text *text)
+{
+	size_t size = sizeof(fz_text);
+	fz_text_span *span;
+
+	for (span = text->head; span; span = span->next)
+		size += sizeof(fz_text_span) + (size_t)span->cap * sizeof(fz_text_item);
+	return size;
+}
+
+/* The memory a list holds: its nodes and the paths, text, stroke
+ * states and shadings they own. Images, fonts and colorspaces are
+ * shared with the document and accounted for where they are kept. */
+static size_t
+fz_display_list_size(fz_context *ctx, fz_display_list *list)
+{
+	fz_display_node *node = list->list;
+	fz_display_node *node_end = list->list + list->len;
+	size_t size = sizeof(*list) + (size_t)list->max * sizeof(fz_display_node);
+	int cs_n = 1;
+
+	while (node != node_end)
+	{
+		fz_display_node n = *node;
+		fz_display_node *next = node + n.size;
+
+		node++;
+		if (n.rect)
+			node += SIZE_IN_NODES(sizeof(fz_rect));
+		switch (n.cs)
+		{
+		default:
+		case CS_UNCHANGED:
+			break;
+		case CS_GRAY_0:
+		case CS_GRAY_1:
+			cs_n = 1;
+			break;
+		case CS_RGB_0:
+		case CS_RGB_1:
+			cs_n = 3;
+			break;
+		case CS_CMYK_0:
+		case CS_CMYK_1:
+			cs_n = 4;
+			break;
+		case CS_OTHER_0:
+			cs_n = fz_colorspace_n(ctx, *(fz_colorspace **)node);
+			node += SIZE_IN_NODES(sizeof(fz_colorspace *));
+			break;
+		}
+		if (n.color)
+			node += SIZE_IN_NODES(cs_n * sizeof(float));
+		if (n.alpha == ALPHA_PRESENT)
+			node += SIZE_IN_NODES(sizeof(float));
+		if (n.ctm & CTM_CHANGE_AD)
+			node += SIZE_IN_NODES(2*sizeof(float));
+		if (n.ctm & CTM_CHANGE_BC)
+			node += SIZE_IN_NODES(2*sizeof(float));
+		if (n.ctm & CTM_CHANGE_EF)
+			node += SIZE_IN_NODES(2*sizeof(float));
+		if (n.stroke)
+		{
+			size += sizeof(fz_stroke_state);
+			node += SIZE_IN_NODES(sizeof(fz_stroke_state *));
+		}
+		if (n.path)
+		{
+			size += fz_path_data_size((fz_path *)node);
+			node += SIZE_IN_NODES(fz_packed_path_size((fz_path *)node));
+		}
+		switch (n.cmd)
+		{
+		case FZ_CMD_FILL_TEXT:
+		case FZ_CMD_STROKE_TEXT:
+		case FZ_CMD_CLIP_TEXT:
+		case FZ_CMD_CLIP_STROKE_TEXT:
+		case FZ_CMD_IGNORE_TEXT:
+			size += fz_text_size(ctx, *(fz_text **)node);
+			break;
+		case FZ_CMD_FILL_SHADE:
+			size += sizeof(fz_shade) + fz_compressed_buffer_size((*(fz_shade **)node)->buffer);
+			break;
+		}
+		node = next;
+	}
+	return size;
+}
+
+typedef struct fz_page_list_key_s fz_page_list_key;
+
+struct fz_page_list_key_s
+{
+	int refs;
+	fz_document *doc;
+	int number;
+};
+
+static int
+fz_make_hash_page_list_key(fz_context *ctx, fz_store_hash *hash, void *key_)
+{
+	fz_page_list_key *key = (fz_page_list_key *)key_;
+	hash->u.pi.ptr = key->doc;
+	hash->u.pi.i = key->number;
+	return 1;
+}
+
+static void *
+fz_keep_page_list_key(fz_context *ctx, void *key_)
+{
+	fz_page_list_key *key = (fz_page_list_key *)key_;
+	return fz_keep_imp(ctx, key, &key->refs);
+}
+
+static void
+fz_drop_page_list_key(fz_context *ctx, void *key_)
+{
+	fz_page_list_key *key = (fz_page_list_key *)key_;
+	if (fz_drop_imp(ctx, key, &key->refs))
+		fz_free(ctx, key);
+}
+
+static int
+fz_cmp_page_list_key(fz_context *ctx, void *k0_, void *k1_)
+{
+	fz_page_list_key *k0 = (fz_page_list_key *)k0_;
+	fz_page_list_key *k1 = (fz_page_list_key *)k1_;
+	return k0->doc != k1->doc || k0->number != k1->number;
+}
+
+static void
+fz_format_page_list_key(fz_context *ctx, char *s, int n, void *key_)
+{
+	fz_page_list_key *key = (fz_page_list_key *)key_;
+	fz_snprintf(s, n, "(page list %d)", key->number);
+}
+
+static const fz_store_type fz_page_list_store_type =
+{
+	fz_make_hash_page_list_key,
+	fz_keep_page_list_key,
+	fz_drop_page_list_key,
+	fz_cmp_page_list_key,
+	fz_format_page_list_key,
+	NULL
+};
+
+static fz_display_list *
+fz_record_page_list(fz_context *ctx, fz_page *page, fz_page_run_page_contents_fn *run, fz_cookie *cookie)
+{
+	fz_display_list *list;
+	fz_device *dev = NULL;
+	fz_rect bounds;
+
+	fz_var(dev);
+
+	list = fz_new_display_list(ctx, fz_bound_page(ctx, page, &bounds));
+	fz_try(ctx)
+	{
+		dev = fz_new_list_device(ctx, list);
+		run(ctx, page, dev, &fz_identity, cookie);
+		fz_close_device(ctx, dev);
+	}
+	fz_always(ctx)
+		fz_drop_device(ctx, dev);
+	fz_catch(ctx)
+	{
+		fz_drop_display_list(ctx, list);
+		fz_rethrow(ctx);
+	}
+	return list;
+}
+
+void
+fz_run_page_contents_cached(fz_context *ctx, fz_document *doc, int number, fz_page *page, fz_page_run_page_contents_fn *run, fz_device *dev, const fz_matrix *transform, fz_cookie *cookie)
+{
+	fz_page_list_key key;
+	fz_page_list_key *keyp = NULL;
+	fz_display_list *list;
+	fz_display_list *existing;
+	int errors;
+
+	fz_var(keyp);
+	fz_var(list);
+
+	key.refs = 1;
+	key.doc = doc;
+	key.number = number;
+
+	list = fz_find_item(ctx, fz_drop_display_list_imp, &key, &fz_page_list_store_type);
+	if (!list && dev->fill_path == fz_list_fill_path)
+	{
+		/* The caller is recording a list already, and would only
+		 * pay for recording the page twice. */
+		run(ctx, page, dev, transform, cookie);
+		return;
+	}
+	if (!list)
+	{
+		errors = cookie ? cookie->errors : 0;
+		list = fz_record_page_list(ctx, page, run, cookie);
+
+		/* Only keep lists that hold the complete page. */
+		if (!cookie || (!cookie->abort && cookie->errors == errors))
+		{
+			fz_try(ctx)
+			{
+				keyp = fz_malloc_struct(ctx, fz_page_list_key);
+				keyp->refs = 1;
+				keyp->doc = doc;
+				keyp->number = number;
+				existing = fz_store_item(ctx, keyp, list, fz_display_list_size(ctx, list), &fz_page_list_store_type);
+				if (existing)
+				{
+					/* Another thread recorded the page at the same time. */
+					fz_drop_display_list(ctx, list);
+					list = existing;
+				}
+			}
+			fz_always(ctx)
+				fz_drop_page_list_key(ctx, keyp);
+			fz_catch(ctx)
+			{
+				/* Do nothing */
+			}
+		}
+	}
+
+	fz_try(ctx)
+		fz_run_display_list(ctx, list, dev, transform, &fz_infinite_rect, cookie);
+	fz_always(ctx)
+		fz_drop_display_list(ctx, list);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+static int
+fz_page_list_key_is_doc(fz_context *ctx, void *doc, void *key_)
+{
+	fz_page_list_key *key = (fz_page_list_key *)key_;
+	return key->doc == doc;
+}
+
+void
+fz_drop_cached_page_lists(fz_context *ctx, fz_document *doc)
+{
+	fz_filter_store(ctx, fz_page_list_key_is_doc, doc, &fz_page_list_store_type);
+}
@@ -68,6 +68,9 @@ struct tiff
 	unsigned char *profile;
 	int profilesize;
 
+	/* area of the image to decode, aligned to whole tiles or strips */
+	unsigned rx, ry, rw, rh;
+
 	/* decoded data */
 	fz_colorspace *colorspace;
 	unsigned char *samples;
@@ -247,19 +250,19 @@ tiff_expand_colormap(fz_context *ctx, struct tiff *tiff)
 	if (tiff->colormaplen < (unsigned)maxval * 3)
 		fz_throw(ctx, FZ_ERROR_GENERIC, "insufficient colormap data");
 
-	if (tiff->imagelength > UINT_MAX / tiff->imagewidth / (tiff->samplesperpixel + 2))
+	if (tiff->rh > UINT_MAX / tiff->rw / (tiff->samplesperpixel + 2))
 		fz_throw(ctx, FZ_ERROR_GENERIC, "image too large");
 
-	stride = tiff->imagewidth * (tiff->samplesperpixel + 2);
+	stride = tiff->rw * (tiff->samplesperpixel + 2);
 
-	samples = fz_malloc(ctx, stride * tiff->imagelength);
+	samples = fz_malloc(ctx, stride * tiff->rh);
 
-	for (y = 0; y < tiff->imagelength; y++)
+	for (y = 0; y < tiff->rh; y++)
 	{
 		src = tiff->samples + (unsigned int)(tiff->stride * y);
 		dst = samples + (unsigned int)(stride * y);
 
-		for (x = 0; x < tiff->imagewidth; x++)
+		for (x = 0; x < tiff->rw; x++)
 		{
 			if (tiff->extrasamples)
 			{
@@ -416,8 +419,8 @@ tiff_paste_tile(fz_context *ctx, struct tiff *tiff, unsigned char *tile, unsigne
 				unsigned char *dst, *src;
 
 				dst = tiff->samples;
-				dst += (row + y) * tiff->stride;
-				dst += (((col + x) * tiff->samplesperpixel + k) * tiff->bitspersample + 7) / 8;
+				dst += (row + y - tiff->ry) * tiff->stride;
+				dst += (((col + x - tiff->rx) * tiff->samplesperpixel + k) * tiff->bitspersample + 7) / 8;
 
 				src = tile;
 				src += y * tiff->tilestride;
@@ -425,9 +428,9 @@ tiff_paste_tile(fz_context *ctx, struct tiff *tiff, unsigned char *tile, unsigne
 
 				switch (tiff->bitspersample)
 				{
-				case 1: *dst |= (*src >> (7 - 1 * ((col + x) % 8))) & 0x1; break;
-				case 2: *dst |= (*src >> (6 - 2 * ((col + x) % 4))) & 0x3; break;
-				case 4: *dst |= (*src >> (4 - 4 * ((col + x) % 2))) & 0xf; break;
+				case 1: *dst |= (*src >> (7 - 1 * ((col + x - tiff->rx) % 8))) & 0x1; break;
+				case 2: *dst |= (*src >> (6 - 2 * ((col + x - tiff->rx) % 4))) & 0x3; break;
+				case 4: *dst |= (*src >> (4 - 4 * ((col + x - tiff->rx) % 2))) & 0xf; break;
 				case 8: *dst = *src; break;
 				case 16: dst[0] = src[0]; dst[1] = src[1]; break;
 				}
@@ -492,8 +495,9 @@ tiff_paste_subsampled_tile(fz_context *ctx, struct tiff *tiff, unsigned char *ti
 	assert(tiff->samplesperpixel == 3);
 	assert(tiff->bitspersample == 8);
 
-	w = tiff->imagewidth;
-	h = tiff->imagelength;
+	/* samples only hold the area being decoded */
+	w = tiff->rx + tiff->rw;
+	h = tiff->ry + tiff->rh;
 
 	sx = 0;
 	sy = 0;
@@ -510,7 +514,7 @@ tiff_paste_subsampled_tile(fz_context *ctx, struct tiff *tiff, unsigned char *ti
 	y = row;
 	k = 0;
 
-	dst = &tiff->samples[row * tiff->stride + col * 3];
+	dst = &tiff->samples[(row - tiff->ry) * tiff->stride + (col - tiff->rx) * 3];
 
 	while (src < tile + len)
 	{
@@ -550,11 +554,9 @@ tiff_paste_subsampled_tile(fz_context *ctx, struct tiff *tiff, unsigned char *ti
 				x += sw;
 				if (x >= col + tw)
 				{
-					dst -= (x - (col + tw)) * 3;
-					dst += (sh - 1) * w * 3;
-					dst += col * 3;
 					x = col;
 					y += sh;
+					dst = &tiff->samples[(y - tiff->ry) * tiff->stride + (col - tiff->rx) * 3];
 				}
 			}
 		}
@@ -567,7 +569,7 @@ static void
 tiff_decode_tiles(fz_context *ctx, struct tiff *tiff)
 {
 	unsigned char *data;
-	unsigned x, y, wlen, tile;
+	unsigned row, col, wlen, tile;
 	unsigned tiles, tilesacross, tilesdown;
 
 	tilesdown = (tiff->imagelength + tiff->tilelength - 1) / tiff->tilelength;
@@ -584,59 +586,58 @@ tiff_decode_tiles(fz_context *ctx, struct tiff *tiff)
 			wlen = tiff->tilestride * tiff->tilelength;
 		else
 			wlen = tiff->tilestride * tiff->ycbcrsubsamp[1];
-
-		data = tiff->data = fz_malloc(ctx, wlen);
-
-		tile = 0;
-		for (x = 0; x < tiff->imagelength; x += tiff->tilelength)
-		{
-			for (y = 0; y < tiff->imagewidth; y += tiff->tilewidth)
-			{
-				unsigned int offset = tiff->tileoffsets[tile];
-				unsigned int rlen = tiff->tilebytecounts[tile];
-				unsigned char *rp = tiff->bp + offset;
-				unsigned decoded;
-
-				if (offset > (unsigned)(tiff->ep - tiff->bp))
-					fz_throw(ctx, FZ_ERROR_GENERIC, "invalid tile offset %u", offset);
-				if (rlen > (unsigned)(tiff->ep - rp))
-					fz_throw(ctx, FZ_ERROR_GENERIC, "invalid tile byte count %u", rlen);
-
-				decoded = tiff_decode_data(ctx, tiff, rp, rlen, data, wlen);
-				tiff_paste_subsampled_tile(ctx, tiff, data, decoded, tiff->tilewidth, tiff->tilelength, x, y);
-				tile++;
-			}
-		}
 	}
 	else
-	{
 		wlen = tiff->tilelength * tiff->tilestride;
-		data = tiff->data = fz_malloc(ctx, wlen);
 
-		tile = 0;
-		for (x = 0; x < tiff->imagelength; x += tiff->tilelength)
+	data = tiff->data = fz_malloc(ctx, wlen);
+
+	/* Only decode the tiles that intersect the area we want */
+	for (row = tiff->ry; row < tiff->ry + tiff->rh; row += tiff->tilelength)
+	{
+		for (col = tiff->rx; col < tiff->rx + tiff->rw; col += tiff->tilewidth)
 		{
-			for (y = 0; y < tiff->imagewidth; y += tiff->tilewidth)
-			{
-				unsigned int offset = tiff->tileoffsets[tile];
-				unsigned int rlen = tiff->tilebytecounts[tile];
-				unsigned char *rp = tiff->bp + offset;
+			unsigned int offset, rlen;
+			unsigned char *rp;
+
+			tile = (row / tiff->tilelength) * tilesacross + col / tiff->tilewidth;
+			offset = tiff->tileoffsets[tile];
+			rlen = tiff->tilebytecounts[tile];
+			rp = tiff->bp + offset;
 
-				if (offset > (unsigned)(tiff->ep - tiff->bp))
-					fz_throw(ctx, FZ_ERROR_GENERIC, "invalid tile offset %u", offset);
-				if (rlen > (unsigned)(tiff->ep - rp))
-					fz_throw(ctx, FZ_ERROR_GENERIC, "invalid tile byte count %u", rlen);
+			if (offset > (unsigned)(tiff->ep - tiff->bp))
+				fz_throw(ctx, FZ_ERROR_GENERIC, "invalid tile offset %u", offset);
+			if (rlen > (unsigned)(tiff->ep - rp))
+				fz_throw(ctx, FZ_ERROR_GENERIC, "invalid tile byte count %u", rlen);
 
+			if (tiff->photometric == 6 && tiff->compression != 6 && tiff->compression != 7)
+			{
+				unsigned decoded = tiff_decode_data(ctx, tiff, rp, rlen, data, wlen);
+				tiff_paste_subsampled_tile(ctx, tiff, data, decoded, tiff->tilewidth, tiff->tilelength, col, row);
+			}
+			else
+			{
 				if (tiff_decode_data(ctx, tiff, rp, rlen, data, wlen) != wlen)
 					fz_throw(ctx, FZ_ERROR_GENERIC, "decoded tile is the wrong size");
-
-				tiff_paste_tile(ctx, tiff, data, x, y);
-				tile++;
+				tiff_paste_tile(ctx, tiff, data, row, col);
 			}
 		}
 	}
 }
 
+static unsigned
+tiff_strip_step(struct tiff *tiff)
+{
+	/* JPEG can handle subsampling on its own */
+	if (tiff->photometric == 6 && tiff->compression != 6 && tiff->compression != 7)
+	{
+		/* regardless of how this is subsampled, a strip is never taller */
+		if (tiff->rowsperstrip < tiff->ycbcrsubsamp[1])
+			return tiff->ycbcrsubsamp[1];
+	}
+	return tiff->rowsperstrip;
+}
+
 static void
 tiff_decode_strips(fz_context *ctx, struct tiff *tiff)
 {
@@ -655,25 +656,22 @@ tiff_decode_strips(fz_context *ctx, struct tiff *tiff)
 	if (tiff->photometric == 6 && tiff->compression != 6 && tiff->compression != 7)
 	{
 		unsigned wlen;
-		unsigned rowsperstrip;
-
-		/* regardless of how this is subsampled, a strip is never taller */
-		if (tiff->rowsperstrip >= tiff->ycbcrsubsamp[1])
-			rowsperstrip = tiff->rowsperstrip;
-		else
-			rowsperstrip = tiff->ycbcrsubsamp[1];
+		unsigned rowsperstrip = tiff_strip_step(tiff);
 
 		wlen = rowsperstrip * tiff->stride;
 		data = tiff->data = fz_malloc(ctx, wlen);
 
-		strip = 0;
-		for (y = 0; y < tiff->imagelength; y += rowsperstrip)
+		for (y = tiff->ry; y < tiff->ry + tiff->rh; y += rowsperstrip)
 		{
-			unsigned offset = tiff->stripoffsets[strip];
-			unsigned rlen = tiff->stripbytecounts[strip];
-			unsigned char *rp = tiff->bp + offset;
+			unsigned offset, rlen;
+			unsigned char *rp;
 			int decoded;
 
+			strip = y / rowsperstrip;
+			offset = tiff->stripoffsets[strip];
+			rlen = tiff->stripbytecounts[strip];
+			rp = tiff->bp + offset;
+
 			if (offset > (unsigned)(tiff->ep - tiff->bp))
 				fz_throw(ctx, FZ_ERROR_GENERIC, "invalid strip offset %u", offset);
 			if (rlen > (unsigned)(tiff->ep - rp))
@@ -681,18 +679,20 @@ tiff_decode_strips(fz_context *ctx, struct tiff *tiff)
 
 			decoded = tiff_decode_data(ctx, tiff, rp, rlen, data, wlen);
 			tiff_paste_subsampled_tile(ctx, tiff, data, decoded, tiff->imagewidth, tiff->rowsperstrip, 0, y);
-			strip++;
 		}
 	}
 	else
 	{
-		strip = 0;
-		for (y = 0; y < tiff->imagelength; y += tiff->rowsperstrip)
+		for (y = tiff->ry; y < tiff->ry + tiff->rh; y += tiff->rowsperstrip)
 		{
-			unsigned offset = tiff->stripoffsets[strip];
-			unsigned rlen = tiff->stripbytecounts[strip];
+			unsigned offset, rlen;
 			unsigned wlen = tiff->stride * tiff->rowsperstrip;
-			unsigned char *rp = tiff->bp + offset;
+			unsigned char *rp;
+
+			strip = y / tiff->rowsperstrip;
+			offset = tiff->stripoffsets[strip];
+			rlen = tiff->stripbytecounts[strip];
+			rp = tiff->bp + offset;
 
 			if (offset > (unsigned)(tiff->ep - tiff->bp))
 				fz_throw(ctx, FZ_ERROR_GENERIC, "invalid strip offset %u", offset);
@@ -710,7 +710,6 @@ tiff_decode_strips(fz_context *ctx, struct tiff *tiff)
 			}
 
 			data += wlen;
-			strip ++;
 		}
 	}
 }
@@ -1067,10 +1066,10 @@ tiff_ycc_to_rgb(fz_context *ctx, struct tiff *tiff)
 {
 	unsigned x, y;
 
-	for (y = 0; y < tiff->imagelength; y++)
+	for (y = 0; y < tiff->rh; y++)
 	{
 		unsigned char * row = &tiff->samples[tiff->stride * y];
-		for (x = 0; x < tiff->imagewidth; x++)
+		for (x = 0; x < tiff->rw; x++)
 		{
 			int ycc[3];
 			ycc[0] = row[x * 3 + 0];
@@ -1221,15 +1220,75 @@ tiff_decode_ifd(fz_context *ctx, struct tiff *tiff)
 	}
 }
 
+static int
+tiff_is_tiled(struct tiff *tiff)
+{
+	return tiff->tilelength && tiff->tilewidth && tiff->tileoffsets && tiff->tilebytecounts;
+}
+
+static void
+tiff_set_region(fz_context *ctx, struct tiff *tiff, const fz_irect *area)
+{
+	unsigned x0 = 0, y0 = 0, x1 = tiff->imagewidth, y1 = tiff->imagelength;
+
+	if (area && area->x0 < area->x1 && area->y0 < area->y1)
+	{
+		if (area->x0 > 0) x0 = fz_mini(area->x0, x1);
+		if (area->y0 > 0) y0 = fz_mini(area->y0, y1);
+		if (area->x1 > 0) x1 = fz_mini(area->x1, x1);
+		if (area->y1 > 0) y1 = fz_mini(area->y1, y1);
+		if (x0 >= x1 || y0 >= y1)
+		{
+			x0 = y0 = 0;
+			x1 = tiff->imagewidth;
+			y1 = tiff->imagelength;
+		}
+	}
+
+	/* We can only decode whole tiles, or whole strips */
+	if (tiff_is_tiled(tiff))
+	{
+		x0 -= x0 % tiff->tilewidth;
+		y0 -= y0 % tiff->tilelength;
+		x1 = fz_mini(x1 + tiff->tilewidth - 1 - (x1 + tiff->tilewidth - 1) % tiff->tilewidth, tiff->imagewidth);
+		y1 = fz_mini(y1 + tiff->tilelength - 1 - (y1 + tiff->tilelength - 1) % tiff->tilelength, tiff->imagelength);
+	}
+	else
+	{
+		unsigned step = tiff_strip_step(tiff);
+		x0 = 0;
+		x1 = tiff->imagewidth;
+		if (step > 0 && step < tiff->imagelength)
+		{
+			y0 -= y0 % step;
+			y1 = fz_mini(y1 + step - 1 - (y1 + step - 1) % step, tiff->imagelength);
+		}
+		else
+		{
+			y0 = 0;
+			y1 = tiff->imagelength;
+		}
+	}
+
+	tiff->rx = x0;
+	tiff->ry = y0;
+	tiff->rw = x1 - x0;
+	tiff->rh = y1 - y0;
+
+	/* tiles are pasted into a buffer the width of the area; strips are always full width */
+	if (tiff_is_tiled(tiff))
+		tiff->stride = (tiff->rw * tiff->samplesperpixel * tiff->bitspersample + 7) / 8;
+}
+
 static void
 tiff_decode_samples(fz_context *ctx, struct tiff *tiff)
 {
 	unsigned i;
 
-	tiff->samples = fz_malloc_array(ctx, tiff->imagelength, tiff->stride);
-	memset(tiff->samples, 0x55, tiff->imagelength * tiff->stride);
+	tiff->samples = fz_malloc_array(ctx, tiff->rh, tiff->stride);
+	memset(tiff->samples, 0x55, tiff->rh * tiff->stride);
 
-	if (tiff->tilelength && tiff->tilewidth && tiff->tileoffsets && tiff->tilebytecounts)
+	if (tiff_is_tiled(tiff))
 		tiff_decode_tiles(ctx, tiff);
 	else if (tiff->rowsperstrip && tiff->stripoffsets && tiff->stripbytecounts)
 		tiff_decode_strips(ctx, tiff);
@@ -1240,9 +1299,9 @@ tiff_decode_samples(fz_context *ctx, struct tiff *tiff)
 	if ((tiff->compression == 5 || tiff->compression == 8 || tiff->compression == 32946) && tiff->predictor == 2)
 	{
 		unsigned char *p = tiff->samples;
-		for (i = 0; i < tiff->imagelength; i++)
+		for (i = 0; i < tiff->rh; i++)
 		{
-			tiff_unpredict_line(p, tiff->imagewidth, tiff->samplesperpixel, tiff->bitspersample);
+			tiff_unpredict_line(p, tiff->rw, tiff->samplesperpixel, tiff->bitspersample);
 			p += tiff->stride;
 		}
 	}
@@ -1259,9 +1318,9 @@ tiff_decode_samples(fz_context *ctx, struct tiff *tiff)
 	if (tiff->photometric == 0)
 	{
 		unsigned char *p = tiff->samples;
-		for (i = 0; i < tiff->imagelength; i++)
+		for (i = 0; i < tiff->rh; i++)
 		{
-			tiff_invert_line(p, tiff->imagewidth, tiff->samplesperpixel, tiff->bitspersample, tiff->extrasamples);
+			tiff_invert_line(p, tiff->rw, tiff->samplesperpixel, tiff->bitspersample, tiff->extrasamples);
 			p += tiff->stride;
 		}
 	}
@@ -1282,22 +1341,117 @@ tiff_decode_samples(fz_context *ctx, struct tiff *tiff)
 
 	/* Byte swap 16-bit images to big endian if necessary */
 	if (tiff->bitspersample == 16 && tiff->order == TII)
-		tiff_swap_byte_order(tiff->samples, tiff->imagewidth * tiff->imagelength * tiff->samplesperpixel);
+		tiff_swap_byte_order(tiff->samples, tiff->rw * tiff->rh * tiff->samplesperpixel);
 
 	/* Lab colorspace expects all sample components 0..255.
 	TIFF supplies them as L = 0..255, a/b = -128..127 (for
 	8 bits per sample, -32768..32767 for 16 bits per sample)
 	Scale them to the colorspace's expectations. */
 	if (tiff->photometric == 8 && tiff->samplesperpixel == 3)
-		tiff_scale_lab_samples(ctx, tiff->samples, tiff->bitspersample, tiff->imagewidth * tiff->imagelength);
+		tiff_scale_lab_samples(ctx, tiff->samples, tiff->bitspersample, tiff->rw * tiff->rh);
+}
+
+static void
+tiff_probe_ifd(fz_context *ctx, struct tiff *tiff, unsigned offset, unsigned *subfiletype, unsigned *w, unsigned *h)
+{
+	unsigned count, i;
+
+	*subfiletype = 0;
+	*w = *h = 0;
+
+	tiff->rp = tiff->bp + offset;
+	count = readshort(tiff);
+	if (count * 12 > (unsigned)(tiff->ep - tiff->rp))
+		fz_throw(ctx, FZ_ERROR_GENERIC, "overlarge IFD entry count %u", count);
+
+	offset += 2;
+	for (i = 0; i < count; i++, offset += 12)
+	{
+		unsigned tag, type, value;
+
+		tiff->rp = tiff->bp + offset;
+		tag = readshort(tiff);
+		type = readshort(tiff);
+		(void)tiff_readlong(tiff);
+		value = tiff->rp - tiff->bp;
+
+		switch (tag)
+		{
+		case NewSubfileType: tiff_read_tag_value(subfiletype, tiff, type, value, 1); break;
+		case ImageWidth: tiff_read_tag_value(w, tiff, type, value, 1); break;
+		case ImageLength: tiff_read_tag_value(h, tiff, type, value, 1); break;
+		}
+	}
+}
+
+/*
+	Look through the reduced resolution images that follow the image
+	at ifd in the IFD chain, for the smallest one that is no further
+	subsampled than 1<<max_l2factor.
+*/
+static unsigned
+tiff_find_reduced_ifd(fz_context *ctx, struct tiff *tiff, unsigned ifd, unsigned w, unsigned h, int max_l2factor, int *l2factor)
+{
+	unsigned offset, best = ifd;
+	unsigned subfiletype, rw, rh;
+	int i, k;
+
+	*l2factor = 0;
+
+	fz_var(best);
+
+	fz_try(ctx)
+	{
+		offset = tiff_next_ifd(ctx, tiff, ifd);
+		for (i = 0; offset != 0 && i < 16; i++)
+		{
+			tiff_probe_ifd(ctx, tiff, offset, &subfiletype, &rw, &rh);
+			if ((subfiletype & 1) == 0)
+				break;
+			for (k = *l2factor + 1; k <= max_l2factor; k++)
+			{
+				if (rw == (w + (1<<k) - 1) >> k && rh == (h + (1<<k) - 1) >> k)
+					break;
+				if (rw == w >> k && rh == h >> k)
+					break;
+			}
+			if (k <= max_l2factor)
+			{
+				best = offset;
+				*l2factor = k;
+			}
+			offset = tiff_next_ifd(ctx, tiff, offset);
+		}
+	}
+	fz_catch(ctx)
+	{
+		/* Broken chain; just use what we've found so far */
+	}
+
+	return best;
+}
+
+static void
+tiff_drop_scratch(fz_context *ctx, struct tiff *tiff)
+{
+	fz_free(ctx, tiff->colormap);
+	fz_free(ctx, tiff->stripoffsets);
+	fz_free(ctx, tiff->stripbytecounts);
+	fz_free(ctx, tiff->tileoffsets);
+	fz_free(ctx, tiff->tilebytecounts);
+	fz_free(ctx, tiff->data);
+	fz_free(ctx, tiff->samples);
+	fz_free(ctx, tiff->profile);
 }
 
 fz_pixmap *
-fz_load_tiff_subimage(fz_context *ctx, unsigned char *buf, size_t len, int subimage)
+fz_load_tiff_subimage_area(fz_context *ctx, unsigned char *buf, size_t len, int subimage, fz_irect *subarea, int *l2factor)
 {
 	fz_pixmap *image = NULL;
 	struct tiff tiff = { 0 };
+	unsigned ifd, subfiletype, w, h;
 	int alpha;
+	int k = 0;
 
 	fz_var(image);
 
@@ -1305,15 +1459,35 @@ fz_load_tiff_subimage(fz_context *ctx, unsigned char *buf, size_t len, int subim
 	{
 		tiff_read_header(ctx, &tiff, buf, len);
 		tiff_seek_ifd(ctx, &tiff, subimage);
+
+		/* Use a reduced resolution version of the image if there is one */
+		ifd = tiff.rp - tiff.bp;
+		tiff_probe_ifd(ctx, &tiff, ifd, &subfiletype, &w, &h);
+		if (l2factor && *l2factor > 0)
+			ifd = tiff_find_reduced_ifd(ctx, &tiff, ifd, w, h, *l2factor, &k);
+		tiff.rp = tiff.bp + ifd;
 		tiff_read_ifd(ctx, &tiff);
 
 		/* Decode the image data */
 		tiff_decode_ifd(ctx, &tiff);
+
+		if (subarea)
+		{
+			fz_irect area;
+			area.x0 = subarea->x0 >> k;
+			area.y0 = subarea->y0 >> k;
+			area.x1 = (subarea->x1 + (1<<k) - 1) >> k;
+			area.y1 = (subarea->y1 + (1<<k) - 1) >> k;
+			tiff_set_region(ctx, &tiff, &area);
+		}
+		else
+			tiff_set_region(ctx, &tiff, NULL);
+
 		tiff_decode_samples(ctx, &tiff);
 
 		/* Expand into fz_pixmap struct */
 		alpha = tiff.extrasamples != 0;
-		image = fz_new_pixmap(ctx, tiff.colorspace, tiff.imagewidth, tiff.imagelength, NULL, alpha);
+		image = fz_new_pixmap(ctx, tiff.colorspace, tiff.rw, tiff.rh, NULL, alpha);
 		image->xres = tiff.xresolution;
 		image->yres = tiff.yresolution;
 
@@ -1323,18 +1497,28 @@ fz_load_tiff_subimage(fz_context *ctx, unsigned char *buf, size_t len, int subim
 		/* TODO: check if any samples are non-premul to detect bad files */
 		if (tiff.extrasamples /* == 2 */)
 			fz_premultiply_pixmap(ctx, image);
+
+		/* Tell the caller what area we actually decoded, in full resolution terms */
+		if (subarea)
+		{
+			subarea->x0 = fz_mini(tiff.rx << k, w);
+			subarea->y0 = fz_mini(tiff.ry << k, h);
+			if (tiff.rx + tiff.rw == tiff.imagewidth)
+				subarea->x1 = w;
+			else
+				subarea->x1 = fz_mini((tiff.rx + tiff.rw) << k, w);
+			if (tiff.ry + tiff.rh == tiff.imagelength)
+				subarea->y1 = h;
+			else
+				subarea->y1 = fz_mini((tiff.ry + tiff.rh) << k, h);
+		}
+		if (l2factor)
+			*l2factor -= k;
 	}
 	fz_always(ctx)
 	{
 		/* Clean up scratch memory */
-		fz_free(ctx, tiff.colormap);
-		fz_free(ctx, tiff.stripoffsets);
-		fz_free(ctx, tiff.stripbytecounts);
-		fz_free(ctx, tiff.tileoffsets);
-		fz_free(ctx, tiff.tilebytecounts);
-		fz_free(ctx, tiff.data);
-		fz_free(ctx, tiff.samples);
-		fz_free(ctx, tiff.profile);
+		tiff_drop_scratch(ctx, &tiff);
 	}
 	fz_catch(ctx)
 	{
@@ -1345,6 +1529,12 @@ fz_load_tiff_subimage(fz_context *ctx, unsigned char *buf, size_t len, int subim
 	return image;
 }
 
+fz_pixmap *
+fz_load_tiff_subimage(fz_context *ctx, unsigned char *buf, size_t len, int subimage)
+{
+	return fz_load_tiff_subimage_area(ctx, buf, len, subimage, NULL, NULL);
+}
+
 fz_pixmap *
 fz_load_tiff(fz_context *ctx, unsigned char *buf, size_t len)
 {
@@ -1376,11 +1566,7 @@ fz_load_tiff_info_subimage(fz_context *ctx, unsigned char *buf, size_t len, int
 	fz_always(ctx)
 	{
 		/* Clean up scratch memory */
-		fz_free(ctx, tiff.colormap);
-		fz_free(ctx, tiff.stripoffsets);
-		fz_free(ctx, tiff.stripbytecounts);
-		fz_free(ctx, tiff.samples);
-		fz_free(ctx, tiff.profile);
+		tiff_drop_scratch(ctx, &tiff);
 	}
 	fz_catch(ctx)
 	{
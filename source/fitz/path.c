@@ -1,4 +1,4 @@
-#include "mupdf/fitz.h"
+#include "fitz-imp.h"
 
 #include <string.h>
 #include <assert.h>
@@ -133,6 +133,13 @@ int fz_packed_path_size(const fz_path *path)
 	}
 }
 
+size_t fz_path_data_size(const fz_path *path)
+{
+	if (path->packed == FZ_PATH_PACKED_FLAT)
+		return 0;
+	return (size_t)path->cmd_cap * sizeof(uint8_t) + (size_t)path->coord_cap * sizeof(float);
+}
+
 int
 fz_pack_path(fz_context *ctx, uint8_t *pack_, int max, const fz_path *path)
 {
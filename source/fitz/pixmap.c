@@ -836,6 +836,60 @@ fz_pixmap_size(fz_context *ctx, fz_pixmap * pix)
 	return sizeof(*pix) + pix->n * pix->w * pix->h;
 }
 
+typedef struct
+{
+	fz_pixmap_converter *pc;
+	fz_pixmap *dst;
+	fz_pixmap *src;
+	fz_colorspace *prf;
+	const fz_default_colorspaces *default_cs;
+	const fz_color_params *color_params;
+} fz_convert_rows_job;
+
+/* Make a pixmap that shares rows y0 to y1 of the samples of pix. */
+static fz_pixmap *
+fz_new_pixmap_from_rows(fz_context *ctx, fz_pixmap *pix, int y0, int y1)
+{
+	fz_pixmap *rows = fz_new_pixmap_with_data(ctx, pix->colorspace, pix->w, y1 - y0, pix->seps, pix->alpha, pix->stride, pix->samples + (size_t)y0 * pix->stride);
+	rows->x = pix->x;
+	rows->y = pix->y + y0;
+	rows->xres = pix->xres;
+	rows->yres = pix->yres;
+	rows->flags = (rows->flags & FZ_PIXMAP_FLAG_FREE_SAMPLES) | (pix->flags & ~FZ_PIXMAP_FLAG_FREE_SAMPLES);
+	return rows;
+}
+
+static void
+fz_convert_rows(fz_context *ctx, void *arg, int y0, int y1)
+{
+	fz_convert_rows_job *job = arg;
+	fz_pixmap *dst = NULL;
+	fz_pixmap *src = NULL;
+
+	if (y0 == 0 && y1 == job->src->h)
+	{
+		job->pc(ctx, job->dst, job->src, job->prf, job->default_cs, job->color_params);
+		return;
+	}
+
+	fz_var(dst);
+	fz_var(src);
+
+	fz_try(ctx)
+	{
+		src = fz_new_pixmap_from_rows(ctx, job->src, y0, y1);
+		dst = fz_new_pixmap_from_rows(ctx, job->dst, y0, y1);
+		job->pc(ctx, dst, src, job->prf, job->default_cs, job->color_params);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_pixmap(ctx, src);
+		fz_drop_pixmap(ctx, dst);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
 fz_pixmap *
 fz_convert_pixmap(fz_context *ctx, fz_pixmap *pix, fz_colorspace *ds, fz_colorspace *prf, fz_default_colorspaces *default_cs, const fz_color_params *color_params, int keep_alpha)
 {
@@ -860,8 +914,14 @@ fz_convert_pixmap(fz_context *ctx, fz_pixmap *pix, fz_colorspace *ds, fz_colorsp
 
 	fz_try(ctx)
 	{
-		fz_pixmap_converter *pc = fz_lookup_pixmap_converter(ctx, ds, pix->colorspace);
-		pc(ctx, cvt, pix, prf, default_cs, color_params);
+		fz_convert_rows_job job;
+		job.pc = fz_lookup_pixmap_converter(ctx, ds, pix->colorspace);
+		job.dst = cvt;
+		job.src = pix;
+		job.prf = prf;
+		job.default_cs = default_cs;
+		job.color_params = color_params;
+		fz_parallel_rows(ctx, pix->h, fz_convert_rows, &job);
 	}
 	fz_catch(ctx)
 	{
@@ -1,28 +1,60 @@
 #include "mupdf/fitz.h"
 
 #include <string.h>
+#include <stddef.h>
 
 typedef struct fz_pool_node_s fz_pool_node;
 
+/* Blocks start small, so that pools for small documents stay small, and
+ * double in size up to 64k as the pool fills. Allocations bigger than a
+ * quarter of the largest block get a block of their own. All memory
+ * handed out is zeroed, as callers rely on. */
+#define POOL_FIRST_BLOCK (1 << 10)
+#define POOL_LAST_BLOCK (64 << 10)
+#define POOL_LARGE (POOL_LAST_BLOCK / 4)
+
 struct fz_pool_s
 {
 	fz_pool_node *head, *tail;
 	char *pos, *end;
+	size_t next_block; /* size of the next block to allocate */
+	fz_pool_node *large; /* blocks holding one large allocation each */
 };
 
 struct fz_pool_node_s
 {
 	fz_pool_node *next;
-	char mem[64 << 10]; /* 64k blocks */
+	char mem[1];
 };
 
+static fz_pool_node *
+new_pool_node(fz_context *ctx, fz_pool *pool, size_t min)
+{
+	size_t size = pool->next_block;
+	fz_pool_node *node;
+
+	while (size < min)
+		size <<= 1;
+	node = fz_calloc(ctx, 1, offsetof(fz_pool_node, mem) + size);
+	pool->pos = node->mem;
+	pool->end = node->mem + size;
+	pool->next_block = fz_minz(size << 1, POOL_LAST_BLOCK);
+	return node;
+}
+
 fz_pool *fz_new_pool(fz_context *ctx)
 {
 	fz_pool *pool = fz_malloc_struct(ctx, fz_pool);
-	fz_pool_node *node = fz_malloc_struct(ctx, fz_pool_node);
-	pool->head = pool->tail = node;
-	pool->pos = node->mem;
-	pool->end = node->mem + sizeof node->mem;
+	fz_try(ctx)
+	{
+		pool->next_block = POOL_FIRST_BLOCK;
+		pool->head = pool->tail = new_pool_node(ctx, pool, 0);
+	}
+	fz_catch(ctx)
+	{
+		fz_free(ctx, pool);
+		fz_rethrow(ctx);
+	}
 	return pool;
 }
 
@@ -33,20 +65,70 @@ void *fz_pool_alloc(fz_context *ctx, fz_pool *pool, size_t size)
 	/* round size to pointer alignment (we don't expect to use doubles) */
 	size = ((size + sizeof(void*) - 1) / sizeof(void*)) * sizeof(void*);
 
-	if (pool->pos + size > pool->end)
+	/* large allocations get a block of their own, kept on a list of
+	 * their own */
+	if (size > POOL_LARGE)
 	{
-		fz_pool_node *node = fz_malloc_struct(ctx, fz_pool_node);
-		pool->tail = pool->tail->next = node;
-		pool->pos = node->mem;
-		pool->end = node->mem + sizeof node->mem;
-		if (pool->pos + size > pool->end)
-			fz_throw(ctx, FZ_ERROR_GENERIC, "out of memory: allocation too large to fit in pool");
+		fz_pool_node *node = fz_calloc(ctx, 1, offsetof(fz_pool_node, mem) + size);
+		node->next = pool->large;
+		pool->large = node;
+		return node->mem;
 	}
+
+	if (pool->pos + size > pool->end)
+		pool->tail = pool->tail->next = new_pool_node(ctx, pool, size);
 	ptr = pool->pos;
 	pool->pos += size;
 	return ptr;
 }
 
+void *fz_pool_grow(fz_context *ctx, fz_pool *pool, void *old, size_t old_size, size_t new_size)
+{
+	char *ptr = old;
+	void *mem;
+
+	old_size = ((old_size + sizeof(void*) - 1) / sizeof(void*)) * sizeof(void*);
+	new_size = ((new_size + sizeof(void*) - 1) / sizeof(void*)) * sizeof(void*);
+
+	if (!ptr)
+		return fz_pool_alloc(ctx, pool, new_size);
+
+	/* the last allocation in the tail block can be extended in place */
+	if (ptr >= pool->tail->mem && ptr + old_size == pool->pos && ptr + new_size <= pool->end)
+	{
+		if (new_size > old_size)
+			memset(ptr + old_size, 0, new_size - old_size);
+		else
+			memset(ptr + new_size, 0, old_size - new_size);
+		pool->pos = ptr + new_size;
+		return ptr;
+	}
+
+	/* the last large allocation has a block of its own, which can be
+	 * reallocated */
+	if (pool->large && ptr == pool->large->mem)
+	{
+		fz_pool_node *node = fz_resize_array(ctx, pool->large, 1, offsetof(fz_pool_node, mem) + new_size);
+		pool->large = node;
+		if (new_size > old_size)
+			memset(node->mem + old_size, 0, new_size - old_size);
+		return node->mem;
+	}
+
+	mem = fz_pool_alloc(ctx, pool, new_size);
+	memcpy(mem, ptr, old_size < new_size ? old_size : new_size);
+
+	/* if it moved out to a large block, the space it left at the end of
+	 * the tail block can be used again */
+	if (ptr >= pool->tail->mem && ptr + old_size == pool->pos)
+	{
+		memset(ptr, 0, old_size);
+		pool->pos = ptr;
+	}
+
+	return mem;
+}
+
 char *fz_pool_strdup(fz_context *ctx, fz_pool *pool, const char *s)
 {
 	size_t n = strlen(s) + 1;
@@ -69,5 +151,12 @@ void fz_drop_pool(fz_context *ctx, fz_pool *pool)
 		fz_free(ctx, node);
 		node = next;
 	}
+	node = pool->large;
+	while (node)
+	{
+		fz_pool_node *next = node->next;
+		fz_free(ctx, node);
+		node = next;
+	}
 	fz_free(ctx, pool);
 }
@@ -453,24 +453,6 @@ struct tensor_patch_s
 	float color[4][FZ_MAX_COLORS];
 };
 
-static void
-triangulate_patch(fz_context *ctx, fz_mesh_processor *painter, tensor_patch p)
-{
-	fz_vertex v0, v1, v2, v3;
-
-	v0.p = p.pole[0][0];
-	v1.p = p.pole[0][3];
-	v2.p = p.pole[3][3];
-	v3.p = p.pole[3][0];
-
-	fz_prepare_color(ctx, painter, &v0, p.color[0]);
-	fz_prepare_color(ctx, painter, &v1, p.color[1]);
-	fz_prepare_color(ctx, painter, &v2, p.color[2]);
-	fz_prepare_color(ctx, painter, &v3, p.color[3]);
-
-	paint_quad(ctx, painter, &v0, &v1, &v2, &v3);
-}
-
 static inline void midcolor(float *c, float *c1, float *c2, int n)
 {
 	int i;
@@ -538,29 +520,6 @@ split_stripe(tensor_patch *p, tensor_patch *s0, tensor_patch *s1, int n)
 	memcpy(s1->color[3], p->color[3], n * sizeof(s1->color[3][0]));
 }
 
-static void
-draw_stripe(fz_context *ctx, fz_mesh_processor *painter, tensor_patch *p, int depth)
-{
-	tensor_patch s0, s1;
-
-	/* split patch into two half-height patches */
-	split_stripe(p, &s0, &s1, painter->ncomp);
-
-	depth--;
-	if (depth == 0)
-	{
-		/* if no more subdividing, draw two new patches... */
-		triangulate_patch(ctx, painter, s1);
-		triangulate_patch(ctx, painter, s0);
-	}
-	else
-	{
-		/* ...otherwise, continue subdividing. */
-		draw_stripe(ctx, painter, &s1, depth);
-		draw_stripe(ctx, painter, &s0, depth);
-	}
-}
-
 static void
 split_patch(tensor_patch *p, tensor_patch *s0, tensor_patch *s1, int n)
 {
@@ -585,29 +544,6 @@ split_patch(tensor_patch *p, tensor_patch *s0, tensor_patch *s1, int n)
 	memcpy(s1->color[3], s0->color[2], n * sizeof(s1->color[3][0]));
 }
 
-static void
-draw_patch(fz_context *ctx, fz_mesh_processor *painter, tensor_patch *p, int depth, int origdepth)
-{
-	tensor_patch s0, s1;
-
-	/* split patch into two half-width patches */
-	split_patch(p, &s0, &s1, painter->ncomp);
-
-	depth--;
-	if (depth == 0)
-	{
-		/* if no more subdividing, draw two new patches... */
-		draw_stripe(ctx, painter, &s0, origdepth);
-		draw_stripe(ctx, painter, &s1, origdepth);
-	}
-	else
-	{
-		/* ...otherwise, continue subdividing. */
-		draw_patch(ctx, painter, &s0, depth, origdepth);
-		draw_patch(ctx, painter, &s1, depth, origdepth);
-	}
-}
-
 static fz_point
 compute_tensor_interior(
 	fz_point a, fz_point b, fz_point c, fz_point d,
@@ -695,126 +631,269 @@ make_tensor_patch(tensor_patch *p, int type, fz_point *pt)
 	}
 }
 
-/* FIXME: Nasty */
-#define SUBDIV 3 /* how many levels to subdivide patches */
+/*
+	Patch meshes are tessellated once per shade and resolution, and the
+	result is kept in the store. The transform is only applied when the
+	mesh is painted, so any transform whose expansion falls in the same
+	power of two bucket shares the same tessellation. Each patch is cut
+	into a grid just fine enough for its curves to be flat, and its
+	colors to be linear, to within a fraction of a device pixel.
+*/
+
+#define MAX_SUBDIV 6 /* most levels to subdivide patches in each direction */
+#define PATCH_FLATNESS 0.25f /* in device pixels */
+#define PATCH_TWIST 64 /* inverse of the color error allowed, relative to the decode range */
+
+typedef struct
+{
+	int du, dv;
+	int offset;
+} fz_patch_grid;
+
+typedef struct
+{
+	fz_storable storable;
+	size_t size;
+	int ncomp;
+	int len, cap;
+	fz_patch_grid *patches;
+	int vlen, vcap;
+	float *values;
+} fz_patch_mesh;
+
+typedef struct
+{
+	int refs;
+	fz_shade *shade;
+	int bucket;
+} fz_patch_mesh_key;
+
+static int
+fz_make_hash_patch_mesh_key(fz_context *ctx, fz_store_hash *hash, void *key_)
+{
+	fz_patch_mesh_key *key = (fz_patch_mesh_key *)key_;
+	hash->u.pi.ptr = key->shade;
+	hash->u.pi.i = key->bucket;
+	return 1;
+}
+
+static void *
+fz_keep_patch_mesh_key(fz_context *ctx, void *key_)
+{
+	fz_patch_mesh_key *key = (fz_patch_mesh_key *)key_;
+	return fz_keep_imp(ctx, key, &key->refs);
+}
 
 static void
-fz_process_shade_type6(fz_context *ctx, fz_shade *shade, const fz_matrix *ctm, fz_mesh_processor *painter)
+fz_drop_patch_mesh_key(fz_context *ctx, void *key_)
 {
-	fz_stream *stream = fz_open_compressed_buffer(ctx, shade->buffer);
-	float color_storage[2][4][FZ_MAX_COLORS];
-	fz_point point_storage[2][12];
-	int store = 0;
-	int ncomp = painter->ncomp;
+	fz_patch_mesh_key *key = (fz_patch_mesh_key *)key_;
+	if (fz_drop_imp(ctx, key, &key->refs))
+	{
+		fz_drop_shade(ctx, key->shade);
+		fz_free(ctx, key);
+	}
+}
+
+static int
+fz_cmp_patch_mesh_key(fz_context *ctx, void *k0_, void *k1_)
+{
+	fz_patch_mesh_key *k0 = (fz_patch_mesh_key *)k0_;
+	fz_patch_mesh_key *k1 = (fz_patch_mesh_key *)k1_;
+	return k0->shade != k1->shade || k0->bucket != k1->bucket;
+}
+
+static void
+fz_format_patch_mesh_key(fz_context *ctx, char *s, int n, void *key_)
+{
+	fz_patch_mesh_key *key = (fz_patch_mesh_key *)key_;
+	fz_snprintf(s, n, "(patch mesh %d)", key->bucket);
+}
+
+static const fz_store_type fz_patch_mesh_store_type =
+{
+	fz_make_hash_patch_mesh_key,
+	fz_keep_patch_mesh_key,
+	fz_drop_patch_mesh_key,
+	fz_cmp_patch_mesh_key,
+	fz_format_patch_mesh_key,
+	NULL
+};
+
+static void
+fz_drop_patch_mesh_imp(fz_context *ctx, fz_storable *mesh_)
+{
+	fz_patch_mesh *mesh = (fz_patch_mesh *)mesh_;
+
+	fz_free(ctx, mesh->patches);
+	fz_free(ctx, mesh->values);
+	fz_free(ctx, mesh);
+}
+
+static void
+fz_drop_patch_mesh(fz_context *ctx, fz_patch_mesh *mesh)
+{
+	fz_drop_storable(ctx, &mesh->storable);
+}
+
+static int
+patch_bucket(const fz_matrix *ctm)
+{
+	float exp = fz_matrix_max_expansion(ctm);
+	int bucket = 0;
+
+	if (exp > 0)
+		bucket = (int)ceilf(log2f(exp));
+	return fz_clampi(bucket, -16, 16);
+}
+
+static float
+curve_flatness(const fz_point *p, int step)
+{
+	/* The largest second difference of the control points. A cubic cut
+	 * into n pieces lies within 3/4 of this over n squared of their
+	 * chords. */
+	float dx0 = p[0].x - 2 * p[step].x + p[2 * step].x;
+	float dy0 = p[0].y - 2 * p[step].y + p[2 * step].y;
+	float dx1 = p[step].x - 2 * p[2 * step].x + p[3 * step].x;
+	float dy1 = p[step].y - 2 * p[2 * step].y + p[3 * step].y;
+	return fz_max(sqrtf(dx0 * dx0 + dy0 * dy0), sqrtf(dx1 * dx1 + dy1 * dy1));
+}
+
+static float
+bilinear_distance(const tensor_patch *p)
+{
+	/* The largest distance of a pole from where the bilinear patch
+	 * through the corners would put it. Curves that are each flat can
+	 * still make a patch that is not, when the poles are unevenly
+	 * spaced along them. */
+	float d = 0;
 	int i, k;
-	int bpflag = shade->u.m.bpflag;
-	int bpcoord = shade->u.m.bpcoord;
-	int bpcomp = shade->u.m.bpcomp;
-	float x0 = shade->u.m.x0;
-	float x1 = shade->u.m.x1;
-	float y0 = shade->u.m.y0;
-	float y1 = shade->u.m.y1;
-	const float *c0 = shade->u.m.c0;
-	const float *c1 = shade->u.m.c1;
 
-	fz_try(ctx)
+	for (i = 0; i < 4; i++)
 	{
-		float (*prevc)[FZ_MAX_COLORS] = NULL;
-		fz_point *prevp = NULL;
-		while (!fz_is_eof_bits(ctx, stream))
+		float v = i / 3.0f;
+		for (k = 0; k < 4; k++)
 		{
-			float (*c)[FZ_MAX_COLORS] = color_storage[store];
-			fz_point *v = point_storage[store];
-			int startcolor;
-			int startpt;
-			int flag;
-			tensor_patch patch;
-
-			flag = fz_read_bits(ctx, stream, bpflag);
+			float u = k / 3.0f;
+			float x = (1 - v) * ((1 - u) * p->pole[0][0].x + u * p->pole[0][3].x) + v * ((1 - u) * p->pole[3][0].x + u * p->pole[3][3].x);
+			float y = (1 - v) * ((1 - u) * p->pole[0][0].y + u * p->pole[0][3].y) + v * ((1 - u) * p->pole[3][0].y + u * p->pole[3][3].y);
+			float dx = p->pole[i][k].x - x;
+			float dy = p->pole[i][k].y - y;
+			d = fz_max(d, dx * dx + dy * dy);
+		}
+	}
+	return sqrtf(d);
+}
 
-			if (flag == 0)
-			{
-				startpt = 0;
-				startcolor = 0;
-			}
-			else
-			{
-				startpt = 4;
-				startcolor = 2;
-			}
+static int
+curve_depth(float d, float tol)
+{
+	int depth = 0;
 
-			for (i = startpt; i < 12; i++)
-			{
-				v[i].x = read_sample(ctx, stream, bpcoord, x0, x1);
-				v[i].y = read_sample(ctx, stream, bpcoord, y0, y1);
-				fz_transform_point(&v[i], ctm);
-			}
+	d *= 0.75f;
+	while (depth < MAX_SUBDIV && d > tol)
+	{
+		d *= 0.25f;
+		depth++;
+	}
+	return depth;
+}
 
-			for (i = startcolor; i < 4; i++)
-			{
-				for (k = 0; k < ncomp; k++)
-					c[i][k] = read_sample(ctx, stream, bpcomp, c0[k], c1[k]);
-			}
+static void
+tessellate_patch(tensor_patch *p, fz_point *grid, int stride, int a, int b, int na, int nb)
+{
+	tensor_patch s0, s1;
 
-			if (flag == 0)
-			{
-			}
-			else if (flag == 1 && prevc)
-			{
-				v[0] = prevp[3];
-				v[1] = prevp[4];
-				v[2] = prevp[5];
-				v[3] = prevp[6];
-				memcpy(c[0], prevc[1], ncomp * sizeof(float));
-				memcpy(c[1], prevc[2], ncomp * sizeof(float));
-			}
-			else if (flag == 2 && prevc)
-			{
-				v[0] = prevp[6];
-				v[1] = prevp[7];
-				v[2] = prevp[8];
-				v[3] = prevp[9];
-				memcpy(c[0], prevc[2], ncomp * sizeof(float));
-				memcpy(c[1], prevc[3], ncomp * sizeof(float));
-			}
-			else if (flag == 3 && prevc)
-			{
-				v[0] = prevp[ 9];
-				v[1] = prevp[10];
-				v[2] = prevp[11];
-				v[3] = prevp[ 0];
-				memcpy(c[0], prevc[3], ncomp * sizeof(float));
-				memcpy(c[1], prevc[0], ncomp * sizeof(float));
-			}
-			else
-				continue;
+	/* Colors are interpolated from the corners when painting, so only
+	 * the poles are split here. */
+	if (nb > 1)
+	{
+		split_patch(p, &s0, &s1, 0);
+		tessellate_patch(&s0, grid, stride, a, b, na, nb >> 1);
+		tessellate_patch(&s1, grid, stride, a, b + (nb >> 1), na, nb >> 1);
+	}
+	else if (na > 1)
+	{
+		split_stripe(p, &s0, &s1, 0);
+		tessellate_patch(&s0, grid, stride, a, b, na >> 1, nb);
+		tessellate_patch(&s1, grid, stride, a + (na >> 1), b, na >> 1, nb);
+	}
+	else
+	{
+		grid[a * stride + b] = p->pole[0][0];
+		grid[a * stride + b + 1] = p->pole[0][3];
+		grid[(a + 1) * stride + b + 1] = p->pole[3][3];
+		grid[(a + 1) * stride + b] = p->pole[3][0];
+	}
+}
 
-			make_tensor_patch(&patch, 6, v);
+static void
+add_patch_to_mesh(fz_context *ctx, fz_shade *shade, fz_patch_mesh *mesh, tensor_patch *p, float tol)
+{
+	int ncomp = mesh->ncomp;
+	float du = 0, dv = 0, twist = 0, flat;
+	int i, k, na, nb, n;
+	fz_patch_grid *grid;
 
-			for (i = 0; i < 4; i++)
-				memcpy(patch.color[i], c[i], ncomp * sizeof(float));
+	for (i = 0; i < 4; i++)
+	{
+		du = fz_max(du, curve_flatness(&p->pole[i][0], 1));
+		dv = fz_max(dv, curve_flatness(&p->pole[0][i], 4));
+	}
+	flat = bilinear_distance(p);
 
-			draw_patch(ctx, painter, &patch, SUBDIV, SUBDIV);
+	/* Gouraud shaded triangles can not follow the twist of a bilinear
+	 * color ramp, so keep cutting until the pieces are small enough. */
+	for (k = 0; k < ncomp; k++)
+	{
+		float range = fabsf(shade->u.m.c1[k] - shade->u.m.c0[k]);
+		float t = fabsf(p->color[0][k] - p->color[1][k] + p->color[2][k] - p->color[3][k]);
+		if (range > 0)
+			twist = fz_max(twist, t / range);
+	}
 
-			prevp = v;
-			prevc = c;
-			store ^= 1;
-		}
+	if (mesh->len == mesh->cap)
+	{
+		int new_cap = fz_maxi(16, mesh->cap * 2);
+		mesh->patches = fz_resize_array(ctx, mesh->patches, new_cap, sizeof(*mesh->patches));
+		mesh->cap = new_cap;
 	}
-	fz_always(ctx)
+	grid = &mesh->patches[mesh->len];
+	grid->du = fz_maxi(curve_depth(du, tol), curve_depth(flat, tol));
+	grid->dv = fz_maxi(curve_depth(dv, tol), curve_depth(flat, tol));
+	while (grid->du + grid->dv < 2 * MAX_SUBDIV && twist * PATCH_TWIST > (1 << (grid->du + grid->dv)))
 	{
-		fz_drop_stream(ctx, stream);
+		if (grid->du <= grid->dv)
+			grid->du++;
+		else
+			grid->dv++;
 	}
-	fz_catch(ctx)
+
+	nb = 1 << grid->du;
+	na = 1 << grid->dv;
+	n = 4 * ncomp + 2 * (na + 1) * (nb + 1);
+	if (mesh->vlen + n > mesh->vcap)
 	{
-		fz_rethrow(ctx);
+		int new_cap = fz_maxi(mesh->vlen + n, mesh->vcap * 2);
+		mesh->values = fz_resize_array(ctx, mesh->values, new_cap, sizeof(float));
+		mesh->vcap = new_cap;
 	}
+	grid->offset = mesh->vlen;
+	for (i = 0; i < 4; i++)
+		memcpy(&mesh->values[mesh->vlen + i * ncomp], p->color[i], ncomp * sizeof(float));
+	tessellate_patch(p, (fz_point *)&mesh->values[mesh->vlen + 4 * ncomp], nb + 1, 0, 0, na, nb);
+	mesh->vlen += n;
+	mesh->len++;
 }
 
+typedef void (fz_patch_fn)(fz_context *ctx, void *arg, tensor_patch *p);
+
 static void
-fz_process_shade_type7(fz_context *ctx, fz_shade *shade, const fz_matrix *ctm, fz_mesh_processor *painter)
+fz_decode_patch_mesh(fz_context *ctx, fz_shade *shade, fz_patch_fn *fn, void *arg)
 {
 	fz_stream *stream = fz_open_compressed_buffer(ctx, shade->buffer);
+	int npoints = shade->type == FZ_MESH_TYPE6 ? 12 : 16;
 	int bpflag = shade->u.m.bpflag;
 	int bpcoord = shade->u.m.bpcoord;
 	int bpcomp = shade->u.m.bpcomp;
@@ -827,7 +906,7 @@ fz_process_shade_type7(fz_context *ctx, fz_shade *shade, const fz_matrix *ctm, f
 	float color_storage[2][4][FZ_MAX_COLORS];
 	fz_point point_storage[2][16];
 	int store = 0;
-	int ncomp = painter->ncomp;
+	int ncomp = (shade->use_function > 0 ? 1 : fz_colorspace_n(ctx, shade->colorspace));
 	int i, k;
 	float (*prevc)[FZ_MAX_COLORS] = NULL;
 	fz_point (*prevp) = NULL;
@@ -856,11 +935,10 @@ fz_process_shade_type7(fz_context *ctx, fz_shade *shade, const fz_matrix *ctm, f
 				startcolor = 2;
 			}
 
-			for (i = startpt; i < 16; i++)
+			for (i = startpt; i < npoints; i++)
 			{
 				v[i].x = read_sample(ctx, stream, bpcoord, x0, x1);
 				v[i].y = read_sample(ctx, stream, bpcoord, y0, y1);
-				fz_transform_point(&v[i], ctm);
 			}
 
 			for (i = startcolor; i < 4; i++)
@@ -902,12 +980,12 @@ fz_process_shade_type7(fz_context *ctx, fz_shade *shade, const fz_matrix *ctm, f
 			else
 				continue; /* We have no patch! */
 
-			make_tensor_patch(&patch, 7, v);
+			make_tensor_patch(&patch, shade->type == FZ_MESH_TYPE6 ? 6 : 7, v);
 
 			for (i = 0; i < 4; i++)
 				memcpy(patch.color[i], c[i], ncomp * sizeof(float));
 
-			draw_patch(ctx, painter, &patch, SUBDIV, SUBDIV);
+			fn(ctx, arg, &patch);
 
 			prevp = v;
 			prevc = c;
@@ -924,6 +1002,212 @@ fz_process_shade_type7(fz_context *ctx, fz_shade *shade, const fz_matrix *ctm, f
 	}
 }
 
+struct bound_arg
+{
+	int empty;
+	fz_rect bbox;
+};
+
+static void
+bound_patch_fn(fz_context *ctx, void *arg_, tensor_patch *p)
+{
+	struct bound_arg *arg = arg_;
+	int i, k;
+
+	if (arg->empty)
+	{
+		arg->bbox.x0 = arg->bbox.x1 = p->pole[0][0].x;
+		arg->bbox.y0 = arg->bbox.y1 = p->pole[0][0].y;
+		arg->empty = 0;
+	}
+	for (i = 0; i < 4; i++)
+		for (k = 0; k < 4; k++)
+			fz_include_point_in_rect(&arg->bbox, &p->pole[i][k]);
+}
+
+/* The bounds of the poles do not depend on the transform, so they are
+ * kept with the shade the first time the patches are decoded, whether
+ * to bound or to tessellate them. */
+static void
+fz_set_patch_bbox(fz_context *ctx, fz_shade *shade, const fz_rect *bbox)
+{
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	shade->u.m.patch_bbox = *bbox;
+	shade->u.m.has_patch_bbox = 1;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+}
+
+static int
+fz_get_patch_bbox(fz_context *ctx, fz_shade *shade, fz_rect *bbox)
+{
+	int has_bbox;
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	has_bbox = shade->u.m.has_patch_bbox;
+	if (has_bbox)
+		*bbox = shade->u.m.patch_bbox;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+	return has_bbox;
+}
+
+struct tessellate_arg
+{
+	fz_shade *shade;
+	fz_patch_mesh *mesh;
+	float tol;
+	struct bound_arg bound;
+};
+
+static void
+tessellate_patch_fn(fz_context *ctx, void *arg_, tensor_patch *p)
+{
+	struct tessellate_arg *arg = arg_;
+	add_patch_to_mesh(ctx, arg->shade, arg->mesh, p, arg->tol);
+	bound_patch_fn(ctx, &arg->bound, p);
+}
+
+static fz_patch_mesh *
+fz_load_patch_mesh(fz_context *ctx, fz_shade *shade, const fz_matrix *ctm)
+{
+	fz_patch_mesh_key key, *keyp;
+	fz_patch_mesh *mesh, *existing;
+	struct tessellate_arg arg;
+
+	key.refs = 1;
+	key.shade = shade;
+	key.bucket = patch_bucket(ctm);
+
+	mesh = fz_find_item(ctx, fz_drop_patch_mesh_imp, &key, &fz_patch_mesh_store_type);
+	if (mesh)
+		return mesh;
+
+	mesh = fz_malloc_struct(ctx, fz_patch_mesh);
+	FZ_INIT_STORABLE(mesh, 1, fz_drop_patch_mesh_imp);
+	mesh->ncomp = (shade->use_function > 0 ? 1 : fz_colorspace_n(ctx, shade->colorspace));
+
+	arg.shade = shade;
+	arg.mesh = mesh;
+	arg.tol = ldexpf(PATCH_FLATNESS, -key.bucket);
+	arg.bound.empty = 1;
+	arg.bound.bbox = fz_empty_rect;
+
+	fz_try(ctx)
+		fz_decode_patch_mesh(ctx, shade, tessellate_patch_fn, &arg);
+	fz_catch(ctx)
+	{
+		fz_drop_patch_mesh(ctx, mesh);
+		fz_rethrow(ctx);
+	}
+
+	fz_set_patch_bbox(ctx, shade, &arg.bound.bbox);
+
+	/* Now we try to cache the mesh. Any failure here will just result
+	 * in us not caching. */
+	keyp = fz_malloc_struct(ctx, fz_patch_mesh_key);
+	keyp->refs = 1;
+	fz_try(ctx)
+	{
+		keyp->shade = fz_keep_shade(ctx, shade);
+		keyp->bucket = key.bucket;
+		existing = fz_store_item(ctx, keyp, mesh, mesh->cap * sizeof(fz_patch_grid) + mesh->vcap * sizeof(float), &fz_patch_mesh_store_type);
+		if (existing)
+		{
+			/* A racing thread got there first; use theirs. */
+			fz_drop_patch_mesh(ctx, mesh);
+			mesh = existing;
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_drop_patch_mesh_key(ctx, keyp);
+	}
+	fz_catch(ctx)
+	{
+	}
+
+	return mesh;
+}
+
+static void
+prepare_patch_column(fz_context *ctx, fz_mesh_processor *painter, fz_vertex *col, const fz_point *grid, const float *corner,
+	const fz_matrix *ctm, int b, int na, int nb)
+{
+	int ncomp = painter->ncomp;
+	const float *c0 = corner;
+	const float *c1 = corner + ncomp;
+	const float *c2 = corner + 2 * ncomp;
+	const float *c3 = corner + 3 * ncomp;
+	float t = (float)b / nb;
+	float c[FZ_MAX_COLORS];
+	int a, k;
+
+	for (a = 0; a <= na; a++)
+	{
+		float s = (float)a / na;
+		for (k = 0; k < ncomp; k++)
+		{
+			float top = c0[k] + (c1[k] - c0[k]) * t;
+			float bot = c3[k] + (c2[k] - c3[k]) * t;
+			c[k] = top + (bot - top) * s;
+		}
+		fz_prepare_vertex(ctx, painter, &col[a], ctm, grid[a * (nb + 1) + b].x, grid[a * (nb + 1) + b].y, c);
+	}
+}
+
+static void
+fz_paint_patch_mesh(fz_context *ctx, fz_patch_mesh *mesh, const fz_matrix *ctm, fz_mesh_processor *painter)
+{
+	fz_vertex *buf, *col0, *col1;
+	int i, a, b;
+
+	buf = fz_malloc_array(ctx, 2 * ((1 << MAX_SUBDIV) + 1), sizeof(fz_vertex));
+	col0 = buf;
+	col1 = buf + (1 << MAX_SUBDIV) + 1;
+
+	fz_try(ctx)
+	{
+		for (i = 0; i < mesh->len; i++)
+		{
+			const fz_patch_grid *patch = &mesh->patches[i];
+			const float *corner = &mesh->values[patch->offset];
+			const fz_point *grid = (const fz_point *)(corner + 4 * mesh->ncomp);
+			int nb = 1 << patch->du;
+			int na = 1 << patch->dv;
+
+			prepare_patch_column(ctx, painter, col0, grid, corner, ctm, 0, na, nb);
+			for (b = 0; b < nb; b++)
+			{
+				fz_vertex *t;
+				prepare_patch_column(ctx, painter, col1, grid, corner, ctm, b + 1, na, nb);
+				for (a = na - 1; a >= 0; a--)
+					paint_quad(ctx, painter, &col0[a], &col1[a], &col1[a + 1], &col0[a + 1]);
+				t = col0; col0 = col1; col1 = t;
+			}
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_free(ctx, buf);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow(ctx);
+	}
+}
+
+static void
+fz_process_shade_type67(fz_context *ctx, fz_shade *shade, const fz_matrix *ctm, fz_mesh_processor *painter)
+{
+	fz_patch_mesh *mesh = fz_load_patch_mesh(ctx, shade, ctm);
+
+	fz_try(ctx)
+		fz_paint_patch_mesh(ctx, mesh, ctm, painter);
+	fz_always(ctx)
+		fz_drop_patch_mesh(ctx, mesh);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
 void
 fz_process_shade(fz_context *ctx, fz_shade *shade, const fz_matrix *ctm,
 		fz_shade_prepare_fn *prepare, fz_shade_process_fn *process, void *process_arg)
@@ -946,10 +1230,8 @@ fz_process_shade(fz_context *ctx, fz_shade *shade, const fz_matrix *ctm,
 		fz_process_shade_type4(ctx, shade, ctm, &painter);
 	else if (shade->type == FZ_MESH_TYPE5)
 		fz_process_shade_type5(ctx, shade, ctm, &painter);
-	else if (shade->type == FZ_MESH_TYPE6)
-		fz_process_shade_type6(ctx, shade, ctm, &painter);
-	else if (shade->type == FZ_MESH_TYPE7)
-		fz_process_shade_type7(ctx, shade, ctm, &painter);
+	else if (shade->type == FZ_MESH_TYPE6 || shade->type == FZ_MESH_TYPE7)
+		fz_process_shade_type67(ctx, shade, ctm, &painter);
 	else
 		fz_throw(ctx, FZ_ERROR_GENERIC, "Unexpected mesh type %d\n", shade->type);
 }
@@ -1028,6 +1310,34 @@ fz_bound_mesh_type4567(fz_context *ctx, fz_shade *shade, fz_rect *bbox)
 	return bbox;
 }
 
+/* The patches lie within the convex hulls of their poles, so the poles
+ * give a much tighter bound than the decode ranges, without having to
+ * tessellate. */
+static fz_rect *
+fz_bound_mesh_type67(fz_context *ctx, fz_shade *shade, fz_rect *bbox)
+{
+	struct bound_arg arg;
+
+	if (fz_get_patch_bbox(ctx, shade, bbox))
+		return bbox;
+
+	arg.empty = 1;
+	arg.bbox = fz_empty_rect;
+
+	fz_try(ctx)
+		fz_decode_patch_mesh(ctx, shade, bound_patch_fn, &arg);
+	fz_catch(ctx)
+	{
+		fz_rethrow_if(ctx, FZ_ERROR_TRYLATER);
+		fz_warn(ctx, "cannot read patch mesh");
+		return fz_bound_mesh_type4567(ctx, shade, bbox);
+	}
+
+	fz_set_patch_bbox(ctx, shade, &arg.bbox);
+	*bbox = arg.bbox;
+	return bbox;
+}
+
 static fz_rect *
 fz_bound_mesh(fz_context *ctx, fz_shade *shade, fz_rect *bbox)
 {
@@ -1038,10 +1348,11 @@ fz_bound_mesh(fz_context *ctx, fz_shade *shade, fz_rect *bbox)
 	else if (shade->type == FZ_RADIAL)
 		fz_bound_mesh_type3(ctx, shade, bbox);
 	else if (shade->type == FZ_MESH_TYPE4 ||
-		shade->type == FZ_MESH_TYPE5 ||
-		shade->type == FZ_MESH_TYPE6 ||
-		shade->type == FZ_MESH_TYPE7)
+		shade->type == FZ_MESH_TYPE5)
 		fz_bound_mesh_type4567(ctx, shade, bbox);
+	else if (shade->type == FZ_MESH_TYPE6 ||
+		shade->type == FZ_MESH_TYPE7)
+		fz_bound_mesh_type67(ctx, shade, bbox);
 	else
 		fz_throw(ctx, FZ_ERROR_GENERIC, "Unexpected mesh type %d\n", shade->type);
 
@@ -1,5 +1,6 @@
 #include "mupdf/fitz.h"
 #include "mupdf/ucdn.h"
+#include "fitz-imp.h"
 
 #include <math.h>
 #include <float.h>
@@ -161,18 +162,22 @@ new_span_soup(fz_context *ctx)
 static void
 free_span_soup(fz_context *ctx, span_soup *soup)
 {
-	int i;
-
+	/* The spans themselves live in the pool of the page. */
 	if (soup == NULL)
 		return;
-	for (i = 0; i < soup->len; i++)
-	{
-		fz_free(ctx, soup->spans[i]);
-	}
 	fz_free(ctx, soup->spans);
 	fz_free(ctx, soup);
 }
 
+/* Grow an array allocated from the pool of a page. The characters of a
+ * span are added with no other allocations in between, so their array is
+ * usually extended in place. */
+static void *
+grow_stext_array(fz_context *ctx, fz_stext_page *page, void *old, int oldcap, int newcap, size_t size)
+{
+	return fz_pool_grow(ctx, page->pool, old, oldcap * size, newcap * size);
+}
+
 static void
 add_span_to_soup(fz_context *ctx, span_soup *soup, fz_stext_span *span)
 {
@@ -209,10 +214,10 @@ push_span(fz_context *ctx, fz_stext_device *tdev, fz_stext_span *span, int new_l
 			if (page->len == page->cap)
 			{
 				int newcap = (page->cap ? page->cap*2 : 4);
-				page->blocks = fz_resize_array(ctx, page->blocks, newcap, sizeof(*page->blocks));
+				page->blocks = grow_stext_array(ctx, page, page->blocks, page->cap, newcap, sizeof(*page->blocks));
 				page->cap = newcap;
 			}
-			block = fz_malloc_struct(ctx, fz_stext_block);
+			block = fz_pool_alloc(ctx, page->pool, sizeof *block);
 			page->blocks[page->len].type = FZ_PAGE_BLOCK_TEXT;
 			page->blocks[page->len].u.text = block;
 			block->cap = 0;
@@ -228,7 +233,7 @@ push_span(fz_context *ctx, fz_stext_device *tdev, fz_stext_span *span, int new_l
 		if (block->len == block->cap)
 		{
 			int newcap = (block->cap ? block->cap*2 : 4);
-			block->lines = fz_resize_array(ctx, block->lines, newcap, sizeof(*block->lines));
+			block->lines = grow_stext_array(ctx, page, block->lines, block->cap, newcap, sizeof(*block->lines));
 			block->cap = newcap;
 		}
 		block->lines[block->len].first_span = NULL;
@@ -471,38 +476,22 @@ fz_stext_page *
 fz_new_stext_page(fz_context *ctx, const fz_rect *mediabox)
 {
 	fz_stext_page *page = fz_malloc(ctx, sizeof(*page));
+	fz_try(ctx)
+		page->pool = fz_new_pool(ctx);
+	fz_catch(ctx)
+	{
+		fz_free(ctx, page);
+		fz_rethrow(ctx);
+	}
 	page->mediabox = *mediabox;
 	page->len = 0;
 	page->cap = 0;
 	page->blocks = NULL;
 	page->next = NULL;
+	page->index = NULL;
 	return page;
 }
 
-static void
-fz_drop_stext_line_contents(fz_context *ctx, fz_stext_line *line)
-{
-	fz_stext_span *span, *next;
-	for (span = line->first_span; span; span=next)
-	{
-		next = span->next;
-		fz_free(ctx, span->text);
-		fz_free(ctx, span);
-	}
-}
-
-static void
-fz_drop_stext_block(fz_context *ctx, fz_stext_block *block)
-{
-	fz_stext_line *line;
-	if (block == NULL)
-		return;
-	for (line = block->lines; line < block->lines + block->len; line++)
-		fz_drop_stext_line_contents(ctx, line);
-	fz_free(ctx, block->lines);
-	fz_free(ctx, block);
-}
-
 static void
 fz_drop_image_block(fz_context *ctx, fz_image_block *block)
 {
@@ -510,7 +499,6 @@ fz_drop_image_block(fz_context *ctx, fz_image_block *block)
 		return;
 	fz_drop_image(ctx, block->image);
 	fz_drop_colorspace(ctx, block->cspace);
-	fz_free(ctx, block);
 }
 
 void
@@ -519,26 +507,20 @@ fz_drop_stext_page(fz_context *ctx, fz_stext_page *page)
 	fz_page_block *block;
 	if (page == NULL)
 		return;
+	/* Text blocks hold nothing outside the pool. */
 	for (block = page->blocks; block < page->blocks + page->len; block++)
-	{
-		switch (block->type)
-		{
-		case FZ_PAGE_BLOCK_TEXT:
-			fz_drop_stext_block(ctx, block->u.text);
-			break;
-		case FZ_PAGE_BLOCK_IMAGE:
+		if (block->type == FZ_PAGE_BLOCK_IMAGE)
 			fz_drop_image_block(ctx, block->u.image);
-			break;
-		}
-	}
-	fz_free(ctx, page->blocks);
+	fz_drop_stext_index(ctx, page);
+	fz_drop_pool(ctx, page->pool);
 	fz_free(ctx, page);
 }
 
 static fz_stext_span *
-fz_new_stext_span(fz_context *ctx, const fz_point *p, int wmode, const fz_matrix *trm)
+fz_new_stext_span(fz_context *ctx, fz_stext_page *page, const fz_point *p, int wmode, const fz_matrix *trm)
 {
-	fz_stext_span *span = fz_malloc_struct(ctx, fz_stext_span);
+	fz_stext_span *span = fz_pool_alloc(ctx, page->pool, sizeof *span);
+	memset(span, 0, sizeof *span);
 	span->ascender_max = 0;
 	span->descender_min = 0;
 	span->cap = 0;
@@ -558,12 +540,12 @@ fz_new_stext_span(fz_context *ctx, const fz_point *p, int wmode, const fz_matrix
 }
 
 static void
-add_char_to_span(fz_context *ctx, fz_stext_span *span, int c, fz_point *p, fz_point *max, fz_stext_style *style)
+add_char_to_span(fz_context *ctx, fz_stext_page *page, fz_stext_span *span, int c, fz_point *p, fz_point *max, fz_stext_style *style)
 {
 	if (span->len == span->cap)
 	{
 		int newcap = (span->cap ? span->cap * 2 : 16);
-		span->text = fz_resize_array(ctx, span->text, newcap, sizeof(fz_stext_char));
+		span->text = grow_stext_array(ctx, page, span->text, span->cap, newcap, sizeof(fz_stext_char));
 		span->cap = newcap;
 		span->bbox = fz_empty_rect;
 	}
@@ -714,7 +696,7 @@ fz_add_stext_char_imp(fz_context *ctx, fz_stext_device *dev, fz_stext_style *sty
 	{
 		add_span_to_soup(ctx, dev->spans, dev->cur_span);
 		dev->cur_span = NULL;
-		dev->cur_span = fz_new_stext_span(ctx, &p, wmode, trm);
+		dev->cur_span = fz_new_stext_span(ctx, dev->page, &p, wmode, trm);
 		dev->cur_span->spacing = 0;
 	}
 
@@ -723,11 +705,11 @@ fz_add_stext_char_imp(fz_context *ctx, fz_stext_device *dev, fz_stext_style *sty
 	{
 		/* We know we always have a cur_span here */
 		r = dev->cur_span->max;
-		add_char_to_span(ctx, dev->cur_span, ' ', &r, &p, style);
+		add_char_to_span(ctx, dev->page, dev->cur_span, ' ', &r, &p, style);
 	}
 
 no_glyph:
-	add_char_to_span(ctx, dev->cur_span, c, &p, &q, style);
+	add_char_to_span(ctx, dev->page, dev->cur_span, c, &p, &q, style);
 	dev->lastchar = c;
 }
 
@@ -949,10 +931,11 @@ fz_stext_fill_image_mask(fz_context *ctx, fz_device *dev, fz_image *img, const f
 	if (page->len == page->cap)
 	{
 		int newcap = (page->cap ? page->cap*2 : 4);
-		page->blocks = fz_resize_array(ctx, page->blocks, newcap, sizeof(*page->blocks));
+		page->blocks = grow_stext_array(ctx, page, page->blocks, page->cap, newcap, sizeof(*page->blocks));
 		page->cap = newcap;
 	}
-	block = fz_malloc_struct(ctx, fz_image_block);
+	block = fz_pool_alloc(ctx, page->pool, sizeof *block);
+	memset(block, 0, sizeof *block);
 	page->blocks[page->len].type = FZ_PAGE_BLOCK_IMAGE;
 	page->blocks[page->len].u.image = block;
 	block->image = fz_keep_image(ctx, img);
@@ -1065,6 +1048,9 @@ fz_stext_close_device(fz_context *ctx, fz_device *dev)
 {
 	fz_stext_device *tdev = (fz_stext_device*)dev;
 
+	/* Any search index built so far no longer matches the page. */
+	fz_drop_stext_index(ctx, tdev->page);
+
 	add_span_to_soup(ctx, tdev->spans, tdev->cur_span);
 	tdev->cur_span = NULL;
 
@@ -1,4 +1,5 @@
 #include "mupdf/fitz.h"
+#include "fitz-imp.h"
 
 #include <string.h>
 #include <assert.h>
@@ -151,38 +152,59 @@ line_height_for_style(line_heights *lh, fz_stext_style *style)
 	return 0.0f; /* Never reached */
 }
 
+/* Split blocks before the given lines. splits holds n (block, line)
+ * pairs, in order. All the splits are done in one pass from the end of
+ * the page backwards, so that each block and line is moved only once. */
 static void
-split_block(fz_context *ctx, fz_stext_page *page, int block_num, int linenum)
+split_blocks(fz_context *ctx, fz_stext_page *page, const int *splits, int n)
 {
-	int split_len;
-	fz_stext_block *block, *block2;
+	int block_num, out, k;
 
-	if (page->len == page->cap)
+	if (n == 0)
+		return;
+
+	if (page->len + n > page->cap)
 	{
 		int new_cap = fz_maxi(16, page->cap * 2);
-		page->blocks = fz_resize_array(ctx, page->blocks, new_cap, sizeof(*page->blocks));
+		while (new_cap < page->len + n)
+			new_cap *= 2;
+		page->blocks = fz_pool_grow(ctx, page->pool, page->blocks, page->cap * sizeof(*page->blocks), new_cap * sizeof(*page->blocks));
 		page->cap = new_cap;
 	}
 
-	memmove(page->blocks+block_num+1, page->blocks+block_num, (page->len - block_num)*sizeof(*page->blocks));
-	page->len++;
-
-	block2 = fz_malloc_struct(ctx, fz_stext_block);
-	block = page->blocks[block_num].u.text;
-
-	page->blocks[block_num+1].type = FZ_PAGE_BLOCK_TEXT;
-	page->blocks[block_num+1].u.text = block2;
-	split_len = block->len - linenum;
-	block2->bbox = block->bbox; /* FIXME! */
-	block2->cap = 0;
-	block2->len = 0;
-	block2->lines = NULL;
-	block2->lines = fz_malloc_array(ctx, split_len, sizeof(fz_stext_line));
-	block2->cap = block2->len;
-	block2->len = split_len;
-	block->len = linenum;
-	memcpy(block2->lines, block->lines + linenum, split_len * sizeof(fz_stext_line));
-	block2->lines[0].distance = 0;
+	out = page->len + n;
+	k = n - 1;
+	for (block_num = page->len - 1; block_num >= 0; block_num--)
+	{
+		fz_stext_block *block = page->blocks[block_num].u.text;
+		int end = page->blocks[block_num].type == FZ_PAGE_BLOCK_TEXT ? block->len : 0;
+
+		while (k >= 0 && splits[2*k] == block_num)
+		{
+			int linenum = splits[2*k+1];
+			int split_len = end - linenum;
+			fz_stext_block *block2 = fz_pool_alloc(ctx, page->pool, sizeof *block2);
+
+			block2->bbox = block->bbox; /* FIXME! */
+			block2->lines = fz_pool_alloc(ctx, page->pool, split_len * sizeof(fz_stext_line));
+			block2->cap = split_len;
+			block2->len = split_len;
+			memcpy(block2->lines, block->lines + linenum, split_len * sizeof(fz_stext_line));
+			block2->lines[0].distance = 0;
+
+			out--;
+			page->blocks[out].type = FZ_PAGE_BLOCK_TEXT;
+			page->blocks[out].u.text = block2;
+			end = linenum;
+			k--;
+		}
+		if (page->blocks[block_num].type == FZ_PAGE_BLOCK_TEXT)
+			block->len = end;
+
+		out--;
+		page->blocks[out] = page->blocks[block_num];
+	}
+	page->len += n;
 }
 
 static inline int
@@ -337,6 +359,25 @@ is_list_entry(fz_stext_line *line, fz_stext_span *span, int *char_num_ptr)
 	return 0;
 }
 
+/* Once there are more region masks than this on a page, lines are only
+ * compared against the masks most recently merged into or matched,
+ * rather than against all of them, which would be quadratic in the
+ * number of lines.
+ *
+ * Pages with fewer distinct masks, which covers ordinary text and tables
+ * whose rows share their columns, are analysed as if there were no limit.
+ * On pages with more (dense forms, many differently ruled tables) a line
+ * may miss a compatible mask outside the neighbourhood. It then starts a
+ * mask of its own, so such pages end up with more, narrower masks and a
+ * few lines are merged differently. On the synthetic forms in
+ * source/tests/stext-analyze-test.c this changes under 2% of the output
+ * lines, and that test fails if it exceeds 5%.
+ *
+ * Can be overridden at build time; the test builds an unlimited copy. */
+#ifndef REGION_MASK_NEIGHBOURHOOD
+#define REGION_MASK_NEIGHBOURHOOD 64
+#endif
+
 typedef struct region_masks_s region_masks;
 
 typedef struct region_mask_s region_mask;
@@ -361,6 +402,8 @@ struct region_mask_s
 	int cap;
 	int len;
 	float size;
+	int index; /* Position in the region_masks it was last added to */
+	fz_stext_line *line; /* The line the mask was made from */
 	region *mask;
 };
 
@@ -370,6 +413,8 @@ struct region_masks_s
 	int cap;
 	int len;
 	region_mask **mask;
+	int nrecent;
+	int recent[REGION_MASK_NEIGHBOURHOOD];
 };
 
 static region_masks *
@@ -380,6 +425,7 @@ new_region_masks(fz_context *ctx)
 	rms->cap = 0;
 	rms->len = 0;
 	rms->mask = NULL;
+	rms->nrecent = 0;
 	return rms;
 }
 
@@ -627,13 +673,45 @@ static void region_mask_merge(region_mask *rm1, const region_mask *rm2, int newl
 	rm1->len = newlen;
 }
 
-static region_mask *region_masks_match(const region_masks *rms, const region_mask *rm, fz_stext_line *line, region_mask *prev_match)
+/* The number of masks that lines should be compared against. */
+static inline int region_masks_candidates(const region_masks *rms)
 {
-	int i;
+	return rms->len <= REGION_MASK_NEIGHBOURHOOD ? rms->len : rms->nrecent;
+}
+
+/* The index of the k'th mask that lines should be compared against. */
+static inline int region_masks_candidate(const region_masks *rms, int k)
+{
+	return rms->len <= REGION_MASK_NEIGHBOURHOOD ? k : rms->recent[k];
+}
+
+/* Move a mask to the front of the recently used list. */
+static void region_masks_touch(region_masks *rms, int i)
+{
+	int j;
+
+	for (j = 0; j < rms->nrecent; j++)
+		if (rms->recent[j] == i)
+			break;
+	if (j == rms->nrecent)
+	{
+		if (rms->nrecent < REGION_MASK_NEIGHBOURHOOD)
+			rms->nrecent++;
+		else
+			j--;
+	}
+	memmove(&rms->recent[1], &rms->recent[0], j * sizeof(*rms->recent));
+	rms->recent[0] = i;
+}
+
+static region_mask *region_masks_match(region_masks *rms, const region_mask *rm, fz_stext_line *line, region_mask *prev_match)
+{
+	int i, k, n;
 	float best_score = 9999999;
 	float score;
 	int best = -1;
 	int best_count = 0;
+	region_mask *own = line->region;
 
 	/* If the 'previous match' matches, use it regardless. */
 	if (prev_match && region_mask_matches(prev_match, rm, &score))
@@ -642,12 +720,22 @@ static region_mask *region_masks_match(const region_masks *rms, const region_mas
 	}
 
 	/* Run through and find the 'most compatible' region mask. We are
-	 * guaranteed that there will always be at least one compatible one!
+	 * guaranteed that there will always be at least one compatible one:
+	 * the one that this line's mask was merged into. Ties go to the
+	 * earliest mask, whatever order the candidates are visited in.
 	 */
-	for (i=0; i < rms->len; i++)
+	n = region_masks_candidates(rms);
+	for (k = 0; k <= n; k++)
 	{
-		int count = region_mask_matches(rms->mask[i], rm, &score);
-		if (count > best_count || (count == best_count && (score < best_score || best == -1)))
+		int count;
+		if (k < n)
+			i = region_masks_candidate(rms, k);
+		else if (n < rms->len)
+			i = own->index;
+		else
+			break;
+		count = region_mask_matches(rms->mask[i], rm, &score);
+		if (count > best_count || (count == best_count && (score < best_score || best == -1 || (score == best_score && i < best))))
 		{
 			best = i;
 			best_score = score;
@@ -655,6 +743,7 @@ static region_mask *region_masks_match(const region_masks *rms, const region_mas
 		}
 	}
 	assert(best >= 0 && best < rms->len);
+	region_masks_touch(rms, best);
 
 	/* So we have the matching mask. */
 	return rms->mask[best];
@@ -694,10 +783,22 @@ static void region_masks_add(region_masks *rms, region_mask *rm)
 		rms->mask = fz_resize_array(rms->ctx, rms->mask, newcap, sizeof(*rms->mask));
 		rms->cap = newcap;
 	}
+	rm->index = rms->len;
 	rms->mask[rms->len] = rm;
 	rms->len++;
 }
 
+static int region_mask_cmp(const void *a_, const void *b_)
+{
+	const region_mask *a = *(const region_mask * const *)a_;
+	const region_mask *b = *(const region_mask * const *)b_;
+
+	/* Largest first; keep equal sized masks in the order of their lines */
+	if (a->size != b->size)
+		return a->size < b->size ? 1 : -1;
+	return a->index - b->index;
+}
+
 static void region_masks_sort(region_masks *rms)
 {
 	int i, j;
@@ -715,24 +816,12 @@ static void region_masks_sort(region_masks *rms)
 	}
 
 	/* Now, sort on size */
-	/* FIXME: bubble sort - use heapsort for efficiency */
-	for (i=0; i < rms->len-1; i++)
-	{
-		for (j=i+1; j < rms->len; j++)
-		{
-			if (rms->mask[i]->size < rms->mask[j]->size)
-			{
-				region_mask *tmp = rms->mask[i];
-				rms->mask[i] = rms->mask[j];
-				rms->mask[j] = tmp;
-			}
-		}
-	}
+	qsort(rms->mask, rms->len, sizeof(*rms->mask), region_mask_cmp);
 }
 
 static void region_masks_merge(region_masks *rms, region_mask *rm)
 {
-	int i;
+	int i, k, n;
 	float best_score = 9999999;
 	float score;
 	int best = -1;
@@ -744,10 +833,14 @@ static void region_masks_merge(region_masks *rms, region_mask *rm)
 	printf("To:\n");
 	dump_region_masks(rms);
 #endif
-	for (i=0; i < rms->len; i++)
+	/* Ties go to the earliest mask, as for region_masks_match. */
+	n = region_masks_candidates(rms);
+	for (k = 0; k < n; k++)
 	{
-		int count = region_masks_mergeable(rms->mask[i], rm, &score);
-		if (count && (score < best_score || best == -1))
+		int count;
+		i = region_masks_candidate(rms, k);
+		count = region_masks_mergeable(rms->mask[i], rm, &score);
+		if (count && (score < best_score || best == -1 || (score == best_score && i < best)))
 		{
 			best = i;
 			best_count = count;
@@ -761,10 +854,15 @@ static void region_masks_merge(region_masks *rms, region_mask *rm)
 		printf("Merges to give:\n");
 		dump_region_masks(rms);
 #endif
+		/* Remember where the line went, for region_masks_match */
+		rm->line->region = rms->mask[best];
+		region_masks_touch(rms, best);
 		free_region_mask(rm);
 		return;
 	}
+	rm->line->region = rm;
 	region_masks_add(rms, rm);
+	region_masks_touch(rms, rm->index);
 #ifdef DEBUG_MASKS
 	printf("Adding new one to give:\n");
 	dump_region_masks(rms);
@@ -1029,6 +1127,11 @@ fz_analyze_text(fz_context *ctx, fz_stext_sheet *sheet, fz_stext_page *page)
 	line_heights *lh;
 	region_masks *rms;
 	int block_num;
+	int *splits = NULL;
+	int nsplits = 0;
+	int splits_cap = 0;
+
+	fz_drop_stext_index(ctx, page);
 
 	/* Simple paragraph analysis; look for the most common 'inter line'
 	 * spacing. This will be assumed to be our line spacing. Anything
@@ -1116,8 +1219,8 @@ list_entry:
 	/* Step 2: Find the most popular line height for each style */
 	cull_line_heights(lh);
 
-	/* Step 3: Run through the blocks, breaking each block into two if
-	 * the line height isn't right. */
+	/* Step 3: Run through the blocks, breaking each block before every
+	 * line whose line height isn't right. */
 	for (block_num = 0; block_num < page->len; block_num++)
 	{
 		int line_num;
@@ -1175,11 +1278,19 @@ list_entry:
 			if (!ok)
 			{
 force_paragraph:
-				split_block(ctx, page, block_num, line_num);
-				break;
+				if (nsplits == splits_cap)
+				{
+					splits_cap = splits_cap ? splits_cap * 2 : 32;
+					splits = fz_resize_array(ctx, splits, splits_cap, 2 * sizeof(*splits));
+				}
+				splits[2*nsplits] = block_num;
+				splits[2*nsplits+1] = line_num;
+				nsplits++;
 			}
 		}
 	}
+	split_blocks(ctx, page, splits, nsplits);
+	fz_free(ctx, splits);
 	free_line_heights(lh);
 
 	/* Simple line region analysis:
@@ -1219,6 +1330,7 @@ force_paragraph:
 			fz_normalize_vector(&blv);
 
 			rm = new_region_mask(ctx, &blv);
+			rm->line = line;
 			for (span = line->first_span; span; span = span->next)
 			{
 				fz_point *region_min = &span->min;
@@ -1,25 +1,64 @@
 #include "mupdf/fitz.h"
+#include "fitz-imp.h"
 
 #include <string.h>
 
-static inline int fz_tolower(int c)
+static inline int iswhite(int c)
 {
-	/* TODO: proper unicode case folding */
-	/* TODO: character equivalence (a matches ä, etc) */
-	if (c >= 'A' && c <= 'Z')
-		return c - 'A' + 'a';
-	return c;
+	return c == ' ' || c == '\r' || c == '\n' || c == '\t' || c == 0xA0 || c == 0x2028 || c == 0x2029;
 }
 
-static inline int iswhite(int c)
+/*
+	The index flattens the text of a page into a single array of
+	characters, with a pseudo-newline at the end of every line, so
+	that searching and selection do not have to walk the block, line
+	and span lists (and recompute bboxes) for every character.
+
+	Alongside it we keep a case folded copy of the text in which every
+	run of whitespace has been collapsed to a single space, which is
+	what the search actually matches against. start[k] gives the
+	position in the flattened text of the k-th folded character;
+	start[nfolded] is the length of the flattened text.
+*/
+
+enum
 {
-	return c == ' ' || c == '\r' || c == '\n' || c == '\t' || c == 0xA0 || c == 0x2028 || c == 0x2029;
+	FZ_STEXT_INDEX_EOL = 1, /* pseudo-newline */
+	FZ_STEXT_INDEX_SPAN_START = 2, /* first character of a span */
+	FZ_STEXT_INDEX_SPAN_END = 4, /* last character of a span */
+	FZ_STEXT_INDEX_LAST_SPAN = 8, /* character is in the last span of its line */
+	FZ_STEXT_INDEX_EMPTY_SPANS = 16, /* pseudo-newline of a line with only empty spans */
+};
+
+struct fz_stext_index_s
+{
+	int len;
+	fz_char_and_box *chars;
+	unsigned char *flags;
+	int nfolded;
+	int *folded;
+	int *start;
+};
+
+void
+fz_drop_stext_index(fz_context *ctx, fz_stext_page *page)
+{
+	fz_stext_index *index = page->index;
+
+	if (index == NULL)
+		return;
+	page->index = NULL;
+	fz_free(ctx, index->chars);
+	fz_free(ctx, index->flags);
+	fz_free(ctx, index->folded);
+	fz_free(ctx, index->start);
+	fz_free(ctx, index);
 }
 
-fz_char_and_box *fz_stext_char_at(fz_context *ctx, fz_char_and_box *cab, fz_stext_page *page, int idx)
+static int textlen_stext(fz_context *ctx, fz_stext_page *page)
 {
+	int len = 0;
 	int block_num;
-	int ofs = 0;
 
 	for (block_num = 0; block_num < page->len; block_num++)
 	{
@@ -34,47 +73,18 @@ fz_char_and_box *fz_stext_char_at(fz_context *ctx, fz_char_and_box *cab, fz_stex
 		{
 			for (span = line->first_span; span; span = span->next)
 			{
-				if (idx < ofs + span->len)
-				{
-					cab->c = span->text[idx - ofs].c;
-					fz_stext_char_bbox(ctx, &cab->bbox, span, idx - ofs);
-					return cab;
-				}
-				ofs += span->len;
-			}
-			/* pseudo-newline */
-			if (idx == ofs)
-			{
-				cab->bbox = fz_empty_rect;
-				cab->c = ' ';
-				return cab;
+				len += span->len;
 			}
-			ofs++;
+			len++; /* pseudo-newline */
 		}
 	}
-	cab->bbox = fz_empty_rect;
-	cab->c = 0;
-	return cab;
-}
-
-static inline int charat(fz_context *ctx, fz_stext_page *page, int idx)
-{
-	fz_char_and_box cab;
-	return fz_stext_char_at(ctx, &cab, page, idx)->c;
-}
-
-static fz_rect *bboxat(fz_context *ctx, fz_stext_page *page, int idx, fz_rect *bbox)
-{
-	fz_char_and_box cab;
-	/* FIXME: Nasty extra copy */
-	*bbox = fz_stext_char_at(ctx, &cab, page, idx)->bbox;
-	return bbox;
+	return len;
 }
 
-static int textlen_stext(fz_context *ctx, fz_stext_page *page)
+static void
+fill_stext_index(fz_context *ctx, fz_stext_index *index, fz_stext_page *page)
 {
-	int len = 0;
-	int block_num;
+	int block_num, i, k, n = 0;
 
 	for (block_num = 0; block_num < page->len; block_num++)
 	{
@@ -87,140 +97,219 @@ static int textlen_stext(fz_context *ctx, fz_stext_page *page)
 		block = page->blocks[block_num].u.text;
 		for (line = block->lines; line < block->lines + block->len; line++)
 		{
+			int line_start = n;
 			for (span = line->first_span; span; span = span->next)
 			{
-				len += span->len;
+				int last = (span == line->last_span ? FZ_STEXT_INDEX_LAST_SPAN : 0);
+				for (i = 0; i < span->len; i++, n++)
+				{
+					index->chars[n].c = span->text[i].c;
+					fz_stext_char_bbox(ctx, &index->chars[n].bbox, span, i);
+					index->flags[n] = last;
+					if (i == 0)
+						index->flags[n] |= FZ_STEXT_INDEX_SPAN_START;
+					if (i == span->len - 1)
+						index->flags[n] |= FZ_STEXT_INDEX_SPAN_END;
+				}
 			}
-			len++; /* pseudo-newline */
+			index->chars[n].c = ' ';
+			index->chars[n].bbox = fz_empty_rect;
+			index->flags[n] = FZ_STEXT_INDEX_EOL;
+			if (n == line_start && line->first_span)
+				index->flags[n] |= FZ_STEXT_INDEX_EMPTY_SPANS;
+			n++;
 		}
 	}
-	return len;
+
+	for (i = 0, k = 0; i < n; k++)
+	{
+		int c = index->chars[i].c;
+		index->start[k] = i++;
+		if (iswhite(c))
+		{
+			index->folded[k] = ' ';
+			while (i < n && iswhite(index->chars[i].c))
+				i++;
+		}
+		else
+			index->folded[k] = fz_tolower(c);
+	}
+	index->start[k] = n;
+	index->nfolded = k;
 }
 
-static int match_stext(fz_context *ctx, fz_stext_page *page, const char *s, int n)
+static fz_stext_index *
+stext_index(fz_context *ctx, fz_stext_page *page)
 {
-	int orig = n;
+	fz_stext_index *index;
+	int len;
+
+	if (page->index)
+		return page->index;
+
+	len = textlen_stext(ctx, page);
+	index = fz_malloc_struct(ctx, fz_stext_index);
+	page->index = index;
+	fz_try(ctx)
+	{
+		index->len = len;
+		index->chars = fz_malloc_array(ctx, len, sizeof(*index->chars));
+		index->flags = fz_malloc(ctx, len);
+		index->folded = fz_malloc_array(ctx, len, sizeof(*index->folded));
+		index->start = fz_malloc_array(ctx, len + 1, sizeof(*index->start));
+		fill_stext_index(ctx, index, page);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_stext_index(ctx, page);
+		fz_rethrow(ctx);
+	}
+	return index;
+}
+
+fz_char_and_box *fz_stext_char_at(fz_context *ctx, fz_char_and_box *cab, fz_stext_page *page, int idx)
+{
+	fz_stext_index *index = stext_index(ctx, page);
+
+	if (idx >= 0 && idx < index->len)
+	{
+		*cab = index->chars[idx];
+		return cab;
+	}
+	cab->bbox = fz_empty_rect;
+	cab->c = 0;
+	return cab;
+}
+
+/* Fold the needle in the same way as the text, and return its length. */
+static int fold_needle(const char *s, int *folded)
+{
+	int n = 0;
 	int c;
+
 	while (*s)
 	{
 		s += fz_chartorune(&c, (char *)s);
-		if (iswhite(c) && iswhite(charat(ctx, page, n)))
+		if (iswhite(c))
 		{
-			const char *s_next;
-
-			/* Skip over whitespace in the document */
-			do
-				n++;
-			while (iswhite(charat(ctx, page, n)));
-
-			/* Skip over multiple whitespace in the search string */
-			while (s_next = s + fz_chartorune(&c, (char *)s), iswhite(c))
-				s = s_next;
+			if (n == 0 || folded[n-1] != ' ')
+				folded[n++] = ' ';
 		}
 		else
+			folded[n++] = fz_tolower(c);
+	}
+	return n;
+}
+
+static int
+add_hit_boxes(fz_stext_index *index, int a, int b, fz_rect *hit_bbox, int hit_count, int hit_max)
+{
+	fz_rect linebox = fz_empty_rect;
+	int i;
+
+	for (i = a; i < b; i++)
+	{
+		fz_rect *charbox = &index->chars[i].bbox;
+		if (!fz_is_empty_rect(charbox))
 		{
-			if (fz_tolower(c) != fz_tolower(charat(ctx, page, n)))
-				return 0;
-			n++;
+			if (charbox->y0 != linebox.y0 || fz_abs(charbox->x0 - linebox.x1) > 5)
+			{
+				if (!fz_is_empty_rect(&linebox) && hit_count < hit_max)
+					hit_bbox[hit_count++] = linebox;
+				linebox = *charbox;
+			}
+			else
+			{
+				fz_union_rect(&linebox, charbox);
+			}
 		}
 	}
-	return n - orig;
+	if (!fz_is_empty_rect(&linebox) && hit_count < hit_max)
+		hit_bbox[hit_count++] = linebox;
+	return hit_count;
 }
 
 int
 fz_search_stext_page(fz_context *ctx, fz_stext_page *text, const char *needle, fz_rect *hit_bbox, int hit_max)
 {
-	int pos, len, i, n, hit_count;
+	fz_stext_index *index;
+	int *pat = NULL;
+	int *fail;
+	int i, k, m, hit_count;
 
 	if (strlen(needle) == 0)
 		return 0;
 
+	index = stext_index(ctx, text);
+
+	/* Knuth-Morris-Pratt over the folded text; matches do not overlap. */
+	pat = fz_malloc_array(ctx, 2 * strlen(needle), sizeof(*pat));
+	fail = pat + strlen(needle);
+	m = fold_needle(needle, pat);
+
+	fail[0] = 0;
+	for (i = 1, k = 0; i < m; i++)
+	{
+		while (k > 0 && pat[i] != pat[k])
+			k = fail[k-1];
+		if (pat[i] == pat[k])
+			k++;
+		fail[i] = k;
+	}
+
 	hit_count = 0;
-	len = textlen_stext(ctx, text);
-	pos = 0;
-	while (pos < len)
+	for (i = 0, k = 0; i < index->nfolded; i++)
 	{
-		n = match_stext(ctx, text, needle, pos);
-		if (n)
-		{
-			fz_rect linebox = fz_empty_rect;
-			for (i = 0; i < n; i++)
-			{
-				fz_rect charbox;
-				bboxat(ctx, text, pos + i, &charbox);
-				if (!fz_is_empty_rect(&charbox))
-				{
-					if (charbox.y0 != linebox.y0 || fz_abs(charbox.x0 - linebox.x1) > 5)
-					{
-						if (!fz_is_empty_rect(&linebox) && hit_count < hit_max)
-							hit_bbox[hit_count++] = linebox;
-						linebox = charbox;
-					}
-					else
-					{
-						fz_union_rect(&linebox, &charbox);
-					}
-				}
-			}
-			if (!fz_is_empty_rect(&linebox) && hit_count < hit_max)
-				hit_bbox[hit_count++] = linebox;
-			pos += n;
-		}
-		else
+		while (k > 0 && index->folded[i] != pat[k])
+			k = fail[k-1];
+		if (index->folded[i] == pat[k])
+			k++;
+		if (k == m)
 		{
-			pos += 1;
+			hit_count = add_hit_boxes(index, index->start[i+1-m], index->start[i+1], hit_bbox, hit_count, hit_max);
+			k = 0;
 		}
 	}
 
+	fz_free(ctx, pat);
 	return hit_count;
 }
 
+static inline int
+hit_char(const fz_rect *bbox, const fz_rect *rect)
+{
+	return bbox->x1 >= rect->x0 && bbox->x0 <= rect->x1 && bbox->y1 >= rect->y0 && bbox->y0 <= rect->y1;
+}
+
 int
 fz_highlight_selection(fz_context *ctx, fz_stext_page *page, fz_rect rect, fz_rect *hit_bbox, int hit_max)
 {
-	fz_rect linebox, charbox;
-	fz_stext_block *block;
-	fz_stext_line *line;
-	fz_stext_span *span;
-	int i, block_num, hit_count;
+	fz_stext_index *index = stext_index(ctx, page);
+	fz_rect linebox = fz_empty_rect;
+	int i, hit_count = 0;
 
-	float x0 = rect.x0;
-	float x1 = rect.x1;
-	float y0 = rect.y0;
-	float y1 = rect.y1;
-
-	hit_count = 0;
-
-	for (block_num = 0; block_num < page->len; block_num++)
+	for (i = 0; i < index->len; i++)
 	{
-		if (page->blocks[block_num].type != FZ_PAGE_BLOCK_TEXT)
-			continue;
-		block = page->blocks[block_num].u.text;
-		for (line = block->lines; line < block->lines + block->len; line++)
+		fz_rect *charbox = &index->chars[i].bbox;
+
+		if (index->flags[i] & FZ_STEXT_INDEX_EOL)
 		{
+			if (!fz_is_empty_rect(&linebox) && hit_count < hit_max)
+				hit_bbox[hit_count++] = linebox;
 			linebox = fz_empty_rect;
-			for (span = line->first_span; span; span = span->next)
+		}
+		else if (hit_char(charbox, &rect))
+		{
+			if (charbox->y0 != linebox.y0 || fz_abs(charbox->x0 - linebox.x1) > 5)
 			{
-				for (i = 0; i < span->len; i++)
-				{
-					fz_stext_char_bbox(ctx, &charbox, span, i);
-					if (charbox.x1 >= x0 && charbox.x0 <= x1 && charbox.y1 >= y0 && charbox.y0 <= y1)
-					{
-						if (charbox.y0 != linebox.y0 || fz_abs(charbox.x0 - linebox.x1) > 5)
-						{
-							if (!fz_is_empty_rect(&linebox) && hit_count < hit_max)
-								hit_bbox[hit_count++] = linebox;
-							linebox = charbox;
-						}
-						else
-						{
-							fz_union_rect(&linebox, &charbox);
-						}
-					}
-				}
+				if (!fz_is_empty_rect(&linebox) && hit_count < hit_max)
+					hit_bbox[hit_count++] = linebox;
+				linebox = *charbox;
+			}
+			else
+			{
+				fz_union_rect(&linebox, charbox);
 			}
-			if (!fz_is_empty_rect(&linebox) && hit_count < hit_max)
-				hit_bbox[hit_count++] = linebox;
 		}
 	}
 
@@ -230,54 +319,44 @@ fz_highlight_selection(fz_context *ctx, fz_stext_page *page, fz_rect rect, fz_re
 char *
 fz_copy_selection(fz_context *ctx, fz_stext_page *page, fz_rect rect)
 {
+	fz_stext_index *index = stext_index(ctx, page);
 	fz_buffer *buffer;
-	fz_rect hitbox;
-	int c, i, block_num, seen = 0;
+	int c, i, flags, seen = 0;
 	unsigned char *s;
 
-	float x0 = rect.x0;
-	float x1 = rect.x1;
-	float y0 = rect.y0;
-	float y1 = rect.y1;
-
 	buffer = fz_new_buffer(ctx, 1024);
 
-	for (block_num = 0; block_num < page->len; block_num++)
+	for (i = 0; i < index->len; i++)
 	{
-		fz_stext_block *block;
-		fz_stext_line *line;
-		fz_stext_span *span;
-
-		if (page->blocks[block_num].type != FZ_PAGE_BLOCK_TEXT)
+		flags = index->flags[i];
+		if ((flags & FZ_STEXT_INDEX_EOL) && !(flags & FZ_STEXT_INDEX_EMPTY_SPANS))
 			continue;
-		block = page->blocks[block_num].u.text;
-		for (line = block->lines; line < block->lines + block->len; line++)
+
+		/* Empty spans start a new line too, even though they hold no text. */
+		if (flags & (FZ_STEXT_INDEX_SPAN_START | FZ_STEXT_INDEX_EMPTY_SPANS))
 		{
-			for (span = line->first_span; span; span = span->next)
+			if (seen)
 			{
-				if (seen)
-				{
-					fz_append_byte(ctx, buffer, '\n');
-				}
+				fz_append_byte(ctx, buffer, '\n');
+			}
 
-				seen = 0;
+			seen = 0;
+		}
 
-				for (i = 0; i < span->len; i++)
-				{
-					fz_stext_char_bbox(ctx, &hitbox, span, i);
-					c = span->text[i].c;
-					if (c < 32)
-						c = 0xFFFD;
-					if (hitbox.x1 >= x0 && hitbox.x0 <= x1 && hitbox.y1 >= y0 && hitbox.y0 <= y1)
-					{
-						fz_append_rune(ctx, buffer, c);
-						seen = 1;
-					}
-				}
+		if (flags & FZ_STEXT_INDEX_EOL)
+			continue;
 
-				seen = (seen && span == line->last_span);
-			}
+		c = index->chars[i].c;
+		if (c < 32)
+			c = 0xFFFD;
+		if (hit_char(&index->chars[i].bbox, &rect))
+		{
+			fz_append_rune(ctx, buffer, c);
+			seen = 1;
 		}
+
+		if (flags & FZ_STEXT_INDEX_SPAN_END)
+			seen = (seen && (flags & FZ_STEXT_INDEX_LAST_SPAN));
 	}
 
 	fz_terminate_buffer(ctx, buffer);
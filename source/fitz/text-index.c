@@ -0,0 +1,726 @@
+#include "mupdf/fitz.h"
+#include "fitz-imp.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+/*
+	The index is kept as a list of entries, one for each occurrence of
+	a word, and a pool of distinct terms (folded words) that they refer
+	to. While pages are being added, terms are found through a hash
+	table. Before searching or writing, the terms are sorted and the
+	entries ordered by term, page and word number, so that all the
+	occurrences of a term are contiguous (starting at term_start[term])
+	and can be found by binary search.
+*/
+
+enum { FZ_TEXT_INDEX_MAX_TERM = 64 };
+enum { FZ_TEXT_INDEX_VERSION = 1 };
+enum { FZ_TEXT_INDEX_BATCH = 64 };
+
+typedef struct fz_text_index_entry_s fz_text_index_entry;
+
+struct fz_text_index_entry_s
+{
+	int term;
+	int page;
+	int word;
+	int offset;
+	fz_rect bbox;
+};
+
+struct fz_text_index_s
+{
+	int pool_len, pool_cap;
+	char *pool;
+
+	int term_len, term_cap;
+	int *terms;
+	int *term_start;
+
+	int hash_cap;
+	int *hash;
+
+	int len, cap;
+	fz_text_index_entry *entries;
+
+	int sorted;
+};
+
+static inline int
+is_word_rune(int c)
+{
+	if (c <= 32 || c == 0x7F)
+		return 0;
+	if (c < 128)
+		return !strchr("!\"#$%&'()*+,-./:;<=>?@[\\]^_`{|}~", c);
+	if (c >= 0xA0 && c <= 0xBF)
+		return 0;
+	if (c == 0xD7 || c == 0xF7)
+		return 0;
+	if (c >= 0x2000 && c <= 0x206F) /* General Punctuation */
+		return 0;
+	if (c >= 0x3000 && c <= 0x3003) /* CJK spaces and punctuation */
+		return 0;
+	return 1;
+}
+
+/* Words longer than FZ_TEXT_INDEX_MAX_TERM bytes are truncated. */
+static inline void
+add_rune_to_term(char *term, int *len, int c)
+{
+	if (*len < FZ_TEXT_INDEX_MAX_TERM)
+		*len += fz_runetochar(term + *len, fz_tolower(c));
+}
+
+static unsigned int
+hash_term(const char *s, int n)
+{
+	unsigned int h = 2166136261u;
+	while (n--)
+		h = (h ^ (unsigned char)*s++) * 16777619u;
+	return h;
+}
+
+static void
+rehash_text_index(fz_context *ctx, fz_text_index *index, int cap)
+{
+	int i;
+
+	fz_free(ctx, index->hash);
+	index->hash = NULL;
+	index->hash_cap = 0;
+	index->hash = fz_malloc_array(ctx, cap, sizeof(*index->hash));
+	index->hash_cap = cap;
+	memset(index->hash, 0, cap * sizeof(*index->hash));
+
+	for (i = 0; i < index->term_len; i++)
+	{
+		const char *s = index->pool + index->terms[i];
+		unsigned int pos = hash_term(s, strlen(s)) & (cap - 1);
+		while (index->hash[pos])
+			pos = (pos + 1) & (cap - 1);
+		index->hash[pos] = i + 1;
+	}
+}
+
+static int
+intern_term(fz_context *ctx, fz_text_index *index, const char *term, int n)
+{
+	unsigned int pos;
+	int t;
+
+	/* Keep the table no more than half full. */
+	if (index->hash_cap < 2 * (index->term_len + 1))
+	{
+		int cap = 1024;
+		while (cap < 2 * (index->term_len + 1))
+			cap *= 2;
+		rehash_text_index(ctx, index, cap);
+	}
+
+	pos = hash_term(term, n) & (index->hash_cap - 1);
+	while ((t = index->hash[pos]) != 0)
+	{
+		const char *s = index->pool + index->terms[t - 1];
+		if (!strncmp(s, term, n) && s[n] == 0)
+			return t - 1;
+		pos = (pos + 1) & (index->hash_cap - 1);
+	}
+
+	if (index->pool_len + n + 1 > index->pool_cap)
+	{
+		int newcap = index->pool_cap ? index->pool_cap : 4096;
+		while (index->pool_len + n + 1 > newcap)
+			newcap *= 2;
+		index->pool = fz_resize_array(ctx, index->pool, newcap, 1);
+		index->pool_cap = newcap;
+	}
+	if (index->term_len == index->term_cap)
+	{
+		int newcap = index->term_cap ? index->term_cap * 2 : 256;
+		index->terms = fz_resize_array(ctx, index->terms, newcap, sizeof(*index->terms));
+		index->term_cap = newcap;
+	}
+
+	memcpy(index->pool + index->pool_len, term, n);
+	index->pool[index->pool_len + n] = 0;
+	index->terms[index->term_len] = index->pool_len;
+	index->pool_len += n + 1;
+	index->hash[pos] = ++index->term_len;
+	return index->term_len - 1;
+}
+
+static void
+add_entry(fz_context *ctx, fz_text_index *index, int term, int page, int word, int offset, const fz_rect *bbox)
+{
+	fz_text_index_entry *entry;
+
+	if (index->len == index->cap)
+	{
+		int newcap = index->cap ? index->cap * 2 : 1024;
+		index->entries = fz_resize_array(ctx, index->entries, newcap, sizeof(*index->entries));
+		index->cap = newcap;
+	}
+	entry = &index->entries[index->len++];
+	entry->term = term;
+	entry->page = page;
+	entry->word = word;
+	entry->offset = offset;
+	entry->bbox = *bbox;
+	index->sorted = 0;
+}
+
+fz_text_index *
+fz_new_text_index(fz_context *ctx)
+{
+	return fz_malloc_struct(ctx, fz_text_index);
+}
+
+void
+fz_drop_text_index(fz_context *ctx, fz_text_index *index)
+{
+	if (index == NULL)
+		return;
+	fz_free(ctx, index->pool);
+	fz_free(ctx, index->terms);
+	fz_free(ctx, index->term_start);
+	fz_free(ctx, index->hash);
+	fz_free(ctx, index->entries);
+	fz_free(ctx, index);
+}
+
+void
+fz_add_stext_page_to_text_index(fz_context *ctx, fz_text_index *index, int number, fz_stext_page *page)
+{
+	char term[FZ_TEXT_INDEX_MAX_TERM + FZ_UTFMAX];
+	int term_len = 0;
+	int block_num, i;
+	int ofs = 0;
+	int word = 0;
+	int start = -1;
+	fz_rect bbox = fz_empty_rect;
+	fz_rect charbox;
+
+	/* Offsets count a pseudo-newline at the end of each line, as
+	 * fz_stext_char_at does. */
+	for (block_num = 0; block_num < page->len; block_num++)
+	{
+		fz_stext_block *block;
+		fz_stext_line *line;
+		fz_stext_span *span;
+
+		if (page->blocks[block_num].type != FZ_PAGE_BLOCK_TEXT)
+			continue;
+		block = page->blocks[block_num].u.text;
+		for (line = block->lines; line < block->lines + block->len; line++)
+		{
+			for (span = line->first_span; span; span = span->next)
+			{
+				for (i = 0; i < span->len; i++, ofs++)
+				{
+					int c = span->text[i].c;
+					if (is_word_rune(c))
+					{
+						fz_stext_char_bbox(ctx, &charbox, span, i);
+						if (start < 0)
+						{
+							start = ofs;
+							term_len = 0;
+							bbox = charbox;
+						}
+						else
+							fz_union_rect(&bbox, &charbox);
+						add_rune_to_term(term, &term_len, c);
+					}
+					else if (start >= 0)
+					{
+						add_entry(ctx, index, intern_term(ctx, index, term, term_len), number, word++, start, &bbox);
+						start = -1;
+					}
+				}
+			}
+			/* Words do not continue onto the next line. */
+			if (start >= 0)
+			{
+				add_entry(ctx, index, intern_term(ctx, index, term, term_len), number, word++, start, &bbox);
+				start = -1;
+			}
+			ofs++;
+		}
+	}
+}
+
+static void
+merge_text_index(fz_context *ctx, fz_text_index *index, fz_text_index *part)
+{
+	int *remap;
+	int i;
+
+	remap = fz_malloc_array(ctx, part->term_len, sizeof(*remap));
+	fz_try(ctx)
+	{
+		for (i = 0; i < part->term_len; i++)
+		{
+			const char *s = part->pool + part->terms[i];
+			remap[i] = intern_term(ctx, index, s, strlen(s));
+		}
+		for (i = 0; i < part->len; i++)
+		{
+			fz_text_index_entry *e = &part->entries[i];
+			add_entry(ctx, index, remap[e->term], e->page, e->word, e->offset, &e->bbox);
+		}
+	}
+	fz_always(ctx)
+		fz_free(ctx, remap);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+typedef struct
+{
+	const char *s;
+	int term;
+} term_order;
+
+static int
+cmp_term_order(const void *a_, const void *b_)
+{
+	const term_order *a = a_;
+	const term_order *b = b_;
+	return strcmp(a->s, b->s);
+}
+
+static int
+cmp_entry(const void *a_, const void *b_)
+{
+	const fz_text_index_entry *a = a_;
+	const fz_text_index_entry *b = b_;
+	if (a->term != b->term)
+		return a->term < b->term ? -1 : 1;
+	if (a->page != b->page)
+		return a->page < b->page ? -1 : 1;
+	if (a->word != b->word)
+		return a->word < b->word ? -1 : 1;
+	return 0;
+}
+
+static void
+sort_text_index(fz_context *ctx, fz_text_index *index)
+{
+	term_order *order;
+	int *rank = NULL;
+	int i;
+
+	if (index->sorted)
+		return;
+
+	order = fz_malloc_array(ctx, index->term_len, sizeof(*order));
+	fz_var(rank);
+	fz_try(ctx)
+	{
+		rank = fz_malloc_array(ctx, index->term_len, sizeof(*rank));
+		fz_free(ctx, index->term_start);
+		index->term_start = NULL;
+		index->term_start = fz_malloc_array(ctx, index->term_len + 1, sizeof(*index->term_start));
+
+		for (i = 0; i < index->term_len; i++)
+		{
+			order[i].s = index->pool + index->terms[i];
+			order[i].term = i;
+		}
+		qsort(order, index->term_len, sizeof(*order), cmp_term_order);
+		for (i = 0; i < index->term_len; i++)
+		{
+			rank[order[i].term] = i;
+			index->terms[i] = (int)(order[i].s - index->pool);
+		}
+
+		for (i = 0; i < index->len; i++)
+			index->entries[i].term = rank[index->entries[i].term];
+		qsort(index->entries, index->len, sizeof(*index->entries), cmp_entry);
+
+		memset(index->term_start, 0, (index->term_len + 1) * sizeof(*index->term_start));
+		for (i = 0; i < index->len; i++)
+			index->term_start[index->entries[i].term + 1]++;
+		for (i = 0; i < index->term_len; i++)
+			index->term_start[i + 1] += index->term_start[i];
+
+		/* The term numbers have changed. */
+		fz_free(ctx, index->hash);
+		index->hash = NULL;
+		index->hash_cap = 0;
+
+		index->sorted = 1;
+	}
+	fz_always(ctx)
+	{
+		fz_free(ctx, order);
+		fz_free(ctx, rank);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+typedef struct
+{
+	fz_display_list **lists;
+	fz_text_index *parts[FZ_MAX_PARALLEL_JOBS];
+	fz_parallel_error error[FZ_MAX_PARALLEL_JOBS];
+	const fz_stext_options *options;
+	int first;
+	int n;
+	int jobs;
+} text_index_job;
+
+static void
+index_display_lists(fz_context *ctx, text_index_job *job, fz_text_index *index, int a, int b)
+{
+	fz_stext_sheet *sheet = NULL;
+	fz_stext_page *text = NULL;
+	int i;
+
+	fz_var(sheet);
+	fz_var(text);
+
+	fz_try(ctx)
+	{
+		sheet = fz_new_stext_sheet(ctx);
+		for (i = a; i < b; i++)
+		{
+			text = fz_new_stext_page_from_display_list(ctx, job->lists[i], sheet, job->options);
+			fz_add_stext_page_to_text_index(ctx, index, job->first + i, text);
+			fz_drop_stext_page(ctx, text);
+			text = NULL;
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_drop_stext_page(ctx, text);
+		fz_drop_stext_sheet(ctx, sheet);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+static void
+run_text_index_job(fz_context *ctx, void *arg, int i)
+{
+	text_index_job *job = arg;
+	int a = job->n * i / job->jobs;
+	int b = job->n * (i + 1) / job->jobs;
+
+	fz_try(ctx)
+	{
+		job->parts[i] = fz_new_text_index(ctx);
+		index_display_lists(ctx, job, job->parts[i], a, b);
+	}
+	fz_catch(ctx)
+		fz_catch_parallel_error(ctx, &job->error[i]);
+}
+
+fz_text_index *
+fz_new_text_index_from_document(fz_context *ctx, fz_document *doc, const fz_stext_options *options)
+{
+	fz_tuning_context *tuning = ctx->tuning;
+	fz_display_list *lists[FZ_TEXT_INDEX_BATCH];
+	fz_text_index *index;
+	text_index_job job;
+	int count, i;
+
+	memset(&job, 0, sizeof job);
+	memset(lists, 0, sizeof lists);
+	job.lists = lists;
+	job.options = options;
+
+	fz_var(job);
+	fz_var(lists);
+
+	index = fz_new_text_index(ctx);
+
+	fz_try(ctx)
+	{
+		count = fz_count_pages(ctx, doc);
+
+		/* Documents are not thread safe, so the pages are loaded
+		 * here, a batch at a time, and only the display lists are
+		 * handed out for text extraction. */
+		for (job.first = 0; job.first < count; job.first += job.n)
+		{
+			job.n = fz_mini(count - job.first, FZ_TEXT_INDEX_BATCH);
+			for (i = 0; i < job.n; i++)
+				lists[i] = fz_new_display_list_from_page_number(ctx, doc, job.first + i);
+
+			if (tuning->parallel && job.n > 1)
+			{
+				job.jobs = fz_mini(job.n, FZ_MAX_PARALLEL_JOBS);
+				for (i = 0; i < job.jobs; i++)
+					job.error[i].code = 0;
+				tuning->parallel(tuning->parallel_arg, ctx, job.jobs, run_text_index_job, &job);
+				fz_rethrow_parallel_errors(ctx, job.error, job.jobs);
+				for (i = 0; i < job.jobs; i++)
+				{
+					merge_text_index(ctx, index, job.parts[i]);
+					fz_drop_text_index(ctx, job.parts[i]);
+					job.parts[i] = NULL;
+				}
+			}
+			else
+				index_display_lists(ctx, &job, index, 0, job.n);
+
+			for (i = 0; i < job.n; i++)
+			{
+				fz_drop_display_list(ctx, lists[i]);
+				lists[i] = NULL;
+			}
+		}
+	}
+	fz_catch(ctx)
+	{
+		for (i = 0; i < job.n; i++)
+			fz_drop_display_list(ctx, lists[i]);
+		for (i = 0; i < job.jobs; i++)
+			fz_drop_text_index(ctx, job.parts[i]);
+		fz_drop_text_index(ctx, index);
+		fz_rethrow(ctx);
+	}
+
+	return index;
+}
+
+static int
+find_term(fz_text_index *index, const char *term)
+{
+	int l = 0;
+	int r = index->term_len - 1;
+
+	while (l <= r)
+	{
+		int m = (l + r) >> 1;
+		int c = strcmp(term, index->pool + index->terms[m]);
+		if (c < 0)
+			r = m - 1;
+		else if (c > 0)
+			l = m + 1;
+		else
+			return m;
+	}
+	return -1;
+}
+
+static fz_text_index_entry *
+find_entry(fz_text_index *index, int term, int page, int word)
+{
+	int l = index->term_start[term];
+	int r = index->term_start[term + 1] - 1;
+
+	while (l <= r)
+	{
+		int m = (l + r) >> 1;
+		fz_text_index_entry *e = &index->entries[m];
+		if (page < e->page || (page == e->page && word < e->word))
+			r = m - 1;
+		else if (page > e->page || word > e->word)
+			l = m + 1;
+		else
+			return e;
+	}
+	return NULL;
+}
+
+int
+fz_search_text_index(fz_context *ctx, fz_text_index *index, const char *needle, fz_text_index_hit *hits, int hit_max)
+{
+	char term[FZ_TEXT_INDEX_MAX_TERM + FZ_UTFMAX];
+	int *words;
+	int n, term_len, hit_count, i, k, c;
+	const char *s;
+
+	sort_text_index(ctx, index);
+
+	words = fz_malloc_array(ctx, strlen(needle) + 1, sizeof(*words));
+	n = 0;
+	term_len = 0;
+	s = needle;
+	do
+	{
+		s += fz_chartorune(&c, (char *)s);
+		if (c && is_word_rune(c))
+			add_rune_to_term(term, &term_len, c);
+		else if (term_len > 0)
+		{
+			term[term_len] = 0;
+			words[n] = find_term(index, term);
+			if (words[n++] < 0)
+			{
+				fz_free(ctx, words);
+				return 0;
+			}
+			term_len = 0;
+		}
+	}
+	while (c);
+
+	hit_count = 0;
+	if (n > 0)
+	{
+		for (i = index->term_start[words[0]]; i < index->term_start[words[0] + 1] && hit_count < hit_max; i++)
+		{
+			fz_text_index_entry *first = &index->entries[i];
+			fz_rect linebox = first->bbox;
+
+			for (k = 1; k < n; k++)
+				if (!find_entry(index, words[k], first->page, first->word + k))
+					break;
+			if (k < n)
+				continue;
+
+			for (k = 1; k < n; k++)
+			{
+				fz_rect *wordbox = &find_entry(index, words[k], first->page, first->word + k)->bbox;
+				if (wordbox->x0 >= linebox.x0 && wordbox->y0 < linebox.y1 && wordbox->y1 > linebox.y0)
+					fz_union_rect(&linebox, wordbox);
+				else
+				{
+					if (hit_count < hit_max)
+					{
+						hits[hit_count].page = first->page;
+						hits[hit_count].offset = first->offset;
+						hits[hit_count].bbox = linebox;
+						hit_count++;
+					}
+					linebox = *wordbox;
+				}
+			}
+			if (hit_count < hit_max)
+			{
+				hits[hit_count].page = first->page;
+				hits[hit_count].offset = first->offset;
+				hits[hit_count].bbox = linebox;
+				hit_count++;
+			}
+		}
+	}
+
+	fz_free(ctx, words);
+	return hit_count;
+}
+
+static void
+write_float(fz_context *ctx, fz_output *out, float f)
+{
+	union { float f; int i; } u;
+	u.f = f;
+	fz_write_int32_le(ctx, out, u.i);
+}
+
+static float
+read_float(fz_context *ctx, fz_stream *stm)
+{
+	union { float f; int i; } u;
+	u.i = fz_read_int32_le(ctx, stm);
+	return u.f;
+}
+
+void
+fz_write_text_index(fz_context *ctx, fz_text_index *index, fz_output *out)
+{
+	int i;
+
+	sort_text_index(ctx, index);
+
+	fz_write_data(ctx, out, "MUTI", 4);
+	fz_write_int32_le(ctx, out, FZ_TEXT_INDEX_VERSION);
+	fz_write_int32_le(ctx, out, index->pool_len);
+	fz_write_int32_le(ctx, out, index->term_len);
+	fz_write_int32_le(ctx, out, index->len);
+
+	fz_write_data(ctx, out, index->pool, index->pool_len);
+	for (i = 0; i < index->term_len; i++)
+	{
+		fz_write_int32_le(ctx, out, index->terms[i]);
+		fz_write_int32_le(ctx, out, index->term_start[i + 1] - index->term_start[i]);
+	}
+	for (i = 0; i < index->len; i++)
+	{
+		fz_text_index_entry *e = &index->entries[i];
+		fz_write_int32_le(ctx, out, e->page);
+		fz_write_int32_le(ctx, out, e->word);
+		fz_write_int32_le(ctx, out, e->offset);
+		write_float(ctx, out, e->bbox.x0);
+		write_float(ctx, out, e->bbox.y0);
+		write_float(ctx, out, e->bbox.x1);
+		write_float(ctx, out, e->bbox.y1);
+	}
+}
+
+fz_text_index *
+fz_read_text_index(fz_context *ctx, fz_stream *stm)
+{
+	fz_text_index *index;
+	unsigned char magic[4];
+	int i, k, t, count;
+
+	if (fz_read(ctx, stm, magic, 4) != 4 || memcmp(magic, "MUTI", 4))
+		fz_throw(ctx, FZ_ERROR_GENERIC, "not a text index");
+	if (fz_read_int32_le(ctx, stm) != FZ_TEXT_INDEX_VERSION)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "unsupported text index version");
+
+	index = fz_new_text_index(ctx);
+	fz_try(ctx)
+	{
+		index->pool_len = fz_read_int32_le(ctx, stm);
+		index->term_len = fz_read_int32_le(ctx, stm);
+		index->len = fz_read_int32_le(ctx, stm);
+		if (index->pool_len < 0 || index->term_len < 0 || index->len < 0)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "corrupt text index");
+		index->pool_cap = index->pool_len;
+		index->term_cap = index->term_len;
+		index->cap = index->len;
+
+		index->pool = fz_malloc(ctx, index->pool_len);
+		if (fz_read(ctx, stm, (unsigned char *)index->pool, index->pool_len) != (size_t)index->pool_len)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "truncated text index");
+		if (index->pool_len > 0 && index->pool[index->pool_len - 1] != 0)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "corrupt text index");
+
+		index->terms = fz_malloc_array(ctx, index->term_len, sizeof(*index->terms));
+		index->term_start = fz_malloc_array(ctx, index->term_len + 1, sizeof(*index->term_start));
+		index->term_start[0] = 0;
+		for (i = 0; i < index->term_len; i++)
+		{
+			index->terms[i] = fz_read_int32_le(ctx, stm);
+			count = fz_read_int32_le(ctx, stm);
+			if (index->terms[i] < 0 || index->terms[i] >= index->pool_len || count < 0 || count > index->len - index->term_start[i])
+				fz_throw(ctx, FZ_ERROR_GENERIC, "corrupt text index");
+			index->term_start[i + 1] = index->term_start[i] + count;
+		}
+		if (index->term_start[index->term_len] != index->len)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "corrupt text index");
+
+		index->entries = fz_malloc_array(ctx, index->len, sizeof(*index->entries));
+		for (t = 0, i = 0; t < index->term_len; t++)
+		{
+			for (k = index->term_start[t]; k < index->term_start[t + 1]; k++, i++)
+			{
+				fz_text_index_entry *e = &index->entries[i];
+				e->term = t;
+				e->page = fz_read_int32_le(ctx, stm);
+				e->word = fz_read_int32_le(ctx, stm);
+				e->offset = fz_read_int32_le(ctx, stm);
+				e->bbox.x0 = read_float(ctx, stm);
+				e->bbox.y0 = read_float(ctx, stm);
+				e->bbox.x1 = read_float(ctx, stm);
+				e->bbox.y1 = read_float(ctx, stm);
+			}
+		}
+		index->sorted = 1;
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_text_index(ctx, index);
+		fz_rethrow(ctx);
+	}
+
+	return index;
+}
@@ -16,8 +16,9 @@ struct fz_tar_archive_s
 {
 	fz_archive super;
 
-	int count;
+	int count, cap;
 	tar_entry *entries;
+	fz_archive_lookup *lookup;
 };
 
 static inline int isoctdigit(char c)
@@ -46,6 +47,7 @@ static void drop_tar_archive(fz_context *ctx, fz_archive *arch)
 	for (i = 0; i < tar->count; ++i)
 		fz_free(ctx, tar->entries[i].name);
 	fz_free(ctx, tar->entries);
+	fz_drop_archive_lookup(ctx, tar->lookup);
 }
 
 static void ensure_tar_entries(fz_context *ctx, fz_tar_archive *tar)
@@ -88,7 +90,12 @@ static void ensure_tar_entries(fz_context *ctx, fz_tar_archive *tar)
 		if (typeflag != '0')
 			continue;
 
-		tar->entries = fz_resize_array(ctx, tar->entries, tar->count + 1, sizeof *tar->entries);
+		if (tar->count == tar->cap)
+		{
+			int new_cap = tar->cap ? tar->cap * 2 : 64;
+			tar->entries = fz_resize_array(ctx, tar->entries, new_cap, sizeof *tar->entries);
+			tar->cap = new_cap;
+		}
 
 		tar->entries[tar->count].name = fz_strdup(ctx, name);
 		tar->entries[tar->count].offset = offset;
@@ -96,15 +103,14 @@ static void ensure_tar_entries(fz_context *ctx, fz_tar_archive *tar)
 
 		tar->count++;
 	}
+
+	tar->lookup = fz_new_archive_lookup(ctx, &tar->super);
 }
 
 static tar_entry *lookup_tar_entry(fz_context *ctx, fz_tar_archive *tar, const char *name)
 {
-	int i;
-	for (i = 0; i < tar->count; i++)
-		if (!fz_strcasecmp(name, tar->entries[i].name))
-			return &tar->entries[i];
-	return NULL;
+	int i = fz_lookup_archive_entry(ctx, tar->lookup, name);
+	return i < 0 ? NULL : &tar->entries[i];
 }
 
 static fz_stream *open_tar_entry(fz_context *ctx, fz_archive *arch, const char *name)
@@ -118,7 +124,7 @@ static fz_stream *open_tar_entry(fz_context *ctx, fz_archive *arch, const char *
 		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot find named tar archive entry");
 
 	fz_seek(ctx, file, ent->offset + 512, 0);
-	return fz_open_null(ctx, file, ent->size, fz_tell(ctx, file));
+	return fz_open_archive_range(ctx, fz_keep_stream(ctx, file), ent->size, fz_tell(ctx, file));
 }
 
 static fz_buffer *read_tar_entry(fz_context *ctx, fz_archive *arch, const char *name)
@@ -33,8 +33,9 @@ struct fz_zip_archive_s
 {
 	fz_archive super;
 
-	int count;
+	int count, cap;
 	zip_entry *entries;
+	fz_archive_lookup *lookup;
 };
 
 static void drop_zip_archive(fz_context *ctx, fz_archive *arch)
@@ -44,6 +45,7 @@ static void drop_zip_archive(fz_context *ctx, fz_archive *arch)
 	for (i = 0; i < zip->count; ++i)
 		fz_free(ctx, zip->entries[i].name);
 	fz_free(ctx, zip->entries);
+	fz_drop_archive_lookup(ctx, zip->lookup);
 }
 
 static void read_zip_dir_imp(fz_context *ctx, fz_zip_archive *zip, int start_offset)
@@ -66,7 +68,7 @@ static void read_zip_dir_imp(fz_context *ctx, fz_zip_archive *zip, int start_off
 	(void) fz_read_int16_le(ctx, file); /* this disk */
 	(void) fz_read_int16_le(ctx, file); /* start disk */
 	(void) fz_read_int16_le(ctx, file); /* entries in this disk */
-	count = fz_read_int16_le(ctx, file); /* entries in central directory disk */
+	count = fz_read_uint16_le(ctx, file); /* entries in central directory disk */
 	(void) fz_read_int32_le(ctx, file); /* size of central directory */
 	offset = fz_read_int32_le(ctx, file); /* offset to central directory */
 
@@ -133,9 +135,9 @@ static void read_zip_dir_imp(fz_context *ctx, fz_zip_archive *zip, int start_off
 		(void) fz_read_int32_le(ctx, file); /* crc-32 */
 		csize = fz_read_int32_le(ctx, file);
 		usize = fz_read_int32_le(ctx, file);
-		namesize = fz_read_int16_le(ctx, file);
-		metasize = fz_read_int16_le(ctx, file);
-		commentsize = fz_read_int16_le(ctx, file);
+		namesize = fz_read_uint16_le(ctx, file);
+		metasize = fz_read_uint16_le(ctx, file);
+		commentsize = fz_read_uint16_le(ctx, file);
 		(void) fz_read_int16_le(ctx, file); /* disk number start */
 		(void) fz_read_int16_le(ctx, file); /* int file atts */
 		(void) fz_read_int32_le(ctx, file); /* ext file atts */
@@ -179,7 +181,12 @@ static void read_zip_dir_imp(fz_context *ctx, fz_zip_archive *zip, int start_off
 
 		fz_seek(ctx, file, commentsize, 1);
 
-		zip->entries = fz_resize_array(ctx, zip->entries, zip->count + 1, sizeof *zip->entries);
+		if (zip->count == zip->cap)
+		{
+			int new_cap = zip->cap ? zip->cap * 2 : 64;
+			zip->entries = fz_resize_array(ctx, zip->entries, new_cap, sizeof *zip->entries);
+			zip->cap = new_cap;
+		}
 
 		zip->entries[zip->count].name = name;
 		zip->entries[zip->count].offset = offset;
@@ -243,6 +250,7 @@ static void ensure_zip_entries(fz_context *ctx, fz_zip_archive *zip)
 			if (!memcmp(buf + i, "PK\5\6", 4))
 			{
 				read_zip_dir_imp(ctx, zip, (int)(size - back + i));
+				zip->lookup = fz_new_archive_lookup(ctx, &zip->super);
 				return;
 			}
 		back += sizeof buf - 4;
@@ -253,17 +261,15 @@ static void ensure_zip_entries(fz_context *ctx, fz_zip_archive *zip)
 
 static zip_entry *lookup_zip_entry(fz_context *ctx, fz_zip_archive *zip, const char *name)
 {
-	int i;
-	for (i = 0; i < zip->count; i++)
-		if (!fz_strcasecmp(name, zip->entries[i].name))
-			return &zip->entries[i];
-	return NULL;
+	int i = fz_lookup_archive_entry(ctx, zip->lookup, name);
+	return i < 0 ? NULL : &zip->entries[i];
 }
 
 static fz_stream *open_zip_entry(fz_context *ctx, fz_archive *arch, const char *name)
 {
 	fz_zip_archive *zip = (fz_zip_archive *) arch;
 	fz_stream *file = zip->super.file;
+	fz_stream *stm;
 	int method;
 	zip_entry *ent;
 
@@ -271,11 +277,18 @@ static fz_stream *open_zip_entry(fz_context *ctx, fz_archive *arch, const char *
 	if (!ent)
 		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot find named zip archive entry");
 
+	/* Entry streams are bounded views of the archive file, that seek to
+	 * their own position for every read, so that several of them can be
+	 * read interleaved with each other and with the archive itself, on
+	 * any thread. */
 	method = read_zip_entry_header(ctx, zip, ent);
 	if (method == 0)
-		return fz_open_null(ctx, file, ent->usize, fz_tell(ctx, file));
+		return fz_open_archive_range(ctx, fz_keep_stream(ctx, file), ent->usize, fz_tell(ctx, file));
 	if (method == 8)
-		return fz_open_flated(ctx, file, -15);
+	{
+		stm = fz_open_archive_range(ctx, fz_keep_stream(ctx, file), ent->csize, fz_tell(ctx, file));
+		return fz_open_flated(ctx, stm, -15);
+	}
 	fz_throw(ctx, FZ_ERROR_GENERIC, "unknown zip method: %d", method);
 }
 
@@ -284,10 +297,10 @@ static fz_buffer *read_zip_entry(fz_context *ctx, fz_archive *arch, const char *
 	fz_zip_archive *zip = (fz_zip_archive *) arch;
 	fz_stream *file = zip->super.file;
 	fz_buffer *ubuf;
-	unsigned char *cbuf;
 	int method;
 	z_stream z;
 	int code;
+	size_t n, remain;
 	int len;
 	zip_entry *ent;
 
@@ -315,35 +328,44 @@ static fz_buffer *read_zip_entry(fz_context *ctx, fz_archive *arch, const char *
 	}
 	else if (method == 8)
 	{
-		cbuf = fz_malloc(ctx, ent->csize);
+		z.zalloc = (alloc_func) fz_malloc_array;
+		z.zfree = (free_func) fz_free;
+		z.opaque = ctx;
+		z.next_in = NULL;
+		z.avail_in = 0;
+		z.next_out = ubuf->data;
+		z.avail_out = ent->usize;
+
+		code = inflateInit2(&z, -15);
+		if (code != Z_OK)
+		{
+			fz_drop_buffer(ctx, ubuf);
+			fz_throw(ctx, FZ_ERROR_GENERIC, "zlib inflateInit2 error: %s", z.msg);
+		}
+
 		fz_try(ctx)
 		{
-			fz_read(ctx, file, cbuf, ent->csize);
-
-			z.zalloc = (alloc_func) fz_malloc_array;
-			z.zfree = (free_func) fz_free;
-			z.opaque = ctx;
-			z.next_in = cbuf;
-			z.avail_in = ent->csize;
-			z.next_out = ubuf->data;
-			z.avail_out = ent->usize;
-
-			code = inflateInit2(&z, -15);
-			if (code != Z_OK)
+			/* Inflate straight out of the file buffer, rather than
+			 * reading the whole compressed entry into memory first. */
+			remain = ent->csize;
+			code = Z_OK;
+			while (code == Z_OK && remain > 0)
 			{
-				fz_throw(ctx, FZ_ERROR_GENERIC, "zlib inflateInit2 error: %s", z.msg);
+				n = fz_available(ctx, file, remain);
+				if (n == 0)
+					break;
+				if (n > remain)
+					n = remain;
+				z.next_in = file->rp;
+				z.avail_in = (uInt)n;
+				code = inflate(&z, Z_NO_FLUSH);
+				file->rp += n - z.avail_in;
+				remain -= n - z.avail_in;
 			}
-			code = inflate(&z, Z_FINISH);
+			if (code == Z_OK || code == Z_BUF_ERROR)
+				fz_throw(ctx, FZ_ERROR_GENERIC, "premature end of data in compressed archive entry");
 			if (code != Z_STREAM_END)
-			{
-				inflateEnd(&z);
 				fz_throw(ctx, FZ_ERROR_GENERIC, "zlib inflate error: %s", z.msg);
-			}
-			code = inflateEnd(&z);
-			if (code != Z_OK)
-			{
-				fz_throw(ctx, FZ_ERROR_GENERIC, "zlib inflateEnd error: %s", z.msg);
-			}
 
 			len = ent->usize - z.avail_out;
 			if (len < ent->usize)
@@ -352,7 +374,7 @@ static fz_buffer *read_zip_entry(fz_context *ctx, fz_archive *arch, const char *
 		}
 		fz_always(ctx)
 		{
-			fz_free(ctx, cbuf);
+			inflateEnd(&z);
 		}
 		fz_catch(ctx)
 		{
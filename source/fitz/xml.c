@@ -66,28 +66,65 @@ static const struct { const char *ent; int ucs; } html_entities[] = {
 	{"spades",9824}, {"clubs",9827}, {"hearts",9829}, {"diams",9830},
 };
 
-struct parser
-{
-	fz_xml *head;
-	int preserve_white;
-	int depth;
-};
+typedef struct xml_document_s xml_document;
 
 struct attribute
 {
-	char name[40];
+	char *name; /* interned */
 	char *value;
 	struct attribute *next;
 };
 
 struct fz_xml_s
 {
-	char name[40];
+	char *name; /* interned; "" for text nodes, NULL for the document node */
 	char *text;
 	struct attribute *atts;
 	fz_xml *up, *down, *tail, *prev, *next;
 };
 
+/* All the nodes, names and strings of a parsed document live in one
+ * pool. The top level nodes hang off a hidden document node, which
+ * holds the pool and a reference count for detached subtrees. */
+struct xml_document_s
+{
+	fz_xml node;
+	fz_pool *pool;
+	int refs;
+};
+
+struct parser
+{
+	fz_xml *head;
+	int preserve_white;
+	int depth;
+
+	/* interned tag and attribute names */
+	fz_pool *pool;
+	char **names;
+	int names_len, names_cap;
+
+	/* SAX mode */
+	const fz_xml_sax *sax;
+	void *arg;
+	char **stack;
+	int stack_cap;
+	char *tag;
+	char **atts;
+	size_t *att_ofs;
+	int att_len, att_cap;
+	char *scratch;
+	size_t scratch_len, scratch_cap;
+
+	/* reading from a stream: where the item being parsed starts, so
+	 * that it can be parsed again once more data has been read */
+	int final;
+	int stop;
+	int skip_newline;
+	char *item;
+	int item_depth;
+};
+
 static void xml_indent(int n)
 {
 	while (n--) {
@@ -157,7 +194,7 @@ fz_xml *fz_xml_next(fz_xml *item)
 
 fz_xml *fz_xml_up(fz_xml *item)
 {
-	return item ? item->up : NULL;
+	return item && item->up && item->up->name ? item->up : NULL;
 }
 
 fz_xml *fz_xml_down(fz_xml *item)
@@ -218,37 +255,31 @@ fz_xml *fz_xml_find_down(fz_xml *item, const char *tag)
 	return fz_xml_find(item, tag);
 }
 
-static void xml_free_attribute(fz_context *ctx, struct attribute *att)
+static xml_document *xml_document_of(fz_xml *item)
 {
-	while (att) {
-		struct attribute *next = att->next;
-		if (att->value)
-			fz_free(ctx, att->value);
-		fz_free(ctx, att);
-		att = next;
-	}
+	while (item->up)
+		item = item->up;
+	return (xml_document *)item;
 }
 
 void fz_drop_xml(fz_context *ctx, fz_xml *item)
 {
-	while (item)
-	{
-		fz_xml *next = item->next;
-		if (item->text)
-			fz_free(ctx, item->text);
-		if (item->atts)
-			xml_free_attribute(ctx, item->atts);
-		if (item->down)
-			fz_drop_xml(ctx, item->down);
-		fz_free(ctx, item);
-		item = next;
-	}
+	xml_document *doc;
+	if (!item)
+		return;
+	doc = xml_document_of(item);
+	if (--doc->refs == 0)
+		fz_drop_pool(ctx, doc->pool);
 }
 
 void fz_detach_xml(fz_xml *node)
 {
 	if (node->up)
+	{
+		/* The detached subtree keeps the document's pool alive. */
+		xml_document_of(node)->refs++;
 		node->up->down = NULL;
+	}
 }
 
 static size_t xml_parse_entity(int *c, char *a)
@@ -311,26 +342,95 @@ static inline int iswhite(int c)
 	return c == ' ' || c == '\r' || c == '\n' || c == '\t';
 }
 
-static void xml_emit_open_tag(fz_context *ctx, struct parser *parser, char *a, char *b)
+static char *xml_intern(fz_context *ctx, struct parser *parser, char *a, char *b)
 {
-	fz_xml *head, *tail;
-	char *ns;
+	unsigned int h = 0;
+	size_t n = b - a;
+	char *p, *name;
+	int i, k, mask;
 
-	/* skip namespace prefix */
-	for (ns = a; ns < b; ++ns)
-		if (*ns == ':')
-			a = ns + 1;
+	if (parser->names_len * 2 >= parser->names_cap)
+	{
+		int new_cap = parser->names_cap ? parser->names_cap * 2 : 256;
+		char **new_names = fz_calloc(ctx, new_cap, sizeof *new_names);
+		for (i = 0; i < parser->names_cap; i++)
+		{
+			name = parser->names[i];
+			if (!name)
+				continue;
+			for (h = 0, p = name; *p; p++)
+				h = h * 31 + (unsigned char)*p;
+			k = h & (new_cap - 1);
+			while (new_names[k])
+				k = (k + 1) & (new_cap - 1);
+			new_names[k] = name;
+		}
+		fz_free(ctx, parser->names);
+		parser->names = new_names;
+		parser->names_cap = new_cap;
+	}
 
-	head = fz_malloc_struct(ctx, fz_xml);
-	if (b - a > sizeof(head->name) - 1)
-		b = a + sizeof(head->name) - 1;
-	memcpy(head->name, a, b - a);
-	head->name[b - a] = 0;
+	for (h = 0, p = a; p < b; p++)
+		h = h * 31 + (unsigned char)*p;
+	mask = parser->names_cap - 1;
+	k = h & mask;
+	while ((name = parser->names[k]) != NULL)
+	{
+		if (!memcmp(name, a, n) && name[n] == 0)
+			return name;
+		k = (k + 1) & mask;
+	}
 
+	name = fz_pool_alloc(ctx, parser->pool, n + 1);
+	memcpy(name, a, n);
+	name[n] = 0;
+	parser->names[k] = name;
+	parser->names_len++;
+	return name;
+}
+
+/* entities are all longer than UTFmax so runetochar is safe */
+static char *xml_decode(char *s, char *a, char *b)
+{
+	int c;
+	while (a < b) {
+		if (*a == '&') {
+			a += xml_parse_entity(&c, a);
+			s += fz_runetochar(s, c);
+		}
+		else {
+			*s++ = *a++;
+		}
+	}
+	*s = 0;
+	return s;
+}
+
+/* Reserve room for n bytes and a terminator in the SAX scratch buffer. */
+static char *xml_scratch(fz_context *ctx, struct parser *parser, size_t n)
+{
+	if (parser->scratch_len + n + 1 > parser->scratch_cap)
+	{
+		size_t new_cap = parser->scratch_cap ? parser->scratch_cap : 1024;
+		while (parser->scratch_len + n + 1 > new_cap)
+			new_cap *= 2;
+		parser->scratch = fz_resize_array(ctx, parser->scratch, new_cap, 1);
+		parser->scratch_cap = new_cap;
+	}
+	return parser->scratch + parser->scratch_len;
+}
+
+static fz_xml *xml_new_node(fz_context *ctx, struct parser *parser, char *name)
+{
+	fz_xml *head, *tail;
+
+	head = fz_pool_alloc(ctx, parser->pool, sizeof *head);
+	head->name = name;
 	head->atts = NULL;
 	head->text = NULL;
 	head->up = parser->head;
 	head->down = NULL;
+	head->tail = NULL;
 	head->prev = NULL;
 	head->next = NULL;
 
@@ -345,7 +445,36 @@ static void xml_emit_open_tag(fz_context *ctx, struct parser *parser, char *a, c
 		parser->head->tail = head;
 	}
 
-	parser->head = head;
+	return head;
+}
+
+static void xml_emit_open_tag(fz_context *ctx, struct parser *parser, char *a, char *b)
+{
+	char *ns, *name;
+
+	/* skip namespace prefix */
+	for (ns = a; ns < b; ++ns)
+		if (*ns == ':')
+			a = ns + 1;
+
+	name = xml_intern(ctx, parser, a, b);
+
+	if (parser->sax)
+	{
+		if (parser->depth == parser->stack_cap)
+		{
+			int new_cap = parser->stack_cap ? parser->stack_cap * 2 : 32;
+			parser->stack = fz_resize_array(ctx, parser->stack, new_cap, sizeof *parser->stack);
+			parser->stack_cap = new_cap;
+		}
+		parser->stack[parser->depth] = name;
+		parser->tag = name;
+		parser->att_len = 0;
+		parser->scratch_len = 0;
+	}
+	else
+		parser->head = xml_new_node(ctx, parser, name);
+
 	parser->depth++;
 }
 
@@ -353,12 +482,30 @@ static void xml_emit_att_name(fz_context *ctx, struct parser *parser, char *a, c
 {
 	fz_xml *head = parser->head;
 	struct attribute *att;
+	char *name;
+
+	name = xml_intern(ctx, parser, a, b);
+
+	if (parser->sax)
+	{
+		/* room for the name, the value, and the terminating NULL */
+		if (2 * parser->att_len + 3 > parser->att_cap)
+		{
+			int new_cap = parser->att_cap ? parser->att_cap * 2 : 32;
+			parser->atts = fz_resize_array(ctx, parser->atts, new_cap, sizeof *parser->atts);
+			parser->att_ofs = fz_resize_array(ctx, parser->att_ofs, new_cap, sizeof *parser->att_ofs);
+			parser->att_cap = new_cap;
+		}
+		parser->atts[2 * parser->att_len] = name;
+		parser->att_ofs[parser->att_len] = parser->scratch_len;
+		xml_scratch(ctx, parser, 0)[0] = 0;
+		parser->scratch_len++;
+		parser->att_len++;
+		return;
+	}
 
-	att = fz_malloc_struct(ctx, struct attribute);
-	if (b - a > sizeof(att->name) - 1)
-		b = a + sizeof(att->name) - 1;
-	memcpy(att->name, a, b - a);
-	att->name[b - a] = 0;
+	att = fz_pool_alloc(ctx, parser->pool, sizeof *att);
+	att->name = name;
 	att->value = NULL;
 	att->next = head->atts;
 	head->atts = att;
@@ -366,38 +513,96 @@ static void xml_emit_att_name(fz_context *ctx, struct parser *parser, char *a, c
 
 static void xml_emit_att_value(fz_context *ctx, struct parser *parser, char *a, char *b)
 {
-	fz_xml *head = parser->head;
-	struct attribute *att = head->atts;
-	char *s;
-	int c;
+	char *s, *e;
 
-	/* entities are all longer than UTFmax so runetochar is safe */
-	s = att->value = fz_malloc(ctx, b - a + 1);
-	while (a < b) {
-		if (*a == '&') {
-			a += xml_parse_entity(&c, a);
-			s += fz_runetochar(s, c);
-		}
-		else {
-			*s++ = *a++;
-		}
+	if (parser->sax)
+	{
+		/* replace the empty value reserved with the name */
+		parser->scratch_len--;
+		s = xml_scratch(ctx, parser, b - a);
+		e = xml_decode(s, a, b);
+		parser->scratch_len += e - s + 1;
+		return;
+	}
+
+	parser->head->atts->value = fz_pool_alloc(ctx, parser->pool, b - a + 1);
+	xml_decode(parser->head->atts->value, a, b);
+}
+
+/* Called at the end of each start tag, once all its attributes are known. */
+static void xml_emit_open_tag_done(fz_context *ctx, struct parser *parser)
+{
+	int i;
+
+	if (!parser->sax)
+		return;
+
+	for (i = 0; i < parser->att_len; i++)
+		parser->atts[2 * i + 1] = parser->scratch + parser->att_ofs[i];
+	if (parser->atts)
+		parser->atts[2 * parser->att_len] = NULL;
+
+	if (parser->sax->open_tag)
+	{
+		static char *no_atts[] = { NULL };
+		parser->sax->open_tag(ctx, parser->arg, parser->tag, parser->atts ? parser->atts : no_atts);
 	}
-	*s = 0;
 }
 
 static void xml_emit_close_tag(fz_context *ctx, struct parser *parser)
 {
+	if (parser->sax)
+	{
+		if (parser->depth > 0)
+		{
+			parser->depth--;
+			if (parser->sax->close_tag)
+				parser->sax->close_tag(ctx, parser->arg, parser->stack[parser->depth]);
+		}
+		return;
+	}
+
 	parser->depth--;
 	if (parser->head->up)
 		parser->head = parser->head->up;
 }
 
-static void xml_emit_text(fz_context *ctx, struct parser *parser, char *a, char *b)
+static void xml_emit_text_node(fz_context *ctx, struct parser *parser, char *a, char *b, int decode)
 {
 	static char *empty = "";
 	fz_xml *head;
 	char *s;
-	int c;
+
+	if (parser->sax)
+	{
+		parser->scratch_len = 0;
+		s = xml_scratch(ctx, parser, b - a);
+		if (decode)
+			xml_decode(s, a, b);
+		else
+		{
+			memcpy(s, a, b - a);
+			s[b - a] = 0;
+		}
+		if (parser->sax->text)
+			parser->sax->text(ctx, parser->arg, s);
+		return;
+	}
+
+	head = xml_new_node(ctx, parser, empty);
+	s = head->text = fz_pool_alloc(ctx, parser->pool, b - a + 1);
+	if (decode)
+		xml_decode(s, a, b);
+	else
+	{
+		memcpy(s, a, b - a);
+		s[b - a] = 0;
+	}
+}
+
+static void xml_emit_text(fz_context *ctx, struct parser *parser, char *a, char *b)
+{
+	char *s;
 
 	/* Skip text outside the root tag */
 	if (parser->depth == 0)
@@ -413,40 +618,12 @@ static void xml_emit_text(fz_context *ctx, struct parser *parser, char *a, char
 			return;
 	}
 
-	xml_emit_open_tag(ctx, parser, empty, empty);
-	head = parser->head;
-
-	/* entities are all longer than UTFmax so runetochar is safe */
-	s = head->text = fz_malloc(ctx, b - a + 1);
-	while (a < b) {
-		if (*a == '&') {
-			a += xml_parse_entity(&c, a);
-			s += fz_runetochar(s, c);
-		}
-		else {
-			*s++ = *a++;
-		}
-	}
-	*s = 0;
-
-	xml_emit_close_tag(ctx, parser);
+	xml_emit_text_node(ctx, parser, a, b, 1);
 }
 
 static void xml_emit_cdata(fz_context *ctx, struct parser *parser, char *a, char *b)
 {
-	static char *empty = "";
-	fz_xml *head;
-	char *s;
-
-	xml_emit_open_tag(ctx, parser, empty, empty);
-	head = parser->head;
-
-	s = head->text = fz_malloc(ctx, b - a + 1);
-	while (a < b)
-		*s++ = *a++;
-	*s = 0;
-
-	xml_emit_close_tag(ctx, parser);
+	xml_emit_text_node(ctx, parser, a, b, 0);
 }
 
 static char *xml_parse_document_imp(fz_context *ctx, struct parser *parser, char *p)
@@ -454,19 +631,35 @@ static char *xml_parse_document_imp(fz_context *ctx, struct parser *parser, char
 	char *mark;
 	int quote;
 
+	if (parser->skip_newline) {
+		parser->skip_newline = 0;
+		if (*p == '\n') ++p;
+	}
+
 parse_text:
-	mark = p;
+	if (parser->stop)
+		return NULL;
+	parser->item = mark = p;
+	parser->item_depth = parser->depth;
 	while (*p && *p != '<') ++p;
 	if (*p == '<') {
+		/* need the next character to know whether to skip the newline */
+		if (!p[1] && !parser->final)
+			return "end of data in element";
 		/* skip trailing newline before closing tag */
 		if (p[1] == '/' && p - 1 >= mark && p[-1] == '\n')
 			xml_emit_text(ctx, parser, mark, p - 1);
 		else if (mark < p)
 			xml_emit_text(ctx, parser, mark, p);
+		parser->item = p;
 		++p;
 		goto parse_element;
-	} else if (mark < p)
+	} else if (mark < p) {
+		/* the text may go on in the data not read yet */
+		if (!parser->final)
+			return "end of data in text";
 		xml_emit_text(ctx, parser, mark, p);
+	}
 	return NULL;
 
 parse_element:
@@ -537,11 +730,14 @@ parse_element_name:
 	while (isname(*p)) ++p;
 	xml_emit_open_tag(ctx, parser, mark, p);
 	if (*p == '>') {
+		xml_emit_open_tag_done(ctx, parser);
 		++p;
 		if (*p == '\n') ++p; /* must skip linebreak immediately after an opening tag */
+		else if (!*p && !parser->final) parser->skip_newline = 1;
 		goto parse_text;
 	}
 	if (p[0] == '/' && p[1] == '>') {
+		xml_emit_open_tag_done(ctx, parser);
 		xml_emit_close_tag(ctx, parser);
 		p += 2;
 		goto parse_text;
@@ -555,11 +751,14 @@ parse_attributes:
 	if (isname(*p))
 		goto parse_attribute_name;
 	if (*p == '>') {
+		xml_emit_open_tag_done(ctx, parser);
 		++p;
 		if (*p == '\n') ++p; /* must skip linebreak immediately after an opening tag */
+		else if (!*p && !parser->final) parser->skip_newline = 1;
 		goto parse_text;
 	}
 	if (p[0] == '/' && p[1] == '>') {
+		xml_emit_open_tag_done(ctx, parser);
 		xml_emit_close_tag(ctx, parser);
 		p += 2;
 		goto parse_text;
@@ -628,11 +827,8 @@ static char *convert_to_utf8(fz_context *doc, unsigned char *s, size_t n, int *d
 	return (char*)s;
 }
 
-fz_xml *
-fz_parse_xml(fz_context *ctx, fz_buffer *buf, int preserve_white)
+static void xml_parse(fz_context *ctx, struct parser *parser, fz_buffer *buf)
 {
-	struct parser parser;
-	fz_xml root, *node;
 	char *p, *error;
 	int dofree;
 	unsigned char *s;
@@ -642,16 +838,12 @@ fz_parse_xml(fz_context *ctx, fz_buffer *buf, int preserve_white)
 	fz_terminate_buffer(ctx, buf);
 	n = fz_buffer_storage(ctx, buf, &s);
 
-	memset(&root, 0, sizeof(root));
-	parser.head = &root;
-	parser.preserve_white = preserve_white;
-	parser.depth = 0;
-
 	p = convert_to_utf8(ctx, s, n, &dofree);
+	parser->final = 1;
 
 	fz_try(ctx)
 	{
-		error = xml_parse_document_imp(ctx, &parser, p);
+		error = xml_parse_document_imp(ctx, parser, p);
 		if (error)
 			fz_throw(ctx, FZ_ERROR_GENERIC, "%s", error);
 	}
@@ -660,13 +852,319 @@ fz_parse_xml(fz_context *ctx, fz_buffer *buf, int preserve_white)
 		if (dofree)
 			fz_free(ctx, p);
 	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+fz_xml *
+fz_parse_xml(fz_context *ctx, fz_buffer *buf, int preserve_white)
+{
+	struct parser parser;
+	xml_document *doc;
+	fz_pool *pool;
+
+	pool = fz_new_pool(ctx);
+
+	memset(&parser, 0, sizeof parser);
+	parser.preserve_white = preserve_white;
+	parser.pool = pool;
+
+	fz_try(ctx)
+	{
+		doc = fz_pool_alloc(ctx, pool, sizeof *doc);
+		memset(doc, 0, sizeof *doc);
+		doc->pool = pool;
+		doc->refs = 1;
+		parser.head = &doc->node;
+		xml_parse(ctx, &parser, buf);
+	}
+	fz_always(ctx)
+	{
+		fz_free(ctx, parser.names);
+	}
 	fz_catch(ctx)
 	{
-		fz_drop_xml(ctx, root.down);
+		fz_drop_pool(ctx, pool);
 		fz_rethrow(ctx);
 	}
 
-	for (node = root.down; node; node = node->next)
-		node->up = NULL;
-	return root.down;
+	if (!doc->node.down)
+	{
+		fz_drop_pool(ctx, pool);
+		return NULL;
+	}
+	return doc->node.down;
+}
+
+/* Parse a stream a chunk at a time. Whatever is left over at the end of
+ * a chunk, an unfinished tag or text that may go on, is kept and parsed
+ * again with the next chunk, which is read at least as large so that
+ * long items are not parsed over and over. */
+#define XML_CHUNK (64 << 10)
+
+static void xml_parse_stream(fz_context *ctx, struct parser *parser, fz_stream *stm)
+{
+	unsigned char *data = NULL;
+	char *p = NULL;
+	char *error;
+	size_t len = 0, cap = 0, start = 0, want, n;
+	int dofree = 0;
+
+	fz_var(data);
+	fz_var(p);
+	fz_var(dofree);
+
+	fz_try(ctx)
+	{
+		do
+		{
+			if (start > 0)
+			{
+				memmove(data, data + start, len - start);
+				len -= start;
+				start = 0;
+			}
+			want = len > XML_CHUNK ? len : XML_CHUNK;
+			if (len + want + 1 > cap)
+			{
+				cap = len + want + 1;
+				data = fz_resize_array(ctx, data, cap, 1);
+			}
+			n = fz_read(ctx, stm, data + len, want);
+			len += n;
+			data[len] = 0;
+			parser->final = (n < want);
+
+			if (!p)
+			{
+				/* UTF-16 is converted in one go, once it has all been read */
+				if (len >= 2 && ((data[0] == 0xFE && data[1] == 0xFF) || (data[0] == 0xFF && data[1] == 0xFE)) && !parser->final)
+					continue;
+				p = convert_to_utf8(ctx, data, len, &dofree);
+			}
+			else
+				p = (char*)data;
+
+			error = xml_parse_document_imp(ctx, parser, p);
+			if (parser->stop)
+				break;
+			if (error && parser->final)
+				fz_throw(ctx, FZ_ERROR_GENERIC, "%s", error);
+			if (error)
+			{
+				start = parser->item - (char*)data;
+				parser->depth = parser->item_depth;
+			}
+			else
+				start = len;
+		}
+		while (!parser->final);
+	}
+	fz_always(ctx)
+	{
+		if (dofree)
+			fz_free(ctx, p);
+		fz_free(ctx, data);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+static void xml_parse_sax(fz_context *ctx, struct parser *parser, fz_stream *stm)
+{
+	fz_try(ctx)
+	{
+		xml_parse_stream(ctx, parser, stm);
+	}
+	fz_always(ctx)
+	{
+		fz_free(ctx, parser->names);
+		fz_free(ctx, parser->stack);
+		fz_free(ctx, parser->atts);
+		fz_free(ctx, parser->att_ofs);
+		fz_free(ctx, parser->scratch);
+		fz_drop_pool(ctx, parser->pool);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+void
+fz_parse_xml_sax(fz_context *ctx, fz_stream *stm, int preserve_white, const fz_xml_sax *sax, void *arg)
+{
+	struct parser parser;
+
+	memset(&parser, 0, sizeof parser);
+	parser.preserve_white = preserve_white;
+	parser.sax = sax;
+	parser.arg = arg;
+	parser.pool = fz_new_pool(ctx);
+
+	xml_parse_sax(ctx, &parser, stm);
+}
+
+/* Builds the root element and each of its children in a document of
+ * their own, from the SAX callbacks, using a second parser to make the
+ * nodes. */
+struct xml_builder
+{
+	struct parser *parser;
+	struct parser tree;
+	xml_document *root;
+	xml_document *child;
+	fz_xml_child_fn *fn;
+	void *arg;
+};
+
+static xml_document *xml_new_document(fz_context *ctx, struct xml_builder *builder)
+{
+	fz_pool *pool = fz_new_pool(ctx);
+	xml_document *doc;
+
+	fz_try(ctx)
+	{
+		doc = fz_pool_alloc(ctx, pool, sizeof *doc);
+		doc->pool = pool;
+		doc->refs = 1;
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_pool(ctx, pool);
+		fz_rethrow(ctx);
+	}
+
+	/* names are interned anew in each document */
+	if (builder->tree.names)
+		memset(builder->tree.names, 0, builder->tree.names_cap * sizeof *builder->tree.names);
+	builder->tree.names_len = 0;
+	builder->tree.pool = pool;
+	builder->tree.head = &doc->node;
+	return doc;
+}
+
+static void xml_build_node(fz_context *ctx, struct xml_builder *builder, char *tag, char **atts)
+{
+	struct parser *tree = &builder->tree;
+	struct attribute *att;
+	fz_xml *head;
+	char *name = xml_intern(ctx, tree, tag, tag + strlen(tag));
+	size_t n;
+
+	head = tree->head = xml_new_node(ctx, tree, name);
+	for (; atts[0]; atts += 2)
+	{
+		att = fz_pool_alloc(ctx, tree->pool, sizeof *att);
+		att->name = xml_intern(ctx, tree, atts[0], atts[0] + strlen(atts[0]));
+		n = strlen(atts[1]) + 1;
+		att->value = fz_pool_alloc(ctx, tree->pool, n);
+		memcpy(att->value, atts[1], n);
+		att->next = head->atts;
+		head->atts = att;
+	}
+}
+
+static void xml_build_child_done(fz_context *ctx, struct xml_builder *builder)
+{
+	xml_document *child = builder->child;
+
+	/* the callback owns the child from here on */
+	builder->child = NULL;
+	if (builder->fn(ctx, builder->arg, builder->root->node.down, child->node.down))
+		builder->parser->stop = 1;
+}
+
+static void xml_build_open_tag(fz_context *ctx, void *arg, char *tag, char **atts)
+{
+	struct xml_builder *builder = arg;
+	int depth = builder->parser->depth;
+
+	if (builder->parser->stop)
+		return;
+
+	if (depth == 1)
+	{
+		if (builder->root)
+			return;
+		builder->root = xml_new_document(ctx, builder);
+		xml_build_node(ctx, builder, tag, atts);
+		if (builder->fn(ctx, builder->arg, builder->root->node.down, NULL))
+			builder->parser->stop = 1;
+		return;
+	}
+
+	if (depth == 2)
+		builder->child = xml_new_document(ctx, builder);
+	if (builder->child)
+		xml_build_node(ctx, builder, tag, atts);
+}
+
+static void xml_build_close_tag(fz_context *ctx, void *arg, char *tag)
+{
+	struct xml_builder *builder = arg;
+	struct parser *tree = &builder->tree;
+
+	if (builder->parser->stop || !builder->child)
+		return;
+
+	tree->head = tree->head->up;
+	if (builder->parser->depth == 1)
+		xml_build_child_done(ctx, builder);
+}
+
+static void xml_build_text(fz_context *ctx, void *arg, char *text)
+{
+	static char *empty = "";
+	struct xml_builder *builder = arg;
+	struct parser *tree = &builder->tree;
+	size_t n = strlen(text) + 1;
+	fz_xml *node;
+
+	if (builder->parser->stop || !builder->root)
+		return;
+
+	if (builder->parser->depth == 1)
+		builder->child = xml_new_document(ctx, builder);
+	if (!builder->child)
+		return;
+
+	node = xml_new_node(ctx, tree, empty);
+	node->text = fz_pool_alloc(ctx, tree->pool, n);
+	memcpy(node->text, text, n);
+
+	if (builder->parser->depth == 1)
+		xml_build_child_done(ctx, builder);
+}
+
+void
+fz_parse_xml_children(fz_context *ctx, fz_stream *stm, int preserve_white, fz_xml_child_fn *fn, void *arg)
+{
+	static const fz_xml_sax sax = { xml_build_open_tag, xml_build_close_tag, xml_build_text };
+	struct xml_builder builder;
+	struct parser parser;
+
+	memset(&builder, 0, sizeof builder);
+	builder.parser = &parser;
+	builder.fn = fn;
+	builder.arg = arg;
+
+	memset(&parser, 0, sizeof parser);
+	parser.preserve_white = preserve_white;
+	parser.sax = &sax;
+	parser.arg = &builder;
+	parser.pool = fz_new_pool(ctx);
+
+	fz_try(ctx)
+	{
+		xml_parse_sax(ctx, &parser, stm);
+	}
+	fz_always(ctx)
+	{
+		if (builder.child)
+			fz_drop_pool(ctx, builder.child->pool);
+		if (builder.root)
+			fz_drop_pool(ctx, builder.root->pool);
+		fz_free(ctx, builder.tree.names);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
 }
@@ -0,0 +1,266 @@
+#include "mupdf/helpers/mu-thread-pool.h"
+
+typedef struct mu_pool_worker_s mu_pool_worker;
+typedef struct mu_pool_job_s mu_pool_job;
+
+struct mu_pool_worker_s
+{
+	mu_thread_pool *pool;
+	fz_context *ctx;
+	mu_thread thread;
+	mu_semaphore start;
+	mu_semaphore stop;
+};
+
+struct mu_pool_job_s
+{
+	fz_parallel_job_fn *job;
+	void *job_arg;
+	mu_pool_job *next;
+};
+
+struct mu_thread_pool_s
+{
+	int count;
+	mu_pool_worker *workers;
+	mu_mutex mutex;
+	int busy;
+	int die;
+
+	/* The batch of jobs currently being run. */
+	fz_parallel_job_fn *job;
+	void *job_arg;
+	int next;
+	int n;
+
+	/* The background thread, and the jobs queued for it. */
+	mu_pool_worker background;
+	int has_background;
+	mu_pool_job *head;
+	mu_pool_job *tail;
+};
+
+static void
+run_jobs(mu_thread_pool *pool, fz_context *ctx)
+{
+	int i;
+
+	while (1)
+	{
+		mu_lock_mutex(&pool->mutex);
+		i = pool->next < pool->n ? pool->next++ : -1;
+		mu_unlock_mutex(&pool->mutex);
+		if (i < 0)
+			break;
+		pool->job(ctx, pool->job_arg, i);
+	}
+}
+
+static void
+worker_thread(void *arg)
+{
+	mu_pool_worker *me = (mu_pool_worker *)arg;
+	mu_thread_pool *pool = me->pool;
+
+	while (1)
+	{
+		mu_wait_semaphore(&me->start);
+		if (pool->die)
+			break;
+		run_jobs(pool, me->ctx);
+		mu_trigger_semaphore(&me->stop);
+	}
+}
+
+/* The queue is always emptied before the thread stops, as the jobs
+ * free their own arguments. */
+static void
+background_thread(void *arg)
+{
+	mu_pool_worker *me = (mu_pool_worker *)arg;
+	mu_thread_pool *pool = me->pool;
+	mu_pool_job *job;
+	int die;
+
+	while (1)
+	{
+		mu_wait_semaphore(&me->start);
+		while (1)
+		{
+			mu_lock_mutex(&pool->mutex);
+			job = pool->head;
+			if (job)
+			{
+				pool->head = job->next;
+				if (!pool->head)
+					pool->tail = NULL;
+			}
+			die = pool->die;
+			mu_unlock_mutex(&pool->mutex);
+			if (!job)
+				break;
+			job->job(me->ctx, job->job_arg, 0);
+			fz_free(me->ctx, job);
+		}
+		if (die)
+			break;
+	}
+}
+
+static void
+start_worker(fz_context *ctx, mu_pool_worker *w, mu_thread_fn *fn)
+{
+	w->ctx = fz_clone_context(ctx);
+	if (!w->ctx)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot clone context for thread pool");
+	if (mu_create_semaphore(&w->start) || mu_create_semaphore(&w->stop))
+	{
+		mu_destroy_semaphore(&w->start);
+		mu_destroy_semaphore(&w->stop);
+		fz_drop_context(w->ctx);
+		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot create thread pool semaphores");
+	}
+	if (mu_create_thread(&w->thread, fn, w))
+	{
+		mu_destroy_semaphore(&w->start);
+		mu_destroy_semaphore(&w->stop);
+		fz_drop_context(w->ctx);
+		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot create thread pool thread");
+	}
+}
+
+static void
+stop_worker(mu_pool_worker *w)
+{
+	mu_trigger_semaphore(&w->start);
+	mu_destroy_thread(&w->thread);
+	mu_destroy_semaphore(&w->start);
+	mu_destroy_semaphore(&w->stop);
+	fz_drop_context(w->ctx);
+}
+
+mu_thread_pool *
+mu_new_thread_pool(fz_context *ctx, int workers)
+{
+	mu_thread_pool *pool;
+	int i;
+
+	pool = fz_malloc_struct(ctx, mu_thread_pool);
+	fz_try(ctx)
+	{
+		if (mu_create_mutex(&pool->mutex))
+			fz_throw(ctx, FZ_ERROR_GENERIC, "cannot create thread pool mutex");
+		pool->workers = fz_malloc_array(ctx, workers, sizeof(mu_pool_worker));
+		memset(pool->workers, 0, workers * sizeof(mu_pool_worker));
+		for (i = 0; i < workers; i++)
+		{
+			pool->workers[i].pool = pool;
+			start_worker(ctx, &pool->workers[i], worker_thread);
+			pool->count++;
+		}
+		pool->background.pool = pool;
+		start_worker(ctx, &pool->background, background_thread);
+		pool->has_background = 1;
+	}
+	fz_catch(ctx)
+	{
+		mu_drop_thread_pool(ctx, pool);
+		fz_rethrow(ctx);
+	}
+
+	return pool;
+}
+
+void
+mu_drop_thread_pool(fz_context *ctx, mu_thread_pool *pool)
+{
+	int i;
+
+	if (!pool)
+		return;
+
+	if (pool->has_background)
+	{
+		mu_lock_mutex(&pool->mutex);
+		pool->die = 1;
+		mu_unlock_mutex(&pool->mutex);
+		stop_worker(&pool->background);
+	}
+	pool->die = 1;
+	for (i = 0; i < pool->count; i++)
+		stop_worker(&pool->workers[i]);
+	mu_destroy_mutex(&pool->mutex);
+	fz_free(ctx, pool->workers);
+	fz_free(ctx, pool);
+}
+
+void
+mu_run_thread_pool(void *pool_, fz_context *ctx, int n, fz_parallel_job_fn *job, void *job_arg)
+{
+	mu_thread_pool *pool = (mu_thread_pool *)pool_;
+	int i, busy, count;
+
+	mu_lock_mutex(&pool->mutex);
+	busy = pool->busy;
+	pool->busy = 1;
+	mu_unlock_mutex(&pool->mutex);
+
+	if (busy)
+	{
+		for (i = 0; i < n; i++)
+			job(ctx, job_arg, i);
+		return;
+	}
+
+	pool->job = job;
+	pool->job_arg = job_arg;
+	pool->next = 0;
+	pool->n = n;
+
+	/* The calling thread takes a share of the jobs too. */
+	count = fz_mini(pool->count, n - 1);
+	for (i = 0; i < count; i++)
+		mu_trigger_semaphore(&pool->workers[i].start);
+	run_jobs(pool, ctx);
+	for (i = 0; i < count; i++)
+		mu_wait_semaphore(&pool->workers[i].stop);
+
+	mu_lock_mutex(&pool->mutex);
+	pool->busy = 0;
+	mu_unlock_mutex(&pool->mutex);
+}
+
+int
+mu_start_thread_pool_job(void *pool_, fz_context *ctx, fz_parallel_job_fn *job, void *job_arg)
+{
+	mu_thread_pool *pool = (mu_thread_pool *)pool_;
+	mu_pool_job *item;
+	int die;
+
+	item = fz_malloc_no_throw(ctx, sizeof *item);
+	if (!item)
+		return 1;
+	item->job = job;
+	item->job_arg = job_arg;
+	item->next = NULL;
+
+	mu_lock_mutex(&pool->mutex);
+	die = pool->die;
+	if (!die)
+	{
+		if (pool->tail)
+			pool->tail->next = item;
+		else
+			pool->head = item;
+		pool->tail = item;
+	}
+	mu_unlock_mutex(&pool->mutex);
+
+	if (die)
+	{
+		fz_free(ctx, item);
+		return 1;
+	}
+	mu_trigger_semaphore(&pool->background.start);
+	return 0;
+}
@@ -191,6 +191,7 @@ struct fz_html_s
 	fz_pool *pool; /* pool allocator for this html tree */
 	float page_w, page_h;
 	float page_margin[4];
+	float layout_w, layout_h, layout_em; /* arguments of the last layout */
 	fz_html_box *root;
 };
 
@@ -242,6 +243,12 @@ struct fz_html_flow_s
 	/* Whether the markup specifies a given language. */
 	unsigned int markup_lang : 15;
 
+	/* Whether unit_w holds the measured width of the text. */
+	unsigned int is_measured : 1;
+
+	/* Width at an em of 1; independent of the layout size so kept across re-layouts. */
+	float unit_w;
+
 	float x, y, w, h;
 	fz_html_box *box; /* for style and em */
 	union {
@@ -159,6 +159,8 @@ static fz_html_flow *add_flow(fz_context *ctx, fz_pool *pool, fz_html_box *top,
 	flow->bidi_level = 0;
 	flow->markup_lang = 0;
 	flow->breaks_line = 0;
+	flow->is_measured = 0;
+	flow->unit_w = 0;
 	flow->box = inline_box;
 	*top->flow_tail = flow;
 	top->flow_tail = &flow->next;
@@ -218,6 +220,8 @@ static fz_html_flow *split_flow(fz_context *ctx, fz_pool *pool, fz_html_flow *fl
 	*new_flow = *flow;
 	new_flow->next = flow->next;
 	flow->next = new_flow;
+	flow->is_measured = 0;
+	new_flow->is_measured = 0;
 
 	text = flow->content.text;
 	while (*text && offset)
@@ -804,6 +808,109 @@ static void measure_image(fz_context *ctx, fz_html_flow *node, float max_w, floa
 	node->h = image_h * s;
 }
 
+/*
+	Shaping results are cached in the store, keyed on the font, script,
+	language, direction and (a digest of) the text of each run. Glyph
+	positions are kept in font units so that the same entry can be used
+	for both measuring and drawing, regardless of the font size.
+*/
+
+typedef struct shaped_glyph_s
+{
+	int gid;
+	unsigned int cluster;
+	int x_advance, y_advance;
+	int x_offset, y_offset;
+} shaped_glyph;
+
+typedef struct shaped_text_s
+{
+	fz_storable storable;
+	int scale;
+	unsigned int len;
+	shaped_glyph glyph[1];
+} shaped_text;
+
+typedef struct shaped_text_key_s
+{
+	int refs;
+	fz_font *font;
+	int script;
+	int language;
+	int rtl;
+	unsigned char digest[16];
+} shaped_text_key;
+
+static void
+drop_shaped_text_imp(fz_context *ctx, fz_storable *shaped)
+{
+	fz_free(ctx, shaped);
+}
+
+static void
+drop_shaped_text(fz_context *ctx, shaped_text *shaped)
+{
+	fz_drop_storable(ctx, &shaped->storable);
+}
+
+static int
+make_hash_shaped_text_key(fz_context *ctx, fz_store_hash *hash, void *key_)
+{
+	shaped_text_key *key = (shaped_text_key *)key_;
+	hash->u.pim.ptr = key->font;
+	hash->u.pim.i = (int)(((unsigned int)key->script << 24) | ((unsigned int)key->language << 1) | key->rtl);
+	memcpy(hash->u.pim.md5, key->digest, 16);
+	return 1;
+}
+
+static void *
+keep_shaped_text_key(fz_context *ctx, void *key_)
+{
+	shaped_text_key *key = (shaped_text_key *)key_;
+	return fz_keep_imp(ctx, key, &key->refs);
+}
+
+static void
+drop_shaped_text_key(fz_context *ctx, void *key_)
+{
+	shaped_text_key *key = (shaped_text_key *)key_;
+	if (fz_drop_imp(ctx, key, &key->refs))
+	{
+		fz_drop_font(ctx, key->font);
+		fz_free(ctx, key);
+	}
+}
+
+static int
+cmp_shaped_text_key(fz_context *ctx, void *k0_, void *k1_)
+{
+	shaped_text_key *k0 = (shaped_text_key *)k0_;
+	shaped_text_key *k1 = (shaped_text_key *)k1_;
+	return k0->font != k1->font ||
+		k0->script != k1->script ||
+		k0->language != k1->language ||
+		k0->rtl != k1->rtl ||
+		memcmp(k0->digest, k1->digest, 16);
+}
+
+static void
+format_shaped_text_key(fz_context *ctx, char *s, int n, void *key_)
+{
+	shaped_text_key *key = (shaped_text_key *)key_;
+	fz_snprintf(s, n, "(shaped text %s script=%d lang=%d rtl=%d)",
+		fz_font_name(ctx, key->font), key->script, key->language, key->rtl);
+}
+
+static const fz_store_type shaped_text_store_type =
+{
+	make_hash_shaped_text_key,
+	keep_shaped_text_key,
+	drop_shaped_text_key,
+	cmp_shaped_text_key,
+	format_shaped_text_key,
+	NULL
+};
+
 typedef struct string_walker
 {
 	fz_context *ctx;
@@ -819,6 +926,8 @@ typedef struct string_walker
 	fz_font *next_font;
 	hb_glyph_position_t *glyph_pos;
 	hb_glyph_info_t *glyph_info;
+	shaped_text *shaped;
+	shaped_glyph *glyph;
 	unsigned int glyph_count;
 	int scale;
 } string_walker;
@@ -881,6 +990,16 @@ static void init_string_walker(fz_context *ctx, string_walker *walker, hb_buffer
 	walker->language = language;
 	walker->font = NULL;
 	walker->next_font = NULL;
+	walker->shaped = NULL;
+	walker->glyph = NULL;
+	walker->glyph_count = 0;
+}
+
+static void drop_string_walker(fz_context *ctx, string_walker *walker)
+{
+	if (walker->shaped)
+		drop_shaped_text(ctx, walker->shaped);
+	walker->shaped = NULL;
 }
 
 static void
@@ -891,43 +1010,23 @@ destroy_hb_shaper_data(fz_context *ctx, void *handle)
 	fz_hb_unlock(ctx);
 }
 
-static int walk_string(string_walker *walker)
+static shaped_text *shape_string(string_walker *walker)
 {
 	fz_context *ctx = walker->ctx;
+	shaped_text *shaped = NULL;
 	FT_Face face;
 	int fterr;
 	int quickshape;
+	unsigned int i;
 	char lang[8];
 
-	walker->start = walker->end;
-	walker->end = walker->s;
-	walker->font = walker->next_font;
-
-	if (*walker->start == 0)
-		return 0;
-
-	/* Run through the string, encoding chars until we find one
-	 * that requires a different fallback font. */
-	while (*walker->s)
-	{
-		int c;
-
-		walker->s += fz_chartorune(&c, walker->s);
-		(void)fz_encode_character_with_fallback(ctx, walker->base_font, c, walker->script, walker->language, &walker->next_font);
-		if (walker->next_font != walker->font)
-		{
-			if (walker->font != NULL)
-				break;
-			walker->font = walker->next_font;
-		}
-		walker->end = walker->s;
-	}
-
 	/* Disable harfbuzz shaping if script is common or LGC and there are no opentype tables. */
 	quickshape = 0;
 	if (walker->script <= 3 && !walker->rtl && !fz_font_flags(walker->font)->has_opentype)
 		quickshape = 1;
 
+	fz_var(shaped);
+
 	fz_hb_lock(ctx);
 	fz_try(ctx)
 	{
@@ -981,7 +1080,6 @@ static int walk_string(string_walker *walker)
 
 	if (quickshape)
 	{
-		unsigned int i;
 		for (i = 0; i < walker->glyph_count; ++i)
 		{
 			int unicode = quick_ligature(ctx, walker, i);
@@ -994,6 +1092,109 @@ static int walk_string(string_walker *walker)
 		}
 	}
 
+	/* Copy the results out of the harfbuzz buffer into a compact array. */
+	shaped = fz_malloc(ctx, sizeof(shaped_text) + (walker->glyph_count > 0 ? walker->glyph_count - 1 : 0) * sizeof(shaped_glyph));
+	FZ_INIT_STORABLE(shaped, 1, drop_shaped_text_imp);
+	shaped->scale = walker->scale;
+	shaped->len = walker->glyph_count;
+	for (i = 0; i < walker->glyph_count; ++i)
+	{
+		shaped->glyph[i].gid = walker->glyph_info[i].codepoint;
+		shaped->glyph[i].cluster = walker->glyph_info[i].cluster;
+		shaped->glyph[i].x_advance = walker->glyph_pos[i].x_advance;
+		shaped->glyph[i].y_advance = walker->glyph_pos[i].y_advance;
+		shaped->glyph[i].x_offset = walker->glyph_pos[i].x_offset;
+		shaped->glyph[i].y_offset = walker->glyph_pos[i].y_offset;
+	}
+
+	return shaped;
+}
+
+static int walk_string(string_walker *walker)
+{
+	fz_context *ctx = walker->ctx;
+	shaped_text_key key;
+	shaped_text_key *keyp;
+	fz_md5 md5;
+
+	drop_string_walker(ctx, walker);
+
+	walker->start = walker->end;
+	walker->end = walker->s;
+	walker->font = walker->next_font;
+
+	if (*walker->start == 0)
+		return 0;
+
+	/* Run through the string, encoding chars until we find one
+	 * that requires a different fallback font. */
+	while (*walker->s)
+	{
+		int c;
+
+		walker->s += fz_chartorune(&c, walker->s);
+		(void)fz_encode_character_with_fallback(ctx, walker->base_font, c, walker->script, walker->language, &walker->next_font);
+		if (walker->next_font != walker->font)
+		{
+			if (walker->font != NULL)
+				break;
+			walker->font = walker->next_font;
+		}
+		walker->end = walker->s;
+	}
+
+	/* Look for a previous shaping of this run in the store. */
+	key.refs = 1;
+	key.font = walker->font;
+	key.script = walker->script;
+	key.language = walker->language;
+	key.rtl = walker->rtl;
+	fz_md5_init(&md5);
+	fz_md5_update(&md5, (const unsigned char *)walker->start, walker->end - walker->start);
+	fz_md5_final(&md5, key.digest);
+
+	walker->shaped = fz_find_item(ctx, drop_shaped_text_imp, &key, &shaped_text_store_type);
+	if (!walker->shaped)
+	{
+		shaped_text *existing;
+
+		walker->shaped = shape_string(walker);
+
+		/* Now we try to cache the shaped text. Any failure here will
+		 * just result in us not caching. */
+		keyp = NULL;
+		fz_var(keyp);
+		fz_try(ctx)
+		{
+			keyp = fz_malloc_struct(ctx, shaped_text_key);
+			*keyp = key;
+			keyp->font = fz_keep_font(ctx, key.font);
+			existing = fz_store_item(ctx, keyp, walker->shaped,
+				sizeof(shaped_text) + walker->shaped->len * sizeof(shaped_glyph),
+				&shaped_text_store_type);
+			if (existing)
+			{
+				/* We already have one. This must have been produced by a
+				 * racing thread. We'll throw away ours and use that one. */
+				drop_shaped_text(ctx, walker->shaped);
+				walker->shaped = existing;
+			}
+		}
+		fz_always(ctx)
+		{
+			if (keyp)
+				drop_shaped_text_key(ctx, keyp);
+		}
+		fz_catch(ctx)
+		{
+			/* Do nothing */
+		}
+	}
+
+	walker->glyph = walker->shaped->glyph;
+	walker->glyph_count = walker->shaped->len;
+	walker->scale = walker->shaped->scale;
+
 	return 1;
 }
 
@@ -1022,15 +1223,31 @@ static void measure_string(fz_context *ctx, fz_html_flow *node, hb_buffer_t *hb_
 	node->w = 0;
 	node->h = fz_from_css_number_scale(node->box->style.line_height, em);
 
-	s = get_node_text(ctx, node);
-	init_string_walker(ctx, &walker, hb_buf, node->bidi_level & 1, node->box->style.font, node->script, node->markup_lang, s);
-	while (walk_string(&walker))
+	/* The shaped width only depends on the text and the font, so we
+	 * measure it once at unit em and scale it for every later layout. */
+	if (!node->is_measured)
 	{
-		int x = 0;
-		for (i = 0; i < walker.glyph_count; i++)
-			x += walker.glyph_pos[i].x_advance;
-		node->w += x * em / walker.scale;
+		node->unit_w = 0;
+		s = get_node_text(ctx, node);
+		init_string_walker(ctx, &walker, hb_buf, node->bidi_level & 1, node->box->style.font, node->script, node->markup_lang, s);
+		fz_try(ctx)
+		{
+			while (walk_string(&walker))
+			{
+				int x = 0;
+				for (i = 0; i < walker.glyph_count; i++)
+					x += walker.glyph[i].x_advance;
+				node->unit_w += (float)x / walker.scale;
+			}
+		}
+		fz_always(ctx)
+			drop_string_walker(ctx, &walker);
+		fz_catch(ctx)
+			fz_rethrow(ctx);
+		node->is_measured = 1;
 	}
+
+	node->w = node->unit_w * em;
 }
 
 static float measure_line(fz_html_flow *node, fz_html_flow *end, float *baseline)
@@ -1564,61 +1781,73 @@ static void draw_flow_box(fz_context *ctx, fz_html_box *box, float page_top, flo
 
 			s = get_node_text(ctx, node);
 			init_string_walker(ctx, &walker, hb_buf, node->bidi_level & 1, style->font, node->script, node->markup_lang, s);
-			while (walk_string(&walker))
+			fz_try(ctx)
 			{
-				float node_scale = node->box->em / walker.scale;
-				unsigned int i;
-				int c, k, n;
-
-				/* Flatten advance and offset into offset array. */
-				int x_advance = 0;
-				int y_advance = 0;
-				for (i = 0; i < walker.glyph_count; ++i)
+				while (walk_string(&walker))
 				{
-					walker.glyph_pos[i].x_offset += x_advance;
-					walker.glyph_pos[i].y_offset += y_advance;
-					x_advance += walker.glyph_pos[i].x_advance;
-					y_advance += walker.glyph_pos[i].y_advance;
-				}
-
-				if (node->bidi_level & 1)
-					x -= x_advance * node_scale;
+					float node_scale = node->box->em / walker.scale;
+					unsigned int i;
+					int c, k, n;
+
+					/* Sum the advances; the shaped glyphs are shared with
+					 * the store, so accumulate the offsets as we go instead
+					 * of flattening them in place. */
+					int x_advance = 0;
+					int y_advance = 0;
+					for (i = 0; i < walker.glyph_count; ++i)
+					{
+						x_advance += walker.glyph[i].x_advance;
+						y_advance += walker.glyph[i].y_advance;
+					}
 
-				/* Walk characters to find glyph clusters */
-				k = 0;
-				while (walker.start + k < walker.end)
-				{
-					n = fz_chartorune(&c, walker.start + k);
+					if (node->bidi_level & 1)
+						x -= x_advance * node_scale;
 
-					for (i = 0; i < walker.glyph_count; ++i)
+					/* Walk characters to find glyph clusters */
+					k = 0;
+					while (walker.start + k < walker.end)
 					{
-						if (walker.glyph_info[i].cluster == k)
+						int gx = 0;
+						int gy = 0;
+
+						n = fz_chartorune(&c, walker.start + k);
+
+						for (i = 0; i < walker.glyph_count; ++i)
+						{
+							if (walker.glyph[i].cluster == k)
+							{
+								trm.e = x + (gx + walker.glyph[i].x_offset) * node_scale;
+								trm.f = y - (gy + walker.glyph[i].y_offset) * node_scale - page_top;
+								fz_show_glyph(ctx, text, walker.font, &trm,
+										walker.glyph[i].gid, c,
+										0, node->bidi_level, box->markup_dir, node->markup_lang);
+								c = -1; /* for subsequent glyphs in x-to-many mappings */
+							}
+							gx += walker.glyph[i].x_advance;
+							gy += walker.glyph[i].y_advance;
+						}
+
+						/* no glyph found (many-to-many or many-to-one mapping) */
+						if (c != -1)
 						{
-							trm.e = x + walker.glyph_pos[i].x_offset * node_scale;
-							trm.f = y - walker.glyph_pos[i].y_offset * node_scale - page_top;
 							fz_show_glyph(ctx, text, walker.font, &trm,
-									walker.glyph_info[i].codepoint, c,
+									-1, c,
 									0, node->bidi_level, box->markup_dir, node->markup_lang);
-							c = -1; /* for subsequent glyphs in x-to-many mappings */
 						}
-					}
 
-					/* no glyph found (many-to-many or many-to-one mapping) */
-					if (c != -1)
-					{
-						fz_show_glyph(ctx, text, walker.font, &trm,
-								-1, c,
-								0, node->bidi_level, box->markup_dir, node->markup_lang);
+						k += n;
 					}
 
-					k += n;
-				}
-
-				if ((node->bidi_level & 1) == 0)
-					x += x_advance * node_scale;
+					if ((node->bidi_level & 1) == 0)
+						x += x_advance * node_scale;
 
-				y += y_advance * node_scale;
+					y += y_advance * node_scale;
+				}
 			}
+			fz_always(ctx)
+				drop_string_walker(ctx, &walker);
+			fz_catch(ctx)
+				fz_rethrow(ctx);
 		}
 		else if (node->type == FLOW_IMAGE)
 		{
@@ -2464,6 +2693,11 @@ fz_layout_html(fz_context *ctx, fz_html *html, float w, float h, float em)
 	fz_var(hb_buf);
 	fz_var(unlocked);
 
+	/* Nothing to do if the layout is already at this size. */
+	if (html->layout_w == w && html->layout_h == h && html->layout_em == em)
+		return;
+	html->layout_w = html->layout_h = html->layout_em = -1;
+
 	html->page_margin[T] = fz_from_css_number(html->root->style.margin[T], em, em, 0);
 	html->page_margin[B] = fz_from_css_number(html->root->style.margin[B], em, em, 0);
 	html->page_margin[L] = fz_from_css_number(html->root->style.margin[L], em, em, 0);
@@ -2489,6 +2723,10 @@ fz_layout_html(fz_context *ctx, fz_html *html, float w, float h, float em)
 			layout_block(ctx, box->down, box, html->page_h, 0, hb_buf);
 			box->h = box->down->h;
 		}
+
+		html->layout_w = w;
+		html->layout_h = h;
+		html->layout_em = em;
 	}
 	fz_always(ctx)
 	{
@@ -2731,6 +2969,7 @@ fz_parse_html(fz_context *ctx, fz_html_font_set *set, fz_archive *zip, const cha
 		g.pool = fz_new_pool(ctx);
 		html = fz_pool_alloc(ctx, g.pool, sizeof *html);
 		html->pool = g.pool;
+		html->layout_w = html->layout_h = html->layout_em = -1;
 		html->root = new_box(ctx, g.pool, DEFAULT_DIR);
 
 		match.up = NULL;
@@ -15,6 +15,7 @@ enum
 };
 
 typedef struct psobj_s psobj;
+typedef struct ps_program_s ps_program;
 
 enum
 {
@@ -62,6 +63,8 @@ struct pdf_function_s
 		struct {
 			psobj *code;
 			int cap;
+			ps_program *prog;	/* compiled code, or NULL to interpret */
+			float *table;		/* sampled outputs for m == 1, or NULL */
 		} p;
 	} u;
 };
@@ -499,7 +502,10 @@ ps_run(fz_context *ctx, psobj *code, ps_stack *st, int pc)
 			case PS_OP_IDIV:
 				i2 = ps_pop_int(st);
 				i1 = ps_pop_int(st);
-				if (i2 != 0)
+				/* INT_MIN / -1 overflows, and traps on some machines. */
+				if (i2 == -1)
+					ps_push_int(st, (int)(0u - (unsigned int)i1));
+				else if (i2 != 0)
 					ps_push_int(st, i1 / i2);
 				else
 					ps_push_int(st, DIV_BY_ZERO(i1, i2, INT_MIN, INT_MAX));
@@ -550,7 +556,9 @@ ps_run(fz_context *ctx, psobj *code, ps_stack *st, int pc)
 			case PS_OP_MOD:
 				i2 = ps_pop_int(st);
 				i1 = ps_pop_int(st);
-				if (i2 != 0)
+				if (i2 == -1)
+					ps_push_int(st, 0);
+				else if (i2 != 0)
 					ps_push_int(st, i1 % i2);
 				else
 					ps_push_int(st, DIV_BY_ZERO(i1, i2, INT_MIN, INT_MAX));
@@ -711,6 +719,775 @@ ps_run(fz_context *ctx, psobj *code, ps_stack *st, int pc)
 	}
 }
 
+/*
+ * Compiled calculator functions
+ *
+ * Most calculator functions use the stack in ways that can be worked out
+ * without running them: the operands of copy, index and roll are
+ * constants, and both branches of a conditional leave the same types on
+ * the stack. Such programs are compiled once into straight line code
+ * over a set of registers. Operations on constants are folded, and
+ * conditionals are replaced by running both branches and selecting
+ * between their results. Running the branch that is not taken is safe
+ * because every operation gives a result for any operands, including
+ * division by zero and INT_MIN / -1. Anything else is left to the
+ * interpreter.
+ */
+
+enum
+{
+	PSC_I2R, PSC_R2I,
+	PSC_ABS_I, PSC_ABS_R, PSC_ADD_I, PSC_ADD_R, PSC_SUB_I, PSC_SUB_R,
+	PSC_MUL_I, PSC_MUL_R, PSC_NEG_I, PSC_NEG_R, PSC_DIV, PSC_IDIV, PSC_MOD,
+	PSC_AND_I, PSC_AND_B, PSC_OR_I, PSC_OR_B, PSC_XOR_I, PSC_XOR_B,
+	PSC_NOT_I, PSC_NOT_B, PSC_BITSHIFT,
+	PSC_ATAN, PSC_CEILING, PSC_FLOOR, PSC_ROUND, PSC_TRUNCATE,
+	PSC_COS, PSC_SIN, PSC_EXP, PSC_LN, PSC_LOG, PSC_SQRT,
+	PSC_EQ_I, PSC_EQ_R, PSC_NE_I, PSC_NE_R, PSC_GE_I, PSC_GE_R,
+	PSC_GT_I, PSC_GT_R, PSC_LE_I, PSC_LE_R, PSC_LT_I, PSC_LT_R,
+	PSC_SELECT
+};
+
+enum { PSC_MAX_REGS = 1024, PSC_MAX_INSNS = 4096 };
+
+typedef union
+{
+	int i;
+	float f;
+} ps_value;
+
+typedef struct
+{
+	unsigned short op, dst, a, b, c;
+} ps_insn;
+
+struct ps_program_s
+{
+	int nregs, len, cap;
+	ps_insn *code;
+	ps_value *init;
+	int out[MAX_N];
+};
+
+/* Same as ps_push_real */
+static inline float ps_real(float x)
+{
+	if (isnan(x))
+		x = 1.0f;
+	return fz_clamp(x, -FLT_MAX, FLT_MAX);
+}
+
+static void
+ps_exec(const ps_insn *code, int len, ps_value *r)
+{
+	const ps_insn *end = code + len;
+	float x;
+
+	for (; code < end; code++)
+	{
+		ps_value *d = &r[code->dst];
+		const ps_value *a = &r[code->a];
+		const ps_value *b = &r[code->b];
+
+		switch (code->op)
+		{
+		case PSC_I2R: d->f = a->i; break;
+		case PSC_R2I: d->i = a->f; break;
+		case PSC_ABS_I: d->i = fz_absi(a->i); break;
+		case PSC_ABS_R: d->f = fz_abs(a->f); break;
+		case PSC_ADD_I: d->i = a->i + b->i; break;
+		case PSC_ADD_R: d->f = ps_real(a->f + b->f); break;
+		case PSC_SUB_I: d->i = a->i - b->i; break;
+		case PSC_SUB_R: d->f = ps_real(a->f - b->f); break;
+		case PSC_MUL_I: d->i = a->i * b->i; break;
+		case PSC_MUL_R: d->f = ps_real(a->f * b->f); break;
+		case PSC_NEG_I: d->i = -a->i; break;
+		case PSC_NEG_R: d->f = -a->f; break;
+		case PSC_DIV:
+			if (fabsf(b->f) >= FLT_EPSILON)
+				d->f = ps_real(a->f / b->f);
+			else
+				d->f = DIV_BY_ZERO(a->f, b->f, -FLT_MAX, FLT_MAX);
+			break;
+		case PSC_IDIV:
+			if (b->i == -1)
+				d->i = (int)(0u - (unsigned int)a->i);
+			else if (b->i != 0)
+				d->i = a->i / b->i;
+			else
+				d->i = DIV_BY_ZERO(a->i, b->i, INT_MIN, INT_MAX);
+			break;
+		case PSC_MOD:
+			if (b->i == -1)
+				d->i = 0;
+			else if (b->i != 0)
+				d->i = a->i % b->i;
+			else
+				d->i = DIV_BY_ZERO(a->i, b->i, INT_MIN, INT_MAX);
+			break;
+		case PSC_AND_I: d->i = a->i & b->i; break;
+		case PSC_AND_B: d->i = a->i && b->i; break;
+		case PSC_OR_I: d->i = a->i | b->i; break;
+		case PSC_OR_B: d->i = a->i || b->i; break;
+		case PSC_XOR_I: d->i = a->i ^ b->i; break;
+		case PSC_XOR_B: d->i = a->i ^ b->i; break;
+		case PSC_NOT_I: d->i = ~a->i; break;
+		case PSC_NOT_B: d->i = !a->i; break;
+		case PSC_BITSHIFT:
+			if (b->i > 0 && b->i < 8 * sizeof (b->i))
+				d->i = a->i << b->i;
+			else if (b->i < 0 && b->i > -8 * (int)sizeof (b->i))
+				d->i = (int)((unsigned int)a->i >> -b->i);
+			else
+				d->i = a->i;
+			break;
+		case PSC_ATAN:
+			x = atan2f(a->f, b->f) * FZ_RADIAN;
+			if (x < 0)
+				x += 360;
+			d->f = ps_real(x);
+			break;
+		case PSC_CEILING: d->f = ceilf(a->f); break;
+		case PSC_FLOOR: d->f = floorf(a->f); break;
+		case PSC_ROUND: d->f = (a->f >= 0) ? floorf(a->f + 0.5f) : ceilf(a->f - 0.5f); break;
+		case PSC_TRUNCATE: d->f = (a->f >= 0) ? floorf(a->f) : ceilf(a->f); break;
+		case PSC_COS: d->f = ps_real(cosf(a->f/FZ_RADIAN)); break;
+		case PSC_SIN: d->f = ps_real(sinf(a->f/FZ_RADIAN)); break;
+		case PSC_EXP: d->f = ps_real(powf(a->f, b->f)); break;
+		case PSC_LN: x = logf(a->f); d->f = ps_real(x); break;
+		case PSC_LOG: d->f = ps_real(log10f(a->f)); break;
+		case PSC_SQRT: d->f = ps_real(sqrtf(a->f)); break;
+		case PSC_EQ_I: d->i = a->i == b->i; break;
+		case PSC_EQ_R: d->i = a->f == b->f; break;
+		case PSC_NE_I: d->i = a->i != b->i; break;
+		case PSC_NE_R: d->i = a->f != b->f; break;
+		case PSC_GE_I: d->i = a->i >= b->i; break;
+		case PSC_GE_R: d->i = a->f >= b->f; break;
+		case PSC_GT_I: d->i = a->i > b->i; break;
+		case PSC_GT_R: d->i = a->f > b->f; break;
+		case PSC_LE_I: d->i = a->i <= b->i; break;
+		case PSC_LE_R: d->i = a->f <= b->f; break;
+		case PSC_LT_I: d->i = a->i < b->i; break;
+		case PSC_LT_R: d->i = a->f < b->f; break;
+		case PSC_SELECT: *d = r[code->c].i ? *a : *b; break;
+		}
+	}
+}
+
+/* A value on the stack at compile time: a constant, or a register. */
+typedef struct
+{
+	int type;
+	int reg;
+	ps_value k;
+} ps_slot;
+
+typedef struct
+{
+	fz_context *ctx;
+	psobj *code;
+	ps_program *prog;
+	ps_slot stack[nelem(((ps_stack *)0)->stack)];
+	int sp;
+} ps_compiler;
+
+static int
+psc_new_reg(ps_compiler *pc, ps_value init)
+{
+	ps_program *prog = pc->prog;
+
+	if (prog->nregs == PSC_MAX_REGS)
+		return -1;
+	prog->init[prog->nregs] = init;
+	return prog->nregs++;
+}
+
+/* Make sure that a slot lives in a register. */
+static int
+psc_reg(ps_compiler *pc, ps_slot *s)
+{
+	if (s->reg < 0)
+		s->reg = psc_new_reg(pc, s->k);
+	return s->reg;
+}
+
+static int
+psc_emit(ps_compiler *pc, int op, int type, ps_slot *a, ps_slot *b, ps_slot *c, ps_slot *out)
+{
+	ps_program *prog = pc->prog;
+	ps_insn *insn;
+
+	out->type = type;
+
+	if (a->reg < 0 && (!b || b->reg < 0) && (!c || c->reg < 0))
+	{
+		/* Fold operations on constants. */
+		ps_value r[4];
+		ps_insn fold = { 0, 3, 0, 1, 2 };
+		fold.op = op;
+		r[0] = a->k;
+		r[1] = b ? b->k : a->k;
+		r[2] = c ? c->k : a->k;
+		ps_exec(&fold, 1, r);
+		out->reg = -1;
+		out->k = r[3];
+		return 0;
+	}
+
+	if (prog->len == PSC_MAX_INSNS)
+		return -1;
+	if (prog->len == prog->cap)
+	{
+		int new_cap = prog->cap + 64;
+		prog->code = fz_resize_array(pc->ctx, prog->code, new_cap, sizeof(ps_insn));
+		prog->cap = new_cap;
+	}
+	insn = &prog->code[prog->len];
+	insn->op = op;
+	if (psc_reg(pc, a) < 0 || (b && psc_reg(pc, b) < 0) || (c && psc_reg(pc, c) < 0))
+		return -1;
+	insn->a = a->reg;
+	insn->b = b ? b->reg : a->reg;
+	insn->c = c ? c->reg : a->reg;
+	out->k.i = 0;
+	out->reg = psc_new_reg(pc, out->k);
+	if (out->reg < 0)
+		return -1;
+	insn->dst = out->reg;
+	prog->len++;
+	return 0;
+}
+
+static int
+psc_to_real(ps_compiler *pc, ps_slot *s)
+{
+	if (s->type == PS_REAL)
+		return 0;
+	if (s->type != PS_INT)
+		return -1;
+	return psc_emit(pc, PSC_I2R, PS_REAL, s, NULL, NULL, s);
+}
+
+static int
+psc_to_int(ps_compiler *pc, ps_slot *s)
+{
+	if (s->type == PS_INT)
+		return 0;
+	if (s->type != PS_REAL)
+		return -1;
+	return psc_emit(pc, PSC_R2I, PS_INT, s, NULL, NULL, s);
+}
+
+static int
+psc_push(ps_compiler *pc, ps_slot *s)
+{
+	if (pc->sp + 1 >= nelem(pc->stack))
+		return -1;
+	pc->stack[pc->sp++] = *s;
+	return 0;
+}
+
+static int
+psc_pop(ps_compiler *pc, int n)
+{
+	if (pc->sp < n)
+		return -1;
+	pc->sp -= n;
+	return 0;
+}
+
+/* Pop one operand and push op(operand). */
+static int
+psc_unary(ps_compiler *pc, int op_i, int op_r)
+{
+	ps_slot *a, out;
+
+	if (psc_pop(pc, 1))
+		return -1;
+	a = &pc->stack[pc->sp];
+	if (a->type == PS_INT && op_i >= 0)
+	{
+		if (psc_emit(pc, op_i, PS_INT, a, NULL, NULL, &out))
+			return -1;
+	}
+	else
+	{
+		if (psc_to_real(pc, a) || psc_emit(pc, op_r, PS_REAL, a, NULL, NULL, &out))
+			return -1;
+	}
+	return psc_push(pc, &out);
+}
+
+/* Pop two operands and push op(a, b). Integer operations are used when
+ * both operands are integers and op_i is given. */
+static int
+psc_binary(ps_compiler *pc, int op_i, int op_r, int type_i, int type_r)
+{
+	ps_slot *a, *b, out;
+
+	if (psc_pop(pc, 2))
+		return -1;
+	a = &pc->stack[pc->sp];
+	b = &pc->stack[pc->sp + 1];
+	if (op_i >= 0 && a->type == PS_INT && b->type == PS_INT)
+	{
+		if (psc_emit(pc, op_i, type_i, a, b, NULL, &out))
+			return -1;
+	}
+	else if (op_r >= 0)
+	{
+		if (psc_to_real(pc, a) || psc_to_real(pc, b) || psc_emit(pc, op_r, type_r, a, b, NULL, &out))
+			return -1;
+	}
+	else
+	{
+		if (psc_to_int(pc, a) || psc_to_int(pc, b) || psc_emit(pc, op_i, type_i, a, b, NULL, &out))
+			return -1;
+	}
+	return psc_push(pc, &out);
+}
+
+/* Pop two booleans, or two integers, and push op(a, b). */
+static int
+psc_logical(ps_compiler *pc, int op_i, int op_b)
+{
+	ps_slot *a, *b, out;
+
+	if (psc_pop(pc, 2))
+		return -1;
+	a = &pc->stack[pc->sp];
+	b = &pc->stack[pc->sp + 1];
+	if (a->type == PS_BOOL && b->type == PS_BOOL)
+	{
+		if (psc_emit(pc, op_b, PS_BOOL, a, b, NULL, &out))
+			return -1;
+	}
+	else if (a->type == PS_INT && b->type == PS_INT)
+	{
+		if (psc_emit(pc, op_i, PS_INT, a, b, NULL, &out))
+			return -1;
+	}
+	else
+		return -1;
+	return psc_push(pc, &out);
+}
+
+static int
+psc_const_int(ps_compiler *pc, int *v)
+{
+	ps_slot *s;
+
+	if (psc_pop(pc, 1))
+		return -1;
+	s = &pc->stack[pc->sp];
+	if (s->reg >= 0 || s->type != PS_INT)
+		return -1;
+	*v = s->k.i;
+	return 0;
+}
+
+static int psc_block(ps_compiler *pc, int pc_start);
+
+static int
+psc_same(const ps_slot *a, const ps_slot *b)
+{
+	if (a->type != b->type)
+		return 0;
+	if (a->reg >= 0 || b->reg >= 0)
+		return a->reg == b->reg;
+	return a->k.i == b->k.i;
+}
+
+/*
+ * Clipping a real with "dup 1 gt { pop 1 } if" leaves an integer in one
+ * branch and a real in the other. Small integer constants are exact as
+ * reals, and the operators give the same results for either, so they
+ * can be merged as reals.
+ */
+static int
+psc_widen(ps_compiler *pc, ps_slot *s)
+{
+	if (s->type != PS_INT || s->reg >= 0 || s->k.i < -(1 << 24) || s->k.i > (1 << 24))
+		return -1;
+	return psc_to_real(pc, s);
+}
+
+static int
+psc_conditional(ps_compiler *pc, int then_pc, int else_pc)
+{
+	ps_slot cond, saved[nelem(pc->stack)], then_stack[nelem(pc->stack)];
+	int saved_sp, then_sp, i;
+
+	if (psc_pop(pc, 1))
+		return -1;
+	cond = pc->stack[pc->sp];
+	if (cond.type != PS_BOOL)
+		return -1;
+
+	/* Only the branch that is taken matters for constant conditions. */
+	if (cond.reg < 0)
+	{
+		if (cond.k.i)
+			return psc_block(pc, then_pc);
+		if (else_pc >= 0)
+			return psc_block(pc, else_pc);
+		return 0;
+	}
+
+	saved_sp = pc->sp;
+	memcpy(saved, pc->stack, saved_sp * sizeof(ps_slot));
+	if (psc_block(pc, then_pc))
+		return -1;
+	then_sp = pc->sp;
+	memcpy(then_stack, pc->stack, then_sp * sizeof(ps_slot));
+
+	pc->sp = saved_sp;
+	memcpy(pc->stack, saved, saved_sp * sizeof(ps_slot));
+	if (else_pc >= 0 && psc_block(pc, else_pc))
+		return -1;
+
+	if (pc->sp != then_sp)
+		return -1;
+	for (i = 0; i < then_sp; i++)
+	{
+		ps_slot *e = &pc->stack[i];
+		ps_slot *t = &then_stack[i];
+		if (psc_same(t, e))
+			continue;
+		if (t->type != e->type)
+		{
+			if (psc_widen(pc, t->type == PS_INT ? t : e))
+				return -1;
+			if (psc_same(t, e))
+				continue;
+		}
+		if (psc_reg(pc, &cond) < 0)
+			return -1;
+		/* Fold never happens here; the condition is in a register. */
+		if (psc_emit(pc, PSC_SELECT, t->type, t, e, &cond, e))
+			return -1;
+	}
+	return 0;
+}
+
+static int
+psc_block(ps_compiler *pc, int ip)
+{
+	psobj *code = pc->code;
+	ps_slot s;
+	int n, j;
+
+	while (1)
+	{
+		switch (code[ip].type)
+		{
+		case PS_INT:
+			s.type = PS_INT;
+			s.reg = -1;
+			s.k.i = code[ip++].u.i;
+			if (psc_push(pc, &s))
+				return -1;
+			break;
+
+		case PS_REAL:
+			s.type = PS_REAL;
+			s.reg = -1;
+			s.k.f = ps_real(code[ip++].u.f);
+			if (psc_push(pc, &s))
+				return -1;
+			break;
+
+		case PS_OPERATOR:
+			switch (code[ip++].u.op)
+			{
+			case PS_OP_ABS: if (psc_unary(pc, PSC_ABS_I, PSC_ABS_R)) return -1; break;
+			case PS_OP_ADD: if (psc_binary(pc, PSC_ADD_I, PSC_ADD_R, PS_INT, PS_REAL)) return -1; break;
+			case PS_OP_SUB: if (psc_binary(pc, PSC_SUB_I, PSC_SUB_R, PS_INT, PS_REAL)) return -1; break;
+			case PS_OP_MUL: if (psc_binary(pc, PSC_MUL_I, PSC_MUL_R, PS_INT, PS_REAL)) return -1; break;
+			case PS_OP_DIV: if (psc_binary(pc, -1, PSC_DIV, 0, PS_REAL)) return -1; break;
+			case PS_OP_IDIV: if (psc_binary(pc, PSC_IDIV, -1, PS_INT, 0)) return -1; break;
+			case PS_OP_MOD: if (psc_binary(pc, PSC_MOD, -1, PS_INT, 0)) return -1; break;
+			case PS_OP_BITSHIFT: if (psc_binary(pc, PSC_BITSHIFT, -1, PS_INT, 0)) return -1; break;
+			case PS_OP_ATAN: if (psc_binary(pc, -1, PSC_ATAN, 0, PS_REAL)) return -1; break;
+			case PS_OP_EXP: if (psc_binary(pc, -1, PSC_EXP, 0, PS_REAL)) return -1; break;
+			case PS_OP_GE: if (psc_binary(pc, PSC_GE_I, PSC_GE_R, PS_BOOL, PS_BOOL)) return -1; break;
+			case PS_OP_GT: if (psc_binary(pc, PSC_GT_I, PSC_GT_R, PS_BOOL, PS_BOOL)) return -1; break;
+			case PS_OP_LE: if (psc_binary(pc, PSC_LE_I, PSC_LE_R, PS_BOOL, PS_BOOL)) return -1; break;
+			case PS_OP_LT: if (psc_binary(pc, PSC_LT_I, PSC_LT_R, PS_BOOL, PS_BOOL)) return -1; break;
+			case PS_OP_AND: if (psc_logical(pc, PSC_AND_I, PSC_AND_B)) return -1; break;
+			case PS_OP_OR: if (psc_logical(pc, PSC_OR_I, PSC_OR_B)) return -1; break;
+			case PS_OP_XOR: if (psc_logical(pc, PSC_XOR_I, PSC_XOR_B)) return -1; break;
+			case PS_OP_CEILING: if (psc_unary(pc, -1, PSC_CEILING)) return -1; break;
+			case PS_OP_FLOOR: if (psc_unary(pc, -1, PSC_FLOOR)) return -1; break;
+			case PS_OP_COS: if (psc_unary(pc, -1, PSC_COS)) return -1; break;
+			case PS_OP_SIN: if (psc_unary(pc, -1, PSC_SIN)) return -1; break;
+			case PS_OP_LN: if (psc_unary(pc, -1, PSC_LN)) return -1; break;
+			case PS_OP_LOG: if (psc_unary(pc, -1, PSC_LOG)) return -1; break;
+			case PS_OP_SQRT: if (psc_unary(pc, -1, PSC_SQRT)) return -1; break;
+			case PS_OP_NEG: if (psc_unary(pc, PSC_NEG_I, PSC_NEG_R)) return -1; break;
+
+			case PS_OP_EQ:
+			case PS_OP_NE:
+				n = code[ip - 1].u.op == PS_OP_EQ;
+				if (pc->sp >= 2 && pc->stack[pc->sp - 1].type == PS_BOOL && pc->stack[pc->sp - 2].type == PS_BOOL)
+				{
+					/* Booleans are stored as 0 and 1. */
+					pc->stack[pc->sp - 1].type = PS_INT;
+					pc->stack[pc->sp - 2].type = PS_INT;
+				}
+				if (psc_binary(pc, n ? PSC_EQ_I : PSC_NE_I, n ? PSC_EQ_R : PSC_NE_R, PS_BOOL, PS_BOOL))
+					return -1;
+				break;
+
+			case PS_OP_NOT:
+				if (pc->sp >= 1 && pc->stack[pc->sp - 1].type == PS_BOOL)
+				{
+					if (psc_pop(pc, 1) || psc_emit(pc, PSC_NOT_B, PS_BOOL, &pc->stack[pc->sp], NULL, NULL, &s) || psc_push(pc, &s))
+						return -1;
+				}
+				else
+				{
+					if (psc_pop(pc, 1))
+						return -1;
+					s = pc->stack[pc->sp];
+					if (psc_to_int(pc, &s) || psc_emit(pc, PSC_NOT_I, PS_INT, &s, NULL, NULL, &s) || psc_push(pc, &s))
+						return -1;
+				}
+				break;
+
+			case PS_OP_CVI:
+				if (psc_pop(pc, 1))
+					return -1;
+				s = pc->stack[pc->sp];
+				if (psc_to_int(pc, &s) || psc_push(pc, &s))
+					return -1;
+				break;
+
+			case PS_OP_CVR:
+				if (psc_pop(pc, 1))
+					return -1;
+				s = pc->stack[pc->sp];
+				if (psc_to_real(pc, &s) || psc_push(pc, &s))
+					return -1;
+				break;
+
+			case PS_OP_ROUND:
+			case PS_OP_TRUNCATE:
+				if (pc->sp < 1 || pc->stack[pc->sp - 1].type == PS_BOOL)
+					return -1;
+				if (pc->stack[pc->sp - 1].type == PS_REAL)
+					if (psc_unary(pc, -1, code[ip - 1].u.op == PS_OP_ROUND ? PSC_ROUND : PSC_TRUNCATE))
+						return -1;
+				break;
+
+			case PS_OP_DUP:
+				if (pc->sp < 1 || psc_push(pc, &pc->stack[pc->sp - 1]))
+					return -1;
+				break;
+
+			case PS_OP_COPY:
+				if (psc_const_int(pc, &n) || n < 0 || n > pc->sp)
+					return -1;
+				for (j = pc->sp - n; n > 0; n--, j++)
+					if (psc_push(pc, &pc->stack[j]))
+						return -1;
+				break;
+
+			case PS_OP_INDEX:
+				if (psc_const_int(pc, &n) || n < 0 || n >= pc->sp)
+					return -1;
+				if (psc_push(pc, &pc->stack[pc->sp - n - 1]))
+					return -1;
+				break;
+
+			case PS_OP_EXCH:
+				if (pc->sp < 2)
+					return -1;
+				s = pc->stack[pc->sp - 1];
+				pc->stack[pc->sp - 1] = pc->stack[pc->sp - 2];
+				pc->stack[pc->sp - 2] = s;
+				break;
+
+			case PS_OP_ROLL:
+			{
+				ps_slot tmp[nelem(pc->stack)];
+				int i1, i2;
+				if (psc_const_int(pc, &i2) || psc_const_int(pc, &i1))
+					return -1;
+				if (i1 < 0 || i1 > pc->sp)
+					return -1;
+				if (i1 == 0 || i2 == 0)
+					break;
+				if (i2 >= 0)
+					i2 %= i1;
+				else
+				{
+					i2 = -i2 % i1;
+					if (i2 != 0)
+						i2 = i1 - i2;
+				}
+				for (j = 0; j < i1; j++)
+					tmp[(j + i2) % i1] = pc->stack[pc->sp - i1 + j];
+				memcpy(&pc->stack[pc->sp - i1], tmp, i1 * sizeof(ps_slot));
+				break;
+			}
+
+			case PS_OP_POP:
+				if (psc_pop(pc, 1))
+					return -1;
+				break;
+
+			case PS_OP_TRUE:
+			case PS_OP_FALSE:
+				s.type = PS_BOOL;
+				s.reg = -1;
+				s.k.i = code[ip - 1].u.op == PS_OP_TRUE;
+				if (psc_push(pc, &s))
+					return -1;
+				break;
+
+			case PS_OP_IF:
+				if (psc_conditional(pc, code[ip + 1].u.block, -1))
+					return -1;
+				ip = code[ip + 2].u.block;
+				break;
+
+			case PS_OP_IFELSE:
+				if (psc_conditional(pc, code[ip + 1].u.block, code[ip + 0].u.block))
+					return -1;
+				ip = code[ip + 2].u.block;
+				break;
+
+			case PS_OP_RETURN:
+				return 0;
+
+			default:
+				return -1;
+			}
+			break;
+
+		default:
+			return -1;
+		}
+	}
+}
+
+static void
+drop_ps_program(fz_context *ctx, ps_program *prog)
+{
+	if (prog)
+	{
+		fz_free(ctx, prog->code);
+		fz_free(ctx, prog->init);
+		fz_free(ctx, prog);
+	}
+}
+
+static ps_program *
+compile_postscript_func(fz_context *ctx, pdf_function *func)
+{
+	ps_compiler pc;
+	ps_program *prog;
+	int i;
+
+	prog = fz_malloc_struct(ctx, ps_program);
+	fz_try(ctx)
+	{
+		prog->init = fz_malloc_array(ctx, PSC_MAX_REGS, sizeof(ps_value));
+
+		pc.ctx = ctx;
+		pc.code = func->u.p.code;
+		pc.prog = prog;
+		pc.sp = 0;
+
+		/* The inputs are in the first registers. */
+		for (i = 0; i < func->m; i++)
+		{
+			ps_value zero = { 0 };
+			pc.stack[pc.sp].type = PS_REAL;
+			pc.stack[pc.sp].reg = psc_new_reg(&pc, zero);
+			pc.sp++;
+		}
+
+		if (psc_block(&pc, 0) || pc.sp < func->n)
+		{
+			drop_ps_program(ctx, prog);
+			prog = NULL;
+		}
+		else
+		{
+			for (i = func->n - 1; i >= 0; i--)
+			{
+				ps_slot *s = &pc.stack[--pc.sp];
+				if (psc_to_real(&pc, s) || psc_reg(&pc, s) < 0)
+					break;
+				prog->out[i] = s->reg;
+			}
+			if (i >= 0)
+			{
+				drop_ps_program(ctx, prog);
+				prog = NULL;
+			}
+			else
+				prog->init = fz_resize_array(ctx, prog->init, prog->nregs, sizeof(ps_value));
+		}
+	}
+	fz_catch(ctx)
+	{
+		drop_ps_program(ctx, prog);
+		prog = NULL;
+	}
+
+	if (prog)
+		func->size += sizeof(*prog) + prog->cap * sizeof(ps_insn) + prog->nregs * sizeof(ps_value);
+
+	return prog;
+}
+
+/*
+ * Functions of one input are sampled into a table once compiled. The
+ * table has four samples for each 8 bit input level, so it is exact for
+ * 8 bit tints and interpolates linearly in between.
+ */
+
+enum { PS_TABLE_SIZE = 255 * 4 };
+
+static void
+eval_tabulated_postscript_func(pdf_function *func, float in, float *out)
+{
+	float d0 = func->domain[0][0];
+	float d1 = func->domain[0][1];
+	float *table = func->u.p.table;
+	float x, f;
+	int i, k, n = func->n;
+
+	x = (fz_clamp(in, d0, d1) - d0) * PS_TABLE_SIZE / (d1 - d0);
+	k = (int)x;
+	if (k >= PS_TABLE_SIZE)
+		k = PS_TABLE_SIZE - 1;
+	f = x - k;
+	table += k * n;
+	for (i = 0; i < n; i++)
+		out[i] = table[i] + f * (table[i + n] - table[i]);
+}
+
+static void
+eval_compiled_postscript_func(fz_context *ctx, pdf_function *func, const float *in, float *out)
+{
+	ps_program *prog = func->u.p.prog;
+	ps_value r[PSC_MAX_REGS];
+	int i;
+
+	memcpy(r, prog->init, prog->nregs * sizeof(ps_value));
+	for (i = 0; i < func->m; i++)
+		r[i].f = ps_real(fz_clamp(in[i], func->domain[i][0], func->domain[i][1]));
+
+	ps_exec(prog->code, prog->len, r);
+
+	for (i = 0; i < func->n; i++)
+		out[i] = fz_clamp(r[prog->out[i]].f, func->range[i][0], func->range[i][1]);
+}
+
 static void
 resize_code(fz_context *ctx, pdf_function *func, int newsize)
 {
@@ -863,6 +1640,8 @@ parse_code(fz_context *ctx, pdf_function *func, fz_stream *stream, int *codeptr,
 	}
 }
 
+static void tabulate_postscript_func(fz_context *ctx, pdf_function *func);
+
 static void
 load_postscript_func(fz_context *ctx, pdf_function *func, pdf_obj *dict)
 {
@@ -904,6 +1683,12 @@ load_postscript_func(fz_context *ctx, pdf_function *func, pdf_obj *dict)
 	}
 
 	func->size += func->u.p.cap * sizeof(psobj);
+
+	/* Fall back to the interpreter if compilation fails. */
+	func->u.p.prog = compile_postscript_func(ctx, func);
+
+	if (func->m == 1 && func->domain[0][0] < func->domain[0][1])
+		tabulate_postscript_func(ctx, func);
 }
 
 static void
@@ -913,6 +1698,18 @@ eval_postscript_func(fz_context *ctx, pdf_function *func, const float *in, float
 	float x;
 	int i;
 
+	if (func->u.p.table)
+	{
+		eval_tabulated_postscript_func(func, *in, out);
+		return;
+	}
+
+	if (func->u.p.prog)
+	{
+		eval_compiled_postscript_func(ctx, func, in, out);
+		return;
+	}
+
 	ps_init_stack(&st);
 
 	for (i = 0; i < func->m; i++)
@@ -930,6 +1727,26 @@ eval_postscript_func(fz_context *ctx, pdf_function *func, const float *in, float
 	}
 }
 
+static void
+tabulate_postscript_func(fz_context *ctx, pdf_function *func)
+{
+	float d0 = func->domain[0][0];
+	float d1 = func->domain[0][1];
+	float *table;
+	float x;
+	int i;
+
+	table = fz_malloc_array(ctx, PS_TABLE_SIZE + 1, func->n * sizeof(float));
+	for (i = 0; i <= PS_TABLE_SIZE; i++)
+	{
+		x = d0 + (d1 - d0) * i / PS_TABLE_SIZE;
+		eval_postscript_func(ctx, func, &x, table + i * func->n);
+	}
+
+	func->u.p.table = table;
+	func->size += (PS_TABLE_SIZE + 1) * func->n * sizeof(float);
+}
+
 /*
  * Sample function
  */
@@ -1394,6 +2211,8 @@ pdf_drop_function_imp(fz_context *ctx, fz_storable *func_)
 		break;
 	case POSTSCRIPT:
 		fz_free(ctx, func->u.p.code);
+		drop_ps_program(ctx, func->u.p.prog);
+		fz_free(ctx, func->u.p.table);
 		break;
 	}
 	fz_free(ctx, func);
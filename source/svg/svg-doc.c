@@ -13,6 +13,7 @@ static void
 svg_drop_document(fz_context *ctx, fz_document *doc_)
 {
 	svg_document *doc = (svg_document*)doc_;
+	fz_drop_cached_page_lists(ctx, doc_);
 	fz_drop_tree(ctx, doc->idmap, NULL);
 	fz_drop_xml(ctx, doc->root);
 }
@@ -39,13 +40,20 @@ svg_bound_page(fz_context *ctx, fz_page *page_, fz_rect *rect)
 }
 
 static void
-svg_run_page(fz_context *ctx, fz_page *page_, fz_device *dev, const fz_matrix *ctm, fz_cookie *cookie)
+svg_run_page_imp(fz_context *ctx, fz_page *page_, fz_device *dev, const fz_matrix *ctm, fz_cookie *cookie)
 {
 	svg_page *page = (svg_page*)page_;
 	svg_document *doc = page->doc;
 	svg_run_document(ctx, doc, doc->root, dev, ctm);
 }
 
+static void
+svg_run_page(fz_context *ctx, fz_page *page_, fz_device *dev, const fz_matrix *ctm, fz_cookie *cookie)
+{
+	svg_page *page = (svg_page*)page_;
+	fz_run_page_contents_cached(ctx, (fz_document*)page->doc, 0, page_, svg_run_page_imp, dev, ctm, cookie);
+}
+
 static void
 svg_drop_page(fz_context *ctx, fz_page *page_)
 {
@@ -0,0 +1,190 @@
+/*
+ * archive-bench - Measure how long it takes to find entries by name in
+ * a large archive.
+ *
+ * Usage: archive-bench [-n entries] [-l lookups] [file]
+ *
+ * Looks up random entries, with their names in a different case, and
+ * names that are not there, as XPS does when it probes for the pieces
+ * of a part. The same lookups are then done by comparing the names
+ * of all entries in turn, as the archives used to. Without a file, a
+ * zip of empty entries named like the parts of an XPS document is
+ * written to archive-bench.zip and used. Fails if the two ever
+ * disagree.
+ */
+
+#include "mupdf/fitz.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _MSC_VER
+struct timeval;
+struct timezone;
+int gettimeofday(struct timeval *tv, struct timezone *tz);
+#else
+#include <sys/time.h>
+#endif
+
+static double
+now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+static unsigned seed = 1;
+
+static float
+next_random(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return ((seed >> 16) & 0x7fff) / 32768.0f;
+}
+
+static void
+make_zip(fz_context *ctx, const char *filename, int count)
+{
+	fz_zip_writer *zip = fz_new_zip_writer(ctx, filename);
+	fz_buffer *buf = NULL;
+	char name[64];
+	int i;
+
+	fz_var(buf);
+
+	fz_try(ctx)
+	{
+		buf = fz_new_buffer(ctx, 1);
+		for (i = 0; i < count; i++)
+		{
+			fz_snprintf(name, sizeof name, "Documents/1/Resources/Images/Image%d.png", i);
+			fz_write_zip_entry(ctx, zip, name, buf, 0);
+		}
+		fz_close_zip_writer(ctx, zip);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_buffer(ctx, buf);
+		fz_drop_zip_writer(ctx, zip);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+static int
+scan_archive(fz_context *ctx, fz_archive *arch, int count, const char *name)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+		if (!fz_strcasecmp(fz_list_archive_entry(ctx, arch, i), name))
+			return 1;
+	return 0;
+}
+
+/* Half the names are entries with their case changed, the other half
+ * are the same names with a piece suffix, which are not there. */
+static void
+make_name(fz_context *ctx, fz_archive *arch, int count, int k, char *name, int size)
+{
+	char *s;
+
+	fz_strlcpy(name, fz_list_archive_entry(ctx, arch, next_random() * count), size);
+	for (s = name; *s; s++)
+		if (*s >= 'a' && *s <= 'z')
+			*s += 'A' - 'a';
+	if (k & 1)
+		fz_strlcat(name, "/[0].piece", size);
+}
+
+int main(int argc, char **argv)
+{
+	const char *filename = "archive-bench.zip";
+	fz_context *ctx;
+	fz_archive *arch = NULL;
+	unsigned char *hashed = NULL;
+	char name[1024];
+	double hash_time, scan_time;
+	int entries = 50000;
+	int lookups = 1000;
+	int c, k, count, failed = 0;
+
+	while ((c = fz_getopt(argc, argv, "n:l:")) != -1)
+	{
+		switch (c)
+		{
+		case 'n': entries = fz_maxi(1, atoi(fz_optarg)); break;
+		case 'l': lookups = fz_maxi(1, atoi(fz_optarg)); break;
+		default:
+			fprintf(stderr, "usage: archive-bench [-n entries] [-l lookups] [file]\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	ctx = fz_new_context(NULL, NULL, FZ_STORE_DEFAULT);
+	if (!ctx)
+	{
+		fprintf(stderr, "cannot create mupdf context\n");
+		return EXIT_FAILURE;
+	}
+
+	fz_var(arch);
+	fz_var(hashed);
+
+	fz_try(ctx)
+	{
+		if (fz_optind < argc)
+			filename = argv[fz_optind];
+		else
+			make_zip(ctx, filename, entries);
+
+		/* Opening reads the directory and builds the index. */
+		hash_time = now();
+		arch = fz_open_archive(ctx, filename);
+		hash_time = now() - hash_time;
+		count = fz_count_archive_entries(ctx, arch);
+		if (count == 0)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "no entries in %s", filename);
+		printf("%s: %d entries, opened in %.2fms\n", filename, count, hash_time);
+
+		hashed = fz_malloc(ctx, lookups);
+		seed = 1;
+		hash_time = now();
+		for (k = 0; k < lookups; k++)
+		{
+			make_name(ctx, arch, count, k, name, sizeof name);
+			hashed[k] = fz_has_archive_entry(ctx, arch, name);
+		}
+		hash_time = now() - hash_time;
+
+		seed = 1;
+		scan_time = now();
+		for (k = 0; k < lookups; k++)
+		{
+			make_name(ctx, arch, count, k, name, sizeof name);
+			if (hashed[k] != scan_archive(ctx, arch, count, name))
+				failed = 1;
+		}
+		scan_time = now() - scan_time;
+
+		printf("%d lookups: hashed %.3fus each, scanned %.3fus each\n",
+			lookups, hash_time * 1000 / lookups, scan_time * 1000 / lookups);
+		if (failed)
+			fprintf(stderr, "FAIL: hashed and scanned lookups disagree\n");
+	}
+	fz_always(ctx)
+	{
+		fz_free(ctx, hashed);
+		fz_drop_archive(ctx, arch);
+	}
+	fz_catch(ctx)
+	{
+		fprintf(stderr, "error: %s\n", fz_caught_message(ctx));
+		failed = 1;
+	}
+
+	fz_drop_context(ctx);
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,273 @@
+/*
+ * color-lut-test - Check the accuracy and speed of pixmap conversions
+ * that go through the interpolated colour lookup tables.
+ *
+ * Usage: color-lut-test [-n repeats] [-d max-delta-e] [-s size]
+ *
+ * Converts pixmaps of random colours in three and four ink DeviceN
+ * colorspaces, whose tint transforms mix the inks multiplicatively, and
+ * in Lab, to RGB. Every pixel is compared with the exact conversion of
+ * the same colour, and the mean and largest CIE76 colour differences are
+ * reported along with the time per pixmap for both. Fails if any
+ * difference is larger than the given limit. The grids are coarse, so
+ * the largest differences are where the transform bends sharply, such
+ * as at the edge of the RGB gamut, while the mean stays below one.
+ */
+
+#include "mupdf/fitz.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+static int repeats = 5;
+static double max_delta_e = 10;
+static int size = 512;
+
+static unsigned seed = 1;
+
+static float
+next_random(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return ((seed >> 16) & 0x7fff) / 32768.0f;
+}
+
+/* The RGB colour of each ink at full strength. */
+static const float inks[4][3] =
+{
+	{ 0.00f, 0.63f, 0.91f },
+	{ 0.93f, 0.00f, 0.55f },
+	{ 1.00f, 0.55f, 0.00f },
+	{ 0.10f, 0.10f, 0.12f },
+};
+
+static fz_colorspace *base_rgb;
+
+static void
+inks_to_rgb(fz_context *ctx, const fz_colorspace *cs, const float *src, float *dst)
+{
+	int n = fz_colorspace_n(ctx, cs);
+	int i, k;
+
+	dst[0] = dst[1] = dst[2] = 1;
+	for (i = 0; i < n; i++)
+	{
+		/* Dot gain makes the inks darken faster than their tint. */
+		float t = powf(src[i], 0.7f);
+		for (k = 0; k < 3; k++)
+			dst[k] *= 1 - t * (1 - inks[i][k]);
+	}
+}
+
+static fz_colorspace *
+inks_base(const fz_colorspace *cs)
+{
+	return base_rgb;
+}
+
+static fz_colorspace *
+new_ink_colorspace(fz_context *ctx, int n)
+{
+	static const char *names[] = { "Cyan", "Magenta", "Orange", "Black" };
+	fz_colorspace *cs;
+	int i;
+
+	cs = fz_new_colorspace(ctx, n == 3 ? "Inks3" : "Inks4", n, 1, 1, inks_to_rgb, NULL, inks_base, NULL, NULL, NULL, 0);
+	for (i = 0; i < n; i++)
+		fz_colorspace_name_colorant(ctx, cs, i, names[i]);
+	return cs;
+}
+
+static float
+srgb_to_linear(float v)
+{
+	return v <= 0.04045f ? v / 12.92f : powf((v + 0.055f) / 1.055f, 2.4f);
+}
+
+static float
+lab_f(float t)
+{
+	return t > 216.0f / 24389 ? cbrtf(t) : (24389.0f / 27 * t + 16) / 116;
+}
+
+static void
+rgb_to_lab(const float *rgb, float *lab)
+{
+	float r = srgb_to_linear(rgb[0]);
+	float g = srgb_to_linear(rgb[1]);
+	float b = srgb_to_linear(rgb[2]);
+	float x = lab_f((0.4124f * r + 0.3576f * g + 0.1805f * b) / 0.9505f);
+	float y = lab_f(0.2126f * r + 0.7152f * g + 0.0722f * b);
+	float z = lab_f((0.0193f * r + 0.1192f * g + 0.9505f * b) / 1.0890f);
+	lab[0] = 116 * y - 16;
+	lab[1] = 500 * (x - y);
+	lab[2] = 200 * (y - z);
+}
+
+static double
+delta_e(const float *rgb0, const float *rgb1)
+{
+	float lab0[3], lab1[3];
+	rgb_to_lab(rgb0, lab0);
+	rgb_to_lab(rgb1, lab1);
+	return sqrt((lab0[0] - lab1[0]) * (lab0[0] - lab1[0]) +
+		(lab0[1] - lab1[1]) * (lab0[1] - lab1[1]) +
+		(lab0[2] - lab1[2]) * (lab0[2] - lab1[2]));
+}
+
+/* Convert the pixmap a colour at a time, as the conversion did before
+ * it had lookup tables, and compare with the converted pixmap. */
+static double
+check(fz_context *ctx, fz_pixmap *src, fz_pixmap *dst, double *mean, double *exact_time)
+{
+	fz_colorspace *ss = fz_pixmap_colorspace(ctx, src);
+	int is_lab = (ss == fz_device_lab(ctx));
+	int n = fz_pixmap_components(ctx, src);
+	int count = fz_pixmap_width(ctx, src) * fz_pixmap_height(ctx, src);
+	unsigned char *s = fz_pixmap_samples(ctx, src);
+	unsigned char *d = fz_pixmap_samples(ctx, dst);
+	fz_color_converter cc;
+	float srcv[FZ_MAX_COLORS];
+	float exact[3], got[3];
+	double e;
+	double max = 0, sum = 0;
+	clock_t t;
+	int i, k;
+
+	t = clock();
+	fz_find_color_converter(ctx, &cc, NULL, fz_pixmap_colorspace(ctx, dst), ss, NULL);
+	for (i = 0; i < count; i++)
+	{
+		for (k = 0; k < n; k++)
+		{
+			float v = s[k] / 255.0f;
+			if (is_lab)
+				srcv[k] = (k == 0 ? v * 100 : s[k] - 128.0f);
+			else
+				srcv[k] = v;
+		}
+		cc.convert(ctx, &cc, exact, srcv);
+		for (k = 0; k < 3; k++)
+			got[k] = d[k] / 255.0f;
+		e = delta_e(exact, got);
+		sum += e;
+		if (e > max)
+			max = e;
+		s += n;
+		d += 3;
+	}
+	fz_drop_color_converter(ctx, &cc);
+	*exact_time = (double)(clock() - t) * 1000 / CLOCKS_PER_SEC;
+	*mean = sum / count;
+
+	return max;
+}
+
+static int
+test(fz_context *ctx, const char *name, fz_colorspace *ss)
+{
+	fz_pixmap *src = NULL;
+	fz_pixmap *dst = NULL;
+	unsigned char *s;
+	double lut_time, exact_time, mean, max;
+	clock_t t;
+	int i, n;
+
+	fz_var(src);
+	fz_var(dst);
+
+	fz_try(ctx)
+	{
+		src = fz_new_pixmap(ctx, ss, size, size, NULL, 0);
+		s = fz_pixmap_samples(ctx, src);
+		n = size * size * fz_pixmap_components(ctx, src);
+		for (i = 0; i < n; i++)
+			s[i] = next_random() * 256;
+
+		/* The first conversion builds the table. */
+		t = clock();
+		for (i = 0; i < repeats; i++)
+		{
+			fz_drop_pixmap(ctx, dst);
+			dst = NULL;
+			dst = fz_convert_pixmap(ctx, src, fz_device_rgb(ctx), NULL, NULL, NULL, 0);
+		}
+		lut_time = (double)(clock() - t) * 1000 / CLOCKS_PER_SEC / repeats;
+
+		max = check(ctx, src, dst, &mean, &exact_time);
+		printf("%-6s lut %8.2fms  exact %8.2fms  mean delta E %5.2f  max %5.2f\n", name, lut_time, exact_time, mean, max);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_pixmap(ctx, dst);
+		fz_drop_pixmap(ctx, src);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	if (max > max_delta_e)
+	{
+		fprintf(stderr, "FAIL: %s: delta E %.2f is over %.2f\n", name, max, max_delta_e);
+		return 1;
+	}
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	fz_context *ctx;
+	fz_colorspace *inks3 = NULL;
+	fz_colorspace *inks4 = NULL;
+	int c, failed = 0;
+
+	while ((c = fz_getopt(argc, argv, "n:d:s:")) != -1)
+	{
+		switch (c)
+		{
+		case 'n': repeats = fz_maxi(1, atoi(fz_optarg)); break;
+		case 'd': max_delta_e = fz_atof(fz_optarg); break;
+		case 's': size = fz_maxi(16, atoi(fz_optarg)); break;
+		default:
+			fprintf(stderr, "usage: color-lut-test [-n repeats] [-d max-delta-e] [-s size]\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	ctx = fz_new_context(NULL, NULL, FZ_STORE_DEFAULT);
+	if (!ctx)
+	{
+		fprintf(stderr, "cannot create mupdf context\n");
+		return EXIT_FAILURE;
+	}
+
+	fz_var(inks3);
+	fz_var(inks4);
+
+	fz_try(ctx)
+	{
+		base_rgb = fz_device_rgb(ctx);
+		inks3 = new_ink_colorspace(ctx, 3);
+		inks4 = new_ink_colorspace(ctx, 4);
+		failed |= test(ctx, "inks3", inks3);
+		failed |= test(ctx, "inks4", inks4);
+		failed |= test(ctx, "lab", fz_device_lab(ctx));
+	}
+	fz_always(ctx)
+	{
+		fz_drop_colorspace(ctx, inks3);
+		fz_drop_colorspace(ctx, inks4);
+	}
+	fz_catch(ctx)
+	{
+		fprintf(stderr, "FAIL: %s\n", fz_caught_message(ctx));
+		failed = 1;
+	}
+
+	fz_drop_context(ctx);
+	if (failed)
+		return EXIT_FAILURE;
+	printf("color-lut-test: OK\n");
+	return EXIT_SUCCESS;
+}
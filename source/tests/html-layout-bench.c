@@ -0,0 +1,225 @@
+/*
+ * html-layout-bench - Measure how long it takes to lay out a large HTML
+ * book again at another font size.
+ *
+ * Usage: html-layout-bench [-n repeats] [file]
+ *
+ * Lays the book out at a cycle of font sizes, as a reader does when the
+ * text is made larger or smaller, and reports the time of the first
+ * layout, the mean time of the ones after it, and the time to run all
+ * the pages of the last one, which shapes the words again to draw them.
+ * This is done twice: once with the usual store, where the words shaped
+ * once are found again, and once with a store too small to keep them,
+ * so that every word is shaped afresh. Without a file, a book of
+ * random words, repeated as often as the words of a real one are, is
+ * written to html-layout-bench.html and used. Fails if the two ever
+ * lay the book out on a different number of pages.
+ */
+
+#include "mupdf/fitz.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _MSC_VER
+struct timeval;
+struct timezone;
+int gettimeofday(struct timeval *tv, struct timezone *tz);
+#else
+#include <sys/time.h>
+#endif
+
+static int repeats = 10;
+
+static const float sizes[] = { 11, 12, 14, 10, 9 };
+#define NSIZES (int)(sizeof sizes / sizeof *sizes)
+
+static double
+now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+static unsigned seed = 1;
+
+static float
+next_random(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return ((seed >> 16) & 0x7fff) / 32768.0f;
+}
+
+/* 3000 paragraphs of words drawn from a vocabulary of 2000, the short
+ * and common ones far more often than the rest. */
+static void
+make_html(fz_context *ctx, const char *filename)
+{
+	fz_output *out = fz_new_output_with_path(ctx, filename, 0);
+	char words[2000][12];
+	int i, k, n, len;
+
+	fz_try(ctx)
+	{
+		for (i = 0; i < 2000; i++)
+		{
+			len = 1 + i / 200 + next_random() * 3;
+			for (k = 0; k < len; k++)
+				words[i][k] = 'a' + next_random() * 26;
+			words[i][k] = 0;
+		}
+
+		fz_write_string(ctx, out, "<html><body>\n");
+		for (i = 0; i < 3000; i++)
+		{
+			fz_write_string(ctx, out, "<p>");
+			n = 40 + next_random() * 80;
+			for (k = 0; k < n; k++)
+			{
+				float r = next_random();
+				fz_write_printf(ctx, out, k ? " %s" : "%s", words[(int)(r * r * r * 2000)]);
+			}
+			fz_write_string(ctx, out, ".</p>\n");
+		}
+		fz_write_string(ctx, out, "</body></html>\n");
+	}
+	fz_always(ctx)
+		fz_drop_output(ctx, out);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+/* Lay the book out repeats + 1 times and note the page count of each. */
+static int
+bench(const char *filename, const char *label, size_t store, int *pages)
+{
+	fz_context *ctx = fz_new_context(NULL, NULL, store);
+	fz_document *doc = NULL;
+	fz_device *dev = NULL;
+	fz_page *page = NULL;
+	fz_rect bounds;
+	double t, first_time, repeat_time, run_time;
+	int i, failed = 0;
+
+	if (!ctx)
+	{
+		fprintf(stderr, "cannot create mupdf context\n");
+		return 1;
+	}
+
+	fz_var(doc);
+	fz_var(dev);
+	fz_var(page);
+
+	fz_try(ctx)
+	{
+		fz_register_document_handlers(ctx);
+		doc = fz_open_document(ctx, filename);
+
+		repeat_time = 0;
+		for (i = 0; i <= repeats; i++)
+		{
+			t = now();
+			fz_layout_document(ctx, doc, 450, 600, sizes[i % NSIZES]);
+			pages[i] = fz_count_pages(ctx, doc);
+			t = now() - t;
+			if (i == 0)
+				first_time = t;
+			else
+				repeat_time += t;
+		}
+
+		dev = fz_new_bbox_device(ctx, &bounds);
+		run_time = now();
+		for (i = 0; i < pages[repeats]; i++)
+		{
+			page = fz_load_page(ctx, doc, i);
+			fz_run_page(ctx, page, dev, &fz_identity, NULL);
+			fz_drop_page(ctx, page);
+			page = NULL;
+		}
+		fz_close_device(ctx, dev);
+		run_time = now() - run_time;
+
+		printf("%s: %s: first layout %.1fms, %d pages; relayout %.1fms; run %d pages %.1fms\n",
+			filename, label, first_time, pages[0], repeat_time / repeats, pages[repeats], run_time);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_page(ctx, page);
+		fz_drop_device(ctx, dev);
+		fz_drop_document(ctx, doc);
+	}
+	fz_catch(ctx)
+	{
+		fprintf(stderr, "error: %s\n", fz_caught_message(ctx));
+		failed = 1;
+	}
+
+	fz_drop_context(ctx);
+	return failed;
+}
+
+int main(int argc, char **argv)
+{
+	const char *filename = "html-layout-bench.html";
+	fz_context *ctx;
+	int *cached, *uncached;
+	int c, failed = 0;
+
+	while ((c = fz_getopt(argc, argv, "n:")) != -1)
+	{
+		switch (c)
+		{
+		case 'n': repeats = fz_maxi(1, atoi(fz_optarg)); break;
+		default:
+			fprintf(stderr, "usage: html-layout-bench [-n repeats] [file]\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (fz_optind < argc)
+		filename = argv[fz_optind];
+	else
+	{
+		ctx = fz_new_context(NULL, NULL, FZ_STORE_DEFAULT);
+		if (!ctx)
+		{
+			fprintf(stderr, "cannot create mupdf context\n");
+			return EXIT_FAILURE;
+		}
+		fz_try(ctx)
+			make_html(ctx, filename);
+		fz_catch(ctx)
+		{
+			fprintf(stderr, "error: %s\n", fz_caught_message(ctx));
+			failed = 1;
+		}
+		fz_drop_context(ctx);
+		if (failed)
+			return EXIT_FAILURE;
+	}
+
+	cached = malloc((repeats + 1) * sizeof *cached);
+	uncached = malloc((repeats + 1) * sizeof *uncached);
+	if (!cached || !uncached)
+	{
+		fprintf(stderr, "out of memory\n");
+		return EXIT_FAILURE;
+	}
+
+	failed |= bench(filename, "cached", FZ_STORE_DEFAULT, cached);
+	failed |= bench(filename, "uncached", 1, uncached);
+
+	if (!failed && memcmp(cached, uncached, (repeats + 1) * sizeof *cached))
+	{
+		fprintf(stderr, "FAIL: %s: page counts differ\n", filename);
+		failed = 1;
+	}
+
+	free(cached);
+	free(uncached);
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,276 @@
+/*
+ * page-cache-bench - Measure how long repeated runs of XPS and SVG
+ * pages take once their display lists are kept in the store.
+ *
+ * Usage: page-cache-bench [-n repeats] [file ...]
+ *
+ * For every page, times recording it into a display list as mudraw
+ * does, the first run, which records the page into the store, and the
+ * mean of the repeated runs that replay it. Without files, an XPS page
+ * of generated paths and glyphs is written to page-cache-bench.xps and
+ * used. Fails if a repeated run, or a render of the stored list,
+ * differs from the page run afresh.
+ */
+
+#include "mupdf/fitz.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _MSC_VER
+struct timeval;
+struct timezone;
+int gettimeofday(struct timeval *tv, struct timezone *tz);
+#else
+#include <sys/time.h>
+#endif
+
+static int repeats = 10;
+
+static double
+now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+static unsigned seed = 1;
+
+static float
+next_random(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return ((seed >> 16) & 0x7fff) / 32768.0f;
+}
+
+static void
+write_string(fz_context *ctx, fz_zip_writer *zip, const char *name, const char *s)
+{
+	fz_buffer *buf = fz_new_buffer_from_shared_data(ctx, (const unsigned char *)s, strlen(s));
+	fz_try(ctx)
+		fz_write_zip_entry(ctx, zip, name, buf, 1);
+	fz_always(ctx)
+		fz_drop_buffer(ctx, buf);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+/* A page of small curved shapes under lines of text, which takes
+ * about as long to interpret as a dense drawing or a page of small
+ * print does. */
+static void
+make_xps(fz_context *ctx, const char *filename)
+{
+	fz_zip_writer *zip = fz_new_zip_writer(ctx, filename);
+	fz_buffer *page = NULL;
+	fz_buffer *font = NULL;
+	const unsigned char *data;
+	int i, k, len;
+
+	fz_var(page);
+	fz_var(font);
+
+	fz_try(ctx)
+	{
+		write_string(ctx, zip, "_rels/.rels",
+			"<Relationships xmlns=\"http://schemas.openxmlformats.org/package/2006/relationships\">"
+			"<Relationship Type=\"http://schemas.microsoft.com/xps/2005/06/fixedrepresentation\" Target=\"/FixedDocSeq.fdseq\" Id=\"R0\"/>"
+			"</Relationships>");
+		write_string(ctx, zip, "FixedDocSeq.fdseq",
+			"<FixedDocumentSequence xmlns=\"http://schemas.microsoft.com/xps/2005/06\">"
+			"<DocumentReference Source=\"/Doc.fdoc\"/>"
+			"</FixedDocumentSequence>");
+		write_string(ctx, zip, "Doc.fdoc",
+			"<FixedDocument xmlns=\"http://schemas.microsoft.com/xps/2005/06\">"
+			"<PageContent Source=\"/P1.fpage\"/>"
+			"</FixedDocument>");
+
+		data = fz_lookup_base14_font(ctx, "Times-Roman", &len);
+		if (!data)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "no builtin font to embed");
+		font = fz_new_buffer_from_shared_data(ctx, data, len);
+		fz_write_zip_entry(ctx, zip, "Font.cff", font, 1);
+
+		page = fz_new_buffer(ctx, 1 << 20);
+		fz_append_string(ctx, page, "<FixedPage xmlns=\"http://schemas.microsoft.com/xps/2005/06\" Width=\"816\" Height=\"1056\">");
+		for (i = 0; i < 20000; i++)
+		{
+			float x = next_random() * 816;
+			float y = next_random() * 1056;
+			fz_append_printf(ctx, page,
+				"<Path Fill=\"#80%02X%02X%02X\" Data=\"M %g,%g C %g,%g %g,%g %g,%g L %g,%g Z\"/>",
+				(int)(next_random() * 255), (int)(next_random() * 255), (int)(next_random() * 255),
+				x, y, x + 4, y - 6, x + 10, y + 6, x + 14, y, x + 7, y + 9);
+		}
+		for (i = 0; i < 90; i++)
+		{
+			fz_append_printf(ctx, page,
+				"<Glyphs Fill=\"#FF000000\" FontUri=\"/Font.cff\" FontRenderingEmSize=\"9\" OriginX=\"24\" OriginY=\"%d\" UnicodeString=\"",
+				24 + i * 11);
+			for (k = 0; k < 150; k++)
+				fz_append_byte(ctx, page, (k % 7 == 6) ? ' ' : 'a' + (int)(next_random() * 26));
+			fz_append_string(ctx, page, "\"/>");
+		}
+		fz_append_string(ctx, page, "</FixedPage>");
+		fz_write_zip_entry(ctx, zip, "P1.fpage", page, 1);
+
+		fz_close_zip_writer(ctx, zip);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_buffer(ctx, page);
+		fz_drop_buffer(ctx, font);
+		fz_drop_zip_writer(ctx, zip);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+/* Run the page through a bbox device, which costs next to nothing
+ * itself, so that the time is that of interpreting or replaying it. */
+static double
+run_page(fz_context *ctx, fz_page *page, fz_rect *bounds)
+{
+	fz_device *dev = fz_new_bbox_device(ctx, bounds);
+	double t = now();
+
+	fz_try(ctx)
+	{
+		fz_run_page(ctx, page, dev, &fz_identity, NULL);
+		fz_close_device(ctx, dev);
+	}
+	fz_always(ctx)
+		fz_drop_device(ctx, dev);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return now() - t;
+}
+
+static int
+bench_page(fz_context *ctx, fz_document *doc, const char *filename, int number)
+{
+	unsigned char listed[16], cached[16];
+	fz_page *page = fz_load_page(ctx, doc, number);
+	fz_display_list *list = NULL;
+	fz_pixmap *pix = NULL;
+	fz_rect first_bounds, bounds;
+	double record_time, first_time, repeat_time;
+	int i, failed = 0;
+
+	fz_var(list);
+	fz_var(pix);
+
+	fz_try(ctx)
+	{
+		/* Nothing is stored for the page yet, so this records it
+		 * only once, into our list. */
+		record_time = now();
+		list = fz_new_display_list_from_page(ctx, page);
+		record_time = now() - record_time;
+
+		first_time = run_page(ctx, page, &first_bounds);
+		repeat_time = 0;
+		for (i = 0; i < repeats; i++)
+		{
+			repeat_time += run_page(ctx, page, &bounds);
+			if (memcmp(&bounds, &first_bounds, sizeof bounds))
+				failed = 1;
+		}
+		repeat_time /= repeats;
+
+		printf("%s page %d: record %.1fms, first run %.1fms, repeat run %.1fms\n",
+			filename, number + 1, record_time, first_time, repeat_time);
+
+		/* The stored list must draw the same page as a fresh one. */
+		pix = fz_new_pixmap_from_display_list(ctx, list, &fz_identity, fz_device_rgb(ctx), 0);
+		fz_md5_pixmap(ctx, pix, listed);
+		fz_drop_pixmap(ctx, pix);
+		pix = NULL;
+		pix = fz_new_pixmap_from_page(ctx, page, &fz_identity, fz_device_rgb(ctx), 0);
+		fz_md5_pixmap(ctx, pix, cached);
+		if (memcmp(listed, cached, 16))
+			failed = 1;
+		if (failed)
+			fprintf(stderr, "FAIL: %s page %d: runs differ\n", filename, number + 1);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_pixmap(ctx, pix);
+		fz_drop_display_list(ctx, list);
+		fz_drop_page(ctx, page);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return failed;
+}
+
+static int
+bench_document(fz_context *ctx, const char *filename)
+{
+	fz_document *doc = fz_open_document(ctx, filename);
+	int i, n, failed = 0;
+
+	fz_try(ctx)
+	{
+		n = fz_count_pages(ctx, doc);
+		for (i = 0; i < n; i++)
+			failed |= bench_page(ctx, doc, filename, i);
+	}
+	fz_always(ctx)
+		fz_drop_document(ctx, doc);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return failed;
+}
+
+int main(int argc, char **argv)
+{
+	fz_context *ctx;
+	int c, failed = 0;
+
+	while ((c = fz_getopt(argc, argv, "n:")) != -1)
+	{
+		switch (c)
+		{
+		case 'n': repeats = fz_maxi(1, atoi(fz_optarg)); break;
+		default:
+			fprintf(stderr, "usage: page-cache-bench [-n repeats] [file ...]\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	ctx = fz_new_context(NULL, NULL, FZ_STORE_DEFAULT);
+	if (!ctx)
+	{
+		fprintf(stderr, "cannot create mupdf context\n");
+		return EXIT_FAILURE;
+	}
+
+	fz_try(ctx)
+	{
+		fz_register_document_handlers(ctx);
+		if (fz_optind == argc)
+		{
+			make_xps(ctx, "page-cache-bench.xps");
+			failed |= bench_document(ctx, "page-cache-bench.xps");
+		}
+		else
+		{
+			for (c = fz_optind; c < argc; c++)
+				failed |= bench_document(ctx, argv[c]);
+		}
+	}
+	fz_catch(ctx)
+	{
+		fprintf(stderr, "error: %s\n", fz_caught_message(ctx));
+		failed = 1;
+	}
+
+	fz_drop_context(ctx);
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,196 @@
+/*
+ * pool-test - Check that growing pool allocations leaves the others intact,
+ * and that all memory handed out is zeroed.
+ */
+
+#include "mupdf/fitz.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int failures = 0;
+
+static void
+fill(unsigned char *p, size_t n, int seed)
+{
+	size_t i;
+	for (i = 0; i < n; i++)
+		p[i] = (unsigned char)(seed + i * 7);
+}
+
+static void
+check(const char *what, const unsigned char *p, size_t n, int seed)
+{
+	size_t i;
+	for (i = 0; i < n; i++)
+	{
+		if (p[i] != (unsigned char)(seed + i * 7))
+		{
+			fprintf(stderr, "FAIL: %s: byte %d corrupted\n", what, (int)i);
+			failures++;
+			return;
+		}
+	}
+}
+
+static void
+check_zero(const char *what, const unsigned char *p, size_t n)
+{
+	size_t i;
+	for (i = 0; i < n; i++)
+	{
+		if (p[i])
+		{
+			fprintf(stderr, "FAIL: %s: byte %d not zero\n", what, (int)i);
+			failures++;
+			return;
+		}
+	}
+}
+
+/* Grow the first allocation in the first block past the large allocation
+ * threshold, allocate after it, and grow it again. */
+static void
+test_grow_head(fz_context *ctx)
+{
+	fz_pool *pool = fz_new_pool(ctx);
+	unsigned char *a, *b, *c;
+	size_t size = 1024;
+
+	a = fz_pool_alloc(ctx, pool, size);
+	fill(a, size, 1);
+	while (size < 32 << 10)
+	{
+		a = fz_pool_grow(ctx, pool, a, size, size * 2);
+		size *= 2;
+		fill(a, size, 1);
+	}
+
+	b = fz_pool_alloc(ctx, pool, 1000);
+	fill(b, 1000, 2);
+
+	a = fz_pool_grow(ctx, pool, a, size, size * 2);
+	check("grown head allocation", a, size, 1);
+	check("allocation after the head", b, 1000, 2);
+	fill(a, size * 2, 1);
+
+	/* The pool must still be usable after it. */
+	c = fz_pool_alloc(ctx, pool, 1000);
+	fill(c, 1000, 3);
+	b = fz_pool_grow(ctx, pool, b, 1000, 2000);
+	check("allocation after the head, grown", b, 1000, 2);
+	check("allocation after the grown head", c, 1000, 3);
+	check("grown head allocation after more allocations", a, size * 2, 1);
+
+	fz_drop_pool(ctx, pool);
+}
+
+/* Grow a large allocation, which is reallocated, while small ones
+ * follow it in the shared blocks. */
+static void
+test_grow_large(fz_context *ctx)
+{
+	fz_pool *pool = fz_new_pool(ctx);
+	unsigned char *big, *small[64];
+	size_t size = 20 << 10;
+	int i;
+
+	big = fz_pool_alloc(ctx, pool, size);
+	fill(big, size, 4);
+	for (i = 0; i < 64; i++)
+	{
+		small[i] = fz_pool_alloc(ctx, pool, 3000);
+		fill(small[i], 3000, i);
+		big = fz_pool_grow(ctx, pool, big, size, size + 4096);
+		check("growing large allocation", big, size, 4);
+		size += 4096;
+		fill(big, size, 4);
+	}
+	for (i = 0; i < 64; i++)
+		check("small allocation after large growth", small[i], 3000, i);
+
+	fz_drop_pool(ctx, pool);
+}
+
+/* Allocations of increasing size, some bigger than the small blocks a
+ * pool starts with, but not big enough for blocks of their own. */
+static void
+test_small_blocks(fz_context *ctx)
+{
+	fz_pool *pool = fz_new_pool(ctx);
+	unsigned char *p[40];
+	size_t size[40];
+	int i;
+
+	for (i = 0; i < 40; i++)
+	{
+		size[i] = 16 + (i * 577) % 12000;
+		p[i] = fz_pool_alloc(ctx, pool, size[i]);
+		fill(p[i], size[i], i);
+	}
+	for (i = 0; i < 40; i++)
+		check("allocation in small blocks", p[i], size[i], i);
+
+	fz_drop_pool(ctx, pool);
+}
+
+/* Space reused after an allocation is grown in place, shrunk, or moved
+ * out of the tail block must be zeroed again. */
+static void
+test_zeroed(fz_context *ctx)
+{
+	fz_pool *pool = fz_new_pool(ctx);
+	unsigned char *a, *b;
+
+	a = fz_pool_alloc(ctx, pool, 200);
+	check_zero("new allocation", a, 200);
+	fill(a, 200, 5);
+	a = fz_pool_grow(ctx, pool, a, 200, 400);
+	check("allocation grown in place", a, 200, 5);
+	check_zero("space added in place", a + 200, 200);
+	fill(a, 400, 5);
+
+	a = fz_pool_grow(ctx, pool, a, 400, 100);
+	b = fz_pool_alloc(ctx, pool, 300);
+	check_zero("space left by shrinking", b, 300);
+	fill(b, 300, 6);
+
+	b = fz_pool_grow(ctx, pool, b, 300, 30 << 10);
+	check("allocation moved to a large block", b, 300, 6);
+	check_zero("space added to a large block", b + 300, (30 << 10) - 300);
+	a = fz_pool_alloc(ctx, pool, 300);
+	check_zero("space left by moving out", a, 300);
+
+	fz_drop_pool(ctx, pool);
+}
+
+int main(int argc, char **argv)
+{
+	fz_context *ctx = fz_new_context(NULL, NULL, FZ_STORE_DEFAULT);
+	if (!ctx)
+	{
+		fprintf(stderr, "cannot create mupdf context\n");
+		return EXIT_FAILURE;
+	}
+
+	fz_try(ctx)
+	{
+		test_grow_head(ctx);
+		test_grow_large(ctx);
+		test_small_blocks(ctx);
+		test_zeroed(ctx);
+	}
+	fz_catch(ctx)
+	{
+		fprintf(stderr, "FAIL: %s\n", fz_caught_message(ctx));
+		failures++;
+	}
+
+	fz_drop_context(ctx);
+
+	if (failures)
+		return EXIT_FAILURE;
+	printf("pool-test: OK\n");
+	return EXIT_SUCCESS;
+}
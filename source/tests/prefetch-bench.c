@@ -0,0 +1,275 @@
+/*
+ * prefetch-bench - Measure page turn latency in image documents, with
+ * and without look-ahead decoding.
+ *
+ * Usage: prefetch-bench [-p pages] [-b megabytes] [-t threads]
+ *	[-r resolution] [-w milliseconds] [file]
+ *
+ * Loads and renders every page in order, timing each, and pausing
+ * between pages as a reader does, first without look-ahead and then
+ * looking ahead the given number of pages in the background on a
+ * thread pool, within the given budget for the decoded images. The
+ * pages are then turned again jumping about the document, where
+ * looking ahead must cancel its work and not slow the turns down.
+ * Without a file, a CBZ of generated pages is written to
+ * prefetch-bench.cbz and used. Fails if looking ahead changes any page.
+ */
+
+#include "mupdf/fitz.h"
+#include "mupdf/helpers/mu-thread-pool.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _MSC_VER
+struct timeval;
+struct timezone;
+int gettimeofday(struct timeval *tv, struct timezone *tz);
+#else
+#include <sys/time.h>
+#endif
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+static mu_mutex mutexes[FZ_LOCK_MAX];
+
+static void bench_lock(void *user, int lock)
+{
+	mu_lock_mutex(&mutexes[lock]);
+}
+
+static void bench_unlock(void *user, int lock)
+{
+	mu_unlock_mutex(&mutexes[lock]);
+}
+
+static fz_locks_context bench_locks =
+{
+	NULL, bench_lock, bench_unlock
+};
+
+static double
+now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+static void
+pause_reading(int ms)
+{
+#ifdef _WIN32
+	Sleep(ms);
+#else
+	usleep(ms * 1000);
+#endif
+}
+
+static unsigned seed = 1;
+
+static float
+next_random(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return ((seed >> 16) & 0x7fff) / 32768.0f;
+}
+
+/* Pages of overlapping translucent shapes, which compress about as
+ * well as scanned comic pages do. */
+static void
+make_cbz(fz_context *ctx, const char *filename, int count)
+{
+	fz_document_writer *wri = fz_new_cbz_writer(ctx, filename, "resolution=200");
+	fz_rect mediabox = { 0, 0, 612, 792 };
+	fz_path *path = NULL;
+	int i, k;
+
+	fz_var(path);
+
+	fz_try(ctx)
+	{
+		for (i = 0; i < count; i++)
+		{
+			fz_device *dev = fz_begin_page(ctx, wri, &mediabox);
+			for (k = 0; k < 300; k++)
+			{
+				float x = next_random() * 612;
+				float y = next_random() * 792;
+				float color[3];
+				color[0] = next_random();
+				color[1] = next_random();
+				color[2] = next_random();
+				path = fz_new_path(ctx);
+				fz_moveto(ctx, path, x, y);
+				fz_lineto(ctx, path, x + next_random() * 200 - 100, y + next_random() * 200);
+				fz_lineto(ctx, path, x + next_random() * 200, y + next_random() * 200 - 100);
+				fz_closepath(ctx, path);
+				fz_fill_path(ctx, dev, path, 0, &fz_identity, fz_device_rgb(ctx), color, 0.7f, NULL);
+				fz_drop_path(ctx, path);
+				path = NULL;
+			}
+			fz_end_page(ctx, wri);
+		}
+		fz_close_document_writer(ctx, wri);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_path(ctx, path);
+		fz_drop_document_writer(ctx, wri);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+/* In order, or jumping 7 pages at a time (which visits every page of
+ * a document whose page count is not a multiple of 7). */
+static void
+turn_pages(fz_context *ctx, const char *filename, float resolution, int pages, size_t budget, int jump, int wait, unsigned char digest[16])
+{
+	fz_md5 md5;
+	fz_document *doc;
+	fz_page *page = NULL;
+	fz_pixmap *pix = NULL;
+	fz_matrix ctm;
+	double total = 0, worst = 0;
+	int i, k, n = 0;
+
+	fz_empty_store(ctx);
+	fz_tune_prefetch(ctx, pages, budget);
+	fz_scale(&ctm, resolution / 72, resolution / 72);
+	fz_md5_init(&md5);
+
+	doc = fz_open_document(ctx, filename);
+
+	fz_var(page);
+	fz_var(pix);
+
+	fz_try(ctx)
+	{
+		n = fz_count_pages(ctx, doc);
+		for (i = 0; i < n; i++)
+		{
+			double t = now();
+			k = jump && n % 7 ? (i * 7) % n : i;
+			page = fz_load_page(ctx, doc, k);
+			pix = fz_new_pixmap_from_page(ctx, page, &ctm, fz_device_rgb(ctx), 0);
+			t = now() - t;
+			total += t;
+			if (t > worst)
+				worst = t;
+			fz_md5_update(&md5, fz_pixmap_samples(ctx, pix),
+				(size_t)fz_pixmap_stride(ctx, pix) * fz_pixmap_height(ctx, pix));
+			fz_drop_pixmap(ctx, pix);
+			pix = NULL;
+			fz_drop_page(ctx, page);
+			page = NULL;
+			pause_reading(wait);
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_drop_pixmap(ctx, pix);
+		fz_drop_page(ctx, page);
+		fz_drop_document(ctx, doc);
+		fz_tune_prefetch(ctx, 0, 0);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	fz_md5_final(&md5, digest);
+	printf("look-ahead %d, %s: %d pages, mean %.1fms, worst %.1fms, total %.0fms\n",
+		pages, jump ? "jumping" : "in order", n, n ? total / n : 0, worst, total);
+}
+
+int main(int argc, char **argv)
+{
+	const char *filename = "prefetch-bench.cbz";
+	mu_thread_pool *pool = NULL;
+	unsigned char plain[16], ahead[16];
+	fz_context *ctx;
+	float resolution = 72;
+	int pages = 4;
+	size_t budget = 0;
+	int threads = 4;
+	int wait = 50;
+	int c, i, jump, status = EXIT_SUCCESS;
+
+	while ((c = fz_getopt(argc, argv, "p:b:t:r:w:")) != -1)
+	{
+		switch (c)
+		{
+		case 'p': pages = fz_maxi(1, atoi(fz_optarg)); break;
+		case 'b': budget = (size_t)fz_maxi(1, atoi(fz_optarg)) << 20; break;
+		case 't': threads = fz_maxi(1, atoi(fz_optarg)); break;
+		case 'r': resolution = fz_atof(fz_optarg); break;
+		case 'w': wait = fz_maxi(0, atoi(fz_optarg)); break;
+		default:
+			fprintf(stderr, "usage: prefetch-bench [-p pages] [-b megabytes] [-t threads] [-r resolution] [-w milliseconds] [file]\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	for (i = 0; i < FZ_LOCK_MAX; i++)
+	{
+		if (mu_create_mutex(&mutexes[i]))
+		{
+			fprintf(stderr, "cannot create mutexes\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	ctx = fz_new_context(NULL, &bench_locks, FZ_STORE_DEFAULT);
+	if (!ctx)
+	{
+		fprintf(stderr, "cannot create mupdf context\n");
+		return EXIT_FAILURE;
+	}
+
+	fz_var(pool);
+
+	fz_try(ctx)
+	{
+		fz_register_document_handlers(ctx);
+		if (fz_optind < argc)
+			filename = argv[fz_optind];
+		else
+			make_cbz(ctx, filename, 24);
+
+		pool = mu_new_thread_pool(ctx, threads);
+		fz_tune_parallel(ctx, mu_run_thread_pool, pool, 0);
+		fz_tune_background(ctx, mu_start_thread_pool_job, pool);
+
+		for (jump = 0; jump <= 1; jump++)
+		{
+			turn_pages(ctx, filename, resolution, 0, 0, jump, wait, plain);
+			turn_pages(ctx, filename, resolution, pages, budget, jump, wait, ahead);
+			if (memcmp(plain, ahead, 16))
+			{
+				fprintf(stderr, "FAIL: pages differ when looking ahead\n");
+				status = EXIT_FAILURE;
+			}
+		}
+	}
+	fz_catch(ctx)
+	{
+		fprintf(stderr, "error: %s\n", fz_caught_message(ctx));
+		status = EXIT_FAILURE;
+	}
+
+	if (pool)
+	{
+		fz_tune_parallel(ctx, NULL, NULL, 0);
+		fz_tune_background(ctx, NULL, NULL);
+		mu_drop_thread_pool(ctx, pool);
+	}
+	fz_drop_context(ctx);
+	for (i = 0; i < FZ_LOCK_MAX; i++)
+		mu_destroy_mutex(&mutexes[i]);
+	return status;
+}
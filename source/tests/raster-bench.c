@@ -0,0 +1,353 @@
+/*
+ * raster-bench - Compare the speed and quality of the rasterizers.
+ *
+ * Usage: raster-bench [-n repeats] [file ...]
+ *
+ * Without files, renders generated CAD-like (many thin strokes and arcs)
+ * and map-like (many overlapping filled polygons) scenes. With files,
+ * renders every page of each document instead.
+ *
+ * Quality is measured against a reference rendered without anti-aliasing
+ * at a multiple of the resolution and box filtered down, so it reflects
+ * the error in the coverage each rasterizer computes.
+ */
+
+#include "mupdf/fitz.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+static const struct {
+	const char *name;
+	int level;
+} rasterizers[] = {
+	{ "aa8", 8 },
+	{ "aa4", 4 },
+	{ "cop", 9 },
+	{ "app", 10 },
+	{ "area", 11 },
+};
+
+static int repeats = 5;
+
+static unsigned seed = 1;
+
+static float
+next_random(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return ((seed >> 16) & 0x7fff) / 32768.0f;
+}
+
+static fz_pixmap *
+render(fz_context *ctx, fz_display_list *list, const fz_matrix *ctm, int w, int h, int level)
+{
+	fz_irect bbox = { 0, 0, w, h };
+	fz_pixmap *pix;
+	fz_device *dev = NULL;
+
+	fz_set_graphics_aa_level(ctx, level);
+	pix = fz_new_pixmap_with_bbox(ctx, fz_device_gray(ctx), &bbox, NULL, 0);
+	fz_var(dev);
+	fz_try(ctx)
+	{
+		fz_clear_pixmap_with_value(ctx, pix, 255);
+		dev = fz_new_draw_device(ctx, ctm, pix);
+		fz_run_display_list(ctx, list, dev, &fz_identity, NULL, NULL);
+		fz_close_device(ctx, dev);
+	}
+	fz_always(ctx)
+		fz_drop_device(ctx, dev);
+	fz_catch(ctx)
+	{
+		fz_drop_pixmap(ctx, pix);
+		fz_rethrow(ctx);
+	}
+	return pix;
+}
+
+/* Render the list without anti-aliasing at 1 << factor times the size,
+ * and box filter it back down. */
+static fz_pixmap *
+render_reference(fz_context *ctx, fz_display_list *list, const fz_matrix *ctm, int w, int h, int factor)
+{
+	fz_matrix scale, big;
+	fz_pixmap *pix;
+
+	fz_concat(&big, ctm, fz_scale(&scale, 1 << factor, 1 << factor));
+	pix = render(ctx, list, &big, w << factor, h << factor, 0);
+	fz_subsample_pixmap(ctx, pix, factor);
+	return pix;
+}
+
+static void
+compare(fz_context *ctx, fz_pixmap *ref, fz_pixmap *pix, double *mean, int *max)
+{
+	unsigned char *a = fz_pixmap_samples(ctx, ref);
+	unsigned char *b = fz_pixmap_samples(ctx, pix);
+	int w = fz_pixmap_width(ctx, pix);
+	int h = fz_pixmap_height(ctx, pix);
+	int as = fz_pixmap_stride(ctx, ref);
+	int bs = fz_pixmap_stride(ctx, pix);
+	double sum = 0;
+	int x, y;
+
+	*max = 0;
+	for (y = 0; y < h; y++)
+	{
+		for (x = 0; x < w; x++)
+		{
+			int d = abs(a[y * as + x] - b[y * bs + x]);
+			sum += d;
+			if (d > *max)
+				*max = d;
+		}
+	}
+	*mean = sum / ((double)w * h);
+}
+
+static void
+bench(fz_context *ctx, const char *name, fz_display_list *list, const fz_matrix *ctm, int w, int h, int factor)
+{
+	fz_pixmap *ref = NULL;
+	fz_pixmap *pix = NULL;
+	int level = fz_graphics_aa_level(ctx);
+	size_t i;
+	int k;
+
+	fz_var(ref);
+	fz_var(pix);
+
+	printf("%s: %dx%d\n", name, w, h);
+	fz_try(ctx)
+	{
+		ref = render_reference(ctx, list, ctm, w, h, factor);
+		for (i = 0; i < nelem(rasterizers); i++)
+		{
+			clock_t t = clock();
+			double mean;
+			int max;
+			for (k = 0; k < repeats; k++)
+			{
+				fz_drop_pixmap(ctx, pix);
+				pix = NULL;
+				pix = render(ctx, list, ctm, w, h, rasterizers[i].level);
+			}
+			t = clock() - t;
+			compare(ctx, ref, pix, &mean, &max);
+			printf("  %-5s %8.2fms  mean error %6.2f  max error %3d\n",
+				rasterizers[i].name, t * 1000.0 / CLOCKS_PER_SEC / repeats, mean, max);
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_drop_pixmap(ctx, pix);
+		fz_drop_pixmap(ctx, ref);
+		fz_set_graphics_aa_level(ctx, level);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+/* Thin lines at all angles and stroked arcs, as in technical drawings. */
+static void
+draw_cad(fz_context *ctx, fz_device *dev, int w, int h)
+{
+	fz_stroke_state *stroke = fz_new_stroke_state(ctx);
+	fz_path *path = NULL;
+	float black[1] = { 0 };
+	int i;
+
+	fz_var(path);
+
+	fz_try(ctx)
+	{
+		for (i = 0; i < 2000; i++)
+		{
+			path = fz_new_path(ctx);
+			fz_moveto(ctx, path, next_random() * w, next_random() * h);
+			fz_lineto(ctx, path, next_random() * w, next_random() * h);
+			stroke->linewidth = 0.25f + next_random() * 1.75f;
+			fz_stroke_path(ctx, dev, path, stroke, &fz_identity, fz_device_gray(ctx), black, 1, NULL);
+			fz_drop_path(ctx, path);
+			path = NULL;
+		}
+		for (i = 0; i < 200; i++)
+		{
+			float x = next_random() * w;
+			float y = next_random() * h;
+			float r = 2 + next_random() * w / 8;
+			float k = r * 0.5523f;
+			path = fz_new_path(ctx);
+			fz_moveto(ctx, path, x + r, y);
+			fz_curveto(ctx, path, x + r, y + k, x + k, y + r, x, y + r);
+			fz_curveto(ctx, path, x - k, y + r, x - r, y + k, x - r, y);
+			fz_curveto(ctx, path, x - r, y - k, x - k, y - r, x, y - r);
+			fz_curveto(ctx, path, x + k, y - r, x + r, y - k, x + r, y);
+			fz_closepath(ctx, path);
+			stroke->linewidth = 0.5f + next_random();
+			fz_stroke_path(ctx, dev, path, stroke, &fz_identity, fz_device_gray(ctx), black, 1, NULL);
+			fz_drop_path(ctx, path);
+			path = NULL;
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_drop_path(ctx, path);
+		fz_drop_stroke_state(ctx, stroke);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+/* Overlapping irregular filled polygons in different shades, as in maps. */
+static void
+draw_map(fz_context *ctx, fz_device *dev, int w, int h)
+{
+	fz_path *path = NULL;
+	int i, k;
+
+	fz_var(path);
+
+	fz_try(ctx)
+	{
+		for (i = 0; i < 400; i++)
+		{
+			float x = next_random() * w;
+			float y = next_random() * h;
+			float r = 4 + next_random() * w / 6;
+			int n = 3 + next_random() * 40;
+			float gray[1];
+			path = fz_new_path(ctx);
+			for (k = 0; k < n; k++)
+			{
+				float a = k * 2 * FZ_PI / n;
+				float d = r * (0.5f + next_random() * 0.5f);
+				if (k == 0)
+					fz_moveto(ctx, path, x + d * cosf(a), y + d * sinf(a));
+				else
+					fz_lineto(ctx, path, x + d * cosf(a), y + d * sinf(a));
+			}
+			fz_closepath(ctx, path);
+			gray[0] = next_random();
+			fz_fill_path(ctx, dev, path, i & 1, &fz_identity, fz_device_gray(ctx), gray, 1, NULL);
+			fz_drop_path(ctx, path);
+			path = NULL;
+		}
+	}
+	fz_always(ctx)
+		fz_drop_path(ctx, path);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+static void
+bench_scene(fz_context *ctx, const char *name, void (*draw)(fz_context *, fz_device *, int, int))
+{
+	fz_rect bounds = { 0, 0, 384, 384 };
+	fz_display_list *list;
+	fz_device *dev = NULL;
+
+	list = fz_new_display_list(ctx, &bounds);
+	fz_var(dev);
+	fz_try(ctx)
+	{
+		dev = fz_new_list_device(ctx, list);
+		draw(ctx, dev, bounds.x1, bounds.y1);
+		fz_close_device(ctx, dev);
+		fz_drop_device(ctx, dev);
+		dev = NULL;
+		bench(ctx, name, list, &fz_identity, bounds.x1, bounds.y1, 4);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_device(ctx, dev);
+		fz_drop_display_list(ctx, list);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+static void
+bench_document(fz_context *ctx, const char *filename)
+{
+	fz_document *doc = fz_open_document(ctx, filename);
+	fz_display_list *list = NULL;
+	char name[1024];
+	int i, n;
+
+	fz_var(list);
+
+	fz_try(ctx)
+	{
+		n = fz_count_pages(ctx, doc);
+		for (i = 0; i < n; i++)
+		{
+			fz_rect bounds;
+			fz_matrix ctm;
+			list = fz_new_display_list_from_page_number(ctx, doc, i);
+			fz_bound_display_list(ctx, list, &bounds);
+			fz_translate(&ctm, -bounds.x0, -bounds.y0);
+			fz_snprintf(name, sizeof name, "%s page %d", filename, i + 1);
+			bench(ctx, name, list, &ctm, bounds.x1 - bounds.x0 + 0.5f, bounds.y1 - bounds.y0 + 0.5f, 3);
+			fz_drop_display_list(ctx, list);
+			list = NULL;
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_drop_display_list(ctx, list);
+		fz_drop_document(ctx, doc);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+int main(int argc, char **argv)
+{
+	fz_context *ctx;
+	int c, status = EXIT_SUCCESS;
+
+	while ((c = fz_getopt(argc, argv, "n:")) != -1)
+	{
+		switch (c)
+		{
+		case 'n': repeats = fz_maxi(1, atoi(fz_optarg)); break;
+		default:
+			fprintf(stderr, "usage: raster-bench [-n repeats] [file ...]\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	ctx = fz_new_context(NULL, NULL, FZ_STORE_DEFAULT);
+	if (!ctx)
+	{
+		fprintf(stderr, "cannot create mupdf context\n");
+		return EXIT_FAILURE;
+	}
+
+	fz_try(ctx)
+	{
+		if (fz_optind == argc)
+		{
+			bench_scene(ctx, "cad", draw_cad);
+			bench_scene(ctx, "map", draw_map);
+		}
+		else
+		{
+			fz_register_document_handlers(ctx);
+			for (c = fz_optind; c < argc; c++)
+				bench_document(ctx, argv[c]);
+		}
+	}
+	fz_catch(ctx)
+	{
+		fprintf(stderr, "error: %s\n", fz_caught_message(ctx));
+		status = EXIT_FAILURE;
+	}
+
+	fz_drop_context(ctx);
+	return status;
+}
@@ -0,0 +1,296 @@
+/*
+ * stext-analyze-test - Time fz_analyze_text on dense table pages and
+ * check its output against an analysis without the region mask limit.
+ *
+ * Usage: stext-analyze-test [fontfile]
+ */
+
+#include "mupdf/fitz.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Build a second copy of the paragraph analysis that compares every line
+ * against every region mask, as it did before the limit was introduced. */
+#define REGION_MASK_NEIGHBOURHOOD (1 << 16)
+#define fz_analyze_text exact_analyze_text
+#include "stext-paragraph.c"
+#undef fz_analyze_text
+
+static const char *words[] = { "12", "3.5", "Total", "x", "abc", "1,204", "N/A", "yes", "no", "42.00", "Q3" };
+
+static unsigned seed = 1;
+
+static unsigned
+next_random(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return (seed >> 16) & 0x7fff;
+}
+
+enum { UNIFORM, RANDOM_CELLS, RANDOM_SIZES };
+
+static const char *mode_name[] = { "uniform grid", "random cells", "random sizes" };
+
+static int failures = 0;
+
+/* A page of rows of table cells. Uniform grids share one set of columns;
+ * the random forms have a different set of columns on every row. */
+static fz_text *
+make_table(fz_context *ctx, fz_font *font, int rows, int mode)
+{
+	fz_text *text = fz_new_text(ctx);
+	int i, k;
+
+	seed = 1;
+	fz_try(ctx)
+	{
+		for (i = 0; i < rows; i++)
+		{
+			int cells = mode == UNIFORM ? 12 : 2 + next_random() % 14;
+			float size = mode == RANDOM_SIZES ? 3 + next_random() % 5 : 4;
+			float y = 20 + i * 6.0f + (mode == RANDOM_SIZES ? next_random() % 3 : 0);
+			float x = 20;
+			for (k = 0; k < cells; k++)
+			{
+				fz_matrix trm;
+				fz_scale(&trm, size, -size);
+				trm.e = x;
+				trm.f = y;
+				fz_show_string(ctx, text, font, &trm, words[(i * 7 + k * 3) % 11], 0, 0, FZ_BIDI_LTR, FZ_LANG_UNSET);
+				x += mode == UNIFORM ? 60 : 20 + next_random() % 120;
+			}
+		}
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_text(ctx, text);
+		fz_rethrow(ctx);
+	}
+	return text;
+}
+
+/* Analyse the page with the given function and return it as plain text. */
+static fz_buffer *
+analyze(fz_context *ctx, fz_text *text, int rows,
+	void (*fn)(fz_context *, fz_stext_sheet *, fz_stext_page *), double *ms)
+{
+	fz_rect mediabox = { 0, 0, 2000, 0 };
+	fz_stext_sheet *sheet = NULL;
+	fz_stext_page *page = NULL;
+	fz_device *dev = NULL;
+	fz_output *out = NULL;
+	fz_buffer *buf = NULL;
+	clock_t t;
+
+	mediabox.y1 = 40 + rows * 6.0f;
+
+	fz_var(sheet);
+	fz_var(page);
+	fz_var(dev);
+	fz_var(out);
+	fz_var(buf);
+
+	fz_try(ctx)
+	{
+		sheet = fz_new_stext_sheet(ctx);
+		page = fz_new_stext_page(ctx, &mediabox);
+		dev = fz_new_stext_device(ctx, sheet, page, NULL);
+		fz_fill_text(ctx, dev, text, &fz_identity, NULL, NULL, 1, NULL);
+		fz_close_device(ctx, dev);
+
+		t = clock();
+		fn(ctx, sheet, page);
+		*ms = (clock() - t) * 1000.0 / CLOCKS_PER_SEC;
+
+		buf = fz_new_buffer(ctx, 1024);
+		out = fz_new_output_with_buffer(ctx, buf);
+		fz_print_stext_page_as_text(ctx, out, page);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_output(ctx, out);
+		fz_drop_device(ctx, dev);
+		fz_drop_stext_page(ctx, page);
+		fz_drop_stext_sheet(ctx, sheet);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_buffer(ctx, buf);
+		fz_rethrow(ctx);
+	}
+	return buf;
+}
+
+/* Split a buffer into lines, returning them as hashes. */
+static unsigned *
+hash_lines(fz_context *ctx, fz_buffer *buf, int *n)
+{
+	unsigned char *s;
+	size_t i, len = fz_buffer_storage(ctx, buf, &s);
+	unsigned *lines;
+	unsigned h = 5381;
+	int count = 0;
+
+	for (i = 0; i < len; i++)
+		if (s[i] == '\n')
+			count++;
+	lines = fz_malloc_array(ctx, count + 1, sizeof *lines);
+
+	count = 0;
+	for (i = 0; i < len; i++)
+	{
+		if (s[i] == '\n')
+		{
+			lines[count++] = h;
+			h = 5381;
+		}
+		else
+			h = h * 33 + s[i];
+	}
+	*n = count;
+	return lines;
+}
+
+/* Count the lines of a that are not part of the longest common
+ * subsequence of a and b, i.e. the lines diff would show as changed. */
+static int
+diff_lines(fz_context *ctx, fz_buffer *a, fz_buffer *b, int *total)
+{
+	unsigned *la = NULL, *lb = NULL;
+	int *prev = NULL, *cur = NULL;
+	int na = 0, nb = 0, i, k, common = 0;
+
+	fz_var(la);
+	fz_var(lb);
+	fz_var(prev);
+	fz_var(cur);
+
+	fz_try(ctx)
+	{
+		la = hash_lines(ctx, a, &na);
+		lb = hash_lines(ctx, b, &nb);
+		prev = fz_calloc(ctx, nb + 1, sizeof *prev);
+		cur = fz_calloc(ctx, nb + 1, sizeof *cur);
+		for (i = 0; i < na; i++)
+		{
+			int *t;
+			for (k = 0; k < nb; k++)
+			{
+				if (la[i] == lb[k])
+					cur[k + 1] = prev[k] + 1;
+				else
+					cur[k + 1] = fz_maxi(prev[k + 1], cur[k]);
+			}
+			t = prev;
+			prev = cur;
+			cur = t;
+		}
+		common = prev[nb];
+	}
+	fz_always(ctx)
+	{
+		fz_free(ctx, cur);
+		fz_free(ctx, prev);
+		fz_free(ctx, lb);
+		fz_free(ctx, la);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	*total = na;
+	return fz_maxi(na, nb) - common;
+}
+
+/* Uniform grids must come out the same as without the limit; random forms
+ * may differ in up to max_percent of their lines. */
+static void
+test_table(fz_context *ctx, fz_font *font, int rows, int mode, int max_percent)
+{
+	fz_text *text = NULL;
+	fz_buffer *bounded = NULL;
+	fz_buffer *exact = NULL;
+	double bounded_ms, exact_ms;
+	int diff, total;
+
+	fz_var(text);
+	fz_var(bounded);
+	fz_var(exact);
+
+	fz_try(ctx)
+	{
+		text = make_table(ctx, font, rows, mode);
+		bounded = analyze(ctx, text, rows, fz_analyze_text, &bounded_ms);
+		exact = analyze(ctx, text, rows, exact_analyze_text, &exact_ms);
+
+		diff = diff_lines(ctx, exact, bounded, &total);
+		printf("%s, %d rows: %.1fms (unlimited %.1fms), %d of %d lines differ\n",
+			mode_name[mode], rows, bounded_ms, exact_ms, diff, total);
+		if (diff * 100 > total * max_percent)
+		{
+			fprintf(stderr, "FAIL: %s, %d rows: %d of %d lines differ\n", mode_name[mode], rows, diff, total);
+			failures++;
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_drop_buffer(ctx, exact);
+		fz_drop_buffer(ctx, bounded);
+		fz_drop_text(ctx, text);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+int main(int argc, char **argv)
+{
+	fz_context *ctx;
+	fz_font *font = NULL;
+
+	ctx = fz_new_context(NULL, NULL, FZ_STORE_DEFAULT);
+	if (!ctx)
+	{
+		fprintf(stderr, "cannot create mupdf context\n");
+		return EXIT_FAILURE;
+	}
+
+	fz_var(font);
+
+	fz_try(ctx)
+	{
+		if (argc > 1)
+			font = fz_new_font_from_file(ctx, NULL, argv[1], 0, 0);
+		else
+		{
+			int len;
+			const unsigned char *data = fz_lookup_base14_font(ctx, "Helvetica", &len);
+			font = fz_new_font_from_memory(ctx, "Helvetica", data, len, 0, 0);
+		}
+
+		test_table(ctx, font, 50, UNIFORM, 0);
+		test_table(ctx, font, 1000, UNIFORM, 0);
+		test_table(ctx, font, 50, RANDOM_CELLS, 0);
+		test_table(ctx, font, 250, RANDOM_CELLS, 5);
+		test_table(ctx, font, 1000, RANDOM_CELLS, 5);
+		test_table(ctx, font, 250, RANDOM_SIZES, 5);
+		test_table(ctx, font, 1000, RANDOM_SIZES, 5);
+		test_table(ctx, font, 4000, RANDOM_CELLS, 5);
+		test_table(ctx, font, 4000, RANDOM_SIZES, 5);
+	}
+	fz_always(ctx)
+		fz_drop_font(ctx, font);
+	fz_catch(ctx)
+	{
+		fprintf(stderr, "FAIL: %s\n", fz_caught_message(ctx));
+		failures++;
+	}
+
+	fz_drop_context(ctx);
+
+	if (failures)
+		return EXIT_FAILURE;
+	printf("stext-analyze-test: OK\n");
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,328 @@
+/*
+ * tint-transform-bench - Measure how long PostScript calculator functions
+ * like the tint transforms of spot colours and DeviceN inks take to
+ * evaluate.
+ *
+ * Usage: tint-transform-bench [-n evaluations]
+ *
+ * The functions are shaped like the ones prepress applications write:
+ * spot colours mapped to CMYK or Lab by scaling, a curve with a
+ * conditional, and inks mixed into CMYK and clipped with "dup 1 gt
+ * { pop 1 } if". Each is timed as it is loaded, which for functions of
+ * one input means sampled into a table, and again wrapped so that it is
+ * only compiled, and so that it is only interpreted: an extra unused
+ * input keeps the table away, and an index whose operand is only known
+ * at run time keeps the compiler away. Every result is checked against
+ * the same function written in C. Fails if any differs by more than a
+ * small tolerance.
+ */
+
+#include "mupdf/fitz.h"
+#include "mupdf/pdf.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#ifdef _MSC_VER
+struct timeval;
+struct timezone;
+int gettimeofday(struct timeval *tv, struct timezone *tz);
+#else
+#include <sys/time.h>
+#endif
+
+static int evaluations = 1000000;
+
+static double
+now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+static unsigned seed = 1;
+
+static float
+next_random(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return ((seed >> 16) & 0x7fff) / 32768.0f;
+}
+
+/* CMYK of the inks mixed by the DeviceN transforms. */
+static const float inks[4][4] =
+{
+	{ 0.00f, 0.90f, 0.80f, 0.05f },
+	{ 0.00f, 0.00f, 0.00f, 1.00f },
+	{ 0.85f, 0.10f, 0.00f, 0.00f },
+	{ 0.00f, 0.45f, 1.00f, 0.00f },
+};
+
+typedef struct
+{
+	const char *name;
+	int m, n;
+	const char *range;
+	char program[1024];
+	void (*eval)(int m, const float *in, float *out);
+} transform;
+
+static void
+eval_spot_cmyk(int m, const float *in, float *out)
+{
+	out[0] = 0.84f * in[0];
+	out[1] = 0;
+	out[2] = 0.51f * in[0];
+	out[3] = 0.14f * in[0];
+}
+
+static void
+eval_spot_lab(int m, const float *in, float *out)
+{
+	out[0] = 100 - 53 * in[0];
+	out[1] = 72 * in[0];
+	out[2] = 44 * in[0];
+}
+
+static void
+eval_curve(int m, const float *in, float *out)
+{
+	if (in[0] <= 0.5f)
+		out[0] = in[0] * 2 * 0.8f;
+	else
+		out[0] = (in[0] - 0.5f) * 0.4f + 0.8f;
+}
+
+static void
+eval_mix(int m, const float *in, float *out)
+{
+	int j, k;
+
+	for (k = 0; k < 4; k++)
+	{
+		out[k] = 0;
+		for (j = 0; j < m; j++)
+			out[k] += in[j] * inks[j][k];
+		if (out[k] > 1)
+			out[k] = 1;
+	}
+}
+
+/* The else branch divides the most negative integer by -1, and by zero
+ * at 1, with idiv and mod, and throws the results away. Compiled code
+ * runs it for every input, and must not be brought down by it. */
+static void
+eval_idiv(int m, const float *in, float *out)
+{
+	out[0] = in[0];
+}
+
+/* Add up each ink's share of each colorant, keeping the sum on top of
+ * the inputs and the colorants done so far, then drop the inputs. */
+static void
+make_mix(transform *t, const char *name, int m)
+{
+	char *p = t->program;
+	char *end = p + sizeof t->program;
+	int j, k;
+
+	t->name = name;
+	t->m = m;
+	t->n = 4;
+	t->range = "0 1 0 1 0 1 0 1";
+	t->eval = eval_mix;
+	for (k = 0; k < 4; k++)
+	{
+		p += fz_snprintf(p, end - p, "0 ");
+		for (j = 0; j < m; j++)
+			p += fz_snprintf(p, end - p, "%d index %g mul add ", m - j + k, inks[j][k]);
+		p += fz_snprintf(p, end - p, "dup 1 gt { pop 1 } if ");
+	}
+	p += fz_snprintf(p, end - p, "%d 4 roll", m + 4);
+	for (j = 0; j < m; j++)
+		p += fz_snprintf(p, end - p, " pop");
+}
+
+static void
+make_transform(transform *t, const char *name, int m, int n, const char *range, const char *program, void (*eval)(int, const float *, float *))
+{
+	t->name = name;
+	t->m = m;
+	t->n = n;
+	t->range = range;
+	fz_strlcpy(t->program, program, sizeof t->program);
+	t->eval = eval;
+}
+
+enum { AS_LOADED, COMPILED, INTERPRETED };
+
+static const char *modes[] = { "as loaded", "compiled", "interpreted" };
+
+static pdf_function *
+load(fz_context *ctx, pdf_document *doc, const transform *t, int mode, int *m)
+{
+	char dict[256];
+	pdf_function *func;
+	fz_buffer *buf;
+	pdf_obj *obj = NULL;
+	pdf_obj *ref = NULL;
+	int i;
+
+	*m = t->m;
+	if (mode != AS_LOADED && t->m == 1)
+		*m = 2;
+
+	buf = fz_new_buffer(ctx, 1024);
+
+	fz_var(obj);
+	fz_var(ref);
+
+	fz_try(ctx)
+	{
+		fz_append_string(ctx, buf, "{ ");
+		if (*m != t->m)
+			fz_append_string(ctx, buf, "pop ");
+		if (mode == INTERPRETED)
+			fz_append_string(ctx, buf, "dup 0 mul cvi index pop ");
+		fz_append_string(ctx, buf, t->program);
+		fz_append_string(ctx, buf, " }");
+
+		fz_strlcpy(dict, "<< /FunctionType 4 /Domain [", sizeof dict);
+		for (i = 0; i < *m; i++)
+			fz_strlcat(dict, " 0 1", sizeof dict);
+		fz_strlcat(dict, " ] /Range [ ", sizeof dict);
+		fz_strlcat(dict, t->range, sizeof dict);
+		fz_strlcat(dict, " ] >>", sizeof dict);
+
+		obj = pdf_new_obj_from_str(ctx, doc, dict);
+		ref = pdf_add_stream(ctx, doc, buf, obj, 0);
+		func = pdf_load_function(ctx, ref, *m, t->n);
+	}
+	fz_always(ctx)
+	{
+		pdf_drop_obj(ctx, ref);
+		pdf_drop_obj(ctx, obj);
+		fz_drop_buffer(ctx, buf);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return func;
+}
+
+static int
+bench(fz_context *ctx, pdf_document *doc, const transform *t, int mode)
+{
+	pdf_function *func;
+	float in[FZ_MAX_COLORS], out[FZ_MAX_COLORS], expect[FZ_MAX_COLORS];
+	float tolerance, error = 0, e, scale;
+	double load_time, eval_time;
+	int i, k, m;
+
+	load_time = now();
+	func = load(ctx, doc, t, mode, &m);
+	load_time = now() - load_time;
+
+	seed = 1;
+	in[m - 1] = 0;
+	eval_time = now();
+	for (i = 0; i < evaluations; i++)
+	{
+		for (k = 0; k < t->m; k++)
+			in[k] = next_random();
+		pdf_eval_function(ctx, func, in, m, out, t->n);
+	}
+	eval_time = now() - eval_time;
+
+	/* Check a sample of the inputs, and the ends of the domain. */
+	seed = 1;
+	for (i = 0; i < 10000; i++)
+	{
+		for (k = 0; k < t->m; k++)
+			in[k] = i < 2 ? i : next_random();
+		pdf_eval_function(ctx, func, in, m, out, t->n);
+		t->eval(t->m, in, expect);
+		for (k = 0; k < t->n; k++)
+		{
+			scale = t->n == 3 ? (k == 0 ? 100 : 255) : 1;
+			e = fabsf(out[k] - expect[k]) / scale;
+			if (e > error)
+				error = e;
+		}
+	}
+
+	pdf_drop_function(ctx, func);
+
+	printf("%-10s %-12s load %8.1fus  eval %7.1fns  max error %.6f\n",
+		t->name, modes[mode], load_time * 1000, eval_time * 1e6 / evaluations, error);
+
+	/* The table interpolates between samples 1/1020 apart. */
+	tolerance = (mode == AS_LOADED && t->m == 1) ? 0.002f : 0.0001f;
+	if (error > tolerance)
+	{
+		fprintf(stderr, "FAIL: %s %s: error %g is over %g\n", t->name, modes[mode], error, tolerance);
+		return 1;
+	}
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	transform transforms[6];
+	fz_context *ctx;
+	pdf_document *doc = NULL;
+	int c, i, mode, failed = 0;
+
+	while ((c = fz_getopt(argc, argv, "n:")) != -1)
+	{
+		switch (c)
+		{
+		case 'n': evaluations = fz_maxi(1, atoi(fz_optarg)); break;
+		default:
+			fprintf(stderr, "usage: tint-transform-bench [-n evaluations]\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	ctx = fz_new_context(NULL, NULL, FZ_STORE_DEFAULT);
+	if (!ctx)
+	{
+		fprintf(stderr, "cannot create mupdf context\n");
+		return EXIT_FAILURE;
+	}
+
+	make_transform(&transforms[0], "spot-cmyk", 1, 4, "0 1 0 1 0 1 0 1",
+		"dup 0.84 mul exch dup 0 mul exch dup 0.51 mul exch 0.14 mul", eval_spot_cmyk);
+	make_transform(&transforms[1], "spot-lab", 1, 3, "0 100 -128 127 -128 127",
+		"dup -53 mul 100 add exch dup 72 mul exch 44 mul", eval_spot_lab);
+	make_transform(&transforms[2], "curve", 1, 1, "0 1",
+		"dup 0.5 le { 2 mul 0.8 mul } { 0.5 sub 0.4 mul 0.8 add } ifelse", eval_curve);
+	make_mix(&transforms[3], "duotone", 2);
+	make_mix(&transforms[4], "quadtone", 4);
+	make_transform(&transforms[5], "idiv", 1, 1, "0 1",
+		"dup 0.5 lt { 1 mul } { dup cvi 1 sub -2147483647 1 sub exch 2 copy idiv pop mod pop } ifelse", eval_idiv);
+
+	fz_var(doc);
+
+	fz_try(ctx)
+	{
+		doc = pdf_create_document(ctx);
+		for (i = 0; i < (int)(sizeof transforms / sizeof *transforms); i++)
+			for (mode = AS_LOADED; mode <= INTERPRETED; mode++)
+				if (mode != COMPILED || transforms[i].m == 1)
+					failed |= bench(ctx, doc, &transforms[i], mode);
+	}
+	fz_always(ctx)
+		pdf_drop_document(ctx, doc);
+	fz_catch(ctx)
+	{
+		fprintf(stderr, "error: %s\n", fz_caught_message(ctx));
+		failed = 1;
+	}
+
+	fz_drop_context(ctx);
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,335 @@
+/*
+ * xml-stream-test - Check that XML read from a stream a chunk at a time
+ * parses the same as XML parsed whole, and measure how long each takes.
+ *
+ * Usage: xml-stream-test [-n documents]
+ *
+ * Writes documents of random elements, attributes, text, entities,
+ * comments, CDATA sections and newlines large enough that the chunks
+ * end in every kind of place, and parses each into a tree, with SAX
+ * callbacks from a stream, and a child of the root at a time from a
+ * stream. The three are written out in the same form and compared.
+ * Fails if any differ.
+ */
+
+#include "mupdf/fitz.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _MSC_VER
+struct timeval;
+struct timezone;
+int gettimeofday(struct timeval *tv, struct timezone *tz);
+#else
+#include <sys/time.h>
+#endif
+
+static int documents = 8;
+
+static double
+now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+static unsigned seed = 1;
+
+static float
+next_random(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return ((seed >> 16) & 0x7fff) / 32768.0f;
+}
+
+static const char *att_names[] = { "Name", "Data", "x:Key", "Fill" };
+#define NATTS (int)(sizeof att_names / sizeof *att_names)
+
+static const char *texts[] = { "plain", "a &amp; b", "&lt;tag&gt;", "&#x263A; &#65;", "  ", "\n", "line\n", "tab\tand space " };
+#define NTEXTS (int)(sizeof texts / sizeof *texts)
+
+static void
+make_element(fz_context *ctx, fz_buffer *buf, int depth)
+{
+	char name[16];
+	int i, n;
+
+	fz_snprintf(name, sizeof name, "%sE%d", next_random() < 0.2f ? "x:" : "", (int)(next_random() * 5));
+	fz_append_printf(ctx, buf, "<%s", name);
+	for (i = 0; i < NATTS; i++)
+	{
+		if (next_random() < 0.5f)
+			continue;
+		if (next_random() < 0.5f)
+			fz_append_printf(ctx, buf, " %s=\"%d &quot;'%s\"", att_names[i], (int)(next_random() * 1000), texts[(int)(next_random() * NTEXTS)]);
+		else
+			fz_append_printf(ctx, buf, "\n\t%s = '%g\"'", att_names[i], next_random() * 100);
+	}
+	if (depth > 3 || next_random() < 0.3f)
+	{
+		fz_append_string(ctx, buf, next_random() < 0.5f ? "/>" : " />");
+		return;
+	}
+	fz_append_string(ctx, buf, next_random() < 0.5f ? ">\n" : ">");
+
+	n = next_random() * 6;
+	for (i = 0; i < n; i++)
+	{
+		float r = next_random();
+		if (r < 0.5f)
+			make_element(ctx, buf, depth + 1);
+		else if (r < 0.8f)
+			fz_append_string(ctx, buf, texts[(int)(next_random() * NTEXTS)]);
+		else if (r < 0.9f)
+			fz_append_string(ctx, buf, "<![CDATA[ <not> & a tag\n]]>");
+		else if (r < 0.95f)
+			fz_append_string(ctx, buf, "<!-- a comment -- with <tags> -->");
+		else
+			fz_append_string(ctx, buf, "<?pi some stuff?>");
+	}
+	fz_append_printf(ctx, buf, "%s</%s>", next_random() < 0.5f ? "\n" : "", name);
+}
+
+static fz_buffer *
+make_document(fz_context *ctx, size_t size)
+{
+	fz_buffer *buf = fz_new_buffer(ctx, size + 1024);
+
+	fz_try(ctx)
+	{
+		fz_append_string(ctx, buf, "<?xml version=\"1.0\"?>\n<!-- prologue -->\n<Root Name=\"root\">\n");
+		while (fz_buffer_storage(ctx, buf, NULL) < size)
+		{
+			make_element(ctx, buf, 0);
+			if (next_random() < 0.3f)
+				fz_append_string(ctx, buf, texts[(int)(next_random() * NTEXTS)]);
+		}
+		fz_append_string(ctx, buf, "</Root>\n");
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_buffer(ctx, buf);
+		fz_rethrow(ctx);
+	}
+
+	return buf;
+}
+
+/* Everything is written out one item to a line: the tag and known
+ * attributes of each element, the text of each text node, and a line
+ * for the end of each element. */
+static void
+print_open(fz_context *ctx, fz_buffer *out, char *tag, char **atts, fz_xml *node)
+{
+	char *value;
+	int i, k;
+
+	fz_append_printf(ctx, out, "<%s", tag);
+	for (i = 0; i < NATTS; i++)
+	{
+		value = NULL;
+		if (node)
+			value = fz_xml_att(node, att_names[i]);
+		else
+			for (k = 0; atts[k]; k += 2)
+				if (!strcmp(atts[k], att_names[i]))
+					value = atts[k + 1];
+		if (value)
+			fz_append_printf(ctx, out, " %s=[%s]", att_names[i], value);
+	}
+	fz_append_byte(ctx, out, '\n');
+}
+
+static void
+print_tree(fz_context *ctx, fz_buffer *out, fz_xml *node)
+{
+	fz_xml *down;
+
+	if (fz_xml_text(node))
+	{
+		fz_append_printf(ctx, out, "T[%s]\n", fz_xml_text(node));
+		return;
+	}
+	print_open(ctx, out, fz_xml_tag(node), NULL, node);
+	for (down = fz_xml_down(node); down; down = fz_xml_next(down))
+		print_tree(ctx, out, down);
+	fz_append_string(ctx, out, "/\n");
+}
+
+static void
+sax_open_tag(fz_context *ctx, void *arg, char *tag, char **atts)
+{
+	print_open(ctx, arg, tag, atts, NULL);
+}
+
+static void
+sax_close_tag(fz_context *ctx, void *arg, char *tag)
+{
+	fz_append_string(ctx, arg, "/\n");
+}
+
+static void
+sax_text(fz_context *ctx, void *arg, char *text)
+{
+	fz_append_printf(ctx, arg, "T[%s]\n", text);
+}
+
+static int
+print_child(fz_context *ctx, void *arg, fz_xml *root, fz_xml *child)
+{
+	fz_try(ctx)
+	{
+		if (child)
+			print_tree(ctx, arg, child);
+		else
+			print_open(ctx, arg, fz_xml_tag(root), NULL, root);
+	}
+	fz_always(ctx)
+		fz_drop_xml(ctx, child);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+	return 0;
+}
+
+enum { TREE, SAX, CHILDREN };
+
+static const char *modes[] = { "tree", "sax", "children" };
+
+static fz_buffer *
+parse(fz_context *ctx, fz_buffer *doc, int mode, int preserve_white, double *time)
+{
+	static const fz_xml_sax sax = { sax_open_tag, sax_close_tag, sax_text };
+	fz_buffer *out = fz_new_buffer(ctx, fz_buffer_storage(ctx, doc, NULL));
+	fz_stream *stm = NULL;
+	fz_xml *root = NULL;
+	double t;
+
+	fz_var(stm);
+	fz_var(root);
+
+	fz_try(ctx)
+	{
+		t = now();
+		if (mode == TREE)
+		{
+			root = fz_parse_xml(ctx, doc, preserve_white);
+			print_tree(ctx, out, root);
+		}
+		else
+		{
+			stm = fz_open_buffer(ctx, doc);
+			if (mode == SAX)
+				fz_parse_xml_sax(ctx, stm, preserve_white, &sax, out);
+			else
+			{
+				fz_parse_xml_children(ctx, stm, preserve_white, print_child, out);
+				fz_append_string(ctx, out, "/\n");
+			}
+		}
+		*time += now() - t;
+	}
+	fz_always(ctx)
+	{
+		fz_drop_xml(ctx, root);
+		fz_drop_stream(ctx, stm);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_buffer(ctx, out);
+		fz_rethrow(ctx);
+	}
+
+	return out;
+}
+
+static int
+test(fz_context *ctx, int number, size_t size, double *times)
+{
+	fz_buffer *doc = make_document(ctx, size);
+	fz_buffer *out[3] = { NULL, NULL, NULL };
+	unsigned char *a, *b;
+	size_t na, nb;
+	int mode, preserve_white, failed = 0;
+
+	fz_var(out);
+
+	fz_try(ctx)
+	{
+		for (preserve_white = 0; preserve_white <= 1; preserve_white++)
+		{
+			for (mode = TREE; mode <= CHILDREN; mode++)
+				out[mode] = parse(ctx, doc, mode, preserve_white, &times[mode]);
+			na = fz_buffer_storage(ctx, out[TREE], &a);
+			for (mode = SAX; mode <= CHILDREN; mode++)
+			{
+				nb = fz_buffer_storage(ctx, out[mode], &b);
+				if (na != nb || memcmp(a, b, na))
+				{
+					fprintf(stderr, "FAIL: document %d (%d bytes): %s parse differs from tree\n",
+						number, (int)fz_buffer_storage(ctx, doc, NULL), modes[mode]);
+					failed = 1;
+				}
+			}
+			for (mode = TREE; mode <= CHILDREN; mode++)
+			{
+				fz_drop_buffer(ctx, out[mode]);
+				out[mode] = NULL;
+			}
+		}
+	}
+	fz_always(ctx)
+	{
+		for (mode = TREE; mode <= CHILDREN; mode++)
+			fz_drop_buffer(ctx, out[mode]);
+		fz_drop_buffer(ctx, doc);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return failed;
+}
+
+int main(int argc, char **argv)
+{
+	fz_context *ctx;
+	double times[3] = { 0, 0, 0 };
+	int c, i, failed = 0;
+
+	while ((c = fz_getopt(argc, argv, "n:")) != -1)
+	{
+		switch (c)
+		{
+		case 'n': documents = fz_maxi(1, atoi(fz_optarg)); break;
+		default:
+			fprintf(stderr, "usage: xml-stream-test [-n documents]\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	ctx = fz_new_context(NULL, NULL, FZ_STORE_DEFAULT);
+	if (!ctx)
+	{
+		fprintf(stderr, "cannot create mupdf context\n");
+		return EXIT_FAILURE;
+	}
+
+	fz_try(ctx)
+	{
+		/* Small documents fit in one chunk, large ones span many. */
+		for (i = 0; i < documents; i++)
+			failed |= test(ctx, i, i == 0 ? 100 : (size_t)(next_random() * (1 << 20)) + (64 << 10), times);
+		printf("%d documents: tree %.1fms, sax %.1fms, children %.1fms\n",
+			documents, times[TREE], times[SAX], times[CHILDREN]);
+	}
+	fz_catch(ctx)
+	{
+		fprintf(stderr, "error: %s\n", fz_caught_message(ctx));
+		failed = 1;
+	}
+
+	fz_drop_context(ctx);
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -10,6 +10,7 @@
 
 #ifndef DISABLE_MUTHREADS
 #include "mupdf/helpers/mu-threads.h"
+#include "mupdf/helpers/mu-thread-pool.h"
 #endif
 
 #include <string.h>
@@ -195,6 +196,13 @@ typedef struct worker_t {
 	fz_pixmap *pix;
 	fz_bitmap *bit;
 	fz_cookie cookie;
+	fz_document *doc; /* own handle of the document, for text pages */
+	int pagenum; /* 0, or text page to extract */
+	fz_buffer *buf;
+	int time;
+	int iscolor;
+	int failed;
+	char error[256];
 #ifndef DISABLE_MUTHREADS
 	mu_semaphore start;
 	mu_semaphore stop;
@@ -257,6 +265,11 @@ static char *filename;
 static int files = 0;
 static int num_workers = 0;
 static worker_t *workers;
+static int text_workers = 0;
+static int text_next = 0;
+#ifndef DISABLE_MUTHREADS
+static mu_thread_pool *pool;
+#endif
 
 #ifdef NO_ICC
 static fz_cmm_engine *icc_engine = NULL;
@@ -283,6 +296,38 @@ static struct {
 	fz_separations *seps;
 } bgprint;
 
+#ifndef DISABLE_MUTHREADS
+/* The most bands that may be queued for the encoder at once. */
+#define MAX_ENCODER_DEPTH 16
+
+/* The encoder thread writes the bands of a page out in order, while the
+ * workers render the next ones. Up to depth rendered bands may wait for
+ * it; the main thread blocks until the oldest is written before queueing
+ * another. The queue is protected by the lock. The semaphores only wake
+ * the threads up to look at it again, so triggering them more often than
+ * they are waited for is harmless. */
+static struct {
+	int active;
+	int quit;
+	int failed;
+	fz_context *ctx;
+	mu_thread thread;
+	mu_mutex lock;
+	mu_semaphore start;
+	mu_semaphore stop;
+	fz_band_writer *bander;
+	int depth;
+	int queued; /* bands queued for the current page */
+	int written; /* bands written for the current page */
+	int64_t write_time; /* microseconds spent writing them */
+	struct {
+		fz_pixmap *pix;
+		fz_bitmap *bit;
+		int draw_height;
+	} band[MAX_ENCODER_DEPTH];
+} encoder;
+#endif
+
 static struct {
 	int count, total;
 	int min, max;
@@ -290,6 +335,8 @@ static struct {
 	int minpage, maxpage;
 	char *minfilename;
 	char *maxfilename;
+	int bands;
+	int64_t write_time;
 } timing;
 
 static void usage(void)
@@ -318,7 +365,7 @@ static void usage(void)
 		"\t-f -\tfit width and/or height exactly; ignore original aspect ratio\n"
 		"\t-B -\tmaximum band_height (pgm, ppm, pam, png output only)\n"
 #ifndef DISABLE_MUTHREADS
-		"\t-T -\tnumber of threads to use for rendering (banded mode only)\n"
+		"\t-T -\tnumber of threads to use for rendering (or for text output, pages to extract at once)\n"
 #else
 		"\t-T -\tnumber of threads to use for rendering (disabled in this non-threading build)\n"
 #endif
@@ -369,6 +416,110 @@ static int gettime(void)
 	return (now.tv_sec - first.tv_sec) * 1000 + (now.tv_usec - first.tv_usec) / 1000;
 }
 
+/* Microseconds, for timing things too short for gettime. */
+static int64_t gettime_us(void)
+{
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return (int64_t)now.tv_sec * 1000000 + now.tv_usec;
+}
+
+static const char *format_name(int format)
+{
+	int i;
+	for (i = 0; i < nelem(suffix_table); i++)
+		if (suffix_table[i].format == format)
+			return suffix_table[i].suffix + 1;
+	return "unknown";
+}
+
+/* Write a band, returning how long it took in microseconds. */
+static int64_t write_band(fz_context *ctx, fz_band_writer *bander, fz_pixmap *pix, fz_bitmap *bit, int draw_height)
+{
+	int64_t start = gettime_us();
+	fz_write_band(ctx, bander, bit ? bit->stride : pix->stride, draw_height, bit ? bit->samples : pix->samples);
+	return gettime_us() - start;
+}
+
+#ifndef DISABLE_MUTHREADS
+static void encoder_worker(void *arg);
+
+/* The encoder thread is only started once a page is rendered in bands
+ * by worker threads to an output, the only time it can help. */
+static void start_encoder(fz_context *ctx)
+{
+	int fail = 0;
+
+	if (encoder.active)
+		return;
+	encoder.ctx = fz_clone_context(ctx);
+	fail |= encoder.ctx == NULL;
+	fail |= mu_create_mutex(&encoder.lock);
+	fail |= mu_create_semaphore(&encoder.start);
+	fail |= mu_create_semaphore(&encoder.stop);
+	fail |= mu_create_thread(&encoder.thread, encoder_worker, NULL);
+	if (fail)
+	{
+		fprintf(stderr, "encoder startup failed\n");
+		exit(1);
+	}
+	encoder.active = 1;
+}
+
+/* Queue a rendered band for the encoder, waiting for room if depth bands
+ * are queued already. On success, *pix is replaced by the pixmap of a
+ * band that has been written, for the worker to render into next, or by
+ * NULL if there is none yet. Returns non-zero if writing has failed. */
+static int queue_band(fz_pixmap **pix, fz_bitmap *bit, int draw_height)
+{
+	fz_pixmap *spare;
+	int i, failed;
+
+	mu_lock_mutex(&encoder.lock);
+	while (!encoder.failed && encoder.queued - encoder.written >= encoder.depth)
+	{
+		mu_unlock_mutex(&encoder.lock);
+		DEBUG_THREADS(("Waiting for encoder\n"));
+		mu_wait_semaphore(&encoder.stop);
+		mu_lock_mutex(&encoder.lock);
+	}
+	failed = encoder.failed;
+	if (!failed)
+	{
+		i = encoder.queued % encoder.depth;
+		spare = encoder.band[i].pix;
+		encoder.band[i].pix = *pix;
+		encoder.band[i].bit = bit;
+		encoder.band[i].draw_height = draw_height;
+		encoder.queued++;
+		*pix = spare;
+	}
+	mu_unlock_mutex(&encoder.lock);
+	if (!failed)
+		mu_trigger_semaphore(&encoder.start);
+	return failed;
+}
+
+/* Wait for the encoder to write all the bands queued for it. Returns
+ * non-zero if writing any of them failed. */
+static int wait_for_encoder(void)
+{
+	int failed;
+
+	mu_lock_mutex(&encoder.lock);
+	while (encoder.written < encoder.queued)
+	{
+		mu_unlock_mutex(&encoder.lock);
+		DEBUG_THREADS(("Waiting for encoder\n"));
+		mu_wait_semaphore(&encoder.stop);
+		mu_lock_mutex(&encoder.lock);
+	}
+	failed = encoder.failed;
+	mu_unlock_mutex(&encoder.lock);
+	return failed;
+}
+#endif
+
 static int has_percent_d(char *s)
 {
 	/* find '%[0-9]*d' */
@@ -469,6 +620,55 @@ static void drawband(fz_context *ctx, fz_page *page, fz_display_list *list, cons
 	}
 }
 
+/* Extract the text of a page and write it to out in the text output format. */
+static void drawtext(fz_context *ctx, fz_output *out, fz_stext_sheet *sheet, fz_page *page, fz_display_list *list, const fz_rect *mediabox, fz_cookie *cookie)
+{
+	fz_stext_page *text = NULL;
+	fz_device *dev = NULL;
+
+	fz_var(text);
+	fz_var(dev);
+
+	fz_try(ctx)
+	{
+		fz_stext_options stext_options;
+
+		stext_options.flags = (output_format == OUT_HTML) ? FZ_STEXT_PRESERVE_IMAGES : 0;
+		text = fz_new_stext_page(ctx, mediabox);
+		dev = fz_new_stext_device(ctx, sheet, text, &stext_options);
+		if (lowmemory)
+			fz_enable_device_hints(ctx, dev, FZ_NO_CACHE);
+		if (list)
+			fz_run_display_list(ctx, list, dev, &fz_identity, &fz_infinite_rect, cookie);
+		else
+			fz_run_page(ctx, page, dev, &fz_identity, cookie);
+		fz_close_device(ctx, dev);
+		fz_drop_device(ctx, dev);
+		dev = NULL;
+		if (output_format == OUT_STEXT)
+		{
+			fz_print_stext_page_as_xml(ctx, out, text);
+		}
+		else if (output_format == OUT_HTML)
+		{
+			fz_analyze_text(ctx, sheet, text);
+			fz_print_stext_page_as_html(ctx, out, text);
+		}
+		else if (output_format == OUT_TEXT)
+		{
+			fz_print_stext_page_as_text(ctx, out, text);
+			fz_write_printf(ctx, out, "\f\n");
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_drop_device(ctx, dev);
+		fz_drop_stext_page(ctx, text);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
 static void dodrawpage(fz_context *ctx, fz_page *page, fz_display_list *list, int pagenum, fz_cookie *cookie, int start, int interptime, char *filename, int bg, fz_separations *seps)
 {
 	fz_rect mediabox;
@@ -521,45 +721,9 @@ static void dodrawpage(fz_context *ctx, fz_page *page, fz_display_list *list, in
 
 	else if (output_format == OUT_TEXT || output_format == OUT_HTML || output_format == OUT_STEXT)
 	{
-		fz_stext_page *text = NULL;
-
-		fz_var(text);
-
 		fz_try(ctx)
 		{
-			fz_stext_options stext_options;
-
-			stext_options.flags = (output_format == OUT_HTML) ? FZ_STEXT_PRESERVE_IMAGES : 0;
-			text = fz_new_stext_page(ctx, &mediabox);
-			dev = fz_new_stext_device(ctx, sheet, text, &stext_options);
-			if (lowmemory)
-				fz_enable_device_hints(ctx, dev, FZ_NO_CACHE);
-			if (list)
-				fz_run_display_list(ctx, list, dev, &fz_identity, &fz_infinite_rect, cookie);
-			else
-				fz_run_page(ctx, page, dev, &fz_identity, cookie);
-			fz_close_device(ctx, dev);
-			fz_drop_device(ctx, dev);
-			dev = NULL;
-			if (output_format == OUT_STEXT)
-			{
-				fz_print_stext_page_as_xml(ctx, out, text);
-			}
-			else if (output_format == OUT_HTML)
-			{
-				fz_analyze_text(ctx, sheet, text);
-				fz_print_stext_page_as_html(ctx, out, text);
-			}
-			else if (output_format == OUT_TEXT)
-			{
-				fz_print_stext_page_as_text(ctx, out, text);
-				fz_write_printf(ctx, out, "\f\n");
-			}
-		}
-		fz_always(ctx)
-		{
-			fz_drop_device(ctx, dev);
-			fz_drop_stext_page(ctx, text);
+			drawtext(ctx, out, sheet, page, list, &mediabox, cookie);
 		}
 		fz_catch(ctx)
 		{
@@ -669,10 +833,13 @@ static void dodrawpage(fz_context *ctx, fz_page *page, fz_display_list *list, in
 		int w, h;
 		fz_band_writer *bander = NULL;
 		fz_bitmap *bit = NULL;
+		int pipeline = 0;
+		int64_t write_time = 0;
 
 		fz_var(pix);
 		fz_var(bander);
 		fz_var(bit);
+		fz_var(pipeline);
 
 		zoom = resolution / 72;
 		fz_pre_scale(fz_rotate(&ctm, rotation), zoom, zoom);
@@ -821,6 +988,25 @@ static void dodrawpage(fz_context *ctx, fz_page *page, fz_display_list *list, in
 				}
 			}
 
+#ifndef DISABLE_MUTHREADS
+			/* When pipelining, each band is handed to the encoder as soon
+			 * as it is rendered, and the worker carries on rendering the
+			 * next into a spare pixmap. The bands waiting to be written
+			 * may take up as much memory as the bands being rendered. */
+			if (num_workers > 0 && bander)
+			{
+				start_encoder(ctx);
+				encoder.bander = bander;
+				encoder.depth = fz_mini(num_workers, MAX_ENCODER_DEPTH);
+				encoder.queued = 0;
+				encoder.written = 0;
+				encoder.write_time = 0;
+				encoder.failed = 0;
+				pipeline = 1;
+				DEBUG_THREADS(("Queueing up to %d bands for the encoder\n", encoder.depth));
+			}
+#endif
+
 			for (band = 0; band < bands; band++)
 			{
 				if (num_workers > 0)
@@ -840,8 +1026,25 @@ static void dodrawpage(fz_context *ctx, fz_page *page, fz_display_list *list, in
 
 				if (output)
 				{
+#ifndef DISABLE_MUTHREADS
+					if (pipeline)
+					{
+						worker_t *w = &workers[band % num_workers];
+
+						DEBUG_THREADS(("Queueing band %d for the encoder\n", band));
+						if (queue_band(&w->pix, bit, drawheight))
+							fz_throw(ctx, FZ_ERROR_GENERIC, "cannot write band");
+						bit = NULL;
+						if (!w->pix && band + num_workers < bands)
+						{
+							w->pix = fz_new_pixmap_with_bbox(ctx, colorspace, &band_ibounds, seps, alpha);
+							fz_set_pixmap_resolution(ctx, w->pix, resolution, resolution);
+						}
+					}
+					else
+#endif
 					if (bander)
-						fz_write_band(ctx, bander, bit ? bit->stride : pix->stride, drawheight, bit ? bit->samples : pix->samples);
+						write_time += write_band(ctx, bander, pix, bit, drawheight);
 					fz_drop_bitmap(ctx, bit);
 					bit = NULL;
 				}
@@ -861,6 +1064,20 @@ static void dodrawpage(fz_context *ctx, fz_page *page, fz_display_list *list, in
 				ctm.f -= drawheight;
 			}
 
+#ifndef DISABLE_MUTHREADS
+			if (pipeline)
+			{
+				if (wait_for_encoder())
+					fz_throw(ctx, FZ_ERROR_GENERIC, "cannot write band");
+				write_time = encoder.write_time;
+			}
+#endif
+			if (bander)
+			{
+				timing.bands += bands;
+				timing.write_time += write_time;
+			}
+
 			/* FIXME */
 			if (showmd5)
 			{
@@ -875,6 +1092,18 @@ static void dodrawpage(fz_context *ctx, fz_page *page, fz_display_list *list, in
 		}
 		fz_always(ctx)
 		{
+#ifndef DISABLE_MUTHREADS
+			if (pipeline)
+			{
+				int i;
+				wait_for_encoder();
+				for (i = 0; i < encoder.depth; i++)
+				{
+					fz_drop_pixmap(ctx, encoder.band[i].pix);
+					encoder.band[i].pix = NULL;
+				}
+			}
+#endif
 			fz_drop_band_writer(ctx, bander);
 			fz_drop_bitmap(ctx, bit);
 			bit = NULL;
@@ -976,6 +1205,245 @@ static void bgprint_flush(void)
 	bgprint.started = 0;
 }
 
+#ifndef DISABLE_MUTHREADS
+/* Text output with workers: each worker extracts whole pages from its own
+ * handle of the document into a buffer. Pages are handed to the workers
+ * in turn, and their output is collected in the same order, so that it is
+ * written in page order. */
+
+static void apply_layer_config(fz_context *ctx, fz_document *doc, const char *lc);
+
+static void textworker(worker_t *me)
+{
+	fz_context *ctx = me->ctx;
+	fz_page *page = NULL;
+	fz_display_list *list = NULL;
+	fz_device *dev = NULL;
+	fz_stext_sheet *text_sheet = NULL;
+	fz_output *text_out = NULL;
+	fz_rect mediabox;
+	int start = gettime();
+
+	fz_var(page);
+	fz_var(list);
+	fz_var(dev);
+	fz_var(text_sheet);
+	fz_var(text_out);
+
+	memset(&me->cookie, 0, sizeof(fz_cookie));
+	me->failed = 0;
+
+	fz_try(ctx)
+	{
+		page = fz_load_page(ctx, me->doc, me->pagenum - 1);
+		fz_bound_page(ctx, page, &mediabox);
+
+		/* As drawpage does, go through a display list unless -D. */
+		if (uselist)
+		{
+			list = fz_new_display_list(ctx, &mediabox);
+			dev = fz_new_list_device(ctx, list);
+			if (lowmemory)
+				fz_enable_device_hints(ctx, dev, FZ_NO_CACHE);
+			fz_run_page(ctx, page, dev, &fz_identity, &me->cookie);
+			fz_close_device(ctx, dev);
+			fz_drop_device(ctx, dev);
+			dev = NULL;
+		}
+
+		if (showfeatures)
+		{
+			dev = fz_new_test_device(ctx, &me->iscolor, 0.02f, 0, NULL);
+			if (lowmemory)
+				fz_enable_device_hints(ctx, dev, FZ_NO_CACHE);
+			if (list)
+				fz_run_display_list(ctx, list, dev, &fz_identity, &fz_infinite_rect, NULL);
+			else
+				fz_run_page(ctx, page, dev, &fz_identity, &me->cookie);
+			fz_close_device(ctx, dev);
+			fz_drop_device(ctx, dev);
+			dev = NULL;
+		}
+
+		text_sheet = fz_new_stext_sheet(ctx);
+		me->buf = fz_new_buffer(ctx, 4096);
+		text_out = fz_new_output_with_buffer(ctx, me->buf);
+		drawtext(ctx, text_out, text_sheet, page, list, &mediabox, &me->cookie);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_device(ctx, dev);
+		fz_drop_output(ctx, text_out);
+		fz_drop_stext_sheet(ctx, text_sheet);
+		fz_drop_display_list(ctx, list);
+		fz_drop_page(ctx, page);
+	}
+	fz_catch(ctx)
+	{
+		me->failed = 1;
+		fz_strlcpy(me->error, fz_caught_message(ctx), sizeof me->error);
+	}
+
+	fz_flush_warnings(ctx);
+	me->time = gettime() - start;
+}
+
+static void open_text_workers(fz_context *ctx, const char *password)
+{
+	int i;
+
+	/* Start the clock before the workers read it. */
+	(void)gettime();
+
+	text_next = 0;
+	for (i = 0; i < num_workers; i++)
+	{
+		worker_t *w = &workers[i];
+
+		fz_try(w->ctx)
+		{
+			w->doc = fz_open_document(w->ctx, filename);
+			if (fz_needs_password(w->ctx, w->doc))
+				fz_authenticate_password(w->ctx, w->doc, password);
+			fz_layout_document(w->ctx, w->doc, layout_w, layout_h, layout_em);
+			/* Only select layers; listing them has been done already. */
+			if (layer_config && *layer_config >= '0' && *layer_config <= '9')
+				apply_layer_config(w->ctx, w->doc, layer_config);
+		}
+		fz_catch(w->ctx)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "%s", fz_caught_message(w->ctx));
+	}
+}
+
+/* Wait for a worker to finish its page, and write out what it extracted. */
+static void finish_text_page(fz_context *ctx, worker_t *w)
+{
+	int first_page = !output_append;
+	int pagenum = w->pagenum;
+	unsigned char *data;
+	size_t len;
+
+	DEBUG_THREADS(("Waiting for worker %d to complete page %d\n", w->num, pagenum));
+	mu_wait_semaphore(&w->stop);
+	w->pagenum = 0;
+
+	fz_try(ctx)
+	{
+		if (w->failed)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "%s", w->error);
+
+		if (first_page)
+			file_level_headers(ctx);
+
+		if (output_file_per_page)
+		{
+			char text_buffer[512];
+
+			fz_drop_output(ctx, out);
+			fz_snprintf(text_buffer, sizeof(text_buffer), output, pagenum);
+			out = fz_new_output_with_path(ctx, text_buffer, output_append);
+			output_append = 1;
+		}
+
+		if (showfeatures)
+			fprintf(stderr, " %s", w->iscolor ? "color" : "grayscale");
+
+		fprintf(stderr, "page %s %d", filename, pagenum);
+
+		len = fz_buffer_storage(ctx, w->buf, &data);
+		fz_write_data(ctx, out, data, len);
+
+		if (!output_append)
+			file_level_trailers(ctx);
+
+		if (showtime)
+		{
+			if (w->time < timing.min)
+			{
+				timing.min = w->time;
+				timing.minpage = pagenum;
+				timing.minfilename = filename;
+			}
+			if (w->time > timing.max)
+			{
+				timing.max = w->time;
+				timing.maxpage = pagenum;
+				timing.maxfilename = filename;
+			}
+			timing.total += w->time;
+			timing.count ++;
+
+			fprintf(stderr, " %dms", w->time);
+		}
+
+		fprintf(stderr, "\n");
+
+		if (lowmemory)
+			fz_empty_store(ctx);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_buffer(ctx, w->buf);
+		w->buf = NULL;
+	}
+	fz_catch(ctx)
+	{
+		if (!ignore_errors)
+			fz_rethrow(ctx);
+		fz_warn(ctx, "ignoring error on page %d in '%s'", pagenum, filename);
+	}
+
+	if (w->cookie.errors)
+		errored = 1;
+}
+
+static void drawtextpage(fz_context *ctx, int pagenum)
+{
+	worker_t *w = &workers[text_next % num_workers];
+
+	if (w->pagenum > 0)
+		finish_text_page(ctx, w);
+
+	w->pagenum = pagenum;
+	text_next++;
+	DEBUG_THREADS(("Triggering worker %d for page %d\n", w->num, pagenum));
+	mu_trigger_semaphore(&w->start);
+}
+
+/* Write out the pages still being extracted, oldest first. */
+static void flush_text_pages(fz_context *ctx)
+{
+	int i;
+
+	for (i = 0; i < num_workers; i++)
+	{
+		worker_t *w = &workers[text_next++ % num_workers];
+		if (w->pagenum > 0)
+			finish_text_page(ctx, w);
+	}
+}
+
+/* Discard any pages still being extracted and close the documents. */
+static void close_text_workers(fz_context *ctx)
+{
+	int i;
+
+	for (i = 0; i < num_workers; i++)
+	{
+		worker_t *w = &workers[i];
+		if (w->pagenum > 0)
+		{
+			mu_wait_semaphore(&w->stop);
+			w->pagenum = 0;
+		}
+		fz_drop_buffer(ctx, w->buf);
+		w->buf = NULL;
+		fz_drop_document(w->ctx, w->doc);
+		w->doc = NULL;
+	}
+}
+#endif
+
 static void drawpage(fz_context *ctx, fz_document *doc, int pagenum)
 {
 	fz_page *page;
@@ -991,6 +1459,14 @@ static void drawpage(fz_context *ctx, fz_document *doc, int pagenum)
 	fz_var(dev);
 	fz_var(seps);
 
+#ifndef DISABLE_MUTHREADS
+	if (text_workers)
+	{
+		drawtextpage(ctx, pagenum);
+		return;
+	}
+#endif
+
 	start = (showtime ? gettime() : 0);
 
 	page = fz_load_page(ctx, doc, pagenum - 1);
@@ -1235,18 +1711,73 @@ trace_realloc(void *arg, void *p_, size_t size)
 static void worker_thread(void *arg)
 {
 	worker_t *me = (worker_t *)arg;
+	int band;
 
 	do
 	{
 		DEBUG_THREADS(("Worker %d waiting\n", me->num));
 		mu_wait_semaphore(&me->start);
-		DEBUG_THREADS(("Worker %d woken for band %d\n", me->num, me->band));
-		if (me->band >= 0)
-			drawband(me->ctx, NULL, me->list, &me->ctm, &me->tbounds, &me->cookie, me->band * band_height, me->pix, &me->bit);
-		DEBUG_THREADS(("Worker %d completed band %d\n", me->num, me->band));
+		/* Read band before signalling: once stop is triggered the main
+		 * thread may already be setting it to -1 for shutdown. */
+		band = me->band;
+		DEBUG_THREADS(("Worker %d woken for band %d\n", me->num, band));
+		if (me->pagenum > 0)
+			textworker(me);
+		else if (band >= 0)
+			drawband(me->ctx, NULL, me->list, &me->ctm, &me->tbounds, &me->cookie, band * band_height, me->pix, &me->bit);
+		DEBUG_THREADS(("Worker %d completed band %d\n", me->num, band));
 		mu_trigger_semaphore(&me->stop);
 	}
-	while (me->band >= 0);
+	while (band >= 0);
+}
+
+static void encoder_worker(void *arg)
+{
+	(void)arg;
+
+	mu_lock_mutex(&encoder.lock);
+	for (;;)
+	{
+		int i, failed;
+		int64_t elapsed = 0;
+
+		fz_var(failed);
+		fz_var(elapsed);
+
+		while (encoder.written == encoder.queued && !encoder.quit)
+		{
+			mu_unlock_mutex(&encoder.lock);
+			DEBUG_THREADS(("Encoder waiting\n"));
+			mu_wait_semaphore(&encoder.start);
+			mu_lock_mutex(&encoder.lock);
+		}
+		if (encoder.written == encoder.queued)
+			break;
+		i = encoder.written % encoder.depth;
+		failed = encoder.failed;
+		mu_unlock_mutex(&encoder.lock);
+
+		/* Once a band has failed, the rest of the page is dropped. */
+		DEBUG_THREADS(("Encoder writing band of height %d\n", encoder.band[i].draw_height));
+		if (!failed)
+		{
+			fz_try(encoder.ctx)
+				elapsed = write_band(encoder.ctx, encoder.bander, encoder.band[i].pix, encoder.band[i].bit, encoder.band[i].draw_height);
+			fz_catch(encoder.ctx)
+				failed = 1;
+		}
+		fz_drop_bitmap(encoder.ctx, encoder.band[i].bit);
+		encoder.band[i].bit = NULL;
+
+		mu_lock_mutex(&encoder.lock);
+		encoder.written++;
+		encoder.write_time += elapsed;
+		encoder.failed = failed;
+		mu_unlock_mutex(&encoder.lock);
+		mu_trigger_semaphore(&encoder.stop);
+		mu_lock_mutex(&encoder.lock);
+	}
+	mu_unlock_mutex(&encoder.lock);
 }
 
 static void bgprint_worker(void *arg)
@@ -1481,10 +2012,6 @@ int mudraw_main(int argc, char **argv)
 			exit(1);
 		}
 
-		if (band_height == 0)
-		{
-			fprintf(stderr, "Using multiple threads without banding is pointless\n");
-		}
 	}
 
 	if (bgprint.active)
@@ -1550,6 +2077,19 @@ int mudraw_main(int argc, char **argv)
 			fprintf(stderr, "worker startup failed\n");
 			exit(1);
 		}
+
+		/* Without bands, split the pixel work of each page instead. */
+		if (band_height == 0)
+		{
+			fz_try(ctx)
+				pool = mu_new_thread_pool(ctx, num_workers);
+			fz_catch(ctx)
+			{
+				fprintf(stderr, "thread pool startup failed\n");
+				exit(1);
+			}
+			fz_tune_parallel(ctx, mu_run_thread_pool, pool, 0);
+		}
 	}
 #endif /* DISABLE_MUTHREADS */
 
@@ -1671,6 +2211,12 @@ int mudraw_main(int argc, char **argv)
 	}
 	colorspace = fz_keep_colorspace(ctx, colorspace);
 
+#ifndef DISABLE_MUTHREADS
+	/* Text is extracted a page per worker rather than a band per worker. */
+	if (num_workers > 0 && (output_format == OUT_TEXT || output_format == OUT_HTML || output_format == OUT_STEXT))
+		text_workers = 1;
+#endif
+
 #if FZ_ENABLE_PDF
 	if (output_format == OUT_PDF)
 	{
@@ -1703,6 +2249,8 @@ int mudraw_main(int argc, char **argv)
 	timing.maxpage = 0;
 	timing.minfilename = "";
 	timing.maxfilename = "";
+	timing.bands = 0;
+	timing.write_time = 0;
 	if (showtime && bgprint.active)
 		timing.total = gettime();
 
@@ -1745,6 +2293,24 @@ int mudraw_main(int argc, char **argv)
 				{
 					fz_save_gproof(ctx, filename, doc, output, resolution, "", "");
 				}
+#ifndef DISABLE_MUTHREADS
+				else if (text_workers)
+				{
+					fz_try(ctx)
+					{
+						open_text_workers(ctx, password);
+						if (fz_optind == argc || !fz_is_page_range(ctx, argv[fz_optind]))
+							drawrange(ctx, doc, "1-N");
+						if (fz_optind < argc && fz_is_page_range(ctx, argv[fz_optind]))
+							drawrange(ctx, doc, argv[fz_optind++]);
+						flush_text_pages(ctx);
+					}
+					fz_always(ctx)
+						close_text_workers(ctx);
+					fz_catch(ctx)
+						fz_rethrow(ctx);
+				}
+#endif
 				else
 				{
 					if (fz_optind == argc || !fz_is_page_range(ctx, argv[fz_optind]))
@@ -1830,6 +2396,16 @@ int mudraw_main(int argc, char **argv)
 			fprintf(stderr, "fastest page %d: %dms (%s)\n", timing.minpage, timing.min, timing.minfilename);
 			fprintf(stderr, "slowest page %d: %dms (%s)\n", timing.maxpage, timing.max, timing.maxfilename);
 		}
+
+		if (timing.bands > 0)
+			fprintf(stderr, "%s band writer: %d bands, %dms writing%s, %.2f pages/s\n",
+				format_name(output_format), timing.bands, (int)(timing.write_time / 1000),
+#ifndef DISABLE_MUTHREADS
+				encoder.active ? " (pipelined)" : "",
+#else
+				"",
+#endif
+				timing.total > 0 ? timing.count * 1000.0 / timing.total : 0.0);
 	}
 
 #ifndef DISABLE_MUTHREADS
@@ -1847,6 +2423,21 @@ int mudraw_main(int argc, char **argv)
 			fz_drop_context(workers[i].ctx);
 		}
 		fz_free(ctx, workers);
+		fz_tune_parallel(ctx, NULL, NULL, 0);
+		mu_drop_thread_pool(ctx, pool);
+	}
+
+	if (encoder.active)
+	{
+		mu_lock_mutex(&encoder.lock);
+		encoder.quit = 1;
+		mu_unlock_mutex(&encoder.lock);
+		mu_trigger_semaphore(&encoder.start);
+		mu_destroy_thread(&encoder.thread);
+		mu_destroy_semaphore(&encoder.start);
+		mu_destroy_semaphore(&encoder.stop);
+		mu_destroy_mutex(&encoder.lock);
+		fz_drop_context(encoder.ctx);
 	}
 
 	if (bgprint.active)
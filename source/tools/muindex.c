@@ -0,0 +1,262 @@
+/*
+ * muindex -- build and search full text indexes of documents
+ */
+
+#include "mupdf/fitz.h"
+#include "mupdf/helpers/mu-thread-pool.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+static void usage(void)
+{
+	fprintf(stderr,
+		"Usage: mutool index [options] input\n"
+		"\t-p -\tpassword\n"
+		"\t-o -\toutput file for the index (default: out.idx)\n"
+		"\t-T -\tnumber of threads to use for text extraction\n"
+		"\n"
+		"\t-W -\tpage width for EPUB layout\n"
+		"\t-H -\tpage height for EPUB layout\n"
+		"\t-S -\tfont size for EPUB layout\n"
+		"\t-U -\tfile name of user stylesheet for EPUB layout\n"
+		"\t-X\tdisable document styles for EPUB layout\n"
+		"\n"
+		"Usage: mutool index -q query index [query...]\n"
+		"\t-q -\tprint the pages and bboxes of the hits for a word or phrase\n"
+		);
+	exit(1);
+}
+
+static float layout_w = 450;
+static float layout_h = 600;
+static float layout_em = 12;
+static char *layout_css = NULL;
+static int layout_use_doc_css = 1;
+
+#ifndef DISABLE_MUTHREADS
+
+static mu_mutex mutexes[FZ_LOCK_MAX];
+
+static void muindex_lock(void *user, int lock)
+{
+	mu_lock_mutex(&mutexes[lock]);
+}
+
+static void muindex_unlock(void *user, int lock)
+{
+	mu_unlock_mutex(&mutexes[lock]);
+}
+
+static fz_locks_context muindex_locks =
+{
+	NULL, muindex_lock, muindex_unlock
+};
+
+static void fin_muindex_locks(void)
+{
+	int i;
+
+	for (i = 0; i < FZ_LOCK_MAX; i++)
+		mu_destroy_mutex(&mutexes[i]);
+}
+
+static fz_locks_context *init_muindex_locks(void)
+{
+	int i;
+	int failed = 0;
+
+	for (i = 0; i < FZ_LOCK_MAX; i++)
+		failed |= mu_create_mutex(&mutexes[i]);
+
+	if (failed)
+	{
+		fin_muindex_locks();
+		return NULL;
+	}
+
+	return &muindex_locks;
+}
+
+#endif
+
+static fz_text_index_hit hits[5000];
+
+static void searchindex(fz_context *ctx, fz_text_index *index, const char *query)
+{
+	int i, n;
+
+	n = fz_search_text_index(ctx, index, query, hits, nelem(hits));
+	for (i = 0; i < n; i++)
+		printf("%d %d %g %g %g %g\n", hits[i].page + 1, hits[i].offset,
+			hits[i].bbox.x0, hits[i].bbox.y0, hits[i].bbox.x1, hits[i].bbox.y1);
+	if (n == nelem(hits))
+		fprintf(stderr, "warning: only the first %d hits are shown\n", n);
+}
+
+static void queryindex(fz_context *ctx, const char *filename, const char *query, char **more, int count)
+{
+	fz_stream *stm = NULL;
+	fz_text_index *index = NULL;
+	int i;
+
+	fz_var(stm);
+	fz_var(index);
+
+	fz_try(ctx)
+	{
+		stm = fz_open_file(ctx, filename);
+		index = fz_read_text_index(ctx, stm);
+		searchindex(ctx, index, query);
+		for (i = 0; i < count; i++)
+			searchindex(ctx, index, more[i]);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_text_index(ctx, index);
+		fz_drop_stream(ctx, stm);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+static void buildindex(fz_context *ctx, const char *filename, const char *password, const char *output)
+{
+	fz_document *doc = NULL;
+	fz_text_index *index = NULL;
+	fz_output *out = NULL;
+
+	fz_var(doc);
+	fz_var(index);
+	fz_var(out);
+
+	fz_try(ctx)
+	{
+		doc = fz_open_document(ctx, filename);
+		if (fz_needs_password(ctx, doc))
+			if (!fz_authenticate_password(ctx, doc, password))
+				fz_throw(ctx, FZ_ERROR_GENERIC, "cannot authenticate password: %s", filename);
+		fz_layout_document(ctx, doc, layout_w, layout_h, layout_em);
+		index = fz_new_text_index_from_document(ctx, doc, NULL);
+		out = fz_new_output_with_path(ctx, output, 0);
+		fz_write_text_index(ctx, index, out);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_output(ctx, out);
+		fz_drop_text_index(ctx, index);
+		fz_drop_document(ctx, doc);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+int muindex_main(int argc, char **argv)
+{
+	fz_context *ctx;
+	fz_locks_context *locks = NULL;
+#ifndef DISABLE_MUTHREADS
+	mu_thread_pool *pool = NULL;
+#endif
+	char *password = "";
+	char *output = "out.idx";
+	char *query = NULL;
+	int num_workers = 0;
+	int c, code = EXIT_SUCCESS;
+
+	while ((c = fz_getopt(argc, argv, "p:o:T:q:W:H:S:U:X")) != -1)
+	{
+		switch (c)
+		{
+		default: usage(); break;
+		case 'p': password = fz_optarg; break;
+		case 'o': output = fz_optarg; break;
+		case 'T': num_workers = atoi(fz_optarg); break;
+		case 'q': query = fz_optarg; break;
+
+		case 'W': layout_w = fz_atof(fz_optarg); break;
+		case 'H': layout_h = fz_atof(fz_optarg); break;
+		case 'S': layout_em = fz_atof(fz_optarg); break;
+		case 'U': layout_css = fz_optarg; break;
+		case 'X': layout_use_doc_css = 0; break;
+		}
+	}
+
+	if (fz_optind == argc)
+		usage();
+
+#ifndef DISABLE_MUTHREADS
+	locks = init_muindex_locks();
+	if (locks == NULL)
+	{
+		fprintf(stderr, "mutex initialisation failed\n");
+		return EXIT_FAILURE;
+	}
+#else
+	if (num_workers > 0)
+		fprintf(stderr, "Threads not enabled in this build\n");
+#endif
+
+	ctx = fz_new_context(NULL, locks, FZ_STORE_UNLIMITED);
+	if (!ctx)
+	{
+		fprintf(stderr, "cannot create mupdf context\n");
+		return EXIT_FAILURE;
+	}
+
+#ifndef DISABLE_MUTHREADS
+	fz_var(pool);
+#endif
+	fz_try(ctx)
+	{
+		fz_register_document_handlers(ctx);
+		if (layout_css)
+		{
+			fz_buffer *buf = fz_read_file(ctx, layout_css);
+			fz_set_user_css(ctx, fz_string_from_buffer(ctx, buf));
+			fz_drop_buffer(ctx, buf);
+		}
+		fz_set_use_document_css(ctx, layout_use_doc_css);
+#ifndef DISABLE_MUTHREADS
+		if (num_workers > 0 && !query)
+		{
+			pool = mu_new_thread_pool(ctx, num_workers);
+			fz_tune_parallel(ctx, mu_run_thread_pool, pool, 0);
+		}
+#endif
+	}
+	fz_catch(ctx)
+	{
+		fprintf(stderr, "cannot initialize mupdf: %s\n", fz_caught_message(ctx));
+		fz_drop_context(ctx);
+		return EXIT_FAILURE;
+	}
+
+	fz_try(ctx)
+	{
+		/* When searching, any arguments after the index are more queries. */
+		if (query)
+			queryindex(ctx, argv[fz_optind], query, argv + fz_optind + 1, argc - fz_optind - 1);
+		else
+			buildindex(ctx, argv[fz_optind], password, output);
+	}
+	fz_catch(ctx)
+	{
+		fprintf(stderr, "%s: %s\n", query ? "cannot search index" : "cannot build index", fz_caught_message(ctx));
+		code = EXIT_FAILURE;
+	}
+
+#ifndef DISABLE_MUTHREADS
+	if (pool)
+	{
+		fz_tune_parallel(ctx, NULL, NULL, 0);
+		mu_drop_thread_pool(ctx, pool);
+	}
+#endif
+	fz_drop_context(ctx);
+#ifndef DISABLE_MUTHREADS
+	fin_muindex_locks();
+#endif
+	return code;
+}
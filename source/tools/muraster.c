@@ -106,7 +106,14 @@
 	memory (in bytes) to use for any given band.
 
 	We will need MURASTER_CONFIG_RENDER_THREADS of these,
-	one for each render thread.
+	one for each render thread. When threading, rendered
+	bands also queue up for the encoder thread while the
+	following bands are rendered. Up to
+	min(MURASTER_CONFIG_BAND_MEMORY / band size, 16) of
+	them are queued, where band size is width * band
+	height * N, so together they take up at most another
+	MURASTER_CONFIG_BAND_MEMORY. Rendering waits for the
+	oldest to be written before it queues another.
 
 	Having this be a multiple of
 	MURASTER_CONFIG_MIN_BAND_HEIGHT * MURASTER_CONFIG_MAX_WIDTH * MURASTER_CONFIG_X_RESOLUTION * N
@@ -458,6 +465,36 @@ static struct {
 	int interptime;
 } bgprint;
 
+/* The most bands that may be queued for the encoder at once. */
+#define MAX_ENCODER_DEPTH 16
+
+/* The encoder thread writes the bands of a page out in order, while the
+ * workers render the next ones. Up to depth rendered bands may wait for
+ * it; the main thread blocks until the oldest is written before queueing
+ * another. The queue is protected by the lock. The semaphores only wake
+ * the threads up to look at it again, so triggering them more often than
+ * they are waited for is harmless. */
+static struct {
+	int active;
+	int quit;
+	int status;
+	fz_context *ctx;
+	mu_thread thread;
+	mu_mutex lock;
+	mu_semaphore start;
+	mu_semaphore stop;
+	fz_band_writer *bander;
+	int depth;
+	int queued; /* bands queued for the current page */
+	int written; /* bands written for the current page */
+	int64_t write_time; /* microseconds spent writing them */
+	struct {
+		fz_pixmap *pix;
+		fz_bitmap *bit;
+		int draw_height;
+	} band[MAX_ENCODER_DEPTH];
+} encoder;
+
 static struct {
 	int count, total;
 	int min, max;
@@ -465,6 +502,8 @@ static struct {
 	int minpage, maxpage;
 	char *minfilename;
 	char *maxfilename;
+	int bands;
+	int64_t write_time;
 } timing;
 
 #define stringify(A) #A
@@ -525,6 +564,31 @@ static int gettime(void)
 	return (now.tv_sec - first.tv_sec) * 1000 + (now.tv_usec - first.tv_usec) / 1000;
 }
 
+/* Microseconds, for timing things too short for gettime. */
+static int64_t gettime_us(void)
+{
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return (int64_t)now.tv_sec * 1000000 + now.tv_usec;
+}
+
+static const char *format_name(int format)
+{
+	int i;
+	for (i = 0; i < nelem(suffix_table); i++)
+		if (suffix_table[i].format == format)
+			return suffix_table[i].suffix + 1;
+	return "unknown";
+}
+
+/* Write a band, returning how long it took in microseconds. */
+static int64_t write_band(fz_context *ctx, fz_band_writer *bander, fz_pixmap *pix, fz_bitmap *bit, int draw_height)
+{
+	int64_t start = gettime_us();
+	fz_write_band(ctx, bander, bit ? bit->stride : pix->stride, draw_height, bit ? bit->samples : pix->samples);
+	return gettime_us() - start;
+}
+
 static int drawband(fz_context *ctx, fz_page *page, fz_display_list *list, const fz_matrix *ctm, const fz_rect *tbounds, fz_cookie *cookie, int band_start, fz_pixmap *pix, fz_bitmap **bit)
 {
 	fz_device *dev = NULL;
@@ -557,11 +621,95 @@ static int drawband(fz_context *ctx, fz_page *page, fz_display_list *list, const
 	return RENDER_OK;
 }
 
+#ifndef DISABLE_MUTHREADS
+static void encoder_worker(void *arg);
+
+/* The encoder thread is only started once a page is rendered in bands
+ * by worker threads to an output, the only time it can help. */
+static void start_encoder(fz_context *ctx)
+{
+	int fail = 0;
+
+	if (encoder.active)
+		return;
+	encoder.ctx = fz_clone_context(ctx);
+	fail |= encoder.ctx == NULL;
+	fail |= mu_create_mutex(&encoder.lock);
+	fail |= mu_create_semaphore(&encoder.start);
+	fail |= mu_create_semaphore(&encoder.stop);
+	fail |= mu_create_thread(&encoder.thread, encoder_worker, NULL);
+	if (fail)
+	{
+		fprintf(stderr, "encoder startup failed\n");
+		exit(1);
+	}
+	encoder.active = 1;
+}
+
+/* Queue a rendered band for the encoder, waiting for room if depth bands
+ * are queued already. On success, *pix is replaced by the pixmap of a
+ * band that has been written, for the worker to render into next, or by
+ * NULL if there is none yet. */
+static int queue_band(fz_pixmap **pix, fz_bitmap *bit, int draw_height)
+{
+	fz_pixmap *spare;
+	int i, status;
+
+	mu_lock_mutex(&encoder.lock);
+	while (encoder.status == RENDER_OK && encoder.queued - encoder.written >= encoder.depth)
+	{
+		mu_unlock_mutex(&encoder.lock);
+		DEBUG_THREADS(("Waiting for encoder\n"));
+		mu_wait_semaphore(&encoder.stop);
+		mu_lock_mutex(&encoder.lock);
+	}
+	status = encoder.status;
+	if (status == RENDER_OK)
+	{
+		i = encoder.queued % encoder.depth;
+		spare = encoder.band[i].pix;
+		encoder.band[i].pix = *pix;
+		encoder.band[i].bit = bit;
+		encoder.band[i].draw_height = draw_height;
+		encoder.queued++;
+		*pix = spare;
+	}
+	mu_unlock_mutex(&encoder.lock);
+	if (status == RENDER_OK)
+		mu_trigger_semaphore(&encoder.start);
+	return status;
+}
+
+/* Wait for the encoder to write all the bands queued for it. Returns
+ * non-zero if writing any of them failed. */
+static int wait_for_encoder(void)
+{
+	int status;
+
+	mu_lock_mutex(&encoder.lock);
+	while (encoder.written < encoder.queued)
+	{
+		mu_unlock_mutex(&encoder.lock);
+		DEBUG_THREADS(("Waiting for encoder\n"));
+		mu_wait_semaphore(&encoder.stop);
+		mu_lock_mutex(&encoder.lock);
+	}
+	status = encoder.status;
+	mu_unlock_mutex(&encoder.lock);
+	return status;
+}
+#endif
+
 static int dodrawpage(fz_context *ctx, int pagenum, fz_cookie *cookie, render_details *render)
 {
 	fz_pixmap *pix = NULL;
 	fz_bitmap *bit = NULL;
 	int errors_are_fatal = 0;
+	int64_t write_time = 0;
+#ifndef DISABLE_MUTHREADS
+	int pipeline = render->num_workers > 0 && out;
+	int i;
+#endif
 
 	fz_var(pix);
 	fz_var(bit);
@@ -587,6 +735,26 @@ static int dodrawpage(fz_context *ctx, int pagenum, fz_cookie *cookie, render_de
 		DEBUG_THREADS(("Using %d Bands\n", bands));
 		ctm.f += start_offset;
 
+		/* When pipelining, each band is handed to the encoder as soon as
+		 * it is rendered, and the worker carries on rendering the next
+		 * into a spare pixmap. The bands waiting to be written may take
+		 * up to max_band_memory between them. */
+#ifndef DISABLE_MUTHREADS
+		if (pipeline)
+		{
+			size_t band_memory = (size_t)(ibounds.x1 - ibounds.x0) * band_height * fz_colorspace_n(ctx, colorspace);
+			size_t depth = band_memory ? max_band_memory / band_memory : 1;
+			start_encoder(ctx);
+			encoder.bander = render->bander;
+			encoder.depth = depth < 1 ? 1 : (int)fz_minz(depth, MAX_ENCODER_DEPTH);
+			encoder.queued = 0;
+			encoder.written = 0;
+			encoder.write_time = 0;
+			encoder.status = RENDER_OK;
+			DEBUG_THREADS(("Queueing up to %d bands for the encoder\n", encoder.depth));
+		}
+#endif
+
 		if (render->num_workers > 0)
 		{
 			for (band = 0; band < fz_mini(render->num_workers, bands); band++)
@@ -650,7 +818,24 @@ static int dodrawpage(fz_context *ctx, int pagenum, fz_cookie *cookie, render_de
 			{
 				/* If we get any errors while outputting the bands, retrying won't help. */
 				errors_are_fatal = 1;
-				fz_write_band(ctx, render->bander, bit ? bit->stride : pix->stride, draw_height, bit ? bit->samples : pix->samples);
+#ifndef DISABLE_MUTHREADS
+				if (pipeline)
+				{
+					worker_t *w = &workers[band % render->num_workers];
+
+					DEBUG_THREADS(("Queueing band_start= %d for the encoder\n", band_start));
+					if (queue_band(&w->pix, bit, draw_height) != RENDER_OK)
+						fz_throw(ctx, FZ_ERROR_GENERIC, "Band write failed");
+					bit = NULL;
+					if (!w->pix && band + render->num_workers < bands)
+					{
+						w->pix = fz_new_pixmap_with_bbox(ctx, colorspace, &ibounds, NULL, 0);
+						fz_set_pixmap_resolution(ctx, w->pix, x_resolution, y_resolution);
+					}
+				}
+				else
+#endif
+					write_time += write_band(ctx, render->bander, pix, bit, draw_height);
 				errors_are_fatal = 0;
 			}
 			fz_drop_bitmap(ctx, bit);
@@ -669,11 +854,36 @@ static int dodrawpage(fz_context *ctx, int pagenum, fz_cookie *cookie, render_de
 			}
 			ctm.f -= draw_height;
 		}
+
+#ifndef DISABLE_MUTHREADS
+		if (pipeline)
+		{
+			errors_are_fatal = 1;
+			if (wait_for_encoder() != RENDER_OK)
+				fz_throw(ctx, FZ_ERROR_GENERIC, "Band write failed");
+			errors_are_fatal = 0;
+			write_time = encoder.write_time;
+		}
+#endif
+
+		timing.bands += bands;
+		timing.write_time += write_time;
 	}
 	fz_always(ctx)
 	{
 		fz_drop_bitmap(ctx, bit);
 		bit = NULL;
+#ifndef DISABLE_MUTHREADS
+		if (pipeline)
+		{
+			wait_for_encoder();
+			for (i = 0; i < encoder.depth; i++)
+			{
+				fz_drop_pixmap(ctx, encoder.band[i].pix);
+				encoder.band[i].pix = NULL;
+			}
+		}
+#endif
 		if (render->num_workers > 0)
 		{
 			int band;
@@ -1328,6 +1538,55 @@ static void worker_thread(void *arg)
 	while (me->band_start >= 0);
 }
 
+static void encoder_worker(void *arg)
+{
+	(void)arg;
+
+	mu_lock_mutex(&encoder.lock);
+	for (;;)
+	{
+		int i, status;
+		int64_t elapsed = 0;
+
+		fz_var(status);
+		fz_var(elapsed);
+
+		while (encoder.written == encoder.queued && !encoder.quit)
+		{
+			mu_unlock_mutex(&encoder.lock);
+			DEBUG_THREADS(("Encoder waiting\n"));
+			mu_wait_semaphore(&encoder.start);
+			mu_lock_mutex(&encoder.lock);
+		}
+		if (encoder.written == encoder.queued)
+			break;
+		i = encoder.written % encoder.depth;
+		status = encoder.status;
+		mu_unlock_mutex(&encoder.lock);
+
+		/* Once a band has failed, the rest of the page is dropped. */
+		DEBUG_THREADS(("Encoder writing band of height %d\n", encoder.band[i].draw_height));
+		if (status == RENDER_OK)
+		{
+			fz_try(encoder.ctx)
+				elapsed = write_band(encoder.ctx, encoder.bander, encoder.band[i].pix, encoder.band[i].bit, encoder.band[i].draw_height);
+			fz_catch(encoder.ctx)
+				status = RENDER_FATAL;
+		}
+		fz_drop_bitmap(encoder.ctx, encoder.band[i].bit);
+		encoder.band[i].bit = NULL;
+
+		mu_lock_mutex(&encoder.lock);
+		encoder.written++;
+		encoder.write_time += elapsed;
+		encoder.status = status;
+		mu_unlock_mutex(&encoder.lock);
+		mu_trigger_semaphore(&encoder.stop);
+		mu_lock_mutex(&encoder.lock);
+	}
+	mu_unlock_mutex(&encoder.lock);
+}
+
 static void bgprint_worker(void *arg)
 {
 	fz_cookie cookie = { 0 };
@@ -1625,6 +1884,8 @@ int main(int argc, char **argv)
 	timing.maxpage = 0;
 	timing.minfilename = "";
 	timing.maxfilename = "";
+	timing.bands = 0;
+	timing.write_time = 0;
 
 	fz_try(ctx)
 	{
@@ -1679,6 +1940,11 @@ int main(int argc, char **argv)
 			timing.total, timing.count, timing.total / timing.count);
 		fprintf(stderr, "fastest page %d: %dms\n", timing.minpage, timing.min);
 		fprintf(stderr, "slowest page %d: %dms\n", timing.maxpage, timing.max);
+		if (timing.bands > 0)
+			fprintf(stderr, "%s band writer: %d bands, %dms writing%s, %.2f pages/s\n",
+				format_name(output_format), timing.bands, (int)(timing.write_time / 1000),
+				encoder.active ? " (pipelined)" : "",
+				timing.total > 0 ? timing.count * 1000.0 / timing.total : 0.0);
 	}
 
 #ifndef DISABLE_MUTHREADS
@@ -1698,6 +1964,19 @@ int main(int argc, char **argv)
 		fz_free(ctx, workers);
 	}
 
+	if (encoder.active)
+	{
+		mu_lock_mutex(&encoder.lock);
+		encoder.quit = 1;
+		mu_unlock_mutex(&encoder.lock);
+		mu_trigger_semaphore(&encoder.start);
+		mu_destroy_thread(&encoder.thread);
+		mu_destroy_semaphore(&encoder.start);
+		mu_destroy_semaphore(&encoder.stop);
+		mu_destroy_mutex(&encoder.lock);
+		fz_drop_context(encoder.ctx);
+	}
+
 	if (bgprint.active)
 	{
 		bgprint.pagenum = -1;
@@ -13,6 +13,7 @@
 
 int muconvert_main(int argc, char *argv[]);
 int mudraw_main(int argc, char *argv[]);
+int muindex_main(int argc, char *argv[]);
 int mutrace_main(int argc, char *argv[]);
 int murun_main(int argc, char *argv[]);
 
@@ -40,6 +41,7 @@ static struct {
 #endif
 	{ mudraw_main, "draw", "convert document" },
 	{ mutrace_main, "trace", "trace device calls" },
+	{ muindex_main, "index", "build and search full text indexes" },
 #if FZ_ENABLE_PDF
 	{ pdfextract_main, "extract", "extract font and image resources" },
 #endif
@@ -173,76 +173,89 @@ xps_drop_page_list(fz_context *ctx, xps_document *doc)
  * Parse the fixed document sequence structure and _rels/.rels to find the start part.
  */
 
+struct xps_metadata_state
+{
+	xps_document *doc;
+	xps_fixdoc *fixdoc;
+};
+
+static char *
+xps_metadata_att(char **atts, const char *name)
+{
+	for (; atts[0]; atts += 2)
+		if (!strcmp(atts[0], name))
+			return atts[1];
+	return NULL;
+}
+
 static void
-xps_parse_metadata_imp(fz_context *ctx, xps_document *doc, fz_xml *item, xps_fixdoc *fixdoc)
+xps_parse_metadata_tag(fz_context *ctx, void *arg, char *tag, char **atts)
 {
-	while (item)
-	{
-		if (fz_xml_is_tag(item, "Relationship"))
-		{
-			char *target = fz_xml_att(item, "Target");
-			char *type = fz_xml_att(item, "Type");
-			if (target && type)
-			{
-				char tgtbuf[1024];
-				xps_resolve_url(ctx, doc, tgtbuf, doc->base_uri, target, sizeof tgtbuf);
-				if (!strcmp(type, REL_START_PART) || !strcmp(type, REL_START_PART_OXPS))
-					doc->start_part = fz_strdup(ctx, tgtbuf);
-				if ((!strcmp(type, REL_DOC_STRUCTURE) || !strcmp(type, REL_DOC_STRUCTURE_OXPS)) && fixdoc)
-					fixdoc->outline = fz_strdup(ctx, tgtbuf);
-				if (!fz_xml_att(item, "Id"))
-					fz_warn(ctx, "missing relationship id for %s", target);
-			}
-		}
+	struct xps_metadata_state *state = arg;
+	xps_document *doc = state->doc;
+	xps_fixdoc *fixdoc = state->fixdoc;
 
-		if (fz_xml_is_tag(item, "DocumentReference"))
+	if (!strcmp(tag, "Relationship"))
+	{
+		char *target = xps_metadata_att(atts, "Target");
+		char *type = xps_metadata_att(atts, "Type");
+		if (target && type)
 		{
-			char *source = fz_xml_att(item, "Source");
-			if (source)
-			{
-				char srcbuf[1024];
-				xps_resolve_url(ctx, doc, srcbuf, doc->base_uri, source, sizeof srcbuf);
-				xps_add_fixed_document(ctx, doc, srcbuf);
-			}
+			char tgtbuf[1024];
+			xps_resolve_url(ctx, doc, tgtbuf, doc->base_uri, target, sizeof tgtbuf);
+			if (!strcmp(type, REL_START_PART) || !strcmp(type, REL_START_PART_OXPS))
+				doc->start_part = fz_strdup(ctx, tgtbuf);
+			if ((!strcmp(type, REL_DOC_STRUCTURE) || !strcmp(type, REL_DOC_STRUCTURE_OXPS)) && fixdoc)
+				fixdoc->outline = fz_strdup(ctx, tgtbuf);
+			if (!xps_metadata_att(atts, "Id"))
+				fz_warn(ctx, "missing relationship id for %s", target);
 		}
+	}
 
-		if (fz_xml_is_tag(item, "PageContent"))
+	if (!strcmp(tag, "DocumentReference"))
+	{
+		char *source = xps_metadata_att(atts, "Source");
+		if (source)
 		{
-			char *source = fz_xml_att(item, "Source");
-			char *width_att = fz_xml_att(item, "Width");
-			char *height_att = fz_xml_att(item, "Height");
-			int width = width_att ? atoi(width_att) : 0;
-			int height = height_att ? atoi(height_att) : 0;
-			if (source)
-			{
-				char srcbuf[1024];
-				xps_resolve_url(ctx, doc, srcbuf, doc->base_uri, source, sizeof srcbuf);
-				xps_add_fixed_page(ctx, doc, srcbuf, width, height);
-			}
+			char srcbuf[1024];
+			xps_resolve_url(ctx, doc, srcbuf, doc->base_uri, source, sizeof srcbuf);
+			xps_add_fixed_document(ctx, doc, srcbuf);
 		}
+	}
 
-		if (fz_xml_is_tag(item, "LinkTarget"))
+	if (!strcmp(tag, "PageContent"))
+	{
+		char *source = xps_metadata_att(atts, "Source");
+		char *width_att = xps_metadata_att(atts, "Width");
+		char *height_att = xps_metadata_att(atts, "Height");
+		int width = width_att ? atoi(width_att) : 0;
+		int height = height_att ? atoi(height_att) : 0;
+		if (source)
 		{
-			char *name = fz_xml_att(item, "Name");
-			if (name)
-				xps_add_link_target(ctx, doc, name);
+			char srcbuf[1024];
+			xps_resolve_url(ctx, doc, srcbuf, doc->base_uri, source, sizeof srcbuf);
+			xps_add_fixed_page(ctx, doc, srcbuf, width, height);
 		}
+	}
 
-		xps_parse_metadata_imp(ctx, doc, fz_xml_down(item), fixdoc);
-
-		item = fz_xml_next(item);
+	if (!strcmp(tag, "LinkTarget"))
+	{
+		char *name = xps_metadata_att(atts, "Name");
+		if (name)
+			xps_add_link_target(ctx, doc, name);
 	}
 }
 
 static void
-xps_parse_metadata(fz_context *ctx, xps_document *doc, xps_part *part, xps_fixdoc *fixdoc)
+xps_parse_metadata(fz_context *ctx, xps_document *doc, char *name, fz_stream *stm, xps_fixdoc *fixdoc)
 {
-	fz_xml *root;
+	static const fz_xml_sax sax = { xps_parse_metadata_tag, NULL, NULL };
+	struct xps_metadata_state state;
 	char buf[1024];
 	char *s;
 
 	/* Save directory name part */
-	fz_strlcpy(buf, part->name, sizeof buf);
+	fz_strlcpy(buf, name, sizeof buf);
 	s = strrchr(buf, '/');
 	if (s)
 		s[0] = 0;
@@ -256,32 +269,39 @@ xps_parse_metadata(fz_context *ctx, xps_document *doc, xps_part *part, xps_fixdo
 		*s = 0;
 
 	doc->base_uri = buf;
-	doc->part_uri = part->name;
-
-	root = fz_parse_xml(ctx, part->data, 0);
-	xps_parse_metadata_imp(ctx, doc, root, fixdoc);
-	fz_drop_xml(ctx, root);
+	doc->part_uri = name;
 
-	doc->base_uri = NULL;
-	doc->part_uri = NULL;
+	/* These parts are only scanned once, so do not build a tree, or
+	 * read them whole. */
+	state.doc = doc;
+	state.fixdoc = fixdoc;
+	fz_try(ctx)
+		fz_parse_xml_sax(ctx, stm, 0, &sax, &state);
+	fz_always(ctx)
+	{
+		doc->base_uri = NULL;
+		doc->part_uri = NULL;
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
 }
 
 static void
 xps_read_and_process_metadata_part(fz_context *ctx, xps_document *doc, char *name, xps_fixdoc *fixdoc)
 {
-	xps_part *part;
+	fz_stream *stm;
 
 	if (!xps_has_part(ctx, doc, name))
 		return;
 
-	part = xps_read_part(ctx, doc, name);
+	stm = xps_open_part(ctx, doc, name);
 	fz_try(ctx)
 	{
-		xps_parse_metadata(ctx, doc, part, fixdoc);
+		xps_parse_metadata(ctx, doc, name, stm, fixdoc);
 	}
 	fz_always(ctx)
 	{
-		xps_drop_part(ctx, doc, part);
+		fz_drop_stream(ctx, stm);
 	}
 	fz_catch(ctx)
 	{
@@ -325,13 +345,64 @@ xps_count_pages(fz_context *ctx, fz_document *doc_)
 	return doc->page_count;
 }
 
+/*
+ * FixedPages are read a child of the root at a time, and each child is
+ * run as soon as it has been read, so that a page never has to be held
+ * whole in memory, either as part data or as a tree. Loading a page only
+ * reads as far as the start tag of the root, for the page size. The
+ * FixedPage.Resources child is kept until the end of the page, as the
+ * resource dictionary points into it. Pages whose root is an
+ * AlternateContent element are parsed into a tree when loaded instead,
+ * as the choice between the alternatives needs all of them.
+ */
+static void
+xps_check_fixed_page(fz_context *ctx, xps_fixpage *page, fz_xml *root)
+{
+	char *width_att;
+	char *height_att;
+
+	if (!fz_xml_is_tag(root, "FixedPage"))
+		fz_throw(ctx, FZ_ERROR_GENERIC, "expected FixedPage element");
+
+	width_att = fz_xml_att(root, "Width");
+	if (!width_att)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "FixedPage missing required attribute: Width");
+
+	height_att = fz_xml_att(root, "Height");
+	if (!height_att)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "FixedPage missing required attribute: Height");
+
+	page->width = atoi(width_att);
+	page->height = atoi(height_att);
+}
+
+struct xps_root_state
+{
+	xps_fixpage *page;
+	int found;
+	int alternate;
+};
+
+static int
+xps_load_root(fz_context *ctx, void *arg, fz_xml *root, fz_xml *child)
+{
+	struct xps_root_state *state = arg;
+
+	fz_drop_xml(ctx, child);
+	state->found = 1;
+	if (fz_xml_is_tag(root, "AlternateContent"))
+		state->alternate = 1;
+	else
+		xps_check_fixed_page(ctx, state->page, root);
+	return 1;
+}
+
 static fz_xml *
-xps_load_fixed_page(fz_context *ctx, xps_document *doc, xps_fixpage *page)
+xps_load_alternate_fixed_page(fz_context *ctx, xps_document *doc, xps_fixpage *page)
 {
 	xps_part *part;
 	fz_xml *root;
-	char *width_att;
-	char *height_att;
+	fz_xml *node;
 
 	part = xps_read_part(ctx, doc, page->name);
 	fz_try(ctx)
@@ -342,51 +413,158 @@ xps_load_fixed_page(fz_context *ctx, xps_document *doc, xps_fixpage *page)
 	{
 		xps_drop_part(ctx, doc, part);
 	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	node = xps_lookup_alternate_content(ctx, doc, root);
+	if (!node)
+	{
+		fz_drop_xml(ctx, root);
+		fz_throw(ctx, FZ_ERROR_GENERIC, "FixedPage missing alternate root element");
+	}
+	fz_detach_xml(node);
+	fz_drop_xml(ctx, root);
+
+	fz_try(ctx)
+		xps_check_fixed_page(ctx, page, node);
+	fz_catch(ctx)
+	{
+		fz_drop_xml(ctx, node);
+		fz_rethrow(ctx);
+	}
+
+	return node;
+}
+
+/* Returns the tree of the page if it has to be kept whole, or NULL if
+ * it is to be read as it is run. */
+static fz_xml *
+xps_load_fixed_page(fz_context *ctx, xps_document *doc, xps_fixpage *page)
+{
+	struct xps_root_state state;
+	fz_stream *stm;
+
+	state.page = page;
+	state.found = 0;
+	state.alternate = 0;
+
+	stm = xps_open_part(ctx, doc, page->name);
+	fz_try(ctx)
+	{
+		fz_parse_xml_children(ctx, stm, 0, xps_load_root, &state);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_stream(ctx, stm);
+	}
 	fz_catch(ctx)
 	{
 		fz_rethrow_if(ctx, FZ_ERROR_TRYLATER);
-		root = NULL;
+		if (state.found)
+			fz_rethrow(ctx);
 	}
-	if (!root)
+	if (!state.found)
 		fz_throw(ctx, FZ_ERROR_GENERIC, "FixedPage missing root element");
 
-	if (fz_xml_is_tag(root, "AlternateContent"))
+	if (state.alternate)
+		return xps_load_alternate_fixed_page(ctx, doc, page);
+	return NULL;
+}
+
+struct xps_walk_state
+{
+	xps_document *doc;
+	char *base_uri;
+	xps_resource *dict;
+	fz_xml *resources;
+	xps_fixed_page_fn *fn;
+	void *arg;
+};
+
+static void
+xps_walk_node(fz_context *ctx, struct xps_walk_state *state, fz_xml *node)
+{
+	if (fz_xml_is_tag(node, "FixedPage.Resources") && fz_xml_down(node))
 	{
-		fz_xml *node = xps_lookup_alternate_content(ctx, doc, root);
-		if (!node)
+		if (state->dict)
+			fz_warn(ctx, "ignoring follow-up resource dictionaries");
+		else
 		{
-			fz_drop_xml(ctx, root);
-			fz_throw(ctx, FZ_ERROR_GENERIC, "FixedPage missing alternate root element");
+			state->dict = xps_parse_resource_dictionary(ctx, state->doc, state->base_uri, fz_xml_down(node));
+			state->resources = node;
 		}
-		fz_detach_xml(node);
-		fz_drop_xml(ctx, root);
-		root = node;
 	}
+	state->fn(ctx, state->doc, state->base_uri, state->dict, node, state->arg);
+}
 
-	if (!fz_xml_is_tag(root, "FixedPage"))
+static int
+xps_walk_child(fz_context *ctx, void *arg, fz_xml *root, fz_xml *child)
+{
+	struct xps_walk_state *state = arg;
+	fz_cookie *cookie = state->doc->cookie;
+
+	/* The root was checked when the page was loaded. */
+	if (!child)
+		return 0;
+
+	fz_try(ctx)
+		xps_walk_node(ctx, state, child);
+	fz_always(ctx)
 	{
-		fz_drop_xml(ctx, root);
-		fz_throw(ctx, FZ_ERROR_GENERIC, "expected FixedPage element");
+		if (child != state->resources)
+			fz_drop_xml(ctx, child);
 	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
 
-	width_att = fz_xml_att(root, "Width");
-	if (!width_att)
+	return cookie && cookie->abort;
+}
+
+void
+xps_walk_fixed_page(fz_context *ctx, xps_document *doc, xps_page *page, xps_fixed_page_fn *fn, void *arg)
+{
+	struct xps_walk_state state;
+	char base_uri[1024];
+	fz_stream *stm = NULL;
+	fz_xml *node;
+	char *s;
+
+	fz_strlcpy(base_uri, page->fix->name, sizeof base_uri);
+	s = strrchr(base_uri, '/');
+	if (s)
+		s[1] = 0;
+
+	state.doc = doc;
+	state.base_uri = base_uri;
+	state.dict = NULL;
+	state.resources = NULL;
+	state.fn = fn;
+	state.arg = arg;
+
+	fz_var(stm);
+
+	fz_try(ctx)
 	{
-		fz_drop_xml(ctx, root);
-		fz_throw(ctx, FZ_ERROR_GENERIC, "FixedPage missing required attribute: Width");
+		if (page->root)
+		{
+			for (node = fz_xml_down(page->root); node; node = fz_xml_next(node))
+				xps_walk_node(ctx, &state, node);
+		}
+		else
+		{
+			stm = xps_open_part(ctx, doc, page->fix->name);
+			fz_parse_xml_children(ctx, stm, 0, xps_walk_child, &state);
+		}
 	}
-
-	height_att = fz_xml_att(root, "Height");
-	if (!height_att)
+	fz_always(ctx)
 	{
-		fz_drop_xml(ctx, root);
-		fz_throw(ctx, FZ_ERROR_GENERIC, "FixedPage missing required attribute: Height");
+		fz_drop_stream(ctx, stm);
+		xps_drop_resource_dictionary(ctx, doc, state.dict);
+		if (!page->root)
+			fz_drop_xml(ctx, state.resources);
 	}
-
-	page->width = atoi(width_att);
-	page->height = atoi(height_att);
-
-	return root;
+	fz_catch(ctx)
+		fz_rethrow(ctx);
 }
 
 static fz_rect *
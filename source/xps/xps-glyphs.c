@@ -73,20 +73,62 @@ static fz_font *
 xps_lookup_font_imp(fz_context *ctx, xps_document *doc, char *name)
 {
 	xps_font_cache *cache;
-	for (cache = doc->font_table; cache; cache = cache->next)
+	if (!doc->font_table)
+		return NULL;
+	cache = doc->font_table[xps_strcasehash(name) & (doc->font_table_size - 1)];
+	for (; cache; cache = cache->next)
 		if (!xps_strcasecmp(cache->name, name))
 			return fz_keep_font(ctx, cache->font);
 	return NULL;
 }
 
+static void
+xps_grow_font_table(fz_context *ctx, xps_document *doc)
+{
+	int new_size = doc->font_table_size ? doc->font_table_size * 2 : 64;
+	xps_font_cache **new_table = fz_calloc(ctx, new_size, sizeof *new_table);
+	xps_font_cache *cache, *next;
+	int i, h;
+
+	for (i = 0; i < doc->font_table_size; i++)
+	{
+		for (cache = doc->font_table[i]; cache; cache = next)
+		{
+			next = cache->next;
+			h = xps_strcasehash(cache->name) & (new_size - 1);
+			cache->next = new_table[h];
+			new_table[h] = cache;
+		}
+	}
+
+	fz_free(ctx, doc->font_table);
+	doc->font_table = new_table;
+	doc->font_table_size = new_size;
+}
+
 static void
 xps_insert_font(fz_context *ctx, xps_document *doc, char *name, fz_font *font)
 {
-	xps_font_cache *cache = fz_malloc_struct(ctx, xps_font_cache);
-	cache->name = fz_strdup(ctx, name);
+	xps_font_cache *cache;
+	int h;
+
+	if (doc->font_count >= doc->font_table_size)
+		xps_grow_font_table(ctx, doc);
+
+	cache = fz_malloc_struct(ctx, xps_font_cache);
+	fz_try(ctx)
+		cache->name = fz_strdup(ctx, name);
+	fz_catch(ctx)
+	{
+		fz_free(ctx, cache);
+		fz_rethrow(ctx);
+	}
 	cache->font = fz_keep_font(ctx, font);
-	cache->next = doc->font_table;
-	doc->font_table = cache;
+
+	h = xps_strcasehash(name) & (doc->font_table_size - 1);
+	cache->next = doc->font_table[h];
+	doc->font_table[h] = cache;
+	doc->font_count++;
 }
 
 /*
@@ -3,10 +3,33 @@
 
 #include <string.h>
 
+/*
+ * Images in one piece are decoded from the archive entry when they are
+ * drawn; split images are read into memory.
+ */
 static fz_image *
-xps_load_image(fz_context *ctx, xps_document *doc, xps_part *part)
+xps_load_image(fz_context *ctx, xps_document *doc, char *partname)
 {
-	return fz_new_image_from_buffer(ctx, part->data);
+	xps_part *part;
+	fz_image *image;
+	char *name;
+
+	name = partname;
+	if (name[0] == '/')
+		name ++;
+
+	if (fz_has_archive_entry(ctx, doc->zip, name))
+		return fz_new_image_from_archive_entry(ctx, doc->zip, name);
+
+	part = xps_read_part(ctx, doc, partname);
+	fz_try(ctx)
+		image = fz_new_image_from_buffer(ctx, part->data);
+	fz_always(ctx)
+		xps_drop_part(ctx, doc, part);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return image;
 }
 
 /* FIXME: area unused! */
@@ -27,7 +50,7 @@ xps_paint_image_brush(fz_context *ctx, xps_document *doc, const fz_matrix *ctm,
 }
 
 static void
-xps_find_image_brush_source_part(fz_context *ctx, xps_document *doc, char *base_uri, fz_xml *root, xps_part **image_part, xps_part **profile_part)
+xps_find_image_brush_source_part(fz_context *ctx, xps_document *doc, char *base_uri, fz_xml *root, char *image_partname, int image_partname_size, xps_part **profile_part)
 {
 	char *image_source_att;
 	char buf[1024];
@@ -71,10 +94,11 @@ xps_find_image_brush_source_part(fz_context *ctx, xps_document *doc, char *base_
 	if (!image_name)
 		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot find image source");
 
-	if (image_part)
+	if (image_partname)
 	{
-		xps_resolve_url(ctx, doc, partname, base_uri, image_name, sizeof partname);
-		*image_part = xps_read_part(ctx, doc, partname);
+		xps_resolve_url(ctx, doc, image_partname, base_uri, image_name, image_partname_size);
+		if (!xps_has_part(ctx, doc, image_partname))
+			fz_throw(ctx, FZ_ERROR_GENERIC, "cannot find image part '%s'", image_partname);
 	}
 
 	if (profile_part)
@@ -93,12 +117,12 @@ void
 xps_parse_image_brush(fz_context *ctx, xps_document *doc, const fz_matrix *ctm, const fz_rect *area,
 	char *base_uri, xps_resource *dict, fz_xml *root)
 {
-	xps_part *part;
+	char partname[1024];
 	fz_image *image;
 
 	fz_try(ctx)
 	{
-		xps_find_image_brush_source_part(ctx, doc, base_uri, root, &part, NULL);
+		xps_find_image_brush_source_part(ctx, doc, base_uri, root, partname, sizeof partname, NULL);
 	}
 	fz_catch(ctx)
 	{
@@ -109,11 +133,7 @@ xps_parse_image_brush(fz_context *ctx, xps_document *doc, const fz_matrix *ctm,
 
 	fz_try(ctx)
 	{
-		image = xps_load_image(ctx, doc, part);
-	}
-	fz_always(ctx)
-	{
-		xps_drop_part(ctx, doc, part);
+		image = xps_load_image(ctx, doc, partname);
 	}
 	fz_catch(ctx)
 	{
@@ -21,6 +21,7 @@ int xps_lookup_link_target(fz_context *ctx, fz_document *doc, const char *target
  */
 
 int xps_strcasecmp(char *a, char *b);
+unsigned int xps_strcasehash(char *s);
 void xps_resolve_url(fz_context *ctx, xps_document *doc, char *output, char *base_uri, char *path, int output_size);
 char *xps_parse_point(fz_context *ctx, xps_document *doc, char *s_in, float *x, float *y);
 
@@ -38,6 +39,7 @@ struct xps_part_s
 
 int xps_has_part(fz_context *ctx, xps_document *doc, char *partname);
 xps_part *xps_read_part(fz_context *ctx, xps_document *doc, char *partname);
+fz_stream *xps_open_part(fz_context *ctx, xps_document *doc, char *partname);
 void xps_drop_part(fz_context *ctx, xps_document *doc, xps_part *part);
 
 /*
@@ -121,27 +123,41 @@ void xps_set_color(fz_context *ctx, xps_document *doc, fz_colorspace *colorspace
  */
 
 typedef struct xps_resource_s xps_resource;
+typedef struct xps_remote_resource_s xps_remote_resource;
 
 struct xps_resource_s
 {
 	char *name;
 	char *base_uri; /* only used in the head nodes */
 	fz_xml *base_xml; /* only used in the head nodes, to free the xml document */
+	xps_resource **table; /* only used in the head nodes, open hash of the keys */
+	int table_size; /* only used in the head nodes */
+	xps_resource *remote; /* only used in the head nodes, for a cached remote dict */
 	fz_xml *data;
 	xps_resource *next;
 	xps_resource *parent; /* up to the previous dict in the stack */
 };
 
+struct xps_remote_resource_s
+{
+	char *part_name;
+	xps_resource *dict; /* owned by the cache, NULL if the part was unusable */
+	xps_remote_resource *next;
+};
+
 xps_resource * xps_parse_resource_dictionary(fz_context *ctx, xps_document *doc, char *base_uri, fz_xml *root);
 void xps_drop_resource_dictionary(fz_context *ctx, xps_document *doc, xps_resource *dict);
 void xps_resolve_resource_reference(fz_context *ctx, xps_document *doc, xps_resource *dict, char **attp, fz_xml **tagp, char **urip);
 
 void xps_print_resource_dictionary(fz_context *ctx, xps_document *doc, xps_resource *dict);
+void xps_drop_remote_resources(fz_context *ctx, xps_document *doc);
 
 /*
  * Fixed page/graphics parsing.
  */
 
+typedef void (xps_fixed_page_fn)(fz_context *ctx, xps_document *doc, char *base_uri, xps_resource *dict, fz_xml *node, void *arg);
+void xps_walk_fixed_page(fz_context *ctx, xps_document *doc, xps_page *page, xps_fixed_page_fn *fn, void *arg);
 void xps_parse_fixed_page(fz_context *ctx, xps_document *doc, const fz_matrix *ctm, xps_page *page);
 void xps_parse_canvas(fz_context *ctx, xps_document *doc, const fz_matrix *ctm, const fz_rect *area, char *base_uri, xps_resource *dict, fz_xml *node);
 void xps_parse_path(fz_context *ctx, xps_document *doc, const fz_matrix *ctm, char *base_uri, xps_resource *dict, fz_xml *node);
@@ -205,8 +221,13 @@ struct xps_document_s
 	char *base_uri; /* base uri for parsing XML and resolving relative paths */
 	char *part_uri; /* part uri for parsing metadata relations */
 
-	/* We cache font resources */
-	xps_font_cache *font_table;
+	/* We cache font resources, in a hash table of chains */
+	xps_font_cache **font_table;
+	int font_table_size;
+	int font_count;
+
+	/* We cache parsed remote resource dictionaries */
+	xps_remote_resource *remote_resources;
 
 	/* Opacity attribute stack */
 	float opacity[64];
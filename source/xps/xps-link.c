@@ -156,31 +156,27 @@ xps_load_links_in_element(fz_context *ctx, xps_document *doc, const fz_matrix *c
 	}
 }
 
-static void
-xps_load_links_in_fixed_page(fz_context *ctx, xps_document *doc, const fz_matrix *ctm, xps_page *page, fz_link **link)
+struct xps_links_state
 {
-	fz_xml *node, *resource_tag;
-	xps_resource *dict = NULL;
-	char base_uri[1024];
-	char *s;
-
-	if (!page->root)
-		return;
+	const fz_matrix *ctm;
+	fz_link **link;
+};
 
-	fz_strlcpy(base_uri, page->fix->name, sizeof base_uri);
-	s = strrchr(base_uri, '/');
-	if (s)
-		s[1] = 0;
-
-	resource_tag = fz_xml_down(fz_xml_find_down(page->root, "FixedPage.Resources"));
-	if (resource_tag)
-		dict = xps_parse_resource_dictionary(ctx, doc, base_uri, resource_tag);
+static void
+xps_load_links_in_fixed_page_element(fz_context *ctx, xps_document *doc, char *base_uri, xps_resource *dict, fz_xml *node, void *arg)
+{
+	struct xps_links_state *state = arg;
+	xps_load_links_in_element(ctx, doc, state->ctm, base_uri, dict, node, state->link);
+}
 
-	for (node = fz_xml_down(page->root); node; node = fz_xml_next(node))
-		xps_load_links_in_element(ctx, doc, ctm, base_uri, dict, node, link);
+static void
+xps_load_links_in_fixed_page(fz_context *ctx, xps_document *doc, const fz_matrix *ctm, xps_page *page, fz_link **link)
+{
+	struct xps_links_state state;
 
-	if (dict)
-		xps_drop_resource_dictionary(ctx, doc, dict);
+	state.ctm = ctm;
+	state.link = link;
+	xps_walk_fixed_page(ctx, doc, page, xps_load_links_in_fixed_page_element, &state);
 }
 
 fz_link *
@@ -7,15 +7,23 @@ static fz_xml *
 xps_lookup_resource(fz_context *ctx, xps_document *doc, xps_resource *dict, char *name, char **urip)
 {
 	xps_resource *head, *node;
+	int i, mask;
 	for (head = dict; head; head = head->parent)
 	{
-		for (node = head; node; node = node->next)
+		node = head->remote ? head->remote : head;
+		if (node->table)
 		{
-			if (!strcmp(node->name, name))
+			mask = node->table_size - 1;
+			i = xps_strcasehash(name) & mask;
+			while (node->table[i])
 			{
-				if (urip && head->base_uri)
-					*urip = head->base_uri;
-				return node->data;
+				if (!strcmp(node->table[i]->name, name))
+				{
+					if (urip && node->base_uri)
+						*urip = node->base_uri;
+					return node->table[i]->data;
+				}
+				i = (i + 1) & mask;
 			}
 		}
 	}
@@ -55,9 +63,8 @@ xps_resolve_resource_reference(fz_context *ctx, xps_document *doc, xps_resource
 }
 
 static xps_resource *
-xps_parse_remote_resource_dictionary(fz_context *ctx, xps_document *doc, char *base_uri, char *source_att)
+xps_load_remote_resource_dictionary(fz_context *ctx, xps_document *doc, char *part_name)
 {
-	char part_name[1024];
 	char part_uri[1024];
 	xps_resource *dict;
 	xps_part *part;
@@ -65,7 +72,6 @@ xps_parse_remote_resource_dictionary(fz_context *ctx, xps_document *doc, char *b
 	char *s;
 
 	/* External resource dictionaries MUST NOT reference other resource dictionaries */
-	xps_resolve_url(ctx, doc, part_name, base_uri, source_att, sizeof part_name);
 	part = xps_read_part(ctx, doc, part_name);
 	fz_try(ctx)
 	{
@@ -95,7 +101,13 @@ xps_parse_remote_resource_dictionary(fz_context *ctx, xps_document *doc, char *b
 	if (s)
 		s[1] = 0;
 
-	dict = xps_parse_resource_dictionary(ctx, doc, part_uri, xml);
+	fz_try(ctx)
+		dict = xps_parse_resource_dictionary(ctx, doc, part_uri, xml);
+	fz_catch(ctx)
+	{
+		fz_drop_xml(ctx, xml);
+		fz_rethrow(ctx);
+	}
 	if (dict)
 		dict->base_xml = xml; /* pass on ownership */
 	else
@@ -104,6 +116,83 @@ xps_parse_remote_resource_dictionary(fz_context *ctx, xps_document *doc, char *b
 	return dict;
 }
 
+/*
+ * Remote resource dictionaries are parsed once per document and kept in
+ * a cache. Callers get a head node of their own that refers to the cached
+ * dictionary, so that they can link it into their dictionary stack.
+ */
+static xps_resource *
+xps_parse_remote_resource_dictionary(fz_context *ctx, xps_document *doc, char *base_uri, char *source_att)
+{
+	char part_name[1024];
+	xps_remote_resource *remote;
+	xps_resource *dict;
+
+	fz_var(remote);
+
+	xps_resolve_url(ctx, doc, part_name, base_uri, source_att, sizeof part_name);
+
+	for (remote = doc->remote_resources; remote; remote = remote->next)
+		if (!strcmp(remote->part_name, part_name))
+			break;
+
+	if (!remote)
+	{
+		dict = xps_load_remote_resource_dictionary(ctx, doc, part_name);
+		fz_try(ctx)
+		{
+			remote = fz_malloc_struct(ctx, xps_remote_resource);
+			remote->dict = dict;
+			remote->part_name = fz_strdup(ctx, part_name);
+		}
+		fz_catch(ctx)
+		{
+			fz_free(ctx, remote);
+			xps_drop_resource_dictionary(ctx, doc, dict);
+			fz_rethrow(ctx);
+		}
+		remote->next = doc->remote_resources;
+		doc->remote_resources = remote;
+	}
+
+	if (!remote->dict)
+		return NULL;
+
+	dict = fz_malloc_struct(ctx, xps_resource);
+	dict->remote = remote->dict;
+	return dict;
+}
+
+static void
+xps_hash_resource_dictionary(fz_context *ctx, xps_resource *head)
+{
+	xps_resource *node;
+	int i, n, size, mask;
+
+	n = 0;
+	for (node = head; node; node = node->next)
+		n++;
+
+	size = 8;
+	while (size < n * 2)
+		size <<= 1;
+	mask = size - 1;
+
+	head->table = fz_calloc(ctx, size, sizeof *head->table);
+	head->table_size = size;
+
+	/* The list is in reverse document order, and the first match in it
+	 * wins, so later definitions of a key override earlier ones. */
+	for (node = head; node; node = node->next)
+	{
+		i = xps_strcasehash(node->name) & mask;
+		while (head->table[i] && strcmp(head->table[i]->name, node->name))
+			i = (i + 1) & mask;
+		if (!head->table[i])
+			head->table[i] = node;
+	}
+}
+
 xps_resource *
 xps_parse_resource_dictionary(fz_context *ctx, xps_document *doc, char *base_uri, fz_xml *root)
 {
@@ -136,7 +225,18 @@ xps_parse_resource_dictionary(fz_context *ctx, xps_document *doc, char *base_uri
 	}
 
 	if (head)
-		head->base_uri = fz_strdup(ctx, base_uri);
+	{
+		fz_try(ctx)
+		{
+			head->base_uri = fz_strdup(ctx, base_uri);
+			xps_hash_resource_dictionary(ctx, head);
+		}
+		fz_catch(ctx)
+		{
+			xps_drop_resource_dictionary(ctx, doc, head);
+			fz_rethrow(ctx);
+		}
+	}
 
 	return head;
 }
@@ -150,7 +250,22 @@ xps_drop_resource_dictionary(fz_context *ctx, xps_document *doc, xps_resource *d
 		next = dict->next;
 		fz_drop_xml(ctx, dict->base_xml);
 		fz_free(ctx, dict->base_uri);
+		fz_free(ctx, dict->table);
 		fz_free(ctx, dict);
 		dict = next;
 	}
 }
+
+void
+xps_drop_remote_resources(fz_context *ctx, xps_document *doc)
+{
+	xps_remote_resource *remote, *next;
+	for (remote = doc->remote_resources; remote; remote = next)
+	{
+		next = remote->next;
+		xps_drop_resource_dictionary(ctx, doc, remote->dict);
+		fz_free(ctx, remote->part_name);
+		fz_free(ctx, remote);
+	}
+	doc->remote_resources = NULL;
+}
@@ -328,54 +328,37 @@ xps_parse_canvas(fz_context *ctx, xps_document *doc, const fz_matrix *ctm, const
 
 }
 
-void
-xps_parse_fixed_page(fz_context *ctx, xps_document *doc, const fz_matrix *ctm, xps_page *page)
+struct xps_fixed_page_state
 {
-	fz_xml *node;
-	xps_resource *dict;
-	char base_uri[1024];
+	const fz_matrix *ctm;
 	fz_rect area;
-	char *s;
-	fz_matrix scm;
+};
 
-	fz_strlcpy(base_uri, page->fix->name, sizeof base_uri);
-	s = strrchr(base_uri, '/');
-	if (s)
-		s[1] = 0;
+static void
+xps_parse_fixed_page_element(fz_context *ctx, xps_document *doc, char *base_uri, xps_resource *dict, fz_xml *node, void *arg)
+{
+	struct xps_fixed_page_state *state = arg;
+	xps_parse_element(ctx, doc, state->ctm, &state->area, base_uri, dict, node);
+}
 
-	dict = NULL;
+void
+xps_parse_fixed_page(fz_context *ctx, xps_document *doc, const fz_matrix *ctm, xps_page *page)
+{
+	struct xps_fixed_page_state state;
+	fz_matrix scm;
 
 	doc->opacity_top = 0;
 	doc->opacity[0] = 1;
 
-	if (!page->root)
-		return;
+	state.ctm = ctm;
+	state.area = fz_unit_rect;
+	fz_transform_rect(&state.area, fz_scale(&scm, page->fix->width, page->fix->height));
 
-	area = fz_unit_rect;
-	fz_transform_rect(&area, fz_scale(&scm, page->fix->width, page->fix->height));
-
-	fz_try(ctx)
-	{
-		for (node = fz_xml_down(page->root); node; node = fz_xml_next(node))
-		{
-			if (fz_xml_is_tag(node, "FixedPage.Resources") && fz_xml_down(node))
-			{
-				if (dict)
-					fz_warn(ctx, "ignoring follow-up resource dictionaries");
-				else
-					dict = xps_parse_resource_dictionary(ctx, doc, base_uri, fz_xml_down(node));
-			}
-			xps_parse_element(ctx, doc, ctm, &area, base_uri, dict, node);
-		}
-	}
-	fz_always(ctx)
-		xps_drop_resource_dictionary(ctx, doc, dict);
-	fz_catch(ctx)
-		fz_rethrow(ctx);
+	xps_walk_fixed_page(ctx, doc, page, xps_parse_fixed_page_element, &state);
 }
 
-void
-xps_run_page(fz_context *ctx, fz_page *page_, fz_device *dev, const fz_matrix *ctm, fz_cookie *cookie)
+static void
+xps_run_page_imp(fz_context *ctx, fz_page *page_, fz_device *dev, const fz_matrix *ctm, fz_cookie *cookie)
 {
 	xps_page *page = (xps_page*)page_;
 	xps_document *doc = page->doc;
@@ -389,3 +372,12 @@ xps_run_page(fz_context *ctx, fz_page *page_, fz_device *dev, const fz_matrix *c
 	doc->cookie = NULL;
 	doc->dev = NULL;
 }
+
+void
+xps_run_page(fz_context *ctx, fz_page *page_, fz_device *dev, const fz_matrix *ctm, fz_cookie *cookie)
+{
+	xps_page *page = (xps_page*)page_;
+
+	/* Parsing the page markup is slow, so replay it from a display list. */
+	fz_run_page_contents_cached(ctx, (fz_document*)page->doc, page->fix->number, page_, xps_run_page_imp, dev, ctm, cookie);
+}
@@ -20,6 +20,16 @@ xps_strcasecmp(char *a, char *b)
 	return xps_tolower(*a) - xps_tolower(*b);
 }
 
+/* A hash that is the same for strings that match with xps_strcasecmp. */
+unsigned int
+xps_strcasehash(char *s)
+{
+	unsigned int h = 0;
+	while (*s)
+		h = h * 31 + xps_tolower(*s++);
+	return h;
+}
+
 /* A URL is defined as consisting of a:
  * SCHEME (e.g. http:)
  * AUTHORITY (username, password, hostname, port, eg //test:passwd@mupdf.com:999)
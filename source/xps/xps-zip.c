@@ -34,6 +34,75 @@ xps_drop_part(fz_context *ctx, xps_document *doc, xps_part *part)
 	fz_free(ctx, part);
 }
 
+/*
+ * Count the pieces of a split part. Returns 0 if the part does not exist.
+ */
+static int
+xps_count_pieces(fz_context *ctx, fz_archive *zip, const char *name)
+{
+	char path[2048];
+	int count;
+
+	for (count = 0; ; ++count)
+	{
+		fz_snprintf(path, sizeof path, "%s/[%d].piece", name, count);
+		if (fz_has_archive_entry(ctx, zip, path))
+			continue;
+		fz_snprintf(path, sizeof path, "%s/[%d].last.piece", name, count);
+		if (fz_has_archive_entry(ctx, zip, path))
+			return count + 1;
+		return 0;
+	}
+}
+
+/*
+ * Open a stream on a part. Split parts are read through one stream
+ * that concatenates the entry streams of all the pieces, so the pieces
+ * are never held in memory separately.
+ */
+fz_stream *
+xps_open_part(fz_context *ctx, xps_document *doc, char *partname)
+{
+	fz_archive *zip = doc->zip;
+	fz_stream *stm;
+	char path[2048];
+	int i, count;
+	char *name;
+
+	name = partname;
+	if (name[0] == '/')
+		name ++;
+
+	/* All in one piece */
+	if (fz_has_archive_entry(ctx, zip, name))
+		return fz_open_archive_entry(ctx, zip, name);
+
+	/* Assemble all the pieces */
+	count = xps_count_pieces(ctx, zip, name);
+	if (count == 0)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot find all pieces for part '%s'", partname);
+
+	stm = fz_open_concat(ctx, count, 0);
+	fz_try(ctx)
+	{
+		for (i = 0; i < count; ++i)
+		{
+			if (i < count - 1)
+				fz_snprintf(path, sizeof path, "%s/[%d].piece", name, i);
+			else
+				fz_snprintf(path, sizeof path, "%s/[%d].last.piece", name, i);
+			fz_concat_push(ctx, stm, fz_open_archive_entry(ctx, zip, path));
+		}
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_stream(ctx, stm);
+		fz_rethrow(ctx);
+	}
+
+	return stm;
+}
+
 /*
  * Read and interleave split parts from a ZIP file.
  */
@@ -41,11 +110,10 @@ xps_part *
 xps_read_part(fz_context *ctx, xps_document *doc, char *partname)
 {
 	fz_archive *zip = doc->zip;
-	fz_buffer *buf, *tmp;
-	char path[2048];
-	int count;
+	fz_stream *stm;
+	fz_buffer *buf;
 	char *name;
-	int seen_last;
+	size_t n;
 
 	name = partname;
 	if (name[0] == '/')
@@ -57,37 +125,30 @@ xps_read_part(fz_context *ctx, xps_document *doc, char *partname)
 		buf = fz_read_archive_entry(ctx, zip, name);
 	}
 
-	/* Assemble all the pieces */
+	/* Read the pieces straight into one buffer */
 	else
 	{
-		buf = fz_new_buffer(ctx, 512);
-		seen_last = 0;
-		for (count = 0; !seen_last; ++count)
+		stm = xps_open_part(ctx, doc, partname);
+		buf = NULL;
+		fz_var(buf);
+		fz_try(ctx)
 		{
-			fz_snprintf(path, sizeof path, "%s/[%d].piece", name, count);
-			if (fz_has_archive_entry(ctx, zip, path))
+			buf = fz_new_buffer(ctx, 4096);
+			while ((n = fz_available(ctx, stm, 4096)) > 0)
 			{
-				tmp = fz_read_archive_entry(ctx, zip, path);
-				fz_append_buffer(ctx, buf, tmp);
-				fz_drop_buffer(ctx, tmp);
-			}
-			else
-			{
-				fz_snprintf(path, sizeof path, "%s/[%d].last.piece", name, count);
-				if (fz_has_archive_entry(ctx, zip, path))
-				{
-					tmp = fz_read_archive_entry(ctx, zip, path);
-					fz_append_buffer(ctx, buf, tmp);
-					fz_drop_buffer(ctx, tmp);
-					seen_last = 1;
-				}
-				else
-				{
-					fz_drop_buffer(ctx, buf);
-					fz_throw(ctx, FZ_ERROR_GENERIC, "cannot find all pieces for part '%s'", partname);
-				}
+				fz_append_data(ctx, buf, stm->rp, n);
+				stm->rp += n;
 			}
 		}
+		fz_always(ctx)
+		{
+			fz_drop_stream(ctx, stm);
+		}
+		fz_catch(ctx)
+		{
+			fz_drop_buffer(ctx, buf);
+			fz_rethrow(ctx);
+		}
 	}
 
 	return xps_new_part(ctx, doc, partname, buf);
@@ -189,19 +250,28 @@ xps_drop_document(fz_context *ctx, fz_document *doc_)
 {
 	xps_document *doc = (xps_document*)doc_;
 	xps_font_cache *font, *next;
+	int i;
+
+	fz_drop_cached_page_lists(ctx, doc_);
 
 	if (doc->zip)
 		fz_drop_archive(ctx, doc->zip);
 
-	font = doc->font_table;
-	while (font)
+	for (i = 0; i < doc->font_table_size; i++)
 	{
-		next = font->next;
-		fz_drop_font(ctx, font->font);
-		fz_free(ctx, font->name);
-		fz_free(ctx, font);
-		font = next;
+		font = doc->font_table[i];
+		while (font)
+		{
+			next = font->next;
+			fz_drop_font(ctx, font->font);
+			fz_free(ctx, font->name);
+			fz_free(ctx, font);
+			font = next;
+		}
 	}
+	fz_free(ctx, doc->font_table);
+
+	xps_drop_remote_resources(ctx, doc);
 
 	xps_drop_page_list(ctx, doc);
 